@@ -91,12 +91,18 @@ typedef struct {
 
 #define PSYC_STRING(data, len) (PsycString) {len, data}
 
+#include "psyc/arena.h"
 #include "psyc/match.h"
+#include "psyc/intern.h"
 #include "psyc/method.h"
 #include "psyc/packet.h"
 #include "psyc/variable.h"
 #include "psyc/parse.h"
+#include "psyc/list.h"
 #include "psyc/render.h"
+#include "psyc/update.h"
+#include "psyc/state.h"
+#include "psyc/subscription.h"
 #include "psyc/text.h"
 #include "psyc/uniform.h"
 
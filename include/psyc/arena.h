@@ -0,0 +1,125 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+#ifndef PSYC_ARENA_H
+#define PSYC_ARENA_H
+
+/**
+ * @file psyc/arena.h
+ * @brief Interface for the bump allocator used for decoded packets.
+ */
+
+/**
+ * @defgroup arena Arena allocator
+ *
+ * A bump allocator: memory is taken from a buffer supplied by the caller
+ * and released all at once with psyc_arena_reset(). When the buffer is full
+ * the arena grows by allocating blocks with malloc(), these are kept for
+ * reuse until psyc_arena_free() is called.
+ *
+ * @code
+ * char buf[4096];
+ * PsycArena arena;
+ *
+ * psyc_arena_init(&arena, buf, sizeof(buf));
+ * // ... psyc_parse_packet(&state, &arena, &packet) ...
+ * psyc_arena_reset(&arena); // packet is no longer used
+ * // ...
+ * psyc_arena_free(&arena);
+ * @endcode
+ * @{
+ */
+
+#include <stddef.h>
+
+/** Alignment of the allocated memory. */
+#define PSYC_ARENA_ALIGN 16
+/** Minimum size of a block allocated when the arena grows. */
+#define PSYC_ARENA_BLOCK_SIZE 4096
+
+/** Block of memory allocated when growing the arena. */
+typedef struct PsycArenaBlock {
+    struct PsycArenaBlock *next; ///< Previously allocated block.
+    size_t size;		///< Usable size of the block.
+} PsycArenaBlock;
+
+/** Arena state. */
+typedef struct {
+    char *data;			///< Memory allocations are taken from.
+    size_t size;		///< Size of data.
+    size_t used;		///< Bytes used in data.
+    char *last;			///< Last allocation, which can grow in place.
+    PsycArenaBlock *blocks;	///< Blocks allocated by the arena, newest first.
+    char *buffer;		///< Memory supplied by the caller.
+    size_t length;		///< Size of buffer.
+} PsycArena;
+
+/**
+ * Initialize an arena.
+ *
+ * @param arena Arena to initialize.
+ * @param buffer Memory to use until it's full, may be NULL.
+ * @param length Size of buffer.
+ */
+void
+psyc_arena_init (PsycArena *arena, char *buffer, size_t length);
+
+/**
+ * Allocate memory from the arena.
+ *
+ * @return Pointer aligned to PSYC_ARENA_ALIGN, or NULL if out of memory.
+ */
+void *
+psyc_arena_alloc (PsycArena *arena, size_t size);
+
+/**
+ * Grow an allocation to size bytes, keeping its contents.
+ *
+ * The last allocation is grown in place if there's enough room after it,
+ * otherwise it is copied to a new one.
+ *
+ * @param arena The arena ptr was allocated from.
+ * @param ptr Previous allocation, or NULL.
+ * @param oldsize Size of the previous allocation.
+ * @param size New size.
+ *
+ * @return The new allocation, or NULL if out of memory.
+ */
+void *
+psyc_arena_grow (PsycArena *arena, void *ptr, size_t oldsize, size_t size);
+
+/**
+ * Release all allocations at once.
+ *
+ * Only the largest block is kept, so an arena that is reused for similar
+ * packets stops calling malloc() after the first few.
+ */
+void
+psyc_arena_reset (PsycArena *arena);
+
+/**
+ * Free the blocks allocated by the arena.
+ */
+void
+psyc_arena_free (PsycArena *arena);
+
+/** @} */ // end of arena group
+
+#endif
@@ -0,0 +1,119 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+#ifndef PSYC_INTERN_H
+#define PSYC_INTERN_H
+
+/**
+ * @file psyc/intern.h
+ * @brief Interface for the keyword intern table.
+ */
+
+/**
+ * @defgroup intern Keyword interning
+ *
+ * A global table giving every known keyword a small integer ID, so that
+ * applications can switch on integers instead of comparing names.
+ *
+ * The table starts with the routing variables, variable types and methods of
+ * variable.h, the routing variables get the IDs of their PsycRoutingVar.
+ * Further keywords are added with psyc_intern(). Lookups don't take a lock and
+ * can run concurrently with additions from other threads.
+ *
+ * With the PSYC_PARSE_INTERN flag the parser hashes names and methods while
+ * scanning them and looks them up in the table,
+ * psyc_parse_keyword_id() returns the ID of the last one.
+ * @{
+ */
+
+#include "match.h"
+
+/** Maximum number of keywords in the table. */
+#ifndef PSYC_INTERN_MAX
+#define PSYC_INTERN_MAX 4096
+#endif
+
+/**
+ * Hash of a keyword, the same as the hash of a PsycMapHash with seed 0.
+ */
+inline uint32_t
+psyc_intern_hash (const char *name, size_t len)
+{
+    uint32_t h = PSYC_MAP_HASH_INIT(0);
+    size_t i;
+
+    for (i = 0; i < len; i++)
+	h = PSYC_MAP_HASH_STEP(h, name[i]);
+    return h;
+}
+
+/**
+ * Look up the ID of a keyword.
+ *
+ * @param name Keyword.
+ * @param len Length of name.
+ * @param hash psyc_intern_hash() of the name.
+ *
+ * @return ID of the keyword, or 0 if it's not in the table.
+ */
+uint32_t
+psyc_intern_lookup (const char *name, size_t len, uint32_t hash);
+
+/**
+ * Look up the ID of a keyword split across a chain of buffers.
+ *
+ * @param iov Chain of buffers, the keyword starts in the first one.
+ * @param off Offset of the keyword in the first buffer.
+ * @param len Length of the keyword.
+ * @param hash psyc_intern_hash() of the keyword.
+ *
+ * @return ID of the keyword, or 0 if it's not in the table.
+ */
+uint32_t
+psyc_intern_lookup_iov (const PsycString *iov, size_t off, size_t len,
+			uint32_t hash);
+
+/**
+ * Add a keyword to the table, unless it's already there.
+ *
+ * The name is copied.
+ *
+ * @return ID of the keyword, or 0 if the table is full or out of memory.
+ */
+uint32_t
+psyc_intern (const char *name, size_t len);
+
+/**
+ * Get the name of a keyword by its ID.
+ *
+ * @return The name, or an empty string if there is no such ID.
+ */
+PsycString
+psyc_intern_name (uint32_t id);
+
+/**
+ * Number of keywords in the table, the largest ID.
+ */
+uint32_t
+psyc_intern_count ();
+
+/** @} */ // end of intern group
+
+#endif
@@ -0,0 +1,157 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+#ifndef PSYC_LIST_H
+#define PSYC_LIST_H
+
+/**
+ * @file psyc/list.h
+ * @brief Interface for random access to the elements of rendered lists.
+ */
+
+/**
+ * @defgroup list Rendered list index
+ *
+ * Offsets of the elements of a rendered _list value, so element i is parsed
+ * on its own instead of parsing the list from the start up to it.
+ *
+ * The index is built lazily, up to the element asked for: elements with a
+ * length are skipped over without looking at their value. A range of
+ * elements is a valid list without a type as it is, and the element at a
+ * byte offset is found by binary search.
+ *
+ * Once it's built to the end with psyc_list_index_count(), the index isn't
+ * changed anymore, so threads can decode chunks of the list in parallel
+ * with psyc_list_index_decode().
+ *
+ * @code
+ * PsycListIndex idx;
+ * PsycElem elem;
+ *
+ * psyc_list_index_init(&idx, value, len);
+ * if (psyc_list_index_get(&idx, 1000, &elem) == PSYC_LIST_INDEX_SUCCESS)
+ *     printf("%.*s\n", PSYC_S2ARGP(elem.value));
+ * psyc_list_index_free(&idx);
+ * @endcode
+ * @{
+ */
+
+#include "parse.h"
+
+/** Return codes of the list index functions. */
+typedef enum {
+    /// Out of memory.
+    PSYC_LIST_INDEX_ERROR_MEMORY = -3,
+    /// There is no element at the index.
+    PSYC_LIST_INDEX_ERROR_RANGE = -2,
+    /// The list can't be parsed up to the element.
+    PSYC_LIST_INDEX_ERROR = -1,
+    PSYC_LIST_INDEX_SUCCESS = 0,
+} PsycListIndexRC;
+
+/** Index of a rendered list. */
+typedef struct {
+    const char *buffer;		///< Rendered list.
+    size_t length;		///< Length of buffer.
+    PsycString type;		///< Type of the list.
+    size_t *offsets;		///< Offset of the '|' starting each element.
+    size_t n;			///< Number of elements found.
+    size_t size;		///< Number of offsets allocated.
+    PsycParseListState parser;	///< Parser finding the next elements.
+    int8_t done;		///< 1 at the end of the list, -1 if it's invalid.
+} PsycListIndex;
+
+/**
+ * Initialize the index of a rendered list, nothing is parsed yet.
+ *
+ * @param idx Index to initialize.
+ * @param buffer Rendered list, which has to stay the same while it's indexed.
+ * @param length Length of buffer.
+ */
+void
+psyc_list_index_init (PsycListIndex *idx, const char *buffer, size_t length);
+
+/**
+ * Free the memory used by an index.
+ */
+void
+psyc_list_index_free (PsycListIndex *idx);
+
+/**
+ * Get the number of elements, building the index to the end of the list.
+ *
+ * @return The number of elements, or a PsycListIndexRC error if the list
+ *         is invalid or out of memory.
+ */
+ptrdiff_t
+psyc_list_index_count (PsycListIndex *idx);
+
+/**
+ * Get element i of the list, in constant time once the index is built up
+ * to it.
+ *
+ * @param idx Index of the list.
+ * @param i Index of the element.
+ * @param elem Set to the type and value of the element, pointing into the
+ *             list, and its rendered length.
+ */
+PsycListIndexRC
+psyc_list_index_get (PsycListIndex *idx, size_t i, PsycElem *elem);
+
+/**
+ * Get the elements from i up to j as they are rendered in the list.
+ *
+ * @param idx Index of the list.
+ * @param i Index of the first element.
+ * @param j Index after the last element, at most the number of elements.
+ * @param slice Set to the elements, a list without a type.
+ */
+PsycListIndexRC
+psyc_list_index_slice (PsycListIndex *idx, size_t i, size_t j,
+		       PsycString *slice);
+
+/**
+ * Find the element at a byte offset of the list, in logarithmic time.
+ *
+ * @return Index of the element, the number of elements if the offset is at
+ *         or past the end of the list, or a PsycListIndexRC error. An offset
+ *         in the type of the list is in the first element.
+ */
+ptrdiff_t
+psyc_list_index_find (PsycListIndex *idx, size_t offset);
+
+/**
+ * Decode the elements from i up to j of a list indexed to the end.
+ *
+ * The index isn't changed, so chunks of the list can be decoded by several
+ * threads at the same time.
+ *
+ * @param idx Index built to the end with psyc_list_index_count().
+ * @param i Index of the first element.
+ * @param j Index after the last element.
+ * @param elems Array of j - i elements to set.
+ */
+PsycListIndexRC
+psyc_list_index_decode (const PsycListIndex *idx, size_t i, size_t j,
+			PsycElem *elems);
+
+/** @} */ // end of list group
+
+#endif
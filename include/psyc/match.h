@@ -84,4 +84,58 @@ psyc_map_lookup_int (const PsycMapInt *map, size_t size,
     return (intptr_t) psyc_map_lookup((PsycMap *) map, size, key, keylen, inherit);
 }
 
+/**
+ * Minimal perfect hash of a map with integer values.
+ *
+ * Generated for the built-in maps by genmap in src/, see variable_hash.c.
+ * Each key is hashed into one of size buckets, the displacement of the bucket
+ * then moves it to a slot of its own.
+ * @see psyc_map_hash_lookup_int()
+ */
+typedef struct {
+    const PsycMapInt *map;	///< The map.
+    const uint8_t *slots;	///< Index in map of the key in each slot.
+    const uint16_t *disp;	///< Displacement of each bucket.
+    size_t size;		///< Number of keys, buckets and slots.
+    size_t maxlen;		///< Length of the longest key.
+    uint32_t seed;		///< Seed of the hash function.
+} PsycMapHash;
+
+/** Longest key supported in a PsycMapHash. */
+#define PSYC_MAP_HASH_KEYLEN_MAX 64
+
+/**
+ * \internal
+ * Hash function of PsycMapHash: FNV-1a, one byte at a time.
+ */
+#define PSYC_MAP_HASH_INIT(seed) ((uint32_t)(seed) ^ 2166136261U)
+#define PSYC_MAP_HASH_STEP(h, c) (((h) ^ (uint8_t)(c)) * 16777619U)
+
+/**
+ * \internal
+ * Get the slot of a key with hash h in a bucket with displacement d.
+ */
+inline uint32_t
+psyc_map_hash_slot (uint32_t h, uint32_t d, size_t size)
+{
+    h ^= d * 0x9e3779b9U;
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h % size;
+}
+
+/**
+ * Look up value associated with a key in a map using its perfect hash.
+ *
+ * Returns the same as psyc_map_lookup_int() with the map of the hash,
+ * with inherit the longest key that key inherits from is found:
+ * the key itself or a prefix of it followed by an underscore.
+ */
+intptr_t
+psyc_map_hash_lookup_int (const PsycMapHash *hash,
+			  const char *key, size_t keylen, PsycBool inherit);
+
 #endif
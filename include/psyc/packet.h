@@ -36,8 +36,6 @@
  * @{
  */
 
-#include <math.h>
-
 #include "method.h"
 
 /**
@@ -250,15 +248,46 @@ typedef struct {
     PsycPacketFlag flag;	///< Packet flag.
 } PsycPacket;
 
+/**
+ * \internal
+ * Powers of 10 used by psyc_num_length(), except the first one which is 0.
+ */
+extern const uint64_t psyc_num_pow10[20];
+
 /**
  * Return the number of digits a number has in its base 10 representation.
  */
 inline size_t
 psyc_num_length (size_t n)
 {
-    return n < 10 ? 1 : log10(n) + 1;
+#ifdef __GNUC__
+    // the number of bits times log10(2) is at most one less than the number
+    // of digits, the next power of 10 tells which
+    size_t t = ((64 - __builtin_clzll((unsigned long long)n | 1)) * 1233) >> 12;
+    return t + (n >= psyc_num_pow10[t]);
+#else
+    size_t len = 1;
+    while (n >= 10) {
+	n /= 10;
+	len++;
+    }
+    return len;
+#endif
 }
 
+/**
+ * Render a number in base 10.
+ *
+ * No NUL is written after the digits.
+ *
+ * @param n The number.
+ * @param buffer Buffer of at least psyc_num_length(n) bytes.
+ *
+ * @return Number of bytes written, i.e. psyc_num_length(n).
+ */
+size_t
+psyc_num_render (size_t n, char *buffer);
+
 /**
  * \internal
  * Check if a modifier needs length.
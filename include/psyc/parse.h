@@ -146,6 +146,14 @@ typedef enum {
     /// Parse only the content.
     /// Parsing starts at the content and the content must be complete.
     PSYC_PARSE_START_AT_CONTENT = 2,
+    /// Find modifier names, values and the end of the body
+    /// using a structural index of the buffer.
+    /// @see psyc_parse_struct_index_set()
+    PSYC_PARSE_STRUCT_INDEX = 4,
+    /// Hash modifier names and methods while scanning them
+    /// and look them up in the intern table.
+    /// @see psyc_parse_keyword_id()
+    PSYC_PARSE_INTERN = 8,
 } PsycParseFlag;
 
 /**
@@ -220,6 +228,14 @@ typedef enum {
     PSYC_PARSE_CONTENT = 12,
     /// Finished parsing packet.
     PSYC_PARSE_COMPLETE = 13,
+    /// Start of a routing modifier split across buffers.
+    /// Operator & name are complete, value contains the first part.
+    /// Used by psyc_parse_iov() only.
+    PSYC_PARSE_ROUTING_START = 14,
+    /// Continuation of a routing modifier split across buffers.
+    PSYC_PARSE_ROUTING_CONT = 15,
+    /// End of a routing modifier split across buffers.
+    PSYC_PARSE_ROUTING_END = 16,
 } PsycParseRC;
 
 /** PSYC packet parts. */
@@ -422,6 +438,27 @@ typedef enum {
     PSYC_UPDATE_PART_VALUE = 14,
 } PsycUpdatePart;
 
+/**
+ * Number of 64-bit words needed for a structural index bitmap of len bytes.
+ */
+#define PSYC_PARSE_STRUCT_WORDS(len) (((len) + 63) / 64)
+
+/**
+ * Structural index of a buffer.
+ *
+ * Bitmaps with one bit per byte of the buffer, byte i is described by
+ * bit i % 64 of word i / 64.
+ * @see psyc_parse_struct_index()
+ */
+typedef struct {
+    uint64_t *nl;		///< Newlines.
+    uint64_t *delim;		///< Structural bytes, i.e. everything that can't
+				///  be part of a keyword: NL, TAB, SP, | and the
+				///  operator glyphs among others.
+    size_t size;		///< Number of words allocated for each bitmap.
+    PsycString buffer;		///< The buffer currently indexed.
+} PsycParseStructIndex;
+
 /**
  * Struct for keeping parser state.
  */
@@ -440,8 +477,45 @@ typedef struct {
     uint8_t flags;		///< Flags for the parser, see PsycParseFlag.
     uint8_t contentlen_found;	///< Is there a length given for this packet?
     uint8_t valuelen_found;	///< Is there a length given for this modifier?
+
+    PsycParseStructIndex *sindex; ///< Structural index of the buffer.
+
+    size_t resume_from;		///< Start of the interrupted scan, relative to startc.
+    size_t resume_at;		///< Position where the interrupted scan continues,
+				///  relative to startc, 0 if there's none.
+
+    uint32_t keyword_hash;	///< Hash of the interrupted keyword scan.
+    uint32_t keyword;		///< Intern ID of the last name or method.
 } PsycParseState;
 
+/**
+ * Struct for keeping the state of the parser for a chain of buffers.
+ * @see psyc_parse_iov()
+ */
+typedef struct {
+    PsycParseState parser;	///< Parser state of the current buffer.
+    const PsycString *iov;	///< Chain of buffers.
+    size_t iovcnt;		///< Number of buffers in the chain.
+    size_t seg;			///< Current buffer in the chain.
+
+    size_t span_seg;		///< Buffer of the next part of a split value.
+    size_t span_off;		///< Offset of the next part of a split value.
+    size_t span_left;		///< Remaining length of a split value.
+    PsycParseRC span_rc;	///< Return code for the first part of the value.
+    size_t next_seg;		///< Buffer where parsing continues after the value.
+    size_t next_off;		///< Offset where parsing continues after the value.
+    size_t name_seg;		///< First buffer between the parts of a name.
+    size_t name_segs;		///< Number of buffers between the parts of a name.
+} PsycParseIovState;
+
+/**
+ * Extent of a packet in a buffer, see psyc_frame().
+ */
+typedef struct {
+    size_t start;		///< Offset of the first byte of the packet.
+    size_t end;			///< Offset after the end of the packet, i.e. after |\n.
+} PsycFrame;
+
 /**
  * Struct for keeping list parser state.
  */
@@ -520,11 +594,31 @@ psyc_parse_state_init (PsycParseState *state, uint8_t flags)
 	state->part = PSYC_PART_CONTENT;
 }
 
+/**
+ * Build the structural index of a buffer.
+ *
+ * This is the first stage of parsing in PSYC_PARSE_STRUCT_INDEX mode:
+ * a single vectorized pass over the buffer marks every newline and every
+ * byte that can't be part of a keyword. psyc_parse() then finds the end of
+ * names, simple values and the body by looking up the next set bit instead
+ * of testing each byte.
+ *
+ * @param idx Index with bitmaps of at least PSYC_PARSE_STRUCT_WORDS(length) words.
+ * @param buffer Buffer to index.
+ * @param length Length of the buffer.
+ *
+ * @return PSYC_OK on success, PSYC_ERROR if the bitmaps are too small.
+ */
+PsycRC
+psyc_parse_struct_index (PsycParseStructIndex *idx,
+			 const char *buffer, size_t length);
+
 /**
  * Sets a new buffer in the parser state struct with data to be parsed.
  *
  * This function does NOT copy the buffer. It will parse whatever is
  * at the memory pointed to by buffer.
+ * In PSYC_PARSE_STRUCT_INDEX mode the buffer is indexed as well.
  *
  * @param state Pointer to the initialized state of the parser
  * @param buffer pointer to the data that should be parsed
@@ -541,6 +635,68 @@ psyc_parse_buffer_set (PsycParseState *state, const char *buffer, size_t length)
 	state->contentlen = length;
 	state->contentlen_found = PSYC_TRUE;
     }
+
+    if (state->flags & PSYC_PARSE_STRUCT_INDEX && state->sindex)
+	psyc_parse_struct_index(state->sindex, buffer, length);
+}
+
+/**
+ * Sets the structural index used in PSYC_PARSE_STRUCT_INDEX mode.
+ *
+ * Call it before psyc_parse_buffer_set(), which then rebuilds the index for
+ * every new buffer. Buffers that don't fit in the index are parsed without it.
+ *
+ * @code
+ * uint64_t nl[PSYC_PARSE_STRUCT_WORDS(BUFSIZE)], delim[PSYC_PARSE_STRUCT_WORDS(BUFSIZE)];
+ * PsycParseStructIndex idx = { nl, delim, PSYC_PARSE_STRUCT_WORDS(BUFSIZE) };
+ *
+ * psyc_parse_state_init(&state, PSYC_PARSE_STRUCT_INDEX);
+ * psyc_parse_struct_index_set(&state, &idx);
+ * psyc_parse_buffer_set(&state, buffer, length);
+ * @endcode
+ */
+inline void
+psyc_parse_struct_index_set (PsycParseState *state, PsycParseStructIndex *idx)
+{
+    state->sindex = idx;
+    state->flags |= PSYC_PARSE_STRUCT_INDEX;
+}
+
+/**
+ * Initializes the state struct of the buffer chain parser.
+ *
+ * @param state Pointer to the state struct that should be initialized.
+ * @param flags Flags to be set for the parser, see PsycParseFlag.
+ *              PSYC_PARSE_START_AT_CONTENT is not supported.
+ */
+inline void
+psyc_parse_iov_state_init (PsycParseIovState *state, uint8_t flags)
+{
+    memset(state, 0, sizeof(PsycParseIovState));
+    psyc_parse_state_init(&state->parser, flags);
+}
+
+/**
+ * Sets a new chain of buffers to be parsed.
+ *
+ * After PSYC_PARSE_INSUFFICIENT the new chain has to start with the unparsed
+ * rest of the previous one, i.e. psyc_parse_iov_remaining_buffer() followed by
+ * the buffers after psyc_parse_iov_segment().
+ * The buffers have to stay unchanged while parsing.
+ */
+inline void
+psyc_parse_iov_buffer_set (PsycParseIovState *state,
+			   const PsycString *iov, size_t iovcnt)
+{
+    state->iov = iov;
+    state->iovcnt = iovcnt;
+    state->seg = 0;
+    state->span_left = 0;
+
+    if (iovcnt)
+	psyc_parse_buffer_set(&state->parser, iov[0].data, iov[0].length);
+    else
+	psyc_parse_buffer_set(&state->parser, NULL, 0);
 }
 
 /**
@@ -647,6 +803,19 @@ psyc_parse_value_length_found (PsycParseState *state)
     return (PsycBool) state->valuelen_found;
 }
 
+/**
+ * Intern ID of the modifier name or method returned last by psyc_parse(),
+ * 0 if it's not in the intern table.
+ *
+ * Only set when parsing with the PSYC_PARSE_INTERN flag.
+ * @see psyc_intern_lookup()
+ */
+inline uint32_t
+psyc_parse_keyword_id (PsycParseState *state)
+{
+    return state->keyword;
+}
+
 inline size_t
 psyc_parse_cursor (PsycParseState *state)
 {
@@ -671,6 +840,48 @@ psyc_parse_remaining_buffer (PsycParseState *state)
     return state->buffer.data + state->cursor;
 }
 
+/**
+ * Index of the buffer in the chain where parsing would be resumed.
+ */
+inline size_t
+psyc_parse_iov_segment (PsycParseIovState *state)
+{
+    return state->seg;
+}
+
+/**
+ * Unparsed rest of the buffer at psyc_parse_iov_segment().
+ */
+inline const char *
+psyc_parse_iov_remaining_buffer (PsycParseIovState *state)
+{
+    return psyc_parse_remaining_buffer(&state->parser);
+}
+
+inline size_t
+psyc_parse_iov_remaining_length (PsycParseIovState *state)
+{
+    return psyc_parse_remaining_length(&state->parser);
+}
+
+/**
+ * Buffers between the two parts of a name returned by psyc_parse_iov(),
+ * when the name spans more than two buffers.
+ *
+ * They are whole parts of the name, in order, empty buffers of the chain
+ * included. Valid until psyc_parse_iov() returns the next name.
+ *
+ * @param iov Set to the first of them in the chain.
+ *
+ * @return Number of buffers, 0 if there are none.
+ */
+inline size_t
+psyc_parse_iov_name_parts (PsycParseIovState *state, const PsycString **iov)
+{
+    *iov = state->iov + state->name_seg;
+    return state->name_segs;
+}
+
 /**
  * Parse PSYC packets.
  *
@@ -694,6 +905,102 @@ PsycParseRC
 psyc_parse (PsycParseState *state, char *oper,
 	    PsycString *name, PsycString *value);
 
+/**
+ * Parse PSYC packets from a chain of buffers.
+ *
+ * Works like psyc_parse(), but the input is a chain of buffers set with
+ * psyc_parse_iov_buffer_set(), e.g. the chunks of a receive ring, and
+ * nothing is copied from one buffer to another.
+ *
+ * Modifiers and the body within one buffer are returned as usual.
+ * A value split at a buffer boundary is returned in parts, one for each
+ * buffer it spans: PSYC_PARSE_ROUTING_START/CONT/END for routing modifiers,
+ * PSYC_PARSE_ENTITY_START/CONT/END for entity modifiers and
+ * PSYC_PARSE_BODY_START/CONT/END for the body.
+ *
+ * @param state An initialized PsycParseIovState.
+ * @param oper In case of a modifier it will be set to the operator.
+ * @param name Array of two strings. In case of a modifier it will point to
+ *             the name, in case of the body it will point to the method.
+ *             If the name is split at a buffer boundary, name[0] is the part
+ *             before and name[1] the part after it, otherwise name[1] is empty.
+ *             If it spans more buffers, name[0] is the part in the first and
+ *             name[1] the part in the last one, the buffers in between are
+ *             returned by psyc_parse_iov_name_parts().
+ * @param value In case of a modifier it will point to the value,
+ *              in case of the body it will point to the data.
+ */
+PsycParseRC
+psyc_parse_iov (PsycParseIovState *state, char *oper,
+		PsycString *name, PsycString *value);
+
+/**
+ * Parse a whole packet into a PsycPacket.
+ *
+ * Calls psyc_parse() until the end of the packet and fills in the packet:
+ * the routing and entity modifier arrays are allocated from the arena and
+ * grow as needed, values split at the end of a buffer are joined in the arena.
+ * The result can be passed to psyc_render() as is.
+ *
+ * Strings of the packet point into the parsed buffer where possible,
+ * so the buffer has to stay valid as long as the packet is used.
+ * When PSYC_PARSE_INSUFFICIENT is returned, the strings pointing into
+ * the parsed part of the buffer are copied to the arena, set the unparsed
+ * rest followed by more data as the new buffer and call it again
+ * to continue with the same packet.
+ *
+ * The packet is cleared when a new packet starts. Allocations are not freed,
+ * call psyc_arena_reset() when the packet is no longer used.
+ *
+ * @code
+ * char mem[4096];
+ * PsycArena arena;
+ * PsycPacket packet;
+ *
+ * psyc_arena_init(&arena, mem, sizeof(mem));
+ * psyc_parse_state_init(&state, PSYC_PARSE_ALL);
+ * psyc_parse_buffer_set(&state, buffer, length);
+ *
+ * while (psyc_parse_packet(&state, &arena, &packet) == PSYC_PARSE_COMPLETE) {
+ *     psyc_render(&packet, out, sizeof(out));
+ *     psyc_arena_reset(&arena);
+ * }
+ * @endcode
+ *
+ * @param state An initialized PsycParseState.
+ * @param arena Arena to allocate memory from.
+ * @param packet The packet parsed.
+ *
+ * @return PSYC_PARSE_COMPLETE when the packet is complete,
+ *         PSYC_PARSE_INSUFFICIENT when more data is needed,
+ *         PSYC_PARSE_ERROR if out of memory or another error code from
+ *         psyc_parse().
+ */
+PsycParseRC
+psyc_parse_packet (PsycParseState *state, PsycArena *arena, PsycPacket *packet);
+
+/**
+ * Find the complete packets in a buffer.
+ *
+ * Only the packet boundaries are looked for, modifiers are not parsed:
+ * the content is skipped using the content length when there's one, otherwise
+ * the packet ends at the first |\n line after the routing header.
+ * This is useful to pass whole packets on to be parsed elsewhere or forwarded.
+ *
+ * @param buffer Buffer with one or more packets, the last may be incomplete.
+ * @param length Length of the buffer.
+ * @param frames The extents of the complete packets are stored here.
+ * @param max Maximum number of frames to store.
+ * @param cursor Set to the offset where framing stopped: the end of the last
+ *               complete packet found, or the start of an invalid packet.
+ *
+ * @return Number of complete packets found, or -1 if the first packet is
+ *         invalid.
+ */
+int
+psyc_frame (const char *buffer, size_t length,
+	    PsycFrame *frames, size_t max, size_t *cursor);
+
 /**
  * List parser.
  *
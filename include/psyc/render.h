@@ -21,6 +21,8 @@
 #ifndef PSYC_RENDER_H
 #define PSYC_RENDER_H
 
+#include <sys/uio.h>
+
 #include "packet.h"
 
 /**
@@ -49,8 +51,55 @@ typedef enum {
     PSYC_RENDER_ERROR = -1,
     /// Packet is rendered successfully in the buffer.
     PSYC_RENDER_SUCCESS = 0,
+    /// Rendering is incomplete because the buffer is full, call
+    /// psyc_render_stream() again after setting a new buffer.
+    PSYC_RENDER_INCOMPLETE = 1,
 } PsycRenderRC;
 
+/**
+ * Part of the packet being rendered by psyc_render_stream().
+ */
+typedef enum {
+    PSYC_RENDER_PART_ROUTING = 0,
+    PSYC_RENDER_PART_LENGTH = 1,
+    PSYC_RENDER_PART_CONTENT = 2,
+    PSYC_RENDER_PART_STATEOP = 3,
+    PSYC_RENDER_PART_ENTITY = 4,
+    PSYC_RENDER_PART_BODY = 5,
+    PSYC_RENDER_PART_END = 6,
+    PSYC_RENDER_PART_DONE = 7,
+} PsycRenderPart;
+
+/** Maximum number of variable routing modifiers in a packet prototype. */
+#ifndef PSYC_RENDER_PROTO_SLOTS
+# define PSYC_RENDER_PROTO_SLOTS 8
+#endif
+
+/**
+ * Packet prototype: a rendered packet with empty values in place of the
+ * variable routing modifiers.
+ * @see psyc_render_proto_init()
+ */
+typedef struct {
+    PsycString buffer;		///< The rendered packet.
+    size_t slots[PSYC_RENDER_PROTO_SLOTS]; ///< Offsets of the variable values.
+    size_t nslots;		///< Number of variable values.
+} PsycRenderProto;
+
+/**
+ * Struct for keeping the state of psyc_render_stream().
+ */
+typedef struct {
+    PsycPacket *packet;		///< Packet being rendered.
+    PsycString buffer;		///< Output buffer.
+    size_t written;		///< Number of bytes written to buffer.
+
+    PsycRenderPart part;	///< Part of the packet being rendered.
+    size_t elem;		///< Modifier being rendered.
+    uint8_t field;		///< Field of the part being rendered.
+    size_t offset;		///< Bytes of the field rendered already.
+} PsycRenderState;
+
 /**
  * Render a PSYC packet into a buffer.
  *
@@ -71,6 +120,200 @@ inline
 PsycRenderRC
 psyc_render (PsycPacket *packet, char *buffer, size_t buflen);
 
+/**
+ * Values up to this size are copied to the scratch buffer by
+ * psyc_render_iov(), longer ones are referenced.
+ */
+#ifndef PSYC_RENDER_IOV_COPY_MAX
+# define PSYC_RENDER_IOV_COPY_MAX 64
+#endif
+
+/**
+ * Render a PSYC packet into an I/O vector, to be sent with writev() or sendmsg().
+ *
+ * Works like psyc_render(), but values, data and raw content longer than
+ * PSYC_RENDER_IOV_COPY_MAX are not copied: their iovec entries point to the
+ * buffers of the packet, which have to stay valid until the packet is sent.
+ * Everything else is rendered to the scratch buffer, consecutive parts of it
+ * share one iovec entry.
+ *
+ * @param packet Packet to render, with lengths set by psyc_packet_length_set().
+ * @param iov Array of iovec entries to fill.
+ * @param iovcnt Number of entries in iov, set to the number of entries used.
+ * @param scratch Buffer for the rendered parts, packet->length bytes always suffice.
+ * @param scratchlen Length of scratch.
+ *
+ * @return PSYC_RENDER_SUCCESS, or PSYC_RENDER_ERROR if iov or scratch is
+ *         too small.
+ */
+PsycRenderRC
+psyc_render_iov (PsycPacket *packet, struct iovec *iov, size_t *iovcnt,
+		 char *scratch, size_t scratchlen);
+
+/**
+ * Initializes the state struct of psyc_render_stream().
+ *
+ * @param state Pointer to the state struct that should be initialized.
+ * @param packet Packet to render, with lengths set by psyc_packet_length_set().
+ * @param buffer Output buffer where the packet is going to be written.
+ * @param buflen Length of output buffer.
+ */
+inline void
+psyc_render_state_init (PsycRenderState *state, PsycPacket *packet,
+			char *buffer, size_t buflen)
+{
+    memset(state, 0, sizeof(PsycRenderState));
+    state->packet = packet;
+    state->buffer = (PsycString) {buflen, buffer};
+}
+
+/**
+ * Sets a new output buffer in the state struct of psyc_render_stream().
+ */
+inline void
+psyc_render_buffer_set (PsycRenderState *state, char *buffer, size_t length)
+{
+    state->buffer = (PsycString) {length, buffer};
+    state->written = 0;
+}
+
+inline size_t
+psyc_render_bytes_written (PsycRenderState *state)
+{
+    return state->written;
+}
+
+/**
+ * Render a PSYC packet into a series of buffers.
+ *
+ * Works like psyc_render(), but the packet doesn't have to fit in the buffer:
+ * the buffer is filled and PSYC_RENDER_INCOMPLETE is returned, after setting
+ * a new buffer with psyc_render_buffer_set() the next call continues where
+ * the previous one stopped. Only the position in the packet is kept
+ * in the state, so the packet must not change until rendering is complete.
+ *
+ * @code
+ * psyc_render_state_init(&state, &packet, buf, sizeof(buf));
+ * do {
+ *     ret = psyc_render_stream(&state);
+ *     send(fd, buf, psyc_render_bytes_written(&state), 0);
+ *     psyc_render_buffer_set(&state, buf, sizeof(buf));
+ * } while (ret == PSYC_RENDER_INCOMPLETE);
+ * @endcode
+ *
+ * @return PSYC_RENDER_SUCCESS when the packet is complete,
+ *         PSYC_RENDER_INCOMPLETE when the buffer is full,
+ *         or an error code as psyc_render().
+ */
+PsycRenderRC
+psyc_render_stream (PsycRenderState *state);
+
+/**
+ * Render the content part of a packet.
+ *
+ * Everything after the routing header is rendered: the content length when
+ * needed, the content and the packet delimiter. The result can be sent
+ * after any routing header, to send a packet to many recipients render the
+ * content once, then the packets with psyc_render_multicast() or
+ * psyc_render_multicast_iov().
+ *
+ * @param packet Packet with lengths set by psyc_packet_length_set(),
+ *               e.g. with psyc_packet_init() or psyc_packet_init_raw().
+ *               Its routing header is ignored.
+ * @param buffer Output buffer.
+ * @param buflen Length of output buffer.
+ * @param content Set to the rendered content part in buffer.
+ */
+PsycRenderRC
+psyc_render_content (PsycPacket *packet, char *buffer, size_t buflen,
+		     PsycString *content);
+
+/**
+ * Render a packet for each of the routing headers given, with the same
+ * content part, one after the other into a buffer.
+ *
+ * @param content Content part rendered by psyc_render_content().
+ * @param routing Routing headers, one for each recipient.
+ * @param count Number of routing headers.
+ * @param buffer Output buffer.
+ * @param buflen Length of output buffer.
+ * @param lengths Array of count lengths, set to the length of each packet.
+ */
+PsycRenderRC
+psyc_render_multicast (const PsycString *content,
+		       PsycHeader *routing, size_t count,
+		       char *buffer, size_t buflen, size_t *lengths);
+
+/**
+ * Render a packet for each of the routing headers given, with the same
+ * content part, into an I/O vector.
+ *
+ * The routing headers are rendered to the scratch buffer, each packet is
+ * two iovec entries: its routing header followed by the content part,
+ * which is not copied. A packet without routing header is one entry only.
+ *
+ * @param content Content part rendered by psyc_render_content().
+ * @param routing Routing headers, one for each recipient.
+ * @param count Number of routing headers.
+ * @param iov Array of iovec entries to fill, 2 * count entries suffice.
+ * @param iovcnt Number of entries in iov, set to the number of entries used.
+ * @param scratch Buffer for the routing headers.
+ * @param scratchlen Length of scratch.
+ */
+PsycRenderRC
+psyc_render_multicast_iov (const PsycString *content,
+			   PsycHeader *routing, size_t count,
+			   struct iovec *iov, size_t *iovcnt,
+			   char *scratch, size_t scratchlen);
+
+/**
+ * Render a packet prototype.
+ *
+ * The packet is rendered once with the values of the variable routing
+ * modifiers left out and their positions recorded, psyc_render_proto()
+ * then renders packets with the given values by copying the parts
+ * in between.
+ *
+ * @code
+ * size_t vars[] = {1, 2}; // _target & _counter
+ * psyc_render_proto_init(&proto, &packet, vars, 2, pbuf, sizeof(pbuf));
+ *
+ * PsycString values[] = {PSYC_C2STRI("psyc://example.net/~alice"),
+ *                        PSYC_C2STRI("42")};
+ * psyc_render_proto(&proto, values, buf, sizeof(buf), &len);
+ * @endcode
+ *
+ * @param proto The prototype to initialize.
+ * @param packet Packet with lengths set by psyc_packet_length_set(),
+ *               the values of the variable modifiers are ignored.
+ * @param vars Indexes of the variable modifiers in packet->routing,
+ *             in ascending order.
+ * @param nvars Number of variable modifiers,
+ *              at most PSYC_RENDER_PROTO_SLOTS.
+ * @param buffer Buffer for the prototype, it has to stay valid as long as
+ *               the prototype is used.
+ * @param buflen Length of buffer.
+ */
+PsycRenderRC
+psyc_render_proto_init (PsycRenderProto *proto, PsycPacket *packet,
+			const size_t *vars, size_t nvars,
+			char *buffer, size_t buflen);
+
+/**
+ * Render a packet from a prototype.
+ *
+ * @param proto Prototype initialized by psyc_render_proto_init().
+ * @param values Values of the variable routing modifiers, in the same order
+ *               as the indexes given to psyc_render_proto_init().
+ *               As all routing values they can't contain a newline.
+ * @param buffer Output buffer.
+ * @param buflen Length of output buffer.
+ * @param length Set to the length of the rendered packet.
+ */
+PsycRenderRC
+psyc_render_proto (PsycRenderProto *proto, const PsycString *values,
+		   char *buffer, size_t buflen, size_t *length);
+
 size_t
 psyc_render_modifier (PsycModifier *mod, char *buffer);
 
@@ -0,0 +1,176 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+#ifndef PSYC_ROUTE_H
+#define PSYC_ROUTE_H
+
+/**
+ * @file psyc/route.h
+ * @brief Interface for routing packets to handlers by uniform.
+ */
+
+/**
+ * @defgroup route Uniform routing table
+ *
+ * A tree keyed on the parts of parsed uniforms: scheme, host, port and
+ * transport, entity type, nick and channel. Handlers can be registered for a
+ * host, a root, an entity or a channel, and psyc_route_lookup() finds the
+ * most specific one for a _target in one walk down the tree: the channel,
+ * else its entity, else the root, else the host on any port.
+ *
+ * Scheme and host are compared case-insensitively. Lookups don't take a lock
+ * and can run in any number of threads while routes are added and removed,
+ * updates are serialized by a spin lock. Replaced memory is freed once the
+ * lookups that could see it are done, lookups of one thread are counted on
+ * a cache line of their own.
+ *
+ * @code
+ * PsycRoutes routes;
+ * PsycUniform uni;
+ * PsycRouteLevel level;
+ *
+ * psyc_routes_init(&routes);
+ * memset(&uni, 0, sizeof(uni));
+ * psyc_uniform_parse(&uni, PSYC_C2ARG("psyc://example.net/@place"));
+ * psyc_route_add(&routes, &uni, PSYC_ROUTE_ROOT, handle_local);
+ *
+ * memset(&uni, 0, sizeof(uni));
+ * psyc_uniform_parse(&uni, PSYC_C2ARG("psyc://example.net/~nick#home"));
+ * psyc_route_lookup(&routes, &uni, &level); // handle_local, PSYC_ROUTE_ROOT
+ * psyc_routes_free(&routes);
+ * @endcode
+ * @{
+ */
+
+#include <stdint.h>
+#include "uniform.h"
+
+/** Part of a uniform a route is registered for. */
+typedef enum {
+    PSYC_ROUTE_NONE = 0,	///< No route found.
+    PSYC_ROUTE_HOST,		///< Scheme and host, any port.
+    PSYC_ROUTE_ROOT,		///< Root uniform: host, port and transport.
+    PSYC_ROUTE_ENTITY,		///< Entity uniform, without the channel.
+    PSYC_ROUTE_CHANNEL,		///< Entity and channel, the entity may be the root.
+} PsycRouteLevel;
+
+struct PsycRouteNode;
+
+/** Children of a route node, replaced as a whole when they change. */
+typedef struct {
+    size_t nchildren;
+    struct PsycRouteNode *children[]; ///< Sorted by key.
+} PsycRouteChildren;
+
+/** Node of the routing tree, one for each uniform part. */
+typedef struct PsycRouteNode {
+    struct PsycRouteNode *parent;
+    PsycRouteChildren *children; ///< NULL if there are none.
+    void *handler;		///< NULL if there is no route to the node.
+    uint8_t depth;		///< Index of the uniform part of key.
+    PsycString key;		///< Stored after the node.
+} PsycRouteNode;
+
+/**
+ * Number of lookup counters of a routing table, threads are spread over them.
+ */
+#ifndef PSYC_ROUTE_READERS
+# define PSYC_ROUTE_READERS 16
+#endif
+
+/** Lookups running in the even and odd epochs, padded to a cache line. */
+typedef struct {
+    uint32_t count[2];
+    uint8_t pad[64 - 2 * sizeof(uint32_t)];
+} PsycRouteReaders;
+
+/** Uniform routing table. */
+typedef struct {
+    PsycRouteNode root;
+    size_t count;		///< Number of routes.
+    size_t nodes;		///< Number of nodes.
+    void **retired;		///< Replaced nodes and children to free.
+    size_t nretired;
+    size_t nwaiting;		///< Retired before the current epoch, freed first.
+    size_t retired_size;	///< Allocated size of retired.
+    uint32_t epoch;		///< Advanced when retired memory starts waiting.
+    uint8_t lock;
+    PsycRouteReaders readers[PSYC_ROUTE_READERS]; ///< Lookups running.
+} PsycRoutes;
+
+/**
+ * Initialize an empty routing table.
+ */
+void
+psyc_routes_init (PsycRoutes *routes);
+
+/**
+ * Free the memory used by a routing table.
+ *
+ * No lookups may be running.
+ */
+void
+psyc_routes_free (PsycRoutes *routes);
+
+/**
+ * Add a route, or replace the handler of an existing one.
+ *
+ * @param routes Routing table.
+ * @param uni Parsed uniform, its parts are copied.
+ * @param level Part of the uniform to route,
+ *        the uniform needs a resource for PSYC_ROUTE_ENTITY
+ *        and a channel for PSYC_ROUTE_CHANNEL.
+ * @param handler Handler returned by psyc_route_lookup(), not NULL.
+ *
+ * @return PSYC_OK, or PSYC_ERROR if the uniform has no such part
+ *         or out of memory.
+ */
+PsycRC
+psyc_route_add (PsycRoutes *routes, const PsycUniform *uni,
+		PsycRouteLevel level, void *handler);
+
+/**
+ * Remove a route added with psyc_route_add().
+ *
+ * @return PSYC_OK, or PSYC_ERROR if there was no such route.
+ */
+PsycRC
+psyc_route_remove (PsycRoutes *routes, const PsycUniform *uni,
+		   PsycRouteLevel level);
+
+/**
+ * Find the most specific route for a uniform.
+ *
+ * Does not take a lock, memory of replaced nodes is released by updates
+ * when the lookups started before it was replaced are done.
+ *
+ * @param routes Routing table.
+ * @param uni Parsed uniform, usually the _target of a packet.
+ * @param level Set to the PsycRouteLevel of the route found, if not NULL.
+ *
+ * @return Handler of the route, or NULL if there is none.
+ */
+void *
+psyc_route_lookup (PsycRoutes *routes, const PsycUniform *uni,
+		   PsycRouteLevel *level);
+
+/** @} */ // end of route group
+
+#endif
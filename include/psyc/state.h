@@ -0,0 +1,249 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+#ifndef PSYC_STATE_H
+#define PSYC_STATE_H
+
+/**
+ * @file psyc/state.h
+ * @brief Interface for keeping the entity state of a context.
+ */
+
+/**
+ * @defgroup state Entity state
+ *
+ * The persistent variables of one context as seen over one link, kept up to
+ * date by applying the entity modifiers of the packets received:
+ *
+ * - ':' sets a variable for the current packet only, the state is unchanged.
+ * - '=' assigns a variable, an empty value removes it.
+ * - '+' augments a _list with more elements, or a _dict with more entries,
+ *   replacing those with the same key.
+ * - '-' diminishes a _list by removing each given element once,
+ *   or a _dict by removing the entries with the given keys.
+ * - '@' updates an element of a _list or _dict, see psyc_update_prepare().
+ * - '?' queries a variable, the state is unchanged.
+ *
+ * Variables are kept in an open addressing table keyed by their
+ * psyc_intern() ID, their values together in one buffer. A state reset
+ * (PSYC_STATE_RESET) takes constant time.
+ *
+ * A resync request (PSYC_STATE_RESYNC) is answered with the state rendered
+ * as packet content. After the first psyc_state_content() or
+ * psyc_state_resync() call it's kept rendered, and only the lines of the
+ * variables changing are rendered again.
+ *
+ * @code
+ * PsycState state;
+ * struct iovec iov[2];
+ * char header[512];
+ *
+ * psyc_state_init(&state);
+ * psyc_state_apply_packet(&state, &packet); // for each packet of the context
+ *
+ * psyc_state_resync(&state, routing, routinglen, header, sizeof(header), iov);
+ * writev(fd, iov, 2); // answer a resync request
+ * psyc_state_free(&state);
+ * @endcode
+ * @{
+ */
+
+#include <stdint.h>
+
+/** Return codes of psyc_state_apply(). */
+typedef enum {
+    /// The update can't be parsed, or there's no element at its index path.
+    PSYC_STATE_ERROR_UPDATE = -6,
+    /// Out of memory.
+    PSYC_STATE_ERROR_MEMORY = -5,
+    /// Unknown operator, or one that isn't supported.
+    PSYC_STATE_ERROR_OPERATOR = -4,
+    /// The value isn't a valid list or dict.
+    PSYC_STATE_ERROR_VALUE = -3,
+    /// The operator can't be applied to a variable of this type.
+    PSYC_STATE_ERROR_TYPE = -2,
+    /// The name can't be interned.
+    PSYC_STATE_ERROR_NAME = -1,
+    /// The state stays the same.
+    PSYC_STATE_UNCHANGED = 0,
+    /// A variable was changed.
+    PSYC_STATE_CHANGED = 1,
+} PsycStateRC;
+
+/** Slot of the variable table. */
+typedef struct {
+    uint32_t id;		///< psyc_intern() ID of the name.
+    uint32_t gen;		///< Slot is used if this is the gen of the state.
+    uint32_t offset;		///< Offset of the value in the value buffer.
+    uint32_t length;		///< Length of the value.
+} PsycStateVar;
+
+/** Line of a variable in the cached resync content. */
+typedef struct {
+    uint32_t offset;
+    uint32_t length;		///< 0 if the variable has no line yet.
+} PsycStateLine;
+
+/** Entity state of a context. */
+typedef struct {
+    PsycStateVar *vars;		///< Variable table.
+    char *values;		///< Value buffer.
+    char *cache;		///< Resync content and packet delimiter.
+    PsycStateLine *lines;	///< Line of each slot, NULL if nothing is cached.
+    uint32_t size;		///< Number of slots, a power of 2.
+    uint32_t count;		///< Number of variables.
+    uint32_t gen;		///< Generation, incremented by reset.
+    uint32_t used;		///< Bytes used in the value buffer.
+    uint32_t alloc;		///< Allocated size of the value buffer.
+    uint32_t garbage;		///< Bytes of replaced values in the buffer.
+    uint32_t cachelen;		///< Length of the cached content and delimiter.
+    uint32_t cachealloc;	///< Allocated size of cache.
+} PsycState;
+
+/**
+ * Initialize an empty state, nothing is allocated until a variable is set.
+ */
+void
+psyc_state_init (PsycState *state);
+
+/**
+ * Free the memory used by a state.
+ */
+void
+psyc_state_free (PsycState *state);
+
+/**
+ * Remove all variables, in constant time. Memory is kept for reuse.
+ */
+void
+psyc_state_reset (PsycState *state);
+
+/**
+ * Get the value of a variable by its psyc_intern() ID.
+ *
+ * @return Pointer to the value, valid until the state is changed,
+ *         or NULL if the variable isn't set.
+ */
+const char *
+psyc_state_get_id (const PsycState *state, uint32_t id, size_t *len);
+
+/**
+ * Get the value of a variable by name.
+ *
+ * @see psyc_state_get_id()
+ */
+const char *
+psyc_state_get (const PsycState *state, const char *name, size_t namelen,
+		size_t *len);
+
+/**
+ * Apply an entity modifier to the state.
+ *
+ * @param state State of the context.
+ * @param oper PsycOperator of the modifier.
+ * @param name Variable name, interned with psyc_intern().
+ * @param namelen Length of name.
+ * @param value Value of the modifier, must not point into the state.
+ * @param valuelen Length of value.
+ *
+ * @return PSYC_STATE_CHANGED, PSYC_STATE_UNCHANGED, or a PsycStateRC error,
+ *         in which case the state is unchanged.
+ */
+PsycStateRC
+psyc_state_apply (PsycState *state, char oper, const char *name, size_t namelen,
+		  const char *value, size_t valuelen);
+
+/**
+ * Apply an entity modifier to a variable given by its psyc_intern() ID.
+ *
+ * @see psyc_state_apply()
+ */
+PsycStateRC
+psyc_state_apply_id (PsycState *state, char oper, uint32_t id,
+		     const char *value, size_t valuelen);
+
+/**
+ * Apply the state operation and the entity modifiers of a parsed packet.
+ *
+ * A reset is done before the modifiers are applied, a resync request
+ * leaves the state unchanged. Stops at the first modifier that can't be
+ * applied, the ones before it stay applied.
+ *
+ * @return PSYC_STATE_CHANGED if any variable changed, PSYC_STATE_UNCHANGED,
+ *         or the PsycStateRC error of the failing modifier.
+ */
+PsycStateRC
+psyc_state_apply_packet (PsycState *state, PsycPacket *packet);
+
+/**
+ * Get the length of the content rendered by psyc_state_render(),
+ * in constant time if it's cached.
+ */
+size_t
+psyc_state_length (const PsycState *state);
+
+/**
+ * Render the state as packet content: a reset followed by an assignment of
+ * each variable, the answer to a resync request.
+ *
+ * @param state State of the context.
+ * @param buffer Buffer of at least psyc_state_length() bytes.
+ * @param buflen Length of buffer.
+ *
+ * @return PSYC_RENDER_SUCCESS, or PSYC_RENDER_ERROR if the buffer is too small.
+ */
+PsycRenderRC
+psyc_state_render (const PsycState *state, char *buffer, size_t buflen);
+
+/**
+ * Get the content rendered by psyc_state_render() from the cache,
+ * rendering it first if it's not cached yet.
+ *
+ * @param state State of the context.
+ * @param len Set to the length of the content.
+ *
+ * @return The content, valid until the state is changed,
+ *         or NULL if out of memory.
+ */
+const char *
+psyc_state_content (PsycState *state, size_t *len);
+
+/**
+ * Prepare the answer to a resync request, to be sent with a single writev():
+ * the routing header and the length of the content are rendered to the
+ * header buffer, the content and packet delimiter are the cached ones.
+ *
+ * @param state State of the context.
+ * @param routing Routing modifiers of the packet.
+ * @param routinglen Number of routing modifiers.
+ * @param header Buffer for the routing header.
+ * @param headerlen Length of header.
+ * @param iov Two entries to set, valid until the state is changed.
+ *
+ * @return PSYC_RENDER_SUCCESS, PSYC_RENDER_ERROR if header is too small or out
+ *         of memory, or PSYC_RENDER_ERROR_MODIFIER_NAME_MISSING.
+ */
+PsycRenderRC
+psyc_state_resync (PsycState *state, PsycModifier *routing, size_t routinglen,
+		   char *header, size_t headerlen, struct iovec *iov);
+
+/** @} */ // end of state group
+
+#endif
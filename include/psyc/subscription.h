@@ -0,0 +1,148 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+#ifndef PSYC_SUBSCRIPTION_H
+#define PSYC_SUBSCRIPTION_H
+
+/**
+ * @file psyc/subscription.h
+ * @brief Interface for matching methods against many subscriptions at once.
+ */
+
+/**
+ * @defgroup subscription Subscription index
+ *
+ * A trie over the keyword segments of the patterns subscribers are
+ * interested in. Instead of calling psyc_inherits() or psyc_matches() for
+ * each subscriber, all subscriptions matching a method are found in a
+ * single walk over the segments of the method.
+ *
+ * @code
+ * PsycSubscriptions subs;
+ * uintptr_t ids[64];
+ * size_t n;
+ *
+ * psyc_subscription_init(&subs);
+ * psyc_subscription_add(&subs, PSYC_C2ARG("_notice"), PSYC_SUBSCRIPTION_INHERIT, 1);
+ * psyc_subscription_add(&subs, PSYC_C2ARG("_enter"), PSYC_SUBSCRIPTION_MATCH, 2);
+ * n = psyc_subscription_lookup(&subs, PSYC_C2ARG("_notice_context_enter"),
+ *                              ids, PSYC_NUM_ELEM(ids)); // 2: ids 1 and 2
+ * psyc_subscription_free(&subs);
+ * @endcode
+ * @{
+ */
+
+#include <stdint.h>
+
+/** How a pattern is matched against a method. */
+typedef enum {
+    /// The method inherits from the pattern, as in psyc_inherits().
+    PSYC_SUBSCRIPTION_INHERIT = 0,
+    /// The pattern matches the method, as in psyc_matches().
+    PSYC_SUBSCRIPTION_MATCH = 1,
+} PsycSubscriptionMode;
+
+/** Node of the subscription trie, one for each keyword segment. */
+typedef struct PsycSubscriptionNode {
+    struct PsycSubscriptionNode *parent;
+    struct PsycSubscriptionNode **children; ///< Sorted by segment.
+    size_t nchildren;
+    size_t children_size;	///< Allocated size of children.
+    uintptr_t *ids[2];		///< Subscribers of each PsycSubscriptionMode.
+    size_t nids[2];
+    size_t ids_size[2];		///< Allocated size of ids.
+    uint32_t walk;		///< Last lookup that reached the node.
+    PsycString segment;		///< Stored after the node.
+} PsycSubscriptionNode;
+
+/** Subscription index. */
+typedef struct {
+    PsycSubscriptionNode root;
+    size_t count;		///< Number of subscriptions.
+    size_t nodes;		///< Number of nodes.
+    uint32_t walk;		///< Number of lookups, for marking nodes.
+    PsycSubscriptionNode **active; ///< Nodes reached during a lookup.
+    size_t active_size;		///< Allocated size of active.
+} PsycSubscriptions;
+
+/**
+ * Initialize an empty subscription index.
+ */
+void
+psyc_subscription_init (PsycSubscriptions *subs);
+
+/**
+ * Free the memory used by a subscription index.
+ */
+void
+psyc_subscription_free (PsycSubscriptions *subs);
+
+/**
+ * Add a subscription.
+ *
+ * The same id can be added with any number of patterns.
+ *
+ * @param subs Subscription index.
+ * @param pattern Keyword to match, in long format: _segment_segment...
+ * @param patternlen Length of pattern.
+ * @param mode How the pattern is matched.
+ * @param id Subscriber ID returned by psyc_subscription_lookup().
+ *
+ * @return PSYC_OK, or PSYC_ERROR if the pattern is invalid or out of memory.
+ */
+PsycRC
+psyc_subscription_add (PsycSubscriptions *subs,
+		       const char *pattern, size_t patternlen,
+		       PsycSubscriptionMode mode, uintptr_t id);
+
+/**
+ * Remove a subscription added with psyc_subscription_add().
+ *
+ * @return PSYC_OK, or PSYC_ERROR if there was no such subscription.
+ */
+PsycRC
+psyc_subscription_remove (PsycSubscriptions *subs,
+			  const char *pattern, size_t patternlen,
+			  PsycSubscriptionMode mode, uintptr_t id);
+
+/**
+ * Find the subscriptions matching a method.
+ *
+ * The IDs are returned once for each matching subscription, in no
+ * particular order. Lookups modify the index, so concurrent lookups on the
+ * same index need a lock.
+ *
+ * @param subs Subscription index.
+ * @param method Method name.
+ * @param methodlen Length of method.
+ * @param ids Array the IDs are written to.
+ * @param size Size of ids.
+ *
+ * @return Number of matching subscriptions, if it's more than size only the
+ *         first size of them are written to ids.
+ */
+size_t
+psyc_subscription_lookup (PsycSubscriptions *subs,
+			  const char *method, size_t methodlen,
+			  uintptr_t *ids, size_t size);
+
+/** @} */ // end of subscription group
+
+#endif
@@ -180,6 +180,143 @@ psyc_template (PsycMethod mc, size_t *len) {
     return t.data;
 }
 
+/**
+ * Literal text or variable of a compiled template.
+ */
+typedef struct {
+    PsycString text;		///< Text to copy, for a variable this is the
+				///  variable in braces used when not found.
+    PsycString name;		///< Variable name, empty for literal text.
+    uint32_t id;		///< Intern ID of the variable name.
+} PsycTextSegment;
+
+/**
+ * Text template split into literal text and variables.
+ * @see psyc_text_compile()
+ */
+typedef struct {
+    PsycTextSegment *segments;
+    size_t nsegments;
+    size_t nvars;		///< Number of variables in segments.
+} PsycTextTemplate;
+
+/**
+ * Callback for psyc_text_render_compiled() that produces a value for a
+ * variable, like PsycTextCB but it also gets the intern ID of the name,
+ * 0 if it's not in the intern table.
+ */
+typedef PsycTextValueRC (*PsycTextIdCB) (void *cls, uint32_t id,
+					 const char *name, size_t namelen,
+					 PsycString *value);
+
+/**
+ * Split a text template into literal text and variables.
+ *
+ * The template is searched for braces only once, the variable names are
+ * added to the intern table. The segments point into the template, which
+ * has to be kept as long as the compiled template is used.
+ *
+ * @param tmpl Compiled template.
+ * @param text Text template.
+ * @param textlen Length of text.
+ * @param ope Opening brace, NULL for "[".
+ * @param opelen Length of opening brace.
+ * @param clo Closing brace, NULL for "]".
+ * @param clolen Length of closing brace.
+ * @param segments Array for the segments of the template, or NULL to only
+ *                 count them: tmpl->nsegments is set to the size needed.
+ * @param size Size of segments.
+ *
+ * @return PSYC_OK, or PSYC_ERROR if segments is too small.
+ */
+PsycRC
+psyc_text_compile (PsycTextTemplate *tmpl, const char *text, size_t textlen,
+		   const char *ope, size_t opelen, const char *clo, size_t clolen,
+		   PsycTextSegment *segments, size_t size);
+
+/**
+ * Fill out a compiled text template.
+ *
+ * Works like psyc_text() with the state initialized by psyc_text_state_init()
+ * with an empty template, but copies the segments of the compiled template in
+ * a single pass without searching for braces.
+ *
+ * @code
+ * psyc_text_state_init(&state, NULL, 0, buffer, buflen);
+ * ret = psyc_text_render_compiled(&state, psyc_template_compiled(mc),
+ *                                 get_value, cls);
+ * @endcode
+ */
+PsycTextRC
+psyc_text_render_compiled (PsycTextState *state, const PsycTextTemplate *tmpl,
+			   PsycTextIdCB get_value, void *get_value_cls);
+
+/**
+ * Get the compiled template of a method from psyc_templates.
+ *
+ * The templates are compiled on first use, into segments allocated for
+ * exactly the ones they have.
+ *
+ * @return The template, or NULL if the method has none, or if the segments
+ *         can't be allocated.
+ */
+const PsycTextTemplate *
+psyc_template_compiled (PsycMethod mc);
+
+/** Number of slots in a PsycTextVars index. */
+#ifndef PSYC_TEXT_VARS_SLOTS
+#define PSYC_TEXT_VARS_SLOTS 64
+#endif
+
+/**
+ * Index of the variables of a packet for filling out its template.
+ * @see psyc_text_vars_init()
+ */
+typedef struct {
+    struct {
+	uint32_t hash;
+	const PsycModifier *mod;
+    } slots[PSYC_TEXT_VARS_SLOTS]; ///< Open addressing hash table.
+    size_t rest;		///< First modifier that didn't fit, counting
+				///  entity then routing ones, 0 if all did.
+    const PsycPacket *packet;
+    PsycBool routing;		///< Are routing modifiers indexed?
+} PsycTextVars;
+
+/**
+ * Index the entity modifiers of a packet, and optionally the routing
+ * modifiers, for psyc_text_vars_get().
+ *
+ * The first modifier with a name is found, entity modifiers come first.
+ * Modifiers that don't fit in the index are searched linearly.
+ *
+ * @code
+ * PsycTextVars vars;
+ * psyc_text_vars_init(&vars, &packet, PSYC_NO);
+ * psyc_text_state_init(&state, tmpl, tmplen, buffer, buflen);
+ * ret = psyc_text(&state, psyc_text_vars_get, &vars);
+ * @endcode
+ */
+void
+psyc_text_vars_init (PsycTextVars *vars, const PsycPacket *packet,
+		     PsycBool routing);
+
+/**
+ * PsycTextCB returning the value of a variable from a PsycTextVars index
+ * given as cls.
+ */
+PsycTextValueRC
+psyc_text_vars_get (void *cls, const char *name, size_t namelen,
+		    PsycString *value);
+
+/**
+ * PsycTextIdCB returning the value of a variable from a PsycTextVars index
+ * given as cls, for psyc_text_render_compiled().
+ */
+PsycTextValueRC
+psyc_text_vars_get_id (void *cls, uint32_t id, const char *name,
+		       size_t namelen, PsycString *value);
+
 /** @} */ // end of text group
 
 #endif
@@ -0,0 +1,268 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+#ifndef PSYC_UPDATE_H
+#define PSYC_UPDATE_H
+
+/**
+ * @file psyc/update.h
+ * @brief Interface for applying updates to lists and dicts.
+ */
+
+/**
+ * @defgroup update Applying updates
+ *
+ * Applies '@' update modifiers, as tokenized by psyc_parse_update(), to the
+ * rendered value of a _list or _dict. The index path leads to the element
+ * updated, which is:
+ *
+ * - '=' replaced by the value given, or appended if the index is the number
+ *   of elements of a list or the key isn't in the dict,
+ * - '+' augmented, if it's a list or dict itself, or added if it's missing,
+ * - '-' diminished, if it's a list or dict itself, or removed if no value
+ *   is given.
+ *
+ * Updates are first prepared as a few edits of byte ranges of the value,
+ * then spliced into it in place, so the elements that aren't updated are
+ * neither parsed into a PsycList nor rendered again. Only the elements
+ * on the path to a nested one are rendered again, as their length changes.
+ * Struct members (._name) can't be updated, as they need a schema.
+ *
+ * '+' and '-' modifiers of a whole list or dict are prepared the same way
+ * with psyc_update_modify().
+ *
+ * The other way round, psyc_update_diff_list() and psyc_update_diff_dict()
+ * find the modifiers changing one value of a variable into another, so a
+ * change of a large list or dict is sent without sending all of it again.
+ *
+ * @code
+ * PsycUpdate u;
+ *
+ * if (psyc_update_prepare(&u, value, len, update, updatelen) == PSYC_UPDATE_CHANGED
+ *     && u.length <= size) {
+ *     psyc_update_splice(&u, value, len);
+ *     len = u.length;
+ * }
+ * psyc_update_free(&u);
+ * @endcode
+ * @{
+ */
+
+#include "variable.h"
+
+/** Return codes of the update functions. */
+typedef enum {
+    /// The value doesn't fit in the buffer.
+    PSYC_UPDATE_ERROR_SIZE = -6,
+    /// Out of memory.
+    PSYC_UPDATE_ERROR_MEMORY = -5,
+    /// Unknown operator, or one that can't be applied to the element.
+    PSYC_UPDATE_ERROR_OPERATOR = -4,
+    /// There is no element at the index path, or it's a struct member.
+    PSYC_UPDATE_ERROR_PATH = -3,
+    /// A value updated or given isn't a valid list or dict.
+    PSYC_UPDATE_ERROR_VALUE = -2,
+    /// The update modifier can't be parsed.
+    PSYC_UPDATE_ERROR = -1,
+    /// The value stays the same.
+    PSYC_UPDATE_UNCHANGED = 0,
+    /// The value is changed.
+    PSYC_UPDATE_CHANGED = 1,
+} PsycUpdateRC;
+
+/** What an edit inserts. */
+typedef enum {
+    /// elem.value as it is.
+    PSYC_UPDATE_EDIT_RAW,
+    /// A list element.
+    PSYC_UPDATE_EDIT_ELEM,
+    /// A dict entry with key.
+    PSYC_UPDATE_EDIT_ENTRY,
+    /// The value of a dict entry, after its key.
+    PSYC_UPDATE_EDIT_VALUE,
+} PsycUpdateEditKind;
+
+/** Replacement of a byte range of a value. */
+typedef struct {
+    size_t start;		///< Offset of the first byte replaced.
+    size_t end;			///< Offset after the last byte replaced.
+    size_t length;		///< Length of what is inserted instead.
+    PsycUpdateEditKind kind;	///< What is inserted.
+    PsycString key;		///< Key of a dict entry.
+    PsycElem elem;		///< Element or value of the entry.
+} PsycUpdateEdit;
+
+/** Update prepared for a value. */
+typedef struct {
+    PsycUpdateEdit *edits;	///< Edits in the order of their offsets.
+    size_t n;			///< Number of edits.
+    size_t size;		///< Number of edits allocated.
+    size_t length;		///< Length of the value after the update.
+    void *mem;			///< Nested values rendered again.
+    PsycUpdateEdit local[4];
+} PsycUpdate;
+
+/**
+ * Prepare an update modifier for a rendered list or dict.
+ *
+ * @param u Update to prepare, to be freed with psyc_update_free()
+ *          whatever is returned.
+ * @param value Rendered list or dict, an empty one if len is 0.
+ * @param len Length of value.
+ * @param update Value of the '@' modifier: index path, operator, type and value.
+ * @param updatelen Length of update.
+ *
+ * @return PSYC_UPDATE_CHANGED if there are edits to splice,
+ *         PSYC_UPDATE_UNCHANGED, or a PsycUpdateRC error.
+ */
+PsycUpdateRC
+psyc_update_prepare (PsycUpdate *u, const char *value, size_t len,
+		     const char *update, size_t updatelen);
+
+/**
+ * Prepare adding elements to a list or entries to a dict with '+',
+ * or removing them with '-'.
+ *
+ * A list element is removed once for each time it's given, dict entries are
+ * removed by key, and replaced by the ones with the same key when added.
+ *
+ * @param u Update to prepare.
+ * @param type PSYC_TYPE_LIST or PSYC_TYPE_DICT.
+ * @param value Rendered list or dict, an empty one if len is 0.
+ * @param len Length of value.
+ * @param oper PSYC_OPERATOR_AUGMENT or PSYC_OPERATOR_DIMINISH.
+ * @param mod Rendered list or dict of the elements to add or remove.
+ * @param modlen Length of mod.
+ *
+ * @see psyc_update_prepare()
+ */
+PsycUpdateRC
+psyc_update_modify (PsycUpdate *u, PsycType type, const char *value, size_t len,
+		    char oper, const char *mod, size_t modlen);
+
+/**
+ * Apply the edits of a prepared update to the value in place.
+ *
+ * @param u Update prepared for the value.
+ * @param value Buffer of at least len and u->length bytes,
+ *              the bytes inserted must not point into it.
+ * @param len Length of the value.
+ */
+void
+psyc_update_splice (const PsycUpdate *u, char *value, size_t len);
+
+/**
+ * Free the memory used by an update.
+ */
+void
+psyc_update_free (PsycUpdate *u);
+
+/**
+ * Apply an update modifier to a rendered list or dict in place.
+ *
+ * @param value Buffer with the rendered value.
+ * @param len Length of the value, set to the new length.
+ * @param size Size of the buffer.
+ * @param update Value of the '@' modifier.
+ * @param updatelen Length of update.
+ *
+ * @return PSYC_UPDATE_CHANGED, PSYC_UPDATE_UNCHANGED, or a PsycUpdateRC
+ *         error, in which case the value is unchanged.
+ */
+PsycUpdateRC
+psyc_update_apply (char *value, size_t *len, size_t size,
+		   const char *update, size_t updatelen);
+
+/**
+ * Apply an update modifier to a parsed list.
+ *
+ * Only elements of the list itself can be replaced, appended or removed,
+ * their values point into update afterwards.
+ *
+ * @param list List to update, its length is set again.
+ * @param size Number of elements allocated for list->elems.
+ * @param update Value of the '@' modifier.
+ * @param updatelen Length of update.
+ *
+ * @return PSYC_UPDATE_CHANGED, PSYC_UPDATE_UNCHANGED, PSYC_UPDATE_ERROR_SIZE
+ *         if there's no room for another element, or another PsycUpdateRC
+ *         error.
+ */
+PsycUpdateRC
+psyc_update_list (PsycList *list, size_t size,
+		  const char *update, size_t updatelen);
+
+/**
+ * Apply an update modifier to a parsed dict.
+ *
+ * @see psyc_update_list()
+ */
+PsycUpdateRC
+psyc_update_dict (PsycDict *dict, size_t size,
+		  const char *update, size_t updatelen);
+
+/**
+ * Find the modifiers that change a list into another.
+ *
+ * The cheapest of these is chosen, by the bytes of the modifiers:
+ * - '-' the elements removed, if the others stay in order and aren't the
+ *   same as an earlier one removed, then '+' those added at the end,
+ * - '@' each element replaced, removed from the end or appended,
+ * - '=' the whole list.
+ *
+ * @param from List the variable is set to, its length is set.
+ * @param to List to change it into, its length is set.
+ * @param name Name of the variable, for the modifiers.
+ * @param namelen Length of name.
+ * @param mods Modifiers to set, their values point into buffer.
+ * @param nmods Number of modifiers allocated, set to the number used.
+ * @param buffer Buffer for the values of the modifiers.
+ * @param buflen Length of buffer.
+ *
+ * @return PSYC_UPDATE_CHANGED, PSYC_UPDATE_UNCHANGED if the lists are the
+ *         same, PSYC_UPDATE_ERROR_SIZE if mods or buffer is too small,
+ *         or PSYC_UPDATE_ERROR_MEMORY.
+ */
+PsycUpdateRC
+psyc_update_diff_list (PsycList *from, PsycList *to,
+		       const char *name, size_t namelen,
+		       PsycModifier *mods, size_t *nmods,
+		       char *buffer, size_t buflen);
+
+/**
+ * Find the modifiers that change a dict into another.
+ *
+ * Entries are matched by key, which should be unique in each dict. Either
+ * '-' the entries removed, '@' each value changed and '+' the entries added,
+ * or '=' the whole dict, whichever is cheaper. The entries added come after
+ * the others, so the entries of to have to be in that order for the value
+ * to be the same as rendering to.
+ *
+ * @see psyc_update_diff_list()
+ */
+PsycUpdateRC
+psyc_update_diff_dict (PsycDict *from, PsycDict *to,
+		       const char *name, size_t namelen,
+		       PsycModifier *mods, size_t *nmods,
+		       char *buffer, size_t buflen);
+
+/** @} */ // end of update group
+
+#endif
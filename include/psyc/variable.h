@@ -41,6 +41,11 @@ extern const size_t psyc_rvars_num;
 extern const size_t psyc_var_types_num;
 extern const size_t psyc_methods_num;
 
+/// Perfect hashes of the maps above, generated by genmap.
+extern const PsycMapHash psyc_rvars_hash;
+extern const PsycMapHash psyc_var_types_hash;
+extern const PsycMapHash psyc_methods_hash;
+
 typedef enum {
     PSYC_RVAR_UNKNOWN,
 
@@ -92,8 +97,17 @@ inline PsycRoutingVar
 psyc_var_routing (const char *name, size_t len)
 {
     return (PsycRoutingVar)
-	psyc_map_lookup_int((PsycMapInt*)psyc_rvars, psyc_rvars_num, name, len,
-			    PSYC_NO);
+	psyc_map_hash_lookup_int(&psyc_rvars_hash, name, len, PSYC_NO);
+}
+
+/**
+ * Get the routing variable of an intern ID.
+ * @see psyc_intern
+ */
+inline PsycRoutingVar
+psyc_var_routing_id (uint32_t id)
+{
+    return id < PSYC_RVARS_NUM ? (PsycRoutingVar) id : PSYC_RVAR_UNKNOWN;
 }
 
 /**
@@ -103,8 +117,7 @@ inline PsycType
 psyc_var_type (const char *name, size_t len)
 {
     return (PsycType)
-	psyc_map_lookup_int((PsycMapInt*)psyc_var_types, psyc_var_types_num,
-			    name, len, PSYC_YES);
+	psyc_map_hash_lookup_int(&psyc_var_types_hash, name, len, PSYC_YES);
 }
 
 /**
@@ -0,0 +1,128 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+#include "lib.h"
+#include <stdlib.h>
+#include <psyc/arena.h>
+
+/// Usable memory of a block starts after the header, aligned.
+#define BLOCK_HEADER \
+    ((sizeof(PsycArenaBlock) + PSYC_ARENA_ALIGN - 1) & ~(PSYC_ARENA_ALIGN - 1))
+#define BLOCK_DATA(b) ((char *)(b) + BLOCK_HEADER)
+
+/**
+ * Offset of the next aligned address in the current memory.
+ */
+static inline size_t
+arena_offset (PsycArena *arena)
+{
+    uintptr_t p = (uintptr_t)(arena->data + arena->used);
+    return arena->used
+	+ (((p + PSYC_ARENA_ALIGN - 1) & ~(uintptr_t)(PSYC_ARENA_ALIGN - 1)) - p);
+}
+
+void
+psyc_arena_init (PsycArena *arena, char *buffer, size_t length)
+{
+    *arena = (PsycArena) {
+	.data = buffer,
+	.size = buffer ? length : 0,
+	.buffer = buffer,
+	.length = buffer ? length : 0,
+    };
+}
+
+void *
+psyc_arena_alloc (PsycArena *arena, size_t size)
+{
+    PsycArenaBlock *b;
+    size_t off = arena->data ? arena_offset(arena) : 0;
+
+    if (!arena->data || off > arena->size || size > arena->size - off) {
+	// doubling the block size keeps the number of blocks logarithmic
+	size_t bsize = arena->size * 2;
+	if (bsize < PSYC_ARENA_BLOCK_SIZE)
+	    bsize = PSYC_ARENA_BLOCK_SIZE;
+	if (bsize < size)
+	    bsize = size;
+
+	b = malloc(BLOCK_HEADER + bsize);
+	if (!b)
+	    return NULL;
+	b->next = arena->blocks;
+	b->size = bsize;
+	arena->blocks = b;
+
+	arena->data = BLOCK_DATA(b);
+	arena->size = bsize;
+	off = 0;
+    }
+
+    arena->used = off + size;
+    arena->last = arena->data + off;
+    return arena->last;
+}
+
+void *
+psyc_arena_grow (PsycArena *arena, void *ptr, size_t oldsize, size_t size)
+{
+    void *p;
+
+    if (ptr && ptr == arena->last
+	&& size <= arena->size - ((char *)ptr - arena->data)) {
+	arena->used = (char *)ptr - arena->data + size;
+	return ptr;
+    }
+
+    p = psyc_arena_alloc(arena, size);
+    if (p && ptr)
+	memcpy(p, ptr, oldsize < size ? oldsize : size);
+    return p;
+}
+
+void
+psyc_arena_reset (PsycArena *arena)
+{
+    PsycArenaBlock *b = arena->blocks, *next;
+
+    if (b) { // the newest block is the largest, keep that one
+	for (next = b->next; next; next = b->next) {
+	    b->next = next->next;
+	    free(next);
+	}
+	arena->data = BLOCK_DATA(b);
+	arena->size = b->size;
+    }
+
+    arena->used = 0;
+    arena->last = NULL;
+}
+
+void
+psyc_arena_free (PsycArena *arena)
+{
+    PsycArenaBlock *b, *next;
+
+    for (b = arena->blocks; b; b = next) {
+	next = b->next;
+	free(b);
+    }
+    psyc_arena_init(arena, arena->buffer, arena->length);
+}
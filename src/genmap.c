@@ -0,0 +1,231 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+/**
+ * Generate minimal perfect hashes for the maps in variable.c.
+ *
+ * Writes variable_hash.c to stdout, run with make maps.
+ *
+ * The keys of a map are hashed into as many buckets as there are keys,
+ * then starting with the largest bucket a displacement is searched for each
+ * one that moves all of its keys to free slots. If that fails the next seed
+ * is tried.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <psyc.h>
+#include <psyc/variable.h>
+
+#define MAXKEYS 256
+#define MAXSEEDS 1000
+#define MAXDISP 65536
+
+typedef struct {
+    const char *name;
+    const PsycMapInt *map;
+    size_t size;
+} Map;
+
+static uint32_t
+hash (uint32_t seed, const PsycString *key)
+{
+    uint32_t h = PSYC_MAP_HASH_INIT(seed);
+    size_t i;
+
+    for (i = 0; i < key->length; i++)
+	h = PSYC_MAP_HASH_STEP(h, key->data[i]);
+    return h;
+}
+
+/**
+ * Try to place the keys of all buckets with the given seed.
+ *
+ * @return 0 on success, -1 if a bucket can't be placed.
+ */
+static int
+place (const Map *m, uint32_t seed, uint8_t *slots, uint16_t *disp)
+{
+    uint32_t h[MAXKEYS];
+    size_t count[MAXKEYS] = {0}, order[MAXKEYS];
+    uint8_t taken[MAXKEYS] = {0}, mine[MAXKEYS];
+    size_t i, j, k, b, s;
+    uint32_t d;
+
+    for (i = 0; i < m->size; i++) {
+	h[i] = hash(seed, &m->map[i].key);
+	count[h[i] % m->size]++;
+    }
+
+    // largest buckets first
+    for (i = 0; i < m->size; i++)
+	order[i] = i;
+    for (i = 0; i < m->size; i++)
+	for (j = i + 1; j < m->size; j++)
+	    if (count[order[j]] > count[order[i]]) {
+		k = order[i];
+		order[i] = order[j];
+		order[j] = k;
+	    }
+
+    memset(disp, 0, m->size * sizeof(*disp));
+
+    for (i = 0; i < m->size && count[order[i]]; i++) {
+	b = order[i];
+	for (d = 0; d < MAXDISP; d++) {
+	    memset(mine, 0, m->size);
+	    for (k = 0; k < m->size; k++) {
+		if (h[k] % m->size != b)
+		    continue;
+		s = psyc_map_hash_slot(h[k], d, m->size);
+		if (taken[s] || mine[s])
+		    break;
+		mine[s] = 1;
+		slots[s] = k;
+	    }
+	    if (k == m->size)
+		break;
+	}
+	if (d == MAXDISP)
+	    return -1;
+
+	disp[b] = d;
+	for (k = 0; k < m->size; k++)
+	    taken[k] |= mine[k];
+    }
+
+    return 0;
+}
+
+/**
+ * Check every key and a few keys inheriting from them.
+ */
+static int
+check (const Map *m, const PsycMapHash *hash, PsycBool inherit)
+{
+    char key[PSYC_MAP_HASH_KEYLEN_MAX + 8];
+    size_t i, len;
+
+    for (i = 0; i < m->size; i++) {
+	len = m->map[i].key.length;
+	memcpy(key, m->map[i].key.data, len);
+	if (psyc_map_hash_lookup_int(hash, key, len, inherit)
+	    != m->map[i].value)
+	    return -1;
+
+	memcpy(key + len, "_foo", 4);
+	if (psyc_map_hash_lookup_int(hash, key, len + 4, inherit)
+	    != (inherit ? psyc_map_hash_lookup_int(hash, key, len, inherit) : 0))
+	    return -1;
+    }
+    return 0;
+}
+
+static int
+generate (const Map *m, PsycBool inherit)
+{
+    uint8_t slots[MAXKEYS];
+    uint16_t disp[MAXKEYS];
+    size_t i, maxlen = 0;
+    uint32_t seed;
+
+    if (m->size > MAXKEYS) {
+	fprintf(stderr, "%s: too many keys\n", m->name);
+	return -1;
+    }
+    for (i = 0; i < m->size; i++)
+	if (m->map[i].key.length > maxlen)
+	    maxlen = m->map[i].key.length;
+    if (maxlen > PSYC_MAP_HASH_KEYLEN_MAX) {
+	fprintf(stderr, "%s: key too long\n", m->name);
+	return -1;
+    }
+
+    for (seed = 0; seed < MAXSEEDS; seed++)
+	if (place(m, seed, slots, disp) == 0)
+	    break;
+    if (seed == MAXSEEDS) {
+	fprintf(stderr, "%s: no perfect hash found, duplicate keys?\n", m->name);
+	return -1;
+    }
+
+    PsycMapHash hash = {m->map, slots, disp, m->size, maxlen, seed};
+    if (check(m, &hash, inherit) != 0) {
+	fprintf(stderr, "%s: lookup failed\n", m->name);
+	return -1;
+    }
+
+    printf("\nstatic const uint8_t %s_slots[] = {", m->name);
+    for (i = 0; i < m->size; i++)
+	printf("%s%d,", i % 16 ? " " : "\n    ", slots[i]);
+    printf("\n};\n\nstatic const uint16_t %s_disp[] = {", m->name);
+    for (i = 0; i < m->size; i++)
+	printf("%s%d,", i % 12 ? " " : "\n    ", disp[i]);
+    printf("\n};\n\n"
+	   "const PsycMapHash psyc_%s_hash = {\n"
+	   "    psyc_%s, %s_slots, %s_disp, %lu, %lu, %lu,\n"
+	   "};\n", m->name, m->name, m->name, m->name,
+	   (unsigned long)m->size, (unsigned long)maxlen, (unsigned long)seed);
+
+    return 0;
+}
+
+int
+main (int argc, char **argv)
+{
+    Map rvars = {"rvars", psyc_rvars, psyc_rvars_num};
+    Map var_types = {"var_types", psyc_var_types, psyc_var_types_num};
+    Map methods = {"methods", psyc_methods, psyc_methods_num};
+
+    printf("/*\n"
+	   "  This file is part of libpsyc.\n"
+	   "  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,\n"
+	   "  and other contributing authors.\n"
+	   "\n"
+	   "  libpsyc is free software: you can redistribute it and/or modify it under the\n"
+	   "  terms of the GNU Affero General Public License as published by the Free\n"
+	   "  Software Foundation, either version 3 of the License, or (at your option) any\n"
+	   "  later version. As a special exception, libpsyc is distributed with additional\n"
+	   "  permissions to link libpsyc libraries with non-AGPL works.\n"
+	   "\n"
+	   "  libpsyc is distributed in the hope that it will be useful, but WITHOUT\n"
+	   "  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS\n"
+	   "  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more\n"
+	   "  details.\n"
+	   "\n"
+	   "  You should have received a copy of the GNU Affero General Public License and\n"
+	   "  the linking exception along with libpsyc in a COPYING file.\n"
+	   "*/\n"
+	   "\n"
+	   "/* Perfect hashes of the maps in variable.c generated by genmap,\n"
+	   " * run make maps after changing them. */\n"
+	   "\n"
+	   "#include \"lib.h\"\n"
+	   "#include <psyc/variable.h>\n");
+
+    if (generate(&rvars, PSYC_NO) != 0
+	|| generate(&var_types, PSYC_YES) != 0
+	|| generate(&methods, PSYC_YES) != 0)
+	return 1;
+
+    return 0;
+}
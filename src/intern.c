@@ -0,0 +1,213 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+/**
+ * The intern table is an open addressing hash table of pointers to entries,
+ * twice the size of the maximum number of keywords. Entries are never
+ * removed or changed once they're published in a slot, so readers only need
+ * to load the slots with acquire semantics. Writers are serialized by a spin
+ * lock, adding keywords is rare compared to lookups.
+ */
+
+#include "lib.h"
+#include <stdlib.h>
+#include <psyc/intern.h>
+#include <psyc/variable.h>
+
+#define SLOTS (2 * PSYC_INTERN_MAX)
+
+typedef struct {
+    uint32_t hash;
+    uint32_t id;
+    PsycString name;
+} Entry;
+
+static Entry *slots[SLOTS];
+static Entry *entries[PSYC_INTERN_MAX + 1];
+static uint32_t count;
+static uint8_t initialized;
+static uint8_t lock;
+
+extern inline uint32_t
+psyc_intern_hash (const char *name, size_t len);
+
+static inline void
+intern_lock ()
+{
+    while (__atomic_test_and_set(&lock, __ATOMIC_ACQUIRE))
+	;
+}
+
+static inline void
+intern_unlock ()
+{
+    __atomic_clear(&lock, __ATOMIC_RELEASE);
+}
+
+/**
+ * Find the slot of a keyword, or the empty slot where it would be added.
+ */
+static inline Entry **
+intern_find (const char *name, size_t len, uint32_t hash)
+{
+    size_t i = hash % SLOTS;
+    Entry *e;
+
+    while ((e = __atomic_load_n(&slots[i], __ATOMIC_ACQUIRE))) {
+	if (e->hash == hash && e->name.length == len
+	    && memcmp(e->name.data, name, len) == 0)
+	    break;
+	i = (i + 1) % SLOTS;
+    }
+    return &slots[i];
+}
+
+/**
+ * Add a keyword, the lock must be held.
+ */
+static uint32_t
+intern_add (const char *name, size_t len)
+{
+    uint32_t hash = psyc_intern_hash(name, len);
+    Entry **slot = intern_find(name, len, hash), *e;
+
+    if (*slot)
+	return (*slot)->id;
+    if (count >= PSYC_INTERN_MAX)
+	return 0;
+
+    e = malloc(sizeof(Entry) + len);
+    if (!e)
+	return 0;
+    memcpy(e + 1, name, len);
+    e->name = PSYC_STRING((char *)(e + 1), len);
+    e->hash = hash;
+    e->id = count + 1;
+
+    entries[e->id] = e;
+    __atomic_store_n(&count, e->id, __ATOMIC_RELEASE);
+    __atomic_store_n(slot, e, __ATOMIC_RELEASE);
+    return e->id;
+}
+
+/**
+ * Add the keywords known by the library on first use.
+ */
+static void
+intern_init ()
+{
+    size_t i;
+
+    intern_lock();
+    if (!initialized) {
+	// in the order of PsycRoutingVar
+	for (i = 0; i < psyc_rvars_num; i++)
+	    intern_add(PSYC_S2ARG(psyc_rvars[i].key));
+	for (i = 0; i < psyc_var_types_num; i++)
+	    intern_add(PSYC_S2ARG(psyc_var_types[i].key));
+	for (i = 0; i < psyc_methods_num; i++)
+	    intern_add(PSYC_S2ARG(psyc_methods[i].key));
+	__atomic_store_n(&initialized, 1, __ATOMIC_RELEASE);
+    }
+    intern_unlock();
+}
+
+uint32_t
+psyc_intern_lookup (const char *name, size_t len, uint32_t hash)
+{
+    Entry *e;
+
+    if (!__atomic_load_n(&initialized, __ATOMIC_ACQUIRE))
+	intern_init();
+
+    e = *intern_find(name, len, hash);
+    return e ? e->id : 0;
+}
+
+/**
+ * Compare a keyword with a name starting at off in iov[0].
+ */
+static inline int
+intern_cmp_iov (PsycString *name, const PsycString *iov, size_t off)
+{
+    size_t i, n;
+
+    for (i = 0; i < name->length; i += n, iov++, off = 0) {
+	n = iov->length - off;
+	if (n > name->length - i)
+	    n = name->length - i;
+	if (memcmp(name->data + i, iov->data + off, n))
+	    return 1;
+    }
+    return 0;
+}
+
+uint32_t
+psyc_intern_lookup_iov (const PsycString *iov, size_t off, size_t len,
+			uint32_t hash)
+{
+    size_t i = hash % SLOTS;
+    Entry *e;
+
+    if (!__atomic_load_n(&initialized, __ATOMIC_ACQUIRE))
+	intern_init();
+
+    while ((e = __atomic_load_n(&slots[i], __ATOMIC_ACQUIRE))) {
+	if (e->hash == hash && e->name.length == len
+	    && intern_cmp_iov(&e->name, iov, off) == 0)
+	    return e->id;
+	i = (i + 1) % SLOTS;
+    }
+    return 0;
+}
+
+uint32_t
+psyc_intern (const char *name, size_t len)
+{
+    uint32_t id = psyc_intern_lookup(name, len, psyc_intern_hash(name, len));
+
+    if (id || !len)
+	return id;
+
+    intern_lock();
+    id = intern_add(name, len);
+    intern_unlock();
+    return id;
+}
+
+PsycString
+psyc_intern_name (uint32_t id)
+{
+    if (!__atomic_load_n(&initialized, __ATOMIC_ACQUIRE))
+	intern_init();
+
+    if (id == 0 || id > __atomic_load_n(&count, __ATOMIC_ACQUIRE))
+	return PSYC_STRING(NULL, 0);
+    return entries[id]->name;
+}
+
+uint32_t
+psyc_intern_count ()
+{
+    if (!__atomic_load_n(&initialized, __ATOMIC_ACQUIRE))
+	intern_init();
+
+    return __atomic_load_n(&count, __ATOMIC_ACQUIRE);
+}
@@ -18,6 +18,9 @@
   the linking exception along with libpsyc in a COPYING file.
 */
 
+#include <psyc.h>
+#include <psyc/packet.h>
+
 #define ALPHANUMS "zyxwvutsrqponmlkjihgfedcba9876543210123456789abcdefghijklmnopqrstuvwxyz"
 
 /**
@@ -62,53 +65,154 @@ itoa (int number, char *out, int base)
     return count;
 }
 
+const uint64_t psyc_num_pow10[20] = {
+    0, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+    100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL,
+    1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+    1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+    1000000000000000000ULL, 10000000000000000000ULL,
+};
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/**
+ * Renders a number two digits at a time from the end,
+ * the length is known beforehand so there's nothing to reverse.
+ */
+size_t
+psyc_num_render (size_t n, char *buffer)
+{
+    size_t len = psyc_num_length(n), i;
+    char *p = buffer + len;
+
+    while (n >= 100) {
+	i = (n % 100) * 2;
+	n /= 100;
+	*--p = digit_pairs[i + 1];
+	*--p = digit_pairs[i];
+    }
+    if (n >= 10) {
+	*--p = digit_pairs[n * 2 + 1];
+	*--p = digit_pairs[n * 2];
+    } else
+	*--p = '0' + n;
+
+    return len;
+}
+
 /* This little test program shows that itoa() is roughly 3 times faster
  * than sprintf  --lynX
+ *
+ * It also compares the log10() & itoa() pair used for rendering lengths before
+ * with psyc_num_length() & psyc_num_render().
  */
 #ifdef CMDTOOL
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <sys/time.h>
+
+extern inline size_t
+psyc_num_length (size_t n);
+
+static size_t
+num_length_log10 (size_t n)
+{
+    return n < 10 ? 1 : log10(n) + 1;
+}
+
+static long
+elapsed (struct timeval *start)
+{
+    struct timeval end;
+    gettimeofday(&end, NULL);
+    return (end.tv_sec - start->tv_sec) * 1000000
+	+ (end.tv_usec - start->tv_usec);
+}
 
 int
 main (int argc, char **argv)
 {
-    char out[4404];
-    int in[44];
-    int c, i, j;
+    char out[4404], buf[32];
+    size_t in[44];
+    size_t c, len, sum = 0;
+    int i, j, times;
+    struct timeval start;
 
-    if (argc < 3 || argc > sizeof(in)) {
+    if (argc < 3 || argc > sizeof(in) / sizeof(*in)) {
 	printf("Usage: %s <times> <numbers>+\n\n"
-	       "Example: %s 999999 123 234 345 -49 -21892\n",
+	       "Example: %s 999999 123 234 345 49 21892 4294967296\n",
 	       argv[0], argv[0]);
 	return -1;
     }
-    for (j = argc - 1; j; j--) {
-	//printf("Looking at arg #%d: %s\n", j, argv[j]);
-	in[j] = atoi(argv[j]);
-	//printf("Got %d: %d\n", j, in[j]);
+    times = atoi(argv[1]);
+    for (j = argc - 1; j > 1; j--) {
+	in[j] = strtoull(argv[j], NULL, 10);
+	len = psyc_num_render(in[j], buf);
+	if (len != (size_t)snprintf(out, sizeof(out), "%llu",
+				   (unsigned long long)in[j])
+	    || memcmp(buf, out, len)) {
+	    printf("psyc_num_render(%s) = %.*s\n", argv[j], (int)len, buf);
+	    return 1;
+	}
     }
-    for (i = in[1]; i; i--) {
+
+    gettimeofday(&start, NULL);
+    for (i = times; i; i--) {
+	c = 0;
+	for (j = argc - 1; j > 1; j--)
+	    c += sprintf(&out[c], " %llu", (unsigned long long)in[j]);
+	sum += c;
+    }
+    printf("sprintf:\t\t\t%ld us\n", elapsed(&start));
+
+    gettimeofday(&start, NULL);
+    for (i = times; i; i--) {
 	c = 0;
 	for (j = argc - 1; j > 1; j--) {
-#if 0
-	    // use good old sprintf
-	    c += sprintf(&out[c], " %d", in[j]);
-#else
-#if 1
-	    // use the itoa implementation
 	    out[c++] = ' ';
 	    c += itoa(in[j], &out[c], 10);
-#else
-	    // just count the needed space
-	    c += itoa(in[j], NULL, 10) + 1;
-#endif
-#endif
 	}
+	sum += c;
     }
-    printf("%d times, %d count, buffer len: %d, buffer: %s\n",
-	   in[1], c, strlen(out), "<omitted>");	// out
+    printf("itoa:\t\t\t\t%ld us\n", elapsed(&start));
+
+    gettimeofday(&start, NULL);
+    for (i = times; i; i--) {
+	c = 0;
+	for (j = argc - 1; j > 1; j--) {
+	    out[c++] = ' ';
+	    c += psyc_num_render(in[j], &out[c]);
+	}
+	sum += c;
+    }
+    printf("psyc_num_render:\t\t%ld us\n", elapsed(&start));
+
+    gettimeofday(&start, NULL);
+    for (i = times; i; i--)
+	for (j = argc - 1; j > 1; j--)
+	    sum += num_length_log10(in[j] + i);
+    printf("log10 length:\t\t\t%ld us\n", elapsed(&start));
+
+    gettimeofday(&start, NULL);
+    for (i = times; i; i--)
+	for (j = argc - 1; j > 1; j--)
+	    sum += psyc_num_length(in[j] + i);
+    printf("psyc_num_length:\t\t%ld us\n", elapsed(&start));
+
+    printf("%d times, checksum: %ld\n", times, (long)sum);
     return 0;
 }
 #endif
@@ -0,0 +1,232 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+/**
+ * The index is the offset of each element, found by psyc_parse_list(), which
+ * skips the value of an element with a length without scanning it. An
+ * element ends where the next one starts, or at the end of the list, so it's
+ * parsed on its own by a parser set to just these bytes.
+ */
+
+#include "lib.h"
+#include <stdlib.h>
+#include <psyc/list.h>
+
+void
+psyc_list_index_init (PsycListIndex *idx, const char *buffer, size_t length)
+{
+    idx->buffer = buffer;
+    idx->length = length;
+    idx->type = (PsycString){0, NULL};
+    idx->offsets = NULL;
+    idx->n = 0;
+    idx->size = 0;
+    idx->done = !length;
+    psyc_parse_list_state_init(&idx->parser);
+    psyc_parse_list_buffer_set(&idx->parser, (char *)buffer, length);
+}
+
+void
+psyc_list_index_free (PsycListIndex *idx)
+{
+    free(idx->offsets);
+    idx->offsets = NULL;
+    idx->n = idx->size = 0;
+}
+
+/**
+ * Find the next element of the list.
+ *
+ * @return 1, 0 at the end of the list, or a PsycListIndexRC error.
+ */
+static int
+index_next (PsycListIndex *idx)
+{
+    PsycString type, elem;
+    size_t start, *offsets;
+    int ret;
+
+    if (idx->done)
+	return idx->done < 0 ? PSYC_LIST_INDEX_ERROR : 0;
+
+    if (idx->n == idx->size) {
+	offsets = realloc(idx->offsets, (idx->size ? idx->size * 2 : 64)
+			  * sizeof(size_t));
+	if (!offsets)
+	    return PSYC_LIST_INDEX_ERROR_MEMORY;
+	idx->offsets = offsets;
+	idx->size = idx->size ? idx->size * 2 : 64;
+    }
+
+    for (;;) {
+	start = idx->parser.cursor;
+	switch (ret = psyc_parse_list(&idx->parser, &type, &elem)) {
+	case PSYC_PARSE_LIST_TYPE:
+	    idx->type = type;
+	    break;
+	case PSYC_PARSE_LIST_ELEM:
+	case PSYC_PARSE_LIST_ELEM_LAST:
+	    idx->offsets[idx->n++] = start;
+	    idx->done = ret == PSYC_PARSE_LIST_ELEM_LAST;
+	    return 1;
+	case PSYC_PARSE_LIST_END:
+	    idx->done = 1;
+	    return 0;
+	default:
+	    idx->done = -1;
+	    return PSYC_LIST_INDEX_ERROR;
+	}
+    }
+}
+
+/**
+ * Build the index until element i is found and it's known where it ends.
+ *
+ * @return PSYC_LIST_INDEX_SUCCESS, PSYC_LIST_INDEX_ERROR_RANGE if the list
+ *         has less elements, or another PsycListIndexRC error.
+ */
+static PsycListIndexRC
+index_build (PsycListIndex *idx, size_t i)
+{
+    int ret;
+
+    while (idx->n <= i + 1 && idx->done != 1)
+	if ((ret = index_next(idx)) < 0)
+	    return ret;
+    return i < idx->n ? PSYC_LIST_INDEX_SUCCESS : PSYC_LIST_INDEX_ERROR_RANGE;
+}
+
+static inline size_t
+index_end (const PsycListIndex *idx, size_t i)
+{
+    return i + 1 < idx->n ? idx->offsets[i + 1] : idx->length;
+}
+
+/**
+ * Parse element i, which is found and ends where the next one starts.
+ */
+static PsycListIndexRC
+index_elem (const PsycListIndex *idx, size_t i, PsycElem *elem)
+{
+    PsycParseListState p;
+    PsycString type, value;
+    size_t start = idx->offsets[i], end = index_end(idx, i);
+
+    psyc_parse_list_state_init(&p);
+    psyc_parse_list_buffer_set(&p, (char *)idx->buffer + start, end - start);
+    switch (psyc_parse_list(&p, &type, &value)) {
+    case PSYC_PARSE_LIST_ELEM:
+    case PSYC_PARSE_LIST_ELEM_LAST:
+	break;
+    default:
+	return PSYC_LIST_INDEX_ERROR;
+    }
+
+    *elem = PSYC_ELEM(type.data, type.length, value.data, value.length,
+		      PSYC_ELEM_NO_LENGTH);
+    // keep the flag it's rendered with, so it's rendered the same again
+    elem->length = end - start - 1;
+    if (psyc_elem_length(elem) != elem->length)
+	elem->flag = PSYC_ELEM_NEED_LENGTH;
+    return PSYC_LIST_INDEX_SUCCESS;
+}
+
+ptrdiff_t
+psyc_list_index_count (PsycListIndex *idx)
+{
+    int ret;
+
+    while ((ret = index_next(idx)) > 0)
+	;
+    return ret < 0 ? ret : (ptrdiff_t)idx->n;
+}
+
+PsycListIndexRC
+psyc_list_index_get (PsycListIndex *idx, size_t i, PsycElem *elem)
+{
+    PsycListIndexRC ret = index_build(idx, i);
+
+    if (ret != PSYC_LIST_INDEX_SUCCESS)
+	return ret;
+    return index_elem(idx, i, elem);
+}
+
+PsycListIndexRC
+psyc_list_index_slice (PsycListIndex *idx, size_t i, size_t j,
+		       PsycString *slice)
+{
+    PsycListIndexRC ret;
+    size_t start, end;
+
+    if (i > j)
+	return PSYC_LIST_INDEX_ERROR_RANGE;
+    if (j > 0 && (ret = index_build(idx, j - 1)) != PSYC_LIST_INDEX_SUCCESS)
+	return ret;
+    if (j < idx->n)
+	end = idx->offsets[j];
+    else if (idx->done == 1 || j == 0)
+	end = j ? idx->length : 0;
+    else
+	return PSYC_LIST_INDEX_ERROR;
+    start = i < j ? idx->offsets[i] : end;
+
+    *slice = PSYC_STRING((char *)idx->buffer + start, end - start);
+    return PSYC_LIST_INDEX_SUCCESS;
+}
+
+ptrdiff_t
+psyc_list_index_find (PsycListIndex *idx, size_t offset)
+{
+    size_t lo = 0, hi, mid;
+    int ret;
+
+    while (!idx->done && (!idx->n || idx->offsets[idx->n - 1] <= offset))
+	if ((ret = index_next(idx)) < 0)
+	    return ret;
+    if (offset >= idx->length)
+	return idx->n;
+
+    // last element starting at or before the offset
+    hi = idx->n;
+    while (lo < hi) {
+	mid = lo + (hi - lo) / 2;
+	if (idx->offsets[mid] <= offset)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo ? lo - 1 : 0;
+}
+
+PsycListIndexRC
+psyc_list_index_decode (const PsycListIndex *idx, size_t i, size_t j,
+			PsycElem *elems)
+{
+    PsycListIndexRC ret;
+
+    if (idx->done != 1)
+	return PSYC_LIST_INDEX_ERROR;
+    if (i > j || j > idx->n)
+	return PSYC_LIST_INDEX_ERROR_RANGE;
+    for (; i < j; i++)
+	if ((ret = index_elem(idx, i, elems++)) != PSYC_LIST_INDEX_SUCCESS)
+	    return ret;
+    return PSYC_LIST_INDEX_SUCCESS;
+}
@@ -170,6 +170,63 @@ extern inline intptr_t
 psyc_map_lookup_int (const PsycMapInt *map, size_t size,
 		     const char *key, size_t keylen, PsycBool inherit);
 
+extern inline uint32_t
+psyc_map_hash_slot (uint32_t h, uint32_t d, size_t size);
+
+/**
+ * Check if the first len bytes of key are in the slot of hash h.
+ */
+static inline const PsycMapInt *
+map_hash_find (const PsycMapHash *hash, uint32_t h,
+	       const char *key, size_t len)
+{
+    const PsycMapInt *e =
+	&hash->map[hash->slots[psyc_map_hash_slot(h, hash->disp[h % hash->size],
+						  hash->size)]];
+
+    return e->key.length == len && memcmp(e->key.data, key, len) == 0 ? e : NULL;
+}
+
+intptr_t
+psyc_map_hash_lookup_int (const PsycMapHash *hash,
+			  const char *key, size_t keylen, PsycBool inherit)
+{
+    // hashes of the prefixes of key followed by an underscore
+    uint32_t prefix[PSYC_MAP_HASH_KEYLEN_MAX];
+    size_t plen[PSYC_MAP_HASH_KEYLEN_MAX];
+    size_t c, n = 0, len = keylen < hash->maxlen ? keylen : hash->maxlen;
+    uint32_t h = PSYC_MAP_HASH_INIT(hash->seed);
+    const PsycMapInt *e;
+
+    if (keylen < 2 || key[0] != '_')
+	return 0;
+
+    h = PSYC_MAP_HASH_STEP(h, key[0]);
+    for (c = 1; c < len; c++) {
+	if (inherit && key[c] == '_') {
+	    prefix[n] = h;
+	    plen[n++] = c;
+	}
+	h = PSYC_MAP_HASH_STEP(h, key[c]);
+    }
+
+    if (keylen <= hash->maxlen && (e = map_hash_find(hash, h, key, keylen)))
+	return e->value;
+
+    if (inherit) {
+	// the prefix ending at maxlen is not hashed in the loop
+	if (keylen > len && key[len] == '_'
+	    && (e = map_hash_find(hash, h, key, len)))
+	    return e->value;
+
+	while (n--)
+	    if ((e = map_hash_find(hash, prefix[n], key, plen[n])))
+		return e->value;
+    }
+
+    return 0;
+}
+
 #ifdef CMDTOOL
 int
 main(int argc, char **argv)
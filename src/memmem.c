@@ -1,4 +1,272 @@
-/*-
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+/**
+ * Find the first occurrence of a byte string in another one.
+ *
+ * Short needles, like the packet delimiter and template brackets, are found
+ * by looking for their first and last bytes at once, 32 or 16 positions at a
+ * time with AVX2 or SSE2, or with memchr() and a check of the second byte
+ * without them. The SIMD variant is selected by the CPU the library is loaded
+ * on. These take O(n * m) time in the worst case, so longer needles are
+ * searched for with the Two-Way algorithm, which is linear.
+ *
+ * memmem() itself started out as Pascal Gloor's, the Two-Way search follows
+ * the one in musl libc; their notices are kept with the code below.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# include <immintrin.h>
+# define MEMMEM_X86
+#endif
+
+/** Needles longer than this are searched for with Two-Way. */
+#define SHORT_MAX 32
+
+typedef void *(*MemmemFn) (const uint8_t *h, size_t hlen,
+			   const uint8_t *n, size_t nlen);
+
+static void *
+memmem_resolve (const uint8_t *h, size_t hlen, const uint8_t *n, size_t nlen);
+
+static MemmemFn memmem_short = memmem_resolve;
+
+/**
+ * Look for the first byte with memchr(), then the second and the rest.
+ */
+static void *
+memmem_scalar (const uint8_t *h, size_t hlen, const uint8_t *n, size_t nlen)
+{
+    const uint8_t *p = h, *last = h + hlen - nlen;
+
+    while (p <= last && (p = memchr(p, n[0], last - p + 1))) {
+	if (p[1] == n[1] && memcmp(p + 2, n + 2, nlen - 2) == 0)
+	    return (void *)p;
+	p++;
+    }
+    return NULL;
+}
+
+#ifdef MEMMEM_X86
+/**
+ * Compare the first and last bytes of the needle with 16 positions at once,
+ * the rest only where both match.
+ */
+__attribute__((target("sse2")))
+static void *
+memmem_sse2 (const uint8_t *h, size_t hlen, const uint8_t *n, size_t nlen)
+{
+    const __m128i first = _mm_set1_epi8(n[0]), last = _mm_set1_epi8(n[nlen - 1]);
+    size_t i = 0;
+    uint32_t m;
+
+    for (; i + nlen - 1 + 16 <= hlen; i += 16) {
+	m = _mm_movemask_epi8(_mm_and_si128(
+	    _mm_cmpeq_epi8(first, _mm_loadu_si128((const __m128i *)(h + i))),
+	    _mm_cmpeq_epi8(last, _mm_loadu_si128((const __m128i *)
+						 (h + i + nlen - 1)))));
+	for (; m; m &= m - 1)
+	    if (memcmp(h + i + __builtin_ctz(m) + 1, n + 1, nlen - 2) == 0)
+		return (void *)(h + i + __builtin_ctz(m));
+    }
+    return i + nlen <= hlen ? memmem_scalar(h + i, hlen - i, n, nlen) : NULL;
+}
+
+/**
+ * Same as memmem_sse2(), 32 positions at once.
+ */
+__attribute__((target("avx2")))
+static void *
+memmem_avx2 (const uint8_t *h, size_t hlen, const uint8_t *n, size_t nlen)
+{
+    const __m256i first = _mm256_set1_epi8(n[0]);
+    const __m256i last = _mm256_set1_epi8(n[nlen - 1]);
+    size_t i = 0;
+    uint32_t m;
+
+    for (; i + nlen - 1 + 32 <= hlen; i += 32) {
+	m = _mm256_movemask_epi8(_mm256_and_si256(
+	    _mm256_cmpeq_epi8(first, _mm256_loadu_si256((const __m256i *)(h + i))),
+	    _mm256_cmpeq_epi8(last, _mm256_loadu_si256((const __m256i *)
+						       (h + i + nlen - 1)))));
+	for (; m; m &= m - 1)
+	    if (memcmp(h + i + __builtin_ctz(m) + 1, n + 1, nlen - 2) == 0)
+		return (void *)(h + i + __builtin_ctz(m));
+    }
+    return i + nlen <= hlen ? memmem_scalar(h + i, hlen - i, n, nlen) : NULL;
+}
+#endif
+
+/**
+ * Select the search for short needles supported by the CPU.
+ */
+#ifdef __GNUC__
+__attribute__((constructor))
+#endif
+static void
+memmem_select ()
+{
+    MemmemFn fn = memmem_scalar;
+
+#ifdef MEMMEM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+	fn = memmem_avx2;
+    else if (__builtin_cpu_supports("sse2"))
+	fn = memmem_sse2;
+#endif
+    __atomic_store_n(&memmem_short, fn, __ATOMIC_RELAXED);
+}
+
+/**
+ * Initial memmem_short, in case memmem() is called before the constructor.
+ */
+static void *
+memmem_resolve (const uint8_t *h, size_t hlen, const uint8_t *n, size_t nlen)
+{
+    memmem_select();
+    return memmem_short(h, hlen, n, nlen);
+}
+
+/*
+ * max_suffix() and memmem_twoway() follow twoway_memmem() in
+ * src/string/memmem.c of musl libc:
+ *
+ * Copyright (c) 2005-2020 Rich Felker, et al.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * Get the start of the maximal suffix of the needle and its period,
+ * with the byte order reversed if rev is set.
+ *
+ * @return Index of the byte before the suffix, SIZE_MAX for the whole needle.
+ */
+static size_t
+max_suffix (const uint8_t *n, size_t nlen, size_t *period, int rev)
+{
+    size_t ip = SIZE_MAX, jp = 0, k = 1, p = 1;
+    uint8_t a, b;
+
+    while (jp + k < nlen) {
+	a = n[ip + k];
+	b = n[jp + k];
+	if (a == b) {
+	    if (k == p) {
+		jp += p;
+		k = 1;
+	    } else
+		k++;
+	} else if (rev ? a < b : a > b) {
+	    jp += k;
+	    k = 1;
+	    p = jp - ip;
+	} else {
+	    ip = jp++;
+	    k = p = 1;
+	}
+    }
+    *period = p;
+    return ip;
+}
+
+/**
+ * Two-Way string matching: the needle is split at a critical factorization,
+ * the right part is matched first from left to right, then the left part.
+ * Positions where the haystack byte under the end of the needle doesn't
+ * occur in the needle at that distance are skipped first, as in Horspool.
+ */
+static void *
+memmem_twoway (const uint8_t *h, size_t hlen, const uint8_t *n, size_t nlen)
+{
+    size_t shift[256], ms, p, ms2, p2, mem0, mem = 0, pos, k;
+
+    memset(shift, 0, sizeof(shift));
+    for (k = 0; k < nlen; k++)
+	shift[n[k]] = k + 1;
+
+    ms = max_suffix(n, nlen, &p, 0);
+    ms2 = max_suffix(n, nlen, &p2, 1);
+    if (ms2 + 1 > ms + 1) {
+	ms = ms2;
+	p = p2;
+    }
+
+    if (memcmp(n, n + p, ms + 1) == 0)
+	// periodic needle, the bytes matched in the last period are remembered
+	mem0 = nlen - p;
+    else {
+	p = (ms > nlen - ms - 1 ? ms : nlen - ms - 1) + 1;
+	mem0 = 0;
+    }
+
+    for (pos = 0; pos <= hlen - nlen;) {
+	k = nlen - shift[h[pos + nlen - 1]];
+	if (k) {
+	    pos += k < mem ? mem : k;
+	    mem = 0;
+	    continue;
+	}
+
+	for (k = ms + 1 > mem ? ms + 1 : mem; k < nlen && n[k] == h[pos + k]; k++)
+	    ;
+	if (k < nlen) {
+	    pos += k - ms;
+	    mem = 0;
+	    continue;
+	}
+
+	for (k = ms + 1; k > mem && n[k - 1] == h[pos + k - 1]; k--)
+	    ;
+	if (k <= mem)
+	    return (void *)(h + pos);
+	pos += p;
+	mem = mem0;
+    }
+    return NULL;
+}
+
+/*
+ * memmem() keeps the checks and comments of the fallback it replaced:
+ *
  * Copyright (c) 2005 Pascal Gloor <pascal.gloor@spale.com>
  *
  * Redistribution and use in source and binary forms, with or without
@@ -26,36 +294,19 @@
  * SUCH DAMAGE.
  */
 
-#include <string.h>
-
 /*
  * Find the first occurrence of the byte string s in byte string l.
  */
 void *
-memmem(const void *l, size_t l_len, const void *s, size_t s_len)
+memmem (const void *l, size_t l_len, const void *s, size_t s_len)
 {
-    register char *cur, *last;
-    const char *cl = (const char *) l;
-    const char *cs = (const char *) s;
-
     /* we need something to compare */
-    if (l_len == 0 || s_len == 0)
-	return NULL;
-
-    /* "s" must be smaller or equal to "l" */
-    if (l_len < s_len)
+    if (l_len == 0 || s_len == 0 || l_len < s_len)
 	return NULL;
 
-    /* special case where s_len == 1 */
     if (s_len == 1)
-	return memchr(l, (int) *cs, l_len);
-
-    /* the last position where its possible to find "s" in "l" */
-    last = (char *) cl + l_len - s_len;
-
-    for (cur = (char *) cl; cur <= last; cur++)
-	if (cur[0] == cs[0] && memcmp(cur, cs, s_len) == 0)
-	    return cur;
-
-    return NULL;
+	return memchr(l, *(const uint8_t *)s, l_len);
+    if (s_len <= SHORT_MAX)
+	return __atomic_load_n(&memmem_short, __ATOMIC_RELAXED)(l, l_len, s, s_len);
+    return memmem_twoway(l, l_len, s, s_len);
 }
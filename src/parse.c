@@ -26,8 +26,10 @@
 #endif
 
 #include "lib.h"
+#include "scan.h"
 #include <psyc/packet.h>
 #include <psyc/parse.h>
+#include <psyc/intern.h>
 
 #define ADVANCE_CURSOR_OR_RETURN(ret)					\
     if (++(state->cursor) >= state->buffer.length) {			\
@@ -59,6 +61,28 @@ psyc_parse_state_init (PsycParseState *state, uint8_t flags);
 extern inline void
 psyc_parse_buffer_set (PsycParseState *state, const char *buffer, size_t length);
 
+extern inline void
+psyc_parse_struct_index_set (PsycParseState *state, PsycParseStructIndex *idx);
+
+extern inline void
+psyc_parse_iov_state_init (PsycParseIovState *state, uint8_t flags);
+
+extern inline void
+psyc_parse_iov_buffer_set (PsycParseIovState *state,
+			   const PsycString *iov, size_t iovcnt);
+
+extern inline size_t
+psyc_parse_iov_segment (PsycParseIovState *state);
+
+extern inline const char *
+psyc_parse_iov_remaining_buffer (PsycParseIovState *state);
+
+extern inline size_t
+psyc_parse_iov_remaining_length (PsycParseIovState *state);
+
+extern inline size_t
+psyc_parse_iov_name_parts (PsycParseIovState *state, const PsycString **iov);
+
 extern inline void
 psyc_parse_list_state_init (PsycParseListState *state);
 
@@ -99,6 +123,9 @@ psyc_parse_value_length (PsycParseState *state);
 extern inline PsycBool
 psyc_parse_value_length_found (PsycParseState *state);
 
+extern inline uint32_t
+psyc_parse_keyword_id (PsycParseState *state);
+
 extern inline size_t
 psyc_parse_cursor (PsycParseState *state);
 
@@ -111,6 +138,100 @@ psyc_parse_remaining_length (PsycParseState *state);
 extern inline const char *
 psyc_parse_remaining_buffer (PsycParseState *state);
 
+PsycRC
+psyc_parse_struct_index (PsycParseStructIndex *idx,
+			 const char *buffer, size_t length)
+{
+    size_t i, words = PSYC_PARSE_STRUCT_WORDS(length);
+    char tail[64];
+
+    if (words > idx->size) {
+	idx->buffer = (PsycString) {0, NULL};
+	return PSYC_ERROR;
+    }
+
+    for (i = 0; i + 1 < words || (i < words && length % 64 == 0); i++)
+	scan_struct(buffer + 64 * i, &idx->nl[i], &idx->delim[i]);
+
+    if (i < words) { // incomplete last block, bits after the end are cleared
+	memset(tail, 0, sizeof(tail));
+	memcpy(tail, buffer + 64 * i, length % 64);
+	scan_struct(tail, &idx->nl[i], &idx->delim[i]);
+	idx->nl[i] &= ~(~0ULL << (length % 64));
+	idx->delim[i] &= ~(~0ULL << (length % 64));
+    }
+
+    idx->buffer = (PsycString) {length, (char*)buffer};
+    return PSYC_OK;
+}
+
+/**
+ * Continue a scan interrupted by the end of the buffer.
+ *
+ * Bytes of the current line that have already been scanned before returning
+ * PSYC_PARSE_INSUFFICIENT are not scanned again when the line is parsed with
+ * more data, this way a value trickling in is not rescanned from the start of
+ * its line with every new chunk.
+ *
+ * @param pos Start of the scan.
+ *
+ * @return Position where the scan should continue.
+ */
+static inline size_t
+parse_resume (PsycParseState *state, size_t pos)
+{
+    if (state->resume_at && pos - state->startc == state->resume_from
+	&& state->startc + state->resume_at <= state->buffer.length) {
+	pos = state->startc + state->resume_at;
+	state->resume_at = 0;
+    }
+    return pos;
+}
+
+/**
+ * Interrupt a scan at the end of the buffer, rewind to the start of the line
+ * and remember the progress for parse_resume().
+ *
+ * @param from Start of the scan.
+ * @param at Position where the scan continues when more data is available.
+ */
+static inline void
+parse_suspend (PsycParseState *state, size_t from, size_t at)
+{
+    state->resume_from = from - state->startc;
+    state->resume_at = at - state->startc;
+    state->cursor = state->startc;
+}
+
+/**
+ * Is the structural index usable for the current buffer?
+ */
+static inline PsycBool
+struct_indexed (PsycParseState *state)
+{
+    return state->flags & PSYC_PARSE_STRUCT_INDEX && state->sindex
+	&& state->sindex->buffer.data == state->buffer.data
+	&& state->sindex->buffer.length == state->buffer.length;
+}
+
+/**
+ * Find the next newline at or after pos.
+ *
+ * @return Position of the newline or the buffer length if there is none.
+ */
+static inline size_t
+parse_next_nl (PsycParseState *state, size_t pos)
+{
+    if (struct_indexed(state))
+	return struct_next(state->sindex->nl, pos, state->buffer.length);
+
+    if (pos >= state->buffer.length)
+	return state->buffer.length;
+
+    return pos + scan_char(state->buffer.data + pos,
+			   state->buffer.length - pos, '\n');
+}
+
 
 /**
  * Parse variable name or method name.
@@ -133,6 +254,54 @@ parse_keyword (ParseState *state, PsycString *name)
     return name->length > 0 ? PARSE_SUCCESS : PARSE_ERROR;
 }
 
+/**
+ * Parse variable name or method name in a packet.
+ *
+ * Same as parse_keyword(), but it uses the structural index if there's one and
+ * resumes after the last keyword character seen when more data arrives.
+ *
+ * @return PARSE_ERROR, PARSE_SUCCESS or PARSE_INSUFFICIENT
+ */
+static inline ParseRC
+parse_packet_keyword (PsycParseState *state, PsycString *name)
+{
+    size_t start = state->cursor, end = parse_resume(state, start), i;
+    uint32_t h = end > start ? state->keyword_hash : PSYC_MAP_HASH_INIT(0);
+
+    if (struct_indexed(state))
+	end = struct_next(state->sindex->delim, end, state->buffer.length);
+    else if (state->flags & PSYC_PARSE_INTERN)
+	// hash the keyword while looking for its end
+	while (end < state->buffer.length
+	       && psyc_is_kw_char(state->buffer.data[end]))
+	    h = PSYC_MAP_HASH_STEP(h, state->buffer.data[end++]);
+    else
+	while (end < state->buffer.length
+	       && psyc_is_kw_char(state->buffer.data[end]))
+	    end++;
+
+    if (state->flags & PSYC_PARSE_INTERN && struct_indexed(state))
+	// the index found the end, hash the keyword here
+	for (h = PSYC_MAP_HASH_INIT(0), i = start; i < end; i++)
+	    h = PSYC_MAP_HASH_STEP(h, state->buffer.data[i]);
+
+    if (end >= state->buffer.length) {
+	state->keyword_hash = h;
+	parse_suspend(state, start, end);
+	return PARSE_INSUFFICIENT;
+    }
+
+    name->data = state->buffer.data + start;
+    name->length = end - start;
+    state->cursor = end;
+
+    if (state->flags & PSYC_PARSE_INTERN)
+	state->keyword = name->length
+	    ? psyc_intern_lookup(name->data, name->length, h) : 0;
+
+    return name->length > 0 ? PARSE_SUCCESS : PARSE_ERROR;
+}
+
 /**
  * Parse length.
  *
@@ -215,7 +384,7 @@ parse_until (ParseState *state, const char end, PsycString *value)
  * @return PARSE_ERROR or PARSE_SUCCESS
  */
 #ifdef __INLINE_PSYC_PARSE
-inline
+static inline
 #endif
 ParseRC
 psyc_parse_modifier (PsycParseState *state, char *oper,
@@ -224,7 +393,7 @@ psyc_parse_modifier (PsycParseState *state, char *oper,
     *oper = *(state->buffer.data + state->cursor);
     ADVANCE_CURSOR_OR_RETURN(PSYC_PARSE_INSUFFICIENT);
 
-    ParseRC ret = parse_keyword((ParseState*)state, name);
+    ParseRC ret = parse_packet_keyword(state, name);
     if (ret == PARSE_ERROR)
 	return PSYC_PARSE_ERROR_MOD_NAME;
     else if (ret != PARSE_SUCCESS)
@@ -270,11 +439,14 @@ psyc_parse_modifier (PsycParseState *state, char *oper,
 	ADVANCE_CURSOR_OR_RETURN(PSYC_PARSE_INSUFFICIENT);
 	value->data = state->buffer.data + state->cursor;
 
-	while (state->buffer.data[state->cursor] != '\n') {
-	    value->length++;
-	    ADVANCE_CURSOR_OR_RETURN(PSYC_PARSE_INSUFFICIENT);
+	length = parse_next_nl(state, parse_resume(state, state->cursor));
+	if (length >= state->buffer.length) {
+	    parse_suspend(state, state->cursor, state->buffer.length);
+	    return PSYC_PARSE_INSUFFICIENT;
 	}
 
+	value->length = length - state->cursor;
+	state->cursor = length;
 	return PARSE_SUCCESS;
     } else
 	return PSYC_PARSE_ERROR_MOD_TAB;
@@ -310,6 +482,7 @@ psyc_parse (PsycParseState *state, char *oper,
 
     switch (state->part) {
     case PSYC_PART_RESET: // New packet starts here, reset state.
+	state->resume_at = 0;
 	state->value_parsed = 0;
 	state->valuelen = 0;
 	state->valuelen_found = 0;
@@ -439,7 +612,7 @@ psyc_parse (PsycParseState *state, char *oper,
 
     case PSYC_PART_METHOD:
 	pos = state->cursor;
-	ret = parse_keyword((ParseState*)state, name);
+	ret = parse_packet_keyword(state, name);
 
 	if (ret == PARSE_INSUFFICIENT)
 	    return ret;
@@ -462,6 +635,10 @@ psyc_parse (PsycParseState *state, char *oper,
 		ADVANCE_CURSOR_OR_RETURN(PSYC_PARSE_INSUFFICIENT);
 	    }
 	} else { // No method, which means the packet should end now.
+	    // there's no data either, the length of a modifier value is
+	    // not that of data
+	    state->valuelen_found = 0;
+	    state->valuelen = 0;
 	    state->part = PSYC_PART_END;
 	    state->startc = state->cursor;
 	    goto PSYC_PART_END;
@@ -474,7 +651,9 @@ psyc_parse (PsycParseState *state, char *oper,
 	value->length = 0;
 
 	if (state->contentlen_found) { // We know the length of the packet.
-	    if (!state->valuelen_found) { // start of data
+	    PsycBool first = !state->valuelen_found; // first part of the data?
+
+	    if (first) {
 		state->valuelen_found = 1;
 		state->valuelen = state->contentlen - state->content_parsed;
 		if (state->valuelen && !(state->flags & PSYC_PARSE_ROUTING_ONLY))
@@ -486,25 +665,27 @@ psyc_parse (PsycParseState *state, char *oper,
 		state->content_parsed += value->length;
 
 		if (ret == PARSE_INCOMPLETE)
-		    return state->value_parsed == value->length
-			? PSYC_PARSE_BODY_START : PSYC_PARSE_BODY_CONT;
+		    return first ? PSYC_PARSE_BODY_START : PSYC_PARSE_BODY_CONT;
 	    }
 
 	    state->part = PSYC_PART_END;
-	    return state->valuelen == value->length ?
-		PSYC_PARSE_BODY : PSYC_PARSE_BODY_END;
+	    return first ? PSYC_PARSE_BODY : PSYC_PARSE_BODY_END;
 	} else { // Search for the terminator.
 	    size_t datac = state->cursor; // start of data
 	    if (state->flags & PSYC_PARSE_ROUTING_ONLY) // in routing-only mode restart
 		state->startc = datac;			// from the start of data
 
+	    // continue after the data already searched
+	    state->cursor = parse_resume(state, datac);
+	    value->length = state->cursor - datac;
+
 	    while (1) {
 		uint8_t nl = state->buffer.data[state->cursor] == '\n';
 		// check for |\n if we're at the start of data or we have found a \n
 		if (state->cursor == datac || nl) {
 		    // incremented cursor inside length?
 		    if (state->cursor + 1 + nl >= state->buffer.length) {
-			state->cursor = state->startc;
+			parse_suspend(state, datac, state->cursor);
 			return PSYC_PARSE_INSUFFICIENT;
 		    }
 
@@ -520,8 +701,14 @@ psyc_parse (PsycParseState *state, char *oper,
 			return PSYC_PARSE_BODY;
 		    }
 		}
-		value->length++;
-		ADVANCE_CURSOR_OR_RETURN(PSYC_PARSE_INSUFFICIENT);
+		// only a \n can start the terminator, skip ahead to the next one
+		state->cursor = parse_next_nl(state, state->cursor + 1);
+		if (state->cursor >= state->buffer.length) {
+		    // the last byte is not a \n, continue after it
+		    parse_suspend(state, datac, state->buffer.length - 1);
+		    return PSYC_PARSE_INSUFFICIENT;
+		}
+		value->length = state->cursor - datac;
 	    }
 	}
 
@@ -558,6 +745,843 @@ psyc_parse (PsycParseState *state, char *oper,
     return PSYC_PARSE_ERROR; // should not be reached
 }
 
+/**
+ * Position in a chain of buffers.
+ */
+typedef struct {
+    size_t seg;		///< Buffer.
+    size_t off;		///< Offset in the buffer.
+    size_t n;		///< Bytes passed since the start of the line.
+} IovCursor;
+
+/**
+ * Return code for the buffer chain parser when psyc_parse()
+ * should continue from the new position.
+ */
+#define PARSE_IOV_CONTINUE 0
+
+/**
+ * Skip to the next non-empty buffer if the cursor is at the end of one.
+ */
+static inline void
+iov_norm (PsycParseIovState *state, IovCursor *c)
+{
+    while (c->seg < state->iovcnt && c->off >= state->iov[c->seg].length) {
+	c->off -= state->iov[c->seg].length;
+	c->seg++;
+    }
+}
+
+static inline void
+iov_skip (PsycParseIovState *state, IovCursor *c, size_t n)
+{
+    c->off += n;
+    c->n += n;
+    iov_norm(state, c);
+}
+
+/**
+ * @return The byte at the cursor or -1 at the end of the chain.
+ */
+static inline int
+iov_peek (PsycParseIovState *state, IovCursor *c)
+{
+    return c->seg < state->iovcnt
+	? (uint8_t)state->iov[c->seg].data[c->off] : -1;
+}
+
+/**
+ * Move the cursor to the next ch.
+ *
+ * @return PSYC_TRUE if found, PSYC_FALSE at the end of the chain.
+ */
+static inline PsycBool
+iov_scan (PsycParseIovState *state, IovCursor *c, char ch)
+{
+    const PsycString *b;
+    size_t i;
+
+    while (c->seg < state->iovcnt) {
+	b = &state->iov[c->seg];
+	i = scan_char(b->data + c->off, b->length - c->off, ch);
+	if (c->off + i < b->length) {
+	    c->off += i;
+	    c->n += i;
+	    return PSYC_TRUE;
+	}
+	iov_skip(state, c, b->length - c->off);
+    }
+    return PSYC_FALSE;
+}
+
+/**
+ * Continue parsing the chain from the position of the cursor.
+ */
+static inline void
+iov_seek (PsycParseIovState *state, size_t seg, size_t off)
+{
+    if (seg >= state->iovcnt) { // end of the chain
+	seg = state->iovcnt - 1;
+	off = state->iov[seg].length;
+    }
+
+    if (seg != state->seg || state->parser.buffer.data != state->iov[seg].data) {
+	state->seg = seg;
+	psyc_parse_buffer_set(&state->parser, state->iov[seg].data,
+			      state->iov[seg].length);
+    }
+    state->parser.cursor = state->parser.startc = off;
+}
+
+/**
+ * Parse a keyword in the chain, it's split in two if it spans two buffers.
+ * If it spans more, name[0] and name[1] are the parts in the first and the last
+ * buffer, and the buffers in between are kept for psyc_parse_iov_name_parts().
+ * With PSYC_PARSE_INTERN the keyword is looked up like in psyc_parse().
+ *
+ * @return PARSE_SUCCESS, PARSE_ERROR if there's no keyword or
+ *         PARSE_INSUFFICIENT.
+ */
+static inline ParseRC
+iov_keyword (PsycParseIovState *state, IovCursor *c, PsycString *name)
+{
+    IovCursor start = *c;
+    size_t len, first, seg;
+    uint32_t h = PSYC_MAP_HASH_INIT(0);
+    int ch;
+
+    while ((ch = iov_peek(state, c)) >= 0 && psyc_is_kw_char(ch)) {
+	h = PSYC_MAP_HASH_STEP(h, ch);
+	iov_skip(state, c, 1);
+    }
+
+    if (ch < 0)
+	return PARSE_INSUFFICIENT;
+
+    len = c->n - start.n;
+    if (state->parser.flags & PSYC_PARSE_INTERN)
+	state->parser.keyword = len
+	    ? psyc_intern_lookup_iov(&state->iov[start.seg], start.off, len, h)
+	    : 0;
+    if (!len)
+	return PARSE_ERROR;
+
+    first = state->iov[start.seg].length - start.off;
+    if (first >= len) {
+	name[0] = (PsycString) {len, (char*)state->iov[start.seg].data + start.off};
+	name[1] = (PsycString) {0, NULL};
+	return PARSE_SUCCESS;
+    }
+
+    // the last part ends at the cursor, or with the buffer before it
+    seg = c->seg;
+    if (!c->off)
+	while (!state->iov[--seg].length)
+	    ;
+
+    name[0] = (PsycString) {first, (char*)state->iov[start.seg].data + start.off};
+    name[1] = (PsycString) {c->off ? c->off : state->iov[seg].length,
+			    (char*)state->iov[seg].data};
+    state->name_seg = start.seg + 1;
+    state->name_segs = seg - start.seg - 1;
+    return PARSE_SUCCESS;
+}
+
+/**
+ * Return the next part of a value split across buffers.
+ */
+static PsycParseRC
+iov_piece (PsycParseIovState *state, PsycString *value)
+{
+    const PsycString *b = &state->iov[state->span_seg];
+    size_t n = b->length - state->span_off;
+    // *_CONT and *_END follow *_START
+    PsycParseRC ret = state->parser.value_parsed
+	? state->span_rc + 1 : state->span_rc;
+
+    if (n >= state->span_left) {
+	n = state->span_left;
+	ret = state->span_rc + 2;
+    }
+
+    *value = (PsycString) {n, (char*)b->data + state->span_off};
+    state->parser.value_parsed += n;
+    state->span_left -= n;
+
+    if (state->span_left) {
+	IovCursor c = {state->span_seg, state->span_off + n, 0};
+	iov_norm(state, &c);
+	state->span_seg = c.seg;
+	state->span_off = c.off;
+    } else { // values without length don't leave a length behind
+	state->parser.valuelen = state->parser.value_parsed = 0;
+	iov_seek(state, state->next_seg, state->next_off);
+    }
+
+    return ret;
+}
+
+/**
+ * Return a value of the chain, in parts if it spans more than one buffer.
+ *
+ * @param start Start of the value.
+ * @param len Length of the value.
+ * @param next Position where parsing continues after the value.
+ * @param rc Return code for a value in one piece.
+ * @param rc_start Return code for the first part of a split value.
+ */
+static PsycParseRC
+iov_value (PsycParseIovState *state, IovCursor *start, size_t len,
+	   IovCursor *next, PsycParseRC rc, PsycParseRC rc_start,
+	   PsycString *value)
+{
+    if (!len || state->iov[start->seg].length - start->off >= len) {
+	*value = (PsycString) {len, len ? (char*)state->iov[start->seg].data
+			       + start->off : NULL};
+	iov_seek(state, next->seg, next->off);
+	return rc;
+    }
+
+    state->span_seg = start->seg;
+    state->span_off = start->off;
+    state->span_left = len;
+    state->span_rc = rc_start;
+    state->next_seg = next->seg;
+    state->next_off = next->off;
+    state->parser.valuelen = len;
+    state->parser.value_parsed = 0;
+
+    return iov_piece(state, value);
+}
+
+/**
+ * Parse a modifier line spanning more than one buffer.
+ *
+ * @param rc PSYC_PARSE_ROUTING or PSYC_PARSE_ENTITY
+ */
+static PsycParseRC
+iov_modifier (PsycParseIovState *state, IovCursor *c, char *oper,
+	      PsycString *name, PsycString *value, PsycParseRC rc)
+{
+    PsycParseState *p = &state->parser;
+    IovCursor v;
+    size_t len = 0;
+    int ch;
+
+    *oper = iov_peek(state, c);
+    iov_skip(state, c, 1);
+
+    switch (iov_keyword(state, c, name)) {
+    case PARSE_SUCCESS:
+	break;
+    case PARSE_INSUFFICIENT:
+	return PSYC_PARSE_INSUFFICIENT;
+    default:
+	return PSYC_PARSE_ERROR_MOD_NAME;
+    }
+
+    p->valuelen = 0;
+    p->valuelen_found = 0;
+    p->value_parsed = 0;
+
+    ch = iov_peek(state, c);
+    if (p->part == PSYC_PART_CONTENT && ch == ' ') { // binary arg
+	iov_skip(state, c, 1);
+	if ((ch = iov_peek(state, c)) < 0)
+	    return PSYC_PARSE_INSUFFICIENT;
+	if (!psyc_is_numeric(ch))
+	    return PSYC_PARSE_ERROR_MOD_LEN;
+
+	do {
+	    len = 10 * len + ch - '0';
+	    iov_skip(state, c, 1);
+	    if ((ch = iov_peek(state, c)) < 0)
+		return PSYC_PARSE_INSUFFICIENT;
+	} while (psyc_is_numeric(ch));
+
+	if (ch != '\t')
+	    return PSYC_PARSE_ERROR_MOD_TAB;
+	iov_skip(state, c, 1);
+
+	p->valuelen_found = 1;
+	p->valuelen = len;
+
+	if (!len) {
+	    *value = (PsycString) {0, NULL};
+	    iov_seek(state, c->seg, c->off);
+	    return rc;
+	}
+	if (c->seg >= state->iovcnt) { // value starts in the next chain
+	    *value = (PsycString) {0, NULL};
+	    iov_seek(state, c->seg, c->off);
+	    return PSYC_PARSE_ENTITY_START;
+	}
+
+	// the first part, psyc_parse() continues with the rest
+	*value = (PsycString) {state->iov[c->seg].length - c->off,
+			       (char*)state->iov[c->seg].data + c->off};
+	if (value->length >= len) {
+	    value->length = len;
+	    rc = PSYC_PARSE_ENTITY;
+	} else
+	    rc = PSYC_PARSE_ENTITY_START;
+
+	p->value_parsed = value->length;
+	iov_skip(state, c, value->length);
+	iov_seek(state, c->seg, c->off);
+	return rc;
+    }
+
+    if (ch != '\t')
+	return PSYC_PARSE_ERROR_MOD_TAB;
+    iov_skip(state, c, 1);
+
+    v = *c;
+    if (!iov_scan(state, c, '\n'))
+	return PSYC_PARSE_INSUFFICIENT;
+
+    return iov_value(state, &v, c->n - v.n, c, rc, rc == PSYC_PARSE_ROUTING
+		     ? PSYC_PARSE_ROUTING_START : PSYC_PARSE_ENTITY_START, value);
+}
+
+/**
+ * Search for the end of a body without length in the chain.
+ */
+static PsycParseRC
+iov_data (PsycParseIovState *state, IovCursor *c, PsycString *value)
+{
+    PsycParseState *p = &state->parser;
+    IovCursor datac = *c, d;
+    size_t len;
+    int ch, nl;
+
+    while (1) {
+	if ((ch = iov_peek(state, c)) < 0)
+	    return PSYC_PARSE_INSUFFICIENT;
+
+	nl = ch == '\n';
+	// check for |\n if we're at the start of data or we have found a \n
+	if (c->n == datac.n || nl) {
+	    d = *c;
+	    iov_skip(state, &d, nl);
+	    ch = iov_peek(state, &d);
+	    iov_skip(state, &d, 1);
+	    if (ch < 0 || iov_peek(state, &d) < 0)
+		return PSYC_PARSE_INSUFFICIENT;
+
+	    if (ch == '|' && iov_peek(state, &d) == '\n')
+		break;
+	}
+
+	iov_skip(state, c, 1);
+	if (!iov_scan(state, c, '\n'))
+	    return PSYC_PARSE_INSUFFICIENT;
+    }
+
+    len = c->n - datac.n;
+    if (p->flags & PSYC_PARSE_ROUTING_ONLY)
+	len++;
+
+    p->content_parsed += c->n;
+    iov_skip(state, c, nl);
+    p->part = PSYC_PART_END;
+
+    return iov_value(state, &datac, len, c,
+		     PSYC_PARSE_BODY, PSYC_PARSE_BODY_START, value);
+}
+
+/**
+ * Parse the line at a buffer boundary, following the same steps as
+ * psyc_parse() but reading from the chain.
+ *
+ * @return PSYC_PARSE_INSUFFICIENT if the line doesn't end in the chain,
+ *         PARSE_IOV_CONTINUE if psyc_parse() should continue
+ *         or a return code of psyc_parse_iov().
+ */
+static PsycParseRC
+iov_seam (PsycParseIovState *state, char *oper,
+	  PsycString *name, PsycString *value)
+{
+    PsycParseState *p = &state->parser;
+    IovCursor c = {state->seg, p->cursor, 0}, d;
+    PsycParseRC ret;
+    size_t len = 0;
+    int ch;
+
+    p->resume_at = 0;
+    iov_norm(state, &c);
+
+    switch (p->part) {
+    case PSYC_PART_ROUTING:
+	if (p->routinglen > 0) {
+	    if (iov_peek(state, &c) != '\n')
+		return PSYC_PARSE_ERROR_MOD_NL;
+	    iov_skip(state, &c, 1);
+	}
+
+	if ((ch = iov_peek(state, &c)) < 0)
+	    return PSYC_PARSE_INSUFFICIENT;
+
+	if (psyc_is_oper(ch)) {
+	    ret = iov_modifier(state, &c, oper, name, value, PSYC_PARSE_ROUTING);
+	    if (ret == PSYC_PARSE_ROUTING || ret == PSYC_PARSE_ROUTING_START)
+		p->routinglen += c.n;
+	    return ret;
+	}
+
+	p->part = PSYC_PART_LENGTH;
+	iov_seek(state, c.seg, c.off);
+	return PARSE_IOV_CONTINUE;
+
+    case PSYC_PART_LENGTH:
+	while ((ch = iov_peek(state, &c)) >= 0 && psyc_is_numeric(ch)) {
+	    len = 10 * len + ch - '0';
+	    iov_skip(state, &c, 1);
+	}
+	if (ch < 0)
+	    return PSYC_PARSE_INSUFFICIENT;
+
+	if (c.n) {
+	    p->contentlen_found = 1;
+	    p->contentlen = len;
+	}
+
+	if (ch == '\n') {
+	    iov_skip(state, &c, 1);
+	    p->part = p->flags & PSYC_PARSE_ROUTING_ONLY
+		? PSYC_PART_DATA : PSYC_PART_CONTENT;
+	} else if (p->contentlen_found)
+	    return PSYC_PARSE_ERROR_LENGTH;
+	else
+	    p->part = PSYC_PART_END;
+
+	iov_seek(state, c.seg, c.off);
+	return PARSE_IOV_CONTINUE;
+
+    case PSYC_PART_CONTENT:
+	if (p->content_parsed > 0) {
+	    if (iov_peek(state, &c) != '\n')
+		return PSYC_PARSE_ERROR_MOD_NL;
+	    iov_skip(state, &c, 1);
+	}
+
+	if ((ch = iov_peek(state, &c)) < 0)
+	    return PSYC_PARSE_INSUFFICIENT;
+
+	if (psyc_is_oper(ch)) {
+	    if (p->content_parsed == 0) {
+		d = c;
+		iov_skip(state, &d, 1);
+		if ((ch = iov_peek(state, &d)) < 0)
+		    return PSYC_PARSE_INSUFFICIENT;
+		if (ch == '\n') {
+		    *oper = iov_peek(state, &c);
+		    iov_seek(state, d.seg, d.off);
+		    switch (*oper) {
+		    case PSYC_STATE_RESYNC:
+			p->content_parsed++;
+			return PSYC_PARSE_STATE_RESYNC;
+		    case PSYC_STATE_RESET:
+			p->content_parsed++;
+			return PSYC_PARSE_STATE_RESET;
+		    default:
+			return PSYC_PARSE_ERROR_MOD_NAME;
+		    }
+		}
+	    }
+
+	    ret = iov_modifier(state, &c, oper, name, value, PSYC_PARSE_ENTITY);
+	    if (ret == PSYC_PARSE_ENTITY || ret == PSYC_PARSE_ENTITY_START)
+		p->content_parsed += c.n;
+	    return ret;
+	}
+
+	p->content_parsed += c.n;
+	p->part = PSYC_PART_METHOD;
+	iov_seek(state, c.seg, c.off);
+	return PARSE_IOV_CONTINUE;
+
+    case PSYC_PART_METHOD:
+	switch (iov_keyword(state, &c, name)) {
+	case PARSE_SUCCESS:
+	    break;
+	case PARSE_INSUFFICIENT:
+	    return PSYC_PARSE_INSUFFICIENT;
+	case PARSE_ERROR: // no method, the packet should end now
+	    p->valuelen_found = 0;
+	    p->valuelen = 0;
+	    p->part = PSYC_PART_END;
+	    iov_seek(state, c.seg, c.off);
+	    return PARSE_IOV_CONTINUE;
+	default:
+	    return PSYC_PARSE_ERROR_METHOD;
+	}
+
+	if (iov_peek(state, &c) != '\n')
+	    return PSYC_PARSE_ERROR_METHOD;
+	iov_skip(state, &c, 1);
+
+	p->valuelen_found = 0;
+	p->value_parsed = 0;
+	p->valuelen = 0;
+
+	if (p->contentlen_found) {
+	    if (c.seg >= state->iovcnt) // parse the method again with the data
+		return PSYC_PARSE_INSUFFICIENT;
+	    p->content_parsed += c.n;
+	    p->part = PSYC_PART_DATA;
+	    iov_seek(state, c.seg, c.off);
+	    return PARSE_IOV_CONTINUE;
+	}
+	return iov_data(state, &c, value);
+
+    case PSYC_PART_DATA:
+	return iov_data(state, &c, value);
+
+    case PSYC_PART_END:
+	if (p->contentlen_found && p->valuelen_found
+	    && p->valuelen && !(p->flags & PSYC_PARSE_ROUTING_ONLY)) {
+	    p->valuelen = 0;
+	    p->valuelen_found = 0;
+
+	    if (iov_peek(state, &c) != '\n')
+		return PSYC_PARSE_ERROR_END;
+
+	    p->content_parsed++;
+	    iov_skip(state, &c, 1);
+	    iov_seek(state, c.seg, c.off);
+	}
+
+	d = c;
+	ch = iov_peek(state, &d);
+	iov_skip(state, &d, 1);
+	if (ch < 0 || iov_peek(state, &d) < 0)
+	    return PSYC_PARSE_INSUFFICIENT;
+
+	p->part = PSYC_PART_RESET;
+	if (ch == '|' && iov_peek(state, &d) == '\n') {
+	    iov_skip(state, &d, 1);
+	    iov_seek(state, d.seg, d.off);
+	    return PSYC_PARSE_COMPLETE;
+	}
+	return PSYC_PARSE_ERROR_END;
+
+    default:
+	return PSYC_PARSE_ERROR;
+    }
+}
+
+PsycParseRC
+psyc_parse_iov (PsycParseIovState *state, char *oper,
+		PsycString *name, PsycString *value)
+{
+    PsycParseState *p = &state->parser;
+    PsycParseRC ret, start = 0;
+
+    if (state->span_left)
+	return iov_piece(state, value);
+
+    name[1] = (PsycString) {0, NULL};
+    state->name_segs = 0;
+
+    while (state->seg < state->iovcnt) {
+	ret = psyc_parse(p, oper, name, value);
+
+	if (start && ret != PSYC_PARSE_INSUFFICIENT)
+	    // the value started in this buffer: *_CONT is the first part,
+	    // *_END or BODY the whole value
+	    return ret == start + 1 ? start : start + 3;
+
+	if ((ret == PSYC_PARSE_ENTITY_START || ret == PSYC_PARSE_BODY_START)
+	    && !value->length && p->cursor >= p->buffer.length
+	    && state->seg + 1 < state->iovcnt) {
+	    // the value starts in the next buffer, don't return an empty part
+	    start = ret;
+	    iov_seek(state, state->seg + 1, 0);
+	    continue;
+	}
+
+	if (ret != PSYC_PARSE_INSUFFICIENT)
+	    return ret;
+
+	if (state->seg + 1 >= state->iovcnt)
+	    break;
+
+	if (p->cursor >= p->buffer.length) // continue with the next buffer
+	    iov_seek(state, state->seg + 1, 0);
+	else if ((ret = iov_seam(state, oper, name, value)) != PARSE_IOV_CONTINUE)
+	    return ret;
+    }
+
+    return start ? start : PSYC_PARSE_INSUFFICIENT;
+}
+
+int
+psyc_frame (const char *buffer, size_t length,
+	    PsycFrame *frames, size_t max, size_t *cursor)
+{
+    size_t n = 0, pos = 0, p, len;
+    uint8_t len_found;
+
+    while (n < max && pos < length) {
+	p = pos;
+
+	// routing header, each line starts with a glyph
+	while (p < length && psyc_is_oper(buffer[p]))
+	    p += scan_char(buffer + p, length - p, '\n') + 1;
+	if (p >= length)
+	    break;
+
+	// optional content length
+	len = 0;
+	len_found = 0;
+	while (p < length && psyc_is_numeric(buffer[p])) {
+	    if (len > (SIZE_MAX - 9) / 10)
+		goto error;
+	    len = 10 * len + buffer[p++] - '0';
+	    len_found = 1;
+	}
+	if (p >= length)
+	    break;
+
+	if (buffer[p] == '\n') { // start of content
+	    p++;
+	    if (len_found) {
+		if (len > length - p)
+		    break;
+		p += len;
+	    } else if (p + 1 >= length) {
+		break;
+	    } else if (buffer[p] != '|' || buffer[p + 1] != '\n') {
+		// search for the terminator, only a \n can start it
+		while (1) {
+		    p += scan_char(buffer + p, length - p, '\n');
+		    if (p + 2 >= length)
+			goto incomplete;
+		    if (buffer[p + 1] == '|' && buffer[p + 2] == '\n')
+			break;
+		    p++;
+		}
+		p++;
+	    }
+	} else if (len_found) // the length should've been followed by a \n
+	    goto error;
+
+	// end of packet
+	if (p + 1 >= length)
+	    break;
+	if (buffer[p] != '|' || buffer[p + 1] != '\n')
+	    goto error;
+
+	frames[n].start = pos;
+	frames[n].end = pos = p + 2;
+	n++;
+    }
+
+incomplete:
+    *cursor = pos;
+    return n;
+
+error:
+    *cursor = pos;
+    return n ? n : -1;
+}
+
+/**
+ * Get the slot for the next modifier of a header, growing the array
+ * in the arena when it's full.
+ *
+ * Arrays hold 8 modifiers at first and double in size when full,
+ * so the capacity follows from the number of lines.
+ */
+static inline PsycModifier *
+packet_modifier (PsycArena *arena, PsycHeader *header)
+{
+    size_t n = header->lines;
+    PsycModifier *m;
+
+    if (n == 0 || (n >= 8 && !(n & (n - 1)))) {
+	m = psyc_arena_grow(arena, header->modifiers, n * sizeof(PsycModifier),
+			    (n ? n * 2 : 8) * sizeof(PsycModifier));
+	if (!m)
+	    return NULL;
+	header->modifiers = m;
+    }
+    return &header->modifiers[n];
+}
+
+/**
+ * Append a part of a split value to dst, allocating length bytes for it
+ * in the arena for the first part.
+ */
+static inline PsycRC
+packet_append (PsycArena *arena, PsycString *dst, PsycString *part,
+	       size_t length)
+{
+    if (!part->length)
+	return PSYC_OK;
+    if (!dst->length) {
+	dst->data = psyc_arena_alloc(arena, length);
+	if (!dst->data)
+	    return PSYC_ERROR;
+    }
+    memcpy(dst->data + dst->length, part->data, part->length);
+    dst->length += part->length;
+    return PSYC_OK;
+}
+
+/**
+ * Copy a string to the arena if it points into the buffer.
+ */
+static inline PsycRC
+packet_pin (PsycArena *arena, PsycString *s, PsycString *buffer)
+{
+    char *p;
+
+    if (!s->length || s->data < buffer->data
+	|| s->data >= buffer->data + buffer->length)
+	return PSYC_OK;
+
+    p = psyc_arena_alloc(arena, s->length);
+    if (!p)
+	return PSYC_ERROR;
+    memcpy(p, s->data, s->length);
+    s->data = p;
+    return PSYC_OK;
+}
+
+/**
+ * Copy the strings of the packet that point into the current buffer to the
+ * arena, so that the caller can discard the parsed part of the buffer.
+ */
+static PsycRC
+packet_pin_all (PsycParseState *state, PsycArena *arena, PsycPacket *p)
+{
+    PsycString *buf = &state->buffer;
+    size_t i;
+
+    for (i = 0; i < p->routing.lines; i++)
+	if (packet_pin(arena, &p->routing.modifiers[i].name, buf) != PSYC_OK
+	    || packet_pin(arena, &p->routing.modifiers[i].value, buf) != PSYC_OK)
+	    return PSYC_ERROR;
+
+    for (i = 0; i < p->entity.lines; i++)
+	if (packet_pin(arena, &p->entity.modifiers[i].name, buf) != PSYC_OK
+	    || packet_pin(arena, &p->entity.modifiers[i].value, buf) != PSYC_OK)
+	    return PSYC_ERROR;
+
+    if (packet_pin(arena, &p->method, buf) != PSYC_OK
+	|| packet_pin(arena, &p->data, buf) != PSYC_OK)
+	return PSYC_ERROR;
+
+    return PSYC_OK;
+}
+
+PsycParseRC
+psyc_parse_packet (PsycParseState *state, PsycArena *arena, PsycPacket *packet)
+{
+    PsycModifier *mod;
+    PsycString name, value;
+    char oper;
+    PsycParseRC ret;
+
+    // a new packet starts here
+    if (state->part == PSYC_PART_RESET
+	|| (state->part == PSYC_PART_ROUTING && state->routinglen == 0)
+	|| (state->flags & PSYC_PARSE_START_AT_CONTENT
+	    && state->part == PSYC_PART_CONTENT && state->content_parsed == 0))
+	memset(packet, 0, sizeof(PsycPacket));
+
+    for (;;) {
+	oper = 0;
+	name = value = (PsycString) {0, NULL};
+	ret = psyc_parse(state, &oper, &name, &value);
+
+	switch (ret) {
+	case PSYC_PARSE_ROUTING:
+	    mod = packet_modifier(arena, &packet->routing);
+	    if (!mod)
+		return PSYC_PARSE_ERROR;
+	    *mod = PSYC_MODIFIER(oper, name, value, PSYC_MODIFIER_ROUTING);
+	    packet->routing.lines++;
+	    break;
+
+	case PSYC_PARSE_STATE_RESYNC:
+	case PSYC_PARSE_STATE_RESET:
+	    packet->stateop = oper;
+	    break;
+
+	case PSYC_PARSE_ENTITY_START:
+	case PSYC_PARSE_ENTITY:
+	    mod = packet_modifier(arena, &packet->entity);
+	    if (!mod)
+		return PSYC_PARSE_ERROR;
+	    *mod = PSYC_MODIFIER(oper, name, value,
+				 state->valuelen_found
+				 ? PSYC_MODIFIER_NEED_LENGTH
+				 : PSYC_MODIFIER_NO_LENGTH);
+	    if (ret == PSYC_PARSE_ENTITY) {
+		packet->entity.lines++;
+		break;
+	    }
+	    // the rest of the value is in the next buffer
+	    mod->value.length = 0;
+	    if (packet_pin(arena, &mod->name, &state->buffer) != PSYC_OK
+		|| packet_append(arena, &mod->value, &value,
+				 state->valuelen) != PSYC_OK)
+		return PSYC_PARSE_ERROR;
+	    break;
+
+	case PSYC_PARSE_ENTITY_CONT:
+	case PSYC_PARSE_ENTITY_END:
+	    mod = &packet->entity.modifiers[packet->entity.lines];
+	    if (packet_append(arena, &mod->value, &value,
+			      state->valuelen) != PSYC_OK)
+		return PSYC_PARSE_ERROR;
+	    if (ret == PSYC_PARSE_ENTITY_END)
+		packet->entity.lines++;
+	    break;
+
+	case PSYC_PARSE_BODY:
+	    packet->method = name;
+	    packet->data = value;
+	    break;
+
+	case PSYC_PARSE_BODY_START:
+	    packet->method = name;
+	    if (packet_pin(arena, &packet->method, &state->buffer) != PSYC_OK)
+		return PSYC_PARSE_ERROR;
+	    // fall thru
+	case PSYC_PARSE_BODY_CONT:
+	case PSYC_PARSE_BODY_END:
+	    if (packet_append(arena, &packet->data, &value,
+			      state->valuelen) != PSYC_OK)
+		return PSYC_PARSE_ERROR;
+	    break;
+
+	case PSYC_PARSE_COMPLETE:
+	    packet->flag = state->contentlen_found
+		? PSYC_PACKET_NEED_LENGTH : PSYC_PACKET_NO_LENGTH;
+
+	    if (state->flags & PSYC_PARSE_ROUTING_ONLY) {
+		packet->content = packet->data;
+		packet->data = (PsycString) {0, NULL};
+	    }
+
+	    psyc_packet_length_set(packet);
+	    return ret;
+
+	case PSYC_PARSE_INSUFFICIENT:
+	    if (packet_pin_all(state, arena, packet) != PSYC_OK)
+		return PSYC_PARSE_ERROR;
+	    return ret;
+
+	default:
+	    return ret;
+	}
+    }
+}
+
 /**
  * Parse list.
  *
@@ -1117,6 +2141,7 @@ psyc_parse_update (PsycParseUpdateState *state, char *oper, PsycString *value)
 	    if (state->buffer.data[state->cursor] != ' ')
 		return ret;
 	    state->part = PSYC_PARSE_UPDATE_TYPE;
+	    state->elemlen_found = 0; // not the length of a dict index
 	    value->length = 0;
 	    value->data = NULL;
 	    ADVANCE_STARTC_OR_RETURN(PSYC_PARSE_UPDATE_INSUFFICIENT);
@@ -24,6 +24,16 @@
 #include <psyc/packet.h>
 #include <psyc/render.h>
 
+extern inline void
+psyc_render_state_init (PsycRenderState *state, PsycPacket *packet,
+			char *buffer, size_t buflen);
+
+extern inline void
+psyc_render_buffer_set (PsycRenderState *state, char *buffer, size_t length);
+
+extern inline size_t
+psyc_render_bytes_written (PsycRenderState *state);
+
 inline PsycRenderRC
 psyc_render_elem (PsycElem *elem, char *buffer, size_t buflen)
 {
@@ -41,7 +51,7 @@ psyc_render_elem (PsycElem *elem, char *buffer, size_t buflen)
     if (elem->value.length && !(elem->flag & PSYC_ELEM_NO_LENGTH)) {
 	if (elem->type.length)
 	    buffer[cur++] = ':';
-	cur += itoa(elem->value.length, buffer + cur, 10);
+	cur += psyc_num_render(elem->value.length, buffer + cur);
     }
 
     if (elem->value.length) {
@@ -64,7 +74,7 @@ psyc_render_dict_key (PsycDictKey *elem, char *buffer, size_t buflen)
 	return PSYC_RENDER_ERROR;
 
     if (elem->value.length && !(elem->flag & PSYC_ELEM_NO_LENGTH))
-	cur += itoa(elem->value.length, buffer + cur, 10);
+	cur += psyc_num_render(elem->value.length, buffer + cur);
 
     if (elem->value.length) {
 	buffer[cur++] = ' ';
@@ -152,7 +162,7 @@ psyc_render_modifier (PsycModifier *mod, char *buffer)
 	&& (mod->flag & PSYC_MODIFIER_NEED_LENGTH
 	    || mod->flag == PSYC_MODIFIER_CHECK_LENGTH)) {
 	buffer[cur++] = ' ';
-	cur += itoa(mod->value.length, buffer + cur, 10);
+	cur += psyc_num_render(mod->value.length, buffer + cur);
     }
 
     buffer[cur++] = '\t';
@@ -184,7 +194,7 @@ psyc_render (PsycPacket *p, char *buffer, size_t buflen)
 
     // add length if needed
     if (p->contentlen && !(p->flag & PSYC_PACKET_NO_LENGTH))
-	cur += itoa(p->contentlen, buffer + cur, 10);
+	cur += psyc_num_render(p->contentlen, buffer + cur);
 
     if (p->contentlen)
 	buffer[cur++] = '\n'; // start of content part if there's content or length
@@ -224,3 +234,506 @@ psyc_render (PsycPacket *p, char *buffer, size_t buflen)
     ASSERT(cur == p->length);
     return PSYC_RENDER_SUCCESS;
 }
+
+/**
+ * I/O vector being filled by psyc_render_iov().
+ */
+typedef struct {
+    struct iovec *iov;
+    size_t iovmax;
+    size_t iovcnt;
+    char *scratch;
+    size_t scratchlen;
+    size_t used;
+} RenderIov;
+
+/**
+ * Reserve len bytes in the scratch buffer, extending the last entry if it
+ * ends where they start.
+ *
+ * @return Pointer to the bytes reserved, or NULL if there's no room.
+ */
+static inline char *
+render_iov_reserve (RenderIov *r, size_t len)
+{
+    char *p = r->scratch + r->used;
+    struct iovec *last = r->iovcnt ? &r->iov[r->iovcnt - 1] : NULL;
+
+    if (len > r->scratchlen - r->used)
+	return NULL;
+
+    if (last && (char*)last->iov_base + last->iov_len == p)
+	last->iov_len += len;
+    else if (r->iovcnt < r->iovmax)
+	r->iov[r->iovcnt++] = (struct iovec) {p, len};
+    else
+	return NULL;
+
+    r->used += len;
+    return p;
+}
+
+static inline PsycRC
+render_iov_copy (RenderIov *r, const char *s, size_t len)
+{
+    char *p;
+
+    if (!len)
+	return PSYC_OK;
+    if (!(p = render_iov_reserve(r, len)))
+	return PSYC_ERROR;
+    memcpy(p, s, len);
+    return PSYC_OK;
+}
+
+static inline PsycRC
+render_iov_char (RenderIov *r, char c)
+{
+    char *p = render_iov_reserve(r, 1);
+
+    if (!p)
+	return PSYC_ERROR;
+    *p = c;
+    return PSYC_OK;
+}
+
+static inline PsycRC
+render_iov_num (RenderIov *r, size_t n)
+{
+    char *p = render_iov_reserve(r, psyc_num_length(n));
+
+    if (!p)
+	return PSYC_ERROR;
+    psyc_num_render(n, p);
+    return PSYC_OK;
+}
+
+/**
+ * Add a reference to a value, or copy it if it's short.
+ */
+static inline PsycRC
+render_iov_ref (RenderIov *r, const char *s, size_t len)
+{
+    if (len <= PSYC_RENDER_IOV_COPY_MAX)
+	return render_iov_copy(r, s, len);
+
+    if (r->iovcnt >= r->iovmax)
+	return PSYC_ERROR;
+    r->iov[r->iovcnt++] = (struct iovec) {(char*)s, len};
+    return PSYC_OK;
+}
+
+static inline PsycRenderRC
+render_iov_modifier (RenderIov *r, PsycModifier *mod)
+{
+    if (!mod->name.length)
+	return PSYC_RENDER_ERROR_MODIFIER_NAME_MISSING;
+
+    if (render_iov_char(r, mod->oper) != PSYC_OK
+	|| render_iov_copy(r, PSYC_S2ARG(mod->name)) != PSYC_OK)
+	return PSYC_RENDER_ERROR;
+
+    if (mod->value.length
+	&& (mod->flag & PSYC_MODIFIER_NEED_LENGTH
+	    || mod->flag == PSYC_MODIFIER_CHECK_LENGTH)
+	&& (render_iov_char(r, ' ') != PSYC_OK
+	    || render_iov_num(r, mod->value.length) != PSYC_OK))
+	return PSYC_RENDER_ERROR;
+
+    if (render_iov_char(r, '\t') != PSYC_OK
+	|| render_iov_ref(r, PSYC_S2ARG(mod->value)) != PSYC_OK
+	|| render_iov_char(r, '\n') != PSYC_OK)
+	return PSYC_RENDER_ERROR;
+
+    return PSYC_RENDER_SUCCESS;
+}
+
+PsycRenderRC
+psyc_render_iov (PsycPacket *p, struct iovec *iov, size_t *iovcnt,
+		 char *scratch, size_t scratchlen)
+{
+    RenderIov r = {iov, *iovcnt, 0, scratch, scratchlen, 0};
+    PsycRenderRC ret;
+    size_t i;
+
+    *iovcnt = 0;
+
+    // render routing modifiers
+    for (i = 0; i < p->routing.lines; i++)
+	if ((ret = render_iov_modifier(&r, &p->routing.modifiers[i]))
+	    != PSYC_RENDER_SUCCESS)
+	    return ret;
+
+    // add length if needed
+    if (p->contentlen && !(p->flag & PSYC_PACKET_NO_LENGTH)
+	&& render_iov_num(&r, p->contentlen) != PSYC_OK)
+	return PSYC_RENDER_ERROR;
+
+    // start of content part if there's content or length
+    if (p->contentlen && render_iov_char(&r, '\n') != PSYC_OK)
+	return PSYC_RENDER_ERROR;
+
+    if (p->content.length) { // reference raw content if present
+	if (render_iov_ref(&r, PSYC_S2ARG(p->content)) != PSYC_OK)
+	    return PSYC_RENDER_ERROR;
+    } else {
+	if (p->stateop && (render_iov_char(&r, p->stateop) != PSYC_OK
+			   || render_iov_char(&r, '\n') != PSYC_OK))
+	    return PSYC_RENDER_ERROR;
+
+	// render entity modifiers
+	for (i = 0; i < p->entity.lines; i++)
+	    if ((ret = render_iov_modifier(&r, &p->entity.modifiers[i]))
+		!= PSYC_RENDER_SUCCESS)
+		return ret;
+
+	if (p->method.length) { // add method\n
+	    if (render_iov_copy(&r, PSYC_S2ARG(p->method)) != PSYC_OK
+		|| render_iov_char(&r, '\n') != PSYC_OK)
+		return PSYC_RENDER_ERROR;
+
+	    if (p->data.length // add data\n
+		&& (render_iov_ref(&r, PSYC_S2ARG(p->data)) != PSYC_OK
+		    || render_iov_char(&r, '\n') != PSYC_OK))
+		return PSYC_RENDER_ERROR;
+	} else if (p->data.length) // error, we have data but no modifier
+	    return PSYC_RENDER_ERROR_METHOD_MISSING;
+    }
+
+    // add packet delimiter
+    if (render_iov_char(&r, PSYC_PACKET_DELIMITER_CHAR) != PSYC_OK
+	|| render_iov_char(&r, '\n') != PSYC_OK)
+	return PSYC_RENDER_ERROR;
+
+    *iovcnt = r.iovcnt;
+    return PSYC_RENDER_SUCCESS;
+}
+
+/**
+ * Check the packet before psyc_render_stream() writes anything.
+ */
+static PsycRenderRC
+render_stream_check (PsycPacket *p)
+{
+    size_t i;
+
+    for (i = 0; i < p->routing.lines; i++)
+	if (!p->routing.modifiers[i].name.length)
+	    return PSYC_RENDER_ERROR_MODIFIER_NAME_MISSING;
+
+    if (p->content.length)
+	return PSYC_RENDER_SUCCESS;
+
+    for (i = 0; i < p->entity.lines; i++)
+	if (!p->entity.modifiers[i].name.length)
+	    return PSYC_RENDER_ERROR_MODIFIER_NAME_MISSING;
+
+    if (!p->method.length && p->data.length)
+	return PSYC_RENDER_ERROR_METHOD_MISSING;
+
+    return PSYC_RENDER_SUCCESS;
+}
+
+/**
+ * Get the field of the packet at the current position of the state.
+ *
+ * Fields are rendered to tmp if they're not in the packet as is,
+ * the field is empty if there's nothing to render at this position.
+ *
+ * @return PSYC_FALSE if there are no more fields in the current part.
+ */
+static PsycBool
+render_stream_field (PsycRenderState *st, PsycString *field, char *tmp)
+{
+    PsycPacket *p = st->packet;
+    PsycHeader *header;
+    PsycModifier *mod;
+
+    *field = (PsycString) {0, NULL};
+
+    switch (st->part) {
+    case PSYC_RENDER_PART_ROUTING:
+    case PSYC_RENDER_PART_ENTITY:
+	header = st->part == PSYC_RENDER_PART_ROUTING ? &p->routing : &p->entity;
+	if (st->elem >= header->lines
+	    || (st->part == PSYC_RENDER_PART_ENTITY && p->content.length))
+	    return PSYC_FALSE;
+
+	mod = &header->modifiers[st->elem];
+	switch (st->field) {
+	case 0:
+	    *field = (PsycString) {1, &mod->oper};
+	    break;
+	case 1:
+	    *field = mod->name;
+	    break;
+	case 2: // SP length TAB
+	    field->data = tmp;
+	    if (mod->value.length
+		&& (mod->flag & PSYC_MODIFIER_NEED_LENGTH
+		    || mod->flag == PSYC_MODIFIER_CHECK_LENGTH)) {
+		tmp[field->length++] = ' ';
+		field->length += psyc_num_render(mod->value.length, tmp + 1);
+	    }
+	    tmp[field->length++] = '\t';
+	    break;
+	case 3:
+	    *field = mod->value;
+	    break;
+	case 4:
+	    *field = PSYC_C2STR("\n");
+	    break;
+	default:
+	    return PSYC_FALSE;
+	}
+	return PSYC_TRUE;
+
+    case PSYC_RENDER_PART_LENGTH:
+	if (st->field > 0)
+	    return PSYC_FALSE;
+	field->data = tmp;
+	if (p->contentlen && !(p->flag & PSYC_PACKET_NO_LENGTH))
+	    field->length = psyc_num_render(p->contentlen, tmp);
+	if (p->contentlen)
+	    tmp[field->length++] = '\n';
+	return PSYC_TRUE;
+
+    case PSYC_RENDER_PART_CONTENT:
+	if (st->field > 0)
+	    return PSYC_FALSE;
+	*field = p->content;
+	return PSYC_TRUE;
+
+    case PSYC_RENDER_PART_STATEOP:
+	if (st->field > 0 || p->content.length)
+	    return PSYC_FALSE;
+	if (p->stateop) {
+	    tmp[0] = p->stateop;
+	    tmp[1] = '\n';
+	    *field = (PsycString) {2, tmp};
+	}
+	return PSYC_TRUE;
+
+    case PSYC_RENDER_PART_BODY:
+	if (st->field > 3 || p->content.length || !p->method.length)
+	    return PSYC_FALSE;
+	switch (st->field) {
+	case 0:
+	    *field = p->method;
+	    break;
+	case 2:
+	    *field = p->data;
+	    break;
+	case 3:
+	    if (!p->data.length)
+		break;
+	    // fall thru
+	case 1:
+	    *field = PSYC_C2STR("\n");
+	}
+	return PSYC_TRUE;
+
+    case PSYC_RENDER_PART_END:
+	if (st->field > 0)
+	    return PSYC_FALSE;
+	*field = PSYC_C2STR("|\n");
+	return PSYC_TRUE;
+
+    default:
+	return PSYC_FALSE;
+    }
+}
+
+PsycRenderRC
+psyc_render_stream (PsycRenderState *st)
+{
+    PsycString field;
+    PsycRenderRC ret;
+    char tmp[32];
+    size_t len;
+
+    if (st->part == PSYC_RENDER_PART_ROUTING && !st->elem && !st->field
+	&& !st->offset && (ret = render_stream_check(st->packet))
+	!= PSYC_RENDER_SUCCESS)
+	return ret;
+
+    while (st->part != PSYC_RENDER_PART_DONE) {
+	if (!render_stream_field(st, &field, tmp)) {
+	    st->part++;
+	    st->elem = 0;
+	    st->field = 0;
+	    continue;
+	}
+
+	len = field.length - st->offset;
+	if (len > st->buffer.length - st->written) {
+	    len = st->buffer.length - st->written;
+	    memcpy(st->buffer.data + st->written, field.data + st->offset, len);
+	    st->written += len;
+	    st->offset += len;
+	    return PSYC_RENDER_INCOMPLETE;
+	}
+
+	memcpy(st->buffer.data + st->written, field.data + st->offset, len);
+	st->written += len;
+	st->offset = 0;
+
+	if (++st->field > 4 && (st->part == PSYC_RENDER_PART_ROUTING
+				|| st->part == PSYC_RENDER_PART_ENTITY)) {
+	    st->field = 0;
+	    st->elem++;
+	}
+    }
+
+    return PSYC_RENDER_SUCCESS;
+}
+
+PsycRenderRC
+psyc_render_content (PsycPacket *p, char *buffer, size_t buflen,
+		     PsycString *content)
+{
+    PsycPacket packet = *p;
+    PsycRenderRC ret;
+
+    // the content part is rendered as a packet without routing
+    packet.routing.lines = 0;
+    psyc_packet_length_set(&packet);
+    ret = psyc_render(&packet, buffer, buflen);
+    if (ret == PSYC_RENDER_SUCCESS)
+	*content = (PsycString) {packet.length, buffer};
+    return ret;
+}
+
+/**
+ * Render a routing header.
+ *
+ * @return Length of the header, or 0 if it doesn't fit in the buffer
+ *         or a modifier has no name.
+ */
+static size_t
+render_routing (PsycHeader *routing, char *buffer, size_t buflen)
+{
+    size_t i, len, cur = 0;
+
+    for (i = 0; i < routing->lines; i++) {
+	len = psyc_modifier_length(&routing->modifiers[i]);
+	if (len > buflen - cur
+	    || psyc_render_modifier(&routing->modifiers[i], buffer + cur) <= 1)
+	    return 0;
+	cur += len;
+    }
+    return cur;
+}
+
+PsycRenderRC
+psyc_render_multicast (const PsycString *content,
+		       PsycHeader *routing, size_t count,
+		       char *buffer, size_t buflen, size_t *lengths)
+{
+    size_t i, len, cur = 0;
+
+    for (i = 0; i < count; i++) {
+	len = render_routing(&routing[i], buffer + cur, buflen - cur);
+	if (routing[i].lines && !len)
+	    return PSYC_RENDER_ERROR;
+	if (content->length > buflen - cur - len)
+	    return PSYC_RENDER_ERROR;
+
+	memcpy(buffer + cur + len, content->data, content->length);
+	lengths[i] = len + content->length;
+	cur += lengths[i];
+    }
+    return PSYC_RENDER_SUCCESS;
+}
+
+PsycRenderRC
+psyc_render_multicast_iov (const PsycString *content,
+			   PsycHeader *routing, size_t count,
+			   struct iovec *iov, size_t *iovcnt,
+			   char *scratch, size_t scratchlen)
+{
+    size_t i, len, n = 0, cur = 0;
+
+    for (i = 0; i < count; i++) {
+	len = render_routing(&routing[i], scratch + cur, scratchlen - cur);
+	if (routing[i].lines && !len)
+	    return PSYC_RENDER_ERROR;
+	if (n + 2 > *iovcnt)
+	    return PSYC_RENDER_ERROR;
+
+	if (len)
+	    iov[n++] = (struct iovec) {scratch + cur, len};
+	iov[n++] = (struct iovec) {content->data, content->length};
+	cur += len;
+    }
+
+    *iovcnt = n;
+    return PSYC_RENDER_SUCCESS;
+}
+
+PsycRenderRC
+psyc_render_proto_init (PsycRenderProto *proto, PsycPacket *p,
+			const size_t *vars, size_t nvars,
+			char *buffer, size_t buflen)
+{
+    PsycModifier mod;
+    PsycString content;
+    size_t i, v = 0, cur = 0, len;
+    PsycRenderRC ret;
+
+    if (nvars > PSYC_RENDER_PROTO_SLOTS)
+	return PSYC_RENDER_ERROR;
+
+    proto->nslots = nvars;
+
+    // render routing modifiers with the variable values left out
+    for (i = 0; i < p->routing.lines; i++) {
+	mod = p->routing.modifiers[i];
+	if (v < nvars && vars[v] == i)
+	    mod.value.length = 0;
+
+	len = psyc_modifier_length(&mod);
+	if (cur + len > buflen)
+	    return PSYC_RENDER_ERROR;
+	if (psyc_render_modifier(&mod, buffer + cur) <= 1)
+	    return PSYC_RENDER_ERROR_MODIFIER_NAME_MISSING;
+	cur += len;
+
+	if (v < nvars && vars[v] == i)
+	    proto->slots[v++] = cur - 1; // before the \n
+    }
+    if (v < nvars) // index out of range or not ascending
+	return PSYC_RENDER_ERROR;
+
+    ret = psyc_render_content(p, buffer + cur, buflen - cur, &content);
+    if (ret != PSYC_RENDER_SUCCESS)
+	return ret;
+
+    proto->buffer = (PsycString) {cur + content.length, buffer};
+    return PSYC_RENDER_SUCCESS;
+}
+
+PsycRenderRC
+psyc_render_proto (PsycRenderProto *proto, const PsycString *values,
+		   char *buffer, size_t buflen, size_t *length)
+{
+    size_t i, len = proto->buffer.length, prev = 0, cur = 0;
+
+    for (i = 0; i < proto->nslots; i++)
+	len += values[i].length;
+    if (len > buflen)
+	return PSYC_RENDER_ERROR;
+
+    for (i = 0; i < proto->nslots; i++) {
+	memcpy(buffer + cur, proto->buffer.data + prev, proto->slots[i] - prev);
+	cur += proto->slots[i] - prev;
+	memcpy(buffer + cur, values[i].data, values[i].length);
+	cur += values[i].length;
+	prev = proto->slots[i];
+    }
+    memcpy(buffer + cur, proto->buffer.data + prev,
+	   proto->buffer.length - prev);
+
+    *length = len;
+    return PSYC_RENDER_SUCCESS;
+}
@@ -0,0 +1,468 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+/**
+ * The routing tree has one level for each part of a uniform: scheme, host,
+ * port and transport, entity type, nick and channel. Parts a uniform doesn't
+ * have are empty keys, so a lookup walks at most six nodes and remembers the
+ * last one with a handler.
+ *
+ * Lookups don't take the lock. The children of a node are never changed in
+ * place, an update publishes a new array and retires the old one along with
+ * removed nodes. Lookups are counted by epoch: memory retired in one epoch
+ * waits for the next one to start, and it's freed by an update that finds no
+ * lookups of the previous epoch running, as the running ones started after it
+ * was replaced. New lookups count in the new epoch, so that happens while
+ * lookups keep running. Each thread has its own counter out of
+ * PSYC_ROUTE_READERS, so lookups in different threads don't write the same
+ * cache line.
+ */
+
+#include "lib.h"
+#include <stdlib.h>
+#include <psyc/route.h>
+
+#define PARTS 6
+#define NODE_KEY(n) ((char *)(n) + sizeof(PsycRouteNode))
+
+/** Number of parts of the uniform for each PsycRouteLevel. */
+static const uint8_t level_parts[] = {0, 2, 3, 5, 6};
+
+/** PsycRouteLevel of a route at the node of each part. */
+static const uint8_t part_level[PARTS] = {
+    PSYC_ROUTE_NONE, PSYC_ROUTE_HOST, PSYC_ROUTE_ROOT,
+    PSYC_ROUTE_NONE, PSYC_ROUTE_ENTITY, PSYC_ROUTE_CHANNEL,
+};
+
+/// Counter of the thread plus one, 0 until its first lookup.
+static __thread uint32_t reader_slot;
+static uint32_t reader_slots;
+
+static inline void
+routes_lock (PsycRoutes *routes)
+{
+    while (__atomic_test_and_set(&routes->lock, __ATOMIC_ACQUIRE))
+	;
+}
+
+static inline void
+routes_unlock (PsycRoutes *routes)
+{
+    __atomic_clear(&routes->lock, __ATOMIC_RELEASE);
+}
+
+/**
+ * Scheme and host are case-insensitive, their keys are stored in lowercase.
+ */
+static inline char
+part_fold (uint8_t depth, char c)
+{
+    return depth < 2 && c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+/**
+ * Get a part of a uniform.
+ */
+static PsycString
+uniform_part (const PsycUniform *uni, int i)
+{
+    uint8_t typed = uni->resource.length
+	&& psyc_entity_type(uni->resource.data[0]) != PSYC_ERROR;
+
+    switch (i) {
+    case 0:
+	return uni->scheme;
+    case 1:
+	return uni->host;
+    case 2: // after the colon
+	if (uni->host_port.length > uni->host.length)
+	    return PSYC_STRING(uni->host.data + uni->host.length + 1,
+			       uni->host_port.length - uni->host.length - 1);
+	return PSYC_STRING(NULL, 0);
+    case 3:
+	return PSYC_STRING(uni->resource.data, typed);
+    case 4:
+	return PSYC_STRING(uni->resource.data + typed,
+			   uni->resource.length - typed);
+    default:
+	return uni->channel;
+    }
+}
+
+/**
+ * Number of parts of a uniform to look up.
+ */
+static inline int
+uniform_parts (const PsycUniform *uni)
+{
+    if (uni->channel.length)
+	return level_parts[PSYC_ROUTE_CHANNEL];
+    if (uni->resource.length)
+	return level_parts[PSYC_ROUTE_ENTITY];
+    return level_parts[PSYC_ROUTE_ROOT];
+}
+
+static inline int
+key_cmp (const PsycRouteNode *node, const char *key, size_t len)
+{
+    size_t i;
+    char c;
+
+    if (node->key.length != len)
+	return node->key.length < len ? -1 : 1;
+    if (len == 0)
+	return 0;
+    if (node->depth >= 2)
+	return memcmp(node->key.data, key, len);
+
+    for (i = 0; i < len; i++)
+	if (node->key.data[i] != (c = part_fold(node->depth, key[i])))
+	    return (uint8_t)node->key.data[i] < (uint8_t)c ? -1 : 1;
+    return 0;
+}
+
+/**
+ * Binary search for a child.
+ *
+ * @return Index of the child, or where it would be inserted if not found.
+ */
+static size_t
+children_search (const PsycRouteChildren *children, PsycString key, int *found)
+{
+    size_t lo = 0, hi = children ? children->nchildren : 0, mid;
+    int c;
+
+    *found = 0;
+    while (lo < hi) {
+	mid = lo + (hi - lo) / 2;
+	c = key_cmp(children->children[mid], PSYC_S2ARG(key));
+	if (c == 0) {
+	    *found = 1;
+	    return mid;
+	}
+	if (c < 0)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo;
+}
+
+static inline PsycRouteNode *
+node_child (const PsycRouteNode *node, PsycString key)
+{
+    PsycRouteChildren *children = __atomic_load_n(&node->children,
+						  __ATOMIC_ACQUIRE);
+    int found;
+    size_t i = children_search(children, key, &found);
+
+    return found ? children->children[i] : NULL;
+}
+
+/**
+ * Make room for n more retired pointers, so that an update can't fail halfway.
+ */
+static int
+retired_reserve (PsycRoutes *routes, size_t n)
+{
+    size_t a = routes->retired_size ? routes->retired_size : 16;
+    void **p;
+
+    if (routes->nretired + n <= routes->retired_size)
+	return 0;
+    while (a < routes->nretired + n)
+	a *= 2;
+    p = realloc(routes->retired, a * sizeof(*routes->retired));
+    if (!p)
+	return -1;
+    routes->retired = p;
+    routes->retired_size = a;
+    return 0;
+}
+
+/**
+ * Free the memory waiting for the lookups of the previous epoch if they're
+ * done, and start a new epoch for the memory retired since, after an update.
+ */
+static void
+retired_free (PsycRoutes *routes)
+{
+    uint8_t prev = (routes->epoch + 1) & 1;
+    size_t i;
+
+    // order the publication of the new children before reading the counts
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (i = 0; i < PSYC_ROUTE_READERS; i++)
+	if (__atomic_load_n(&routes->readers[i].count[prev], __ATOMIC_SEQ_CST))
+	    return;
+
+    for (i = 0; i < routes->nwaiting; i++)
+	free(routes->retired[i]);
+    routes->nretired -= routes->nwaiting;
+    if (routes->nwaiting && routes->nretired)
+	memmove(routes->retired, routes->retired + routes->nwaiting,
+		routes->nretired * sizeof(*routes->retired));
+
+    // lookups starting from now on see the tree without these
+    routes->nwaiting = routes->nretired;
+    if (routes->nwaiting)
+	__atomic_store_n(&routes->epoch, routes->epoch + 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Count a lookup in the current epoch.
+ *
+ * @return The counter to decrement when the lookup is done.
+ */
+static inline uint32_t *
+reader_enter (PsycRoutes *routes)
+{
+    uint32_t slot = reader_slot, epoch, *count;
+
+    if (!slot)
+	slot = reader_slot = __atomic_add_fetch(&reader_slots, 1,
+						__ATOMIC_RELAXED);
+    for (;;) {
+	epoch = __atomic_load_n(&routes->epoch, __ATOMIC_SEQ_CST);
+	count = &routes->readers[slot % PSYC_ROUTE_READERS].count[epoch & 1];
+	__atomic_add_fetch(count, 1, __ATOMIC_SEQ_CST);
+	// an update that missed the count has started a new epoch
+	if (__atomic_load_n(&routes->epoch, __ATOMIC_SEQ_CST) == epoch)
+	    return count;
+	__atomic_sub_fetch(count, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * Publish the children of parent with the child at index i inserted,
+ * or removed if child is NULL.
+ */
+static int
+children_replace (PsycRoutes *routes, PsycRouteNode *parent, size_t i,
+		  PsycRouteNode *child)
+{
+    PsycRouteChildren *old = parent->children, *new = NULL;
+    size_t n = old ? old->nchildren : 0;
+
+    if (child || n > 1) {
+	n += child ? 1 : -1;
+	new = malloc(sizeof(PsycRouteChildren) + n * sizeof(*new->children));
+	if (!new)
+	    return -1;
+	new->nchildren = n;
+	if (i)
+	    memcpy(new->children, old->children, i * sizeof(*new->children));
+	if (child) {
+	    new->children[i] = child;
+	    if (n - i - 1)
+		memcpy(new->children + i + 1, old->children + i,
+		       (n - i - 1) * sizeof(*new->children));
+	} else
+	    memcpy(new->children + i, old->children + i + 1,
+		   (n - i) * sizeof(*new->children));
+    }
+
+    __atomic_store_n(&parent->children, new, __ATOMIC_RELEASE);
+    if (old)
+	routes->retired[routes->nretired++] = old;
+    return 0;
+}
+
+static PsycRouteNode *
+node_add (PsycRoutes *routes, PsycRouteNode *parent, PsycString key)
+{
+    PsycRouteNode *node;
+    uint8_t depth = parent == &routes->root ? 0 : parent->depth + 1;
+    int found;
+    size_t i = children_search(parent->children, key, &found), j;
+
+    if (found)
+	return parent->children->children[i];
+
+    node = calloc(1, sizeof(PsycRouteNode) + key.length);
+    if (!node)
+	return NULL;
+    for (j = 0; j < key.length; j++)
+	NODE_KEY(node)[j] = part_fold(depth, key.data[j]);
+    node->key = PSYC_STRING(NODE_KEY(node), key.length);
+    node->depth = depth;
+    node->parent = parent;
+
+    if (children_replace(routes, parent, i, node) != 0) {
+	free(node);
+	return NULL;
+    }
+    routes->nodes++;
+    return node;
+}
+
+/**
+ * Retire the nodes without a route and children from node upwards.
+ */
+static void
+node_prune (PsycRoutes *routes, PsycRouteNode *node)
+{
+    PsycRouteNode *parent;
+    int found;
+    size_t i;
+
+    while (node != &routes->root && !node->children && !node->handler) {
+	parent = node->parent;
+	i = children_search(parent->children, node->key, &found);
+	if (children_replace(routes, parent, i, NULL) != 0)
+	    return;
+	routes->retired[routes->nretired++] = node;
+	routes->nodes--;
+	node = parent;
+    }
+}
+
+static void
+node_free (PsycRouteNode *node)
+{
+    size_t i;
+
+    if (!node->children)
+	return;
+    for (i = 0; i < node->children->nchildren; i++) {
+	node_free(node->children->children[i]);
+	free(node->children->children[i]);
+    }
+    free(node->children);
+}
+
+/**
+ * Find the node of a route, the lock must be held.
+ */
+static PsycRouteNode *
+route_node (PsycRoutes *routes, const PsycUniform *uni, PsycRouteLevel level)
+{
+    PsycRouteNode *node = &routes->root;
+    int i;
+
+    for (i = 0; node && i < level_parts[level]; i++)
+	node = node_child(node, uniform_part(uni, i));
+    return node;
+}
+
+static inline int
+route_valid (const PsycUniform *uni, PsycRouteLevel level)
+{
+    return uni->valid && level > PSYC_ROUTE_NONE && level <= PSYC_ROUTE_CHANNEL
+	&& (level != PSYC_ROUTE_ENTITY || uni->resource.length)
+	&& (level != PSYC_ROUTE_CHANNEL || uni->channel.length);
+}
+
+void
+psyc_routes_init (PsycRoutes *routes)
+{
+    memset(routes, 0, sizeof(*routes));
+}
+
+void
+psyc_routes_free (PsycRoutes *routes)
+{
+    size_t i;
+
+    node_free(&routes->root);
+    for (i = 0; i < routes->nretired; i++)
+	free(routes->retired[i]);
+    free(routes->retired);
+    psyc_routes_init(routes);
+}
+
+PsycRC
+psyc_route_add (PsycRoutes *routes, const PsycUniform *uni,
+		PsycRouteLevel level, void *handler)
+{
+    PsycRouteNode *node = &routes->root;
+    PsycRC ret = PSYC_ERROR;
+    int i;
+
+    if (!handler || !route_valid(uni, level))
+	return PSYC_ERROR;
+
+    routes_lock(routes);
+    if (retired_reserve(routes, level_parts[level]) == 0) {
+	for (i = 0; node && i < level_parts[level]; i++)
+	    node = node_add(routes, node, uniform_part(uni, i));
+
+	if (node) {
+	    if (!node->handler)
+		routes->count++;
+	    __atomic_store_n(&node->handler, handler, __ATOMIC_RELEASE);
+	    ret = PSYC_OK;
+	}
+    }
+    retired_free(routes);
+    routes_unlock(routes);
+    return ret;
+}
+
+PsycRC
+psyc_route_remove (PsycRoutes *routes, const PsycUniform *uni,
+		   PsycRouteLevel level)
+{
+    PsycRouteNode *node;
+    PsycRC ret = PSYC_ERROR;
+
+    if (!route_valid(uni, level))
+	return PSYC_ERROR;
+
+    routes_lock(routes);
+    node = route_node(routes, uni, level);
+    if (node && node->handler && retired_reserve(routes, 2 * PARTS) == 0) {
+	__atomic_store_n(&node->handler, NULL, __ATOMIC_RELEASE);
+	routes->count--;
+	node_prune(routes, node);
+	ret = PSYC_OK;
+    }
+    retired_free(routes);
+    routes_unlock(routes);
+    return ret;
+}
+
+void *
+psyc_route_lookup (PsycRoutes *routes, const PsycUniform *uni,
+		   PsycRouteLevel *level)
+{
+    PsycRouteNode *node = &routes->root;
+    void *handler, *found = NULL;
+    uint32_t *readers;
+    int i, n = uni->valid ? uniform_parts(uni) : 0;
+
+    if (level)
+	*level = PSYC_ROUTE_NONE;
+
+    readers = reader_enter(routes);
+    for (i = 0; i < n; i++) {
+	if (!(node = node_child(node, uniform_part(uni, i))))
+	    break;
+	if (part_level[i] && (handler = __atomic_load_n(&node->handler,
+							__ATOMIC_ACQUIRE))) {
+	    found = handler;
+	    if (level)
+		*level = part_level[i];
+	}
+    }
+    __atomic_sub_fetch(readers, 1, __ATOMIC_RELEASE);
+
+    return found;
+}
@@ -0,0 +1,243 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+/* byte scanning helpers, this is needed to compile the library, not to use it */
+
+#ifndef PSYC_SCAN_H
+# define PSYC_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) && defined(__AVX2__)
+# include <immintrin.h>
+# define SCAN_AVX2
+#endif
+#if defined(__GNUC__) && defined(__SSE2__)
+# include <emmintrin.h>
+# define SCAN_SSE2
+#endif
+
+/**
+ * Find the first occurrence of c in data.
+ *
+ * Whole 32-byte (AVX2) or 16-byte (SSE2) blocks without c are skipped with a
+ * single compare, the tail is checked byte by byte.  Without SIMD support
+ * this is a plain scalar loop.
+ *
+ * @return Offset of the first c, or len if there is none.
+ */
+static inline size_t
+scan_char (const char *data, size_t len, char c)
+{
+    size_t i = 0;
+
+#ifdef SCAN_AVX2
+    const __m256i c32 = _mm256_set1_epi8(c);
+    for (; i + 32 <= len; i += 32) {
+	uint32_t m = _mm256_movemask_epi8(
+	    _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(data + i)),
+			      c32));
+	if (m)
+	    return i + __builtin_ctz(m);
+    }
+#endif
+#ifdef SCAN_SSE2
+    const __m128i c16 = _mm_set1_epi8(c);
+    for (; i + 16 <= len; i += 16) {
+	uint32_t m = _mm_movemask_epi8(
+	    _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + i)), c16));
+	if (m)
+	    return i + __builtin_ctz(m);
+    }
+#endif
+
+    for (; i < len; i++)
+	if (data[i] == c)
+	    return i;
+
+    return len;
+}
+
+#ifdef SCAN_SSE2
+/**
+ * Classify 16 bytes, set the bits of newlines in nl
+ * and the bits of bytes that are not keyword characters in delim.
+ */
+static inline void
+scan_struct16 (const char *data, uint32_t *nl, uint32_t *delim)
+{
+    const __m128i v = _mm_loadu_si128((const __m128i *)data);
+    // letters are folded to lowercase, bytes >= 0x80 are negative
+    const __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i kw = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+			       _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    kw = _mm_or_si128(kw, _mm_and_si128(
+			  _mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+			  _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1))));
+    kw = _mm_or_si128(kw, _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+
+    *nl = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+    *delim = ~_mm_movemask_epi8(kw) & 0xffff;
+}
+#endif
+
+/**
+ * Classify a 64-byte block for the structural index.
+ *
+ * @param data 64 bytes of input.
+ * @param nl Bitmap word of newlines.
+ * @param delim Bitmap word of bytes that are not keyword characters.
+ */
+static inline void
+scan_struct (const char *data, uint64_t *nl, uint64_t *delim)
+{
+#ifdef SCAN_SSE2
+    uint32_t n, d;
+    int i;
+
+    *nl = *delim = 0;
+    for (i = 0; i < 4; i++) {
+	scan_struct16(data + 16 * i, &n, &d);
+	*nl |= (uint64_t)n << (16 * i);
+	*delim |= (uint64_t)d << (16 * i);
+    }
+#else
+    char c;
+    int i;
+
+    *nl = *delim = 0;
+    for (i = 0; i < 64; i++) {
+	c = data[i];
+	if (c == '\n')
+	    *nl |= 1ULL << i;
+	if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z')
+	      || (c >= 'A' && c <= 'Z') || c == '_'))
+	    *delim |= 1ULL << i;
+    }
+#endif
+}
+
+/**
+ * Find the next set bit in a structural index bitmap.
+ *
+ * @return Position of the first set bit at or after pos,
+ *         or len if there is none before len.
+ */
+static inline size_t
+struct_next (const uint64_t *bits, size_t pos, size_t len)
+{
+    size_t w = pos / 64, words = (len + 63) / 64;
+    uint64_t m;
+
+    if (pos >= len)
+	return len;
+
+    m = bits[w] & (~0ULL << (pos % 64));
+    while (!m) {
+	if (++w >= words)
+	    return len;
+	m = bits[w];
+    }
+
+#ifdef __GNUC__
+    pos = w * 64 + __builtin_ctzll(m);
+#else
+    for (pos = w * 64; !(m & 1); m >>= 1)
+	pos++;
+#endif
+    return pos < len ? pos : len;
+}
+
+#ifdef SCAN_SSE2
+/**
+ * Bitmask of the letters among 16 bytes, bytes >= 0x80 are negative.
+ */
+static inline __m128i
+scan_alpha16 (__m128i v)
+{
+    const __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    return _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+			 _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+}
+
+static inline __m128i
+scan_range16 (__m128i v, char lo, char hi)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+			 _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+}
+#endif
+
+/**
+ * Skip whole 16-byte blocks of hostname characters: alphanumeric, . and -
+ *
+ * @return Offset of the first other character in a block,
+ *         or of the tail shorter than a block, which is left to the caller.
+ */
+static inline size_t
+scan_host_run (const char *data, size_t len)
+{
+    size_t i = 0;
+
+#ifdef SCAN_SSE2
+    for (; i + 16 <= len; i += 16) {
+	const __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+	__m128i m = _mm_or_si128(scan_alpha16(v), scan_range16(v, '0', '9'));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('.')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('-')));
+	uint32_t r = ~_mm_movemask_epi8(m) & 0xffff;
+	if (r)
+	    return i + __builtin_ctz(r);
+    }
+#endif
+    return i;
+}
+
+/**
+ * Skip whole 16-byte blocks of name characters as in psyc_is_name_char().
+ *
+ * @return Offset of the first other character in a block,
+ *         or of the tail shorter than a block, which is left to the caller.
+ */
+static inline size_t
+scan_name_run (const char *data, size_t len)
+{
+    size_t i = 0;
+
+#ifdef SCAN_SSE2
+    for (; i + 16 <= len; i += 16) {
+	const __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+	__m128i m = _mm_or_si128(scan_alpha16(v), scan_range16(v, '$', ';'));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('!')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('?')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('=')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('@')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('~')));
+	uint32_t r = ~_mm_movemask_epi8(m) & 0xffff;
+	if (r)
+	    return i + __builtin_ctz(r);
+    }
+#endif
+    return i;
+}
+
+#endif // PSYC_SCAN_H
@@ -0,0 +1,640 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+/**
+ * The variable table uses linear probing with backward shift deletion, so
+ * there are no tombstones. A slot is in use only if it has the generation of
+ * the state, which makes a reset a matter of incrementing the generation.
+ *
+ * Values are appended to the value buffer. A value is overwritten in place
+ * when the new one isn't longer, and extended in place when it's the last one
+ * in the buffer, as it is for a list growing one element at a time. The
+ * buffer is compacted when it's full and at least a third of it is garbage.
+ *
+ * Once the resync content is asked for, it's kept rendered along with the
+ * offset of each variable's line in it. A changed line is rendered in place,
+ * moving the lines after it, so the cache only has to be rendered again when
+ * the variable table grows.
+ */
+
+#include "lib.h"
+#include <stdlib.h>
+#include <psyc/state.h>
+#include <psyc/update.h>
+
+#define STATE_MIN_SIZE 8
+#define STATE_MIN_ALLOC 64
+
+static inline uint32_t
+var_hash (const PsycState *state, uint32_t id)
+{
+    return (id * 2654435761u) & (state->size - 1);
+}
+
+static inline int
+var_used (const PsycState *state, const PsycStateVar *v)
+{
+    return v->gen == state->gen;
+}
+
+static PsycStateVar *
+var_find (const PsycState *state, uint32_t id)
+{
+    uint32_t i, mask = state->size - 1;
+
+    if (!state->count)
+	return NULL;
+    for (i = var_hash(state, id); var_used(state, &state->vars[i]); i = (i + 1) & mask)
+	if (state->vars[i].id == id)
+	    return &state->vars[i];
+    return NULL;
+}
+
+/**
+ * Get the '=' modifier of a variable.
+ */
+static inline PsycModifier
+var_modifier (const PsycState *state, const PsycStateVar *v)
+{
+    PsycModifier m = PSYC_MODIFIER(PSYC_OPERATOR_ASSIGN, psyc_intern_name(v->id),
+				   PSYC_STRING(state->values + v->offset, v->length),
+				   PSYC_MODIFIER_CHECK_LENGTH);
+    m.flag = psyc_modifier_length_check(&m);
+    return m;
+}
+
+/**
+ * Drop the cached resync content, it's rendered again when needed.
+ */
+static void
+cache_drop (PsycState *state)
+{
+    free(state->lines);
+    state->lines = NULL;
+}
+
+/**
+ * Replace the line of a slot in the cached content with len bytes,
+ * a new line is inserted before the packet delimiter.
+ * Drops the cache if out of memory.
+ *
+ * @return 0, -1 if out of memory.
+ */
+static int
+cache_splice (PsycState *state, PsycStateLine *line, size_t len)
+{
+    PsycStateLine *l;
+    uint32_t offset = line->length ? line->offset : state->cachelen - 2;
+    size_t need = state->cachelen - line->length + len, alloc;
+    char *cache;
+
+    if (need > state->cachealloc) {
+	for (alloc = state->cachealloc; alloc < need; alloc *= 2)
+	    ;
+	if (alloc > UINT32_MAX || !(cache = realloc(state->cache, alloc))) {
+	    cache_drop(state);
+	    return -1;
+	}
+	state->cache = cache;
+	state->cachealloc = alloc;
+    }
+
+    if (len != line->length) {
+	memmove(state->cache + offset + len, state->cache + offset + line->length,
+		state->cachelen - offset - line->length);
+	for (l = state->lines; l < state->lines + state->size; l++)
+	    if (l->length && l->offset > offset
+		&& var_used(state, &state->vars[l - state->lines]))
+		l->offset += len - line->length;
+    }
+    state->cachelen = need;
+    line->offset = offset;
+    line->length = len;
+    return 0;
+}
+
+/**
+ * Render the line of a variable again in the cached content, if there is one.
+ */
+static void
+cache_set (PsycState *state, PsycStateVar *v)
+{
+    PsycStateLine *line;
+    PsycModifier m;
+
+    if (!state->lines)
+	return;
+    line = &state->lines[v - state->vars];
+    m = var_modifier(state, v);
+    if (!cache_splice(state, line, psyc_modifier_length(&m)))
+	psyc_render_modifier(&m, state->cache + line->offset);
+}
+
+/**
+ * Render the resync content, followed by the packet delimiter.
+ */
+static int
+cache_build (PsycState *state)
+{
+    PsycStateVar *v;
+    PsycStateLine *line;
+    PsycModifier m;
+    size_t need = psyc_state_length(state) + 2, alloc;
+    char *cache;
+
+    if (need > state->cachealloc) {
+	for (alloc = STATE_MIN_ALLOC; alloc < need; alloc *= 2)
+	    ;
+	if (alloc > UINT32_MAX || !(cache = realloc(state->cache, alloc)))
+	    return -1;
+	state->cache = cache;
+	state->cachealloc = alloc;
+    }
+    if (!(state->lines = malloc((state->size ? state->size : 1)
+				* sizeof(PsycStateLine))))
+	return -1;
+
+    state->cache[0] = PSYC_STATE_RESET;
+    state->cache[1] = '\n';
+    state->cachelen = 2;
+    for (v = state->vars; v < state->vars + state->size; v++) {
+	line = &state->lines[v - state->vars];
+	line->length = 0;
+	if (var_used(state, v)) {
+	    m = var_modifier(state, v);
+	    line->offset = state->cachelen;
+	    line->length = psyc_render_modifier(&m, state->cache + state->cachelen);
+	    state->cachelen += line->length;
+	}
+    }
+    state->cache[state->cachelen++] = PSYC_PACKET_DELIMITER_CHAR;
+    state->cache[state->cachelen++] = '\n';
+    return 0;
+}
+
+/**
+ * Get an unused slot for a new variable, growing the table at 3/4 load.
+ */
+static PsycStateVar *
+var_insert (PsycState *state, uint32_t id)
+{
+    PsycStateVar *old = state->vars, *v;
+    uint32_t i, mask, oldsize = state->size;
+
+    if ((state->count + 1) * 4 > state->size * 3) {
+	state->size = oldsize ? oldsize * 2 : STATE_MIN_SIZE;
+	state->vars = calloc(state->size, sizeof(PsycStateVar));
+	if (!state->vars) {
+	    state->vars = old;
+	    state->size = oldsize;
+	    return NULL;
+	}
+	mask = state->size - 1;
+	for (v = old; v < old + oldsize; v++)
+	    if (var_used(state, v)) {
+		for (i = var_hash(state, v->id); var_used(state, &state->vars[i]);
+		     i = (i + 1) & mask)
+		    ;
+		state->vars[i] = *v;
+	    }
+	free(old);
+	cache_drop(state);
+    }
+
+    mask = state->size - 1;
+    for (i = var_hash(state, id); var_used(state, &state->vars[i]); i = (i + 1) & mask)
+	;
+    v = &state->vars[i];
+    v->id = id;
+    v->gen = state->gen;
+    v->length = 0;
+    if (state->lines)
+	state->lines[i].length = 0;
+    state->count++;
+    return v;
+}
+
+/**
+ * Remove a variable, moving back the following ones of the same probe run
+ * that would not be found past the slot left empty.
+ */
+static void
+var_delete (PsycState *state, PsycStateVar *v)
+{
+    PsycStateVar *vars = state->vars;
+    uint32_t i = v - vars, j = i, k, mask = state->size - 1;
+
+    state->garbage += v->length;
+    if (state->lines)
+	cache_splice(state, &state->lines[i], 0);
+    for (;;) {
+	j = (j + 1) & mask;
+	if (!var_used(state, &vars[j]))
+	    break;
+	k = var_hash(state, vars[j].id);
+	if (i <= j ? i < k && k <= j : i < k || k <= j)
+	    continue; // its home slot is after the empty one
+	vars[i] = vars[j];
+	if (state->lines)
+	    state->lines[i] = state->lines[j];
+	i = j;
+    }
+    vars[i].gen = state->gen - 1;
+    state->count--;
+}
+
+/**
+ * Make room for len more bytes at the end of the value buffer,
+ * compacting it if it has enough garbage.
+ * Offsets of the values may change, the variable table stays the same.
+ */
+static int
+values_reserve (PsycState *state, size_t len)
+{
+    PsycStateVar *v;
+    char *values;
+    size_t need, alloc;
+    uint32_t used = 0;
+
+    if (state->used + len <= state->alloc)
+	return 0;
+
+    if (state->garbage * 3 >= state->alloc) {
+	need = state->used - state->garbage + len;
+	for (alloc = STATE_MIN_ALLOC; alloc < need; alloc *= 2)
+	    ;
+	if (alloc > UINT32_MAX || !(values = malloc(alloc)))
+	    return -1;
+	for (v = state->vars; v < state->vars + state->size; v++)
+	    if (var_used(state, v)) {
+		memcpy(values + used, state->values + v->offset, v->length);
+		v->offset = used;
+		used += v->length;
+	    }
+	free(state->values);
+	state->values = values;
+	state->used = used;
+	state->garbage = 0;
+    } else {
+	need = state->used + len;
+	for (alloc = state->alloc ? state->alloc : STATE_MIN_ALLOC; alloc < need; alloc *= 2)
+	    ;
+	if (alloc > UINT32_MAX || !(values = realloc(state->values, alloc)))
+	    return -1;
+	state->values = values;
+    }
+    state->alloc = alloc;
+    return 0;
+}
+
+/**
+ * Set a variable to the concatenation of a prefix of its current value and
+ * the given data.
+ */
+static PsycStateVar *
+var_store (PsycState *state, PsycStateVar *v, uint32_t id, size_t keep,
+	   const char *data, size_t len)
+{
+    size_t total = keep + len;
+
+    if (v && keep == v->length && v->offset + keep == state->used
+	&& state->used + len <= state->alloc) { // extend the last value
+	memcpy(state->values + state->used, data, len);
+	state->used += len;
+	v->length += len;
+	return v;
+    }
+    if (v && total <= v->length) { // overwrite
+	memcpy(state->values + v->offset + keep, data, len);
+	state->garbage += v->length - total;
+	v->length = total;
+	return v;
+    }
+
+    if (values_reserve(state, total))
+	return NULL;
+    if (v) {
+	memcpy(state->values + state->used, state->values + v->offset, keep);
+	state->garbage += v->length;
+    } else if (!(v = var_insert(state, id)))
+	return NULL;
+    memcpy(state->values + state->used + keep, data, len);
+    v->offset = state->used;
+    v->length = total;
+    state->used += total;
+    return v;
+}
+
+static PsycStateRC
+var_set (PsycState *state, PsycStateVar *v, uint32_t id, size_t keep,
+	 const char *data, size_t len)
+{
+    if (!(v = var_store(state, v, id, keep, data, len)))
+	return PSYC_STATE_ERROR_MEMORY;
+    cache_set(state, v);
+    return PSYC_STATE_CHANGED;
+}
+
+/**
+ * Apply a prepared update to a variable, in place if it doesn't grow or it's
+ * the last value in the buffer, and remove it if nothing is left.
+ */
+static PsycStateRC
+var_update (PsycState *state, PsycStateVar *v, uint32_t id, PsycUpdate *u)
+{
+    size_t len = v ? v->length : 0;
+
+    if (!u->length) {
+	if (v)
+	    var_delete(state, v);
+	return PSYC_STATE_CHANGED;
+    }
+    if (v && (u->length <= len || (v->offset + len == state->used
+				   && state->used + u->length - len <= state->alloc))) {
+	if (u->length > len)
+	    state->used += u->length - len;
+	else
+	    state->garbage += len - u->length;
+    } else {
+	if (values_reserve(state, u->length))
+	    return PSYC_STATE_ERROR_MEMORY;
+	if (v) {
+	    memcpy(state->values + state->used, state->values + v->offset, len);
+	    state->garbage += len;
+	} else if (!(v = var_insert(state, id)))
+	    return PSYC_STATE_ERROR_MEMORY;
+	v->offset = state->used;
+	state->used += u->length;
+    }
+    psyc_update_splice(u, state->values + v->offset, len);
+    v->length = u->length;
+    cache_set(state, v);
+    return PSYC_STATE_CHANGED;
+}
+
+void
+psyc_state_init (PsycState *state)
+{
+    memset(state, 0, sizeof(PsycState));
+    state->gen = 1;
+}
+
+void
+psyc_state_free (PsycState *state)
+{
+    free(state->vars);
+    free(state->values);
+    free(state->cache);
+    free(state->lines);
+    psyc_state_init(state);
+}
+
+void
+psyc_state_reset (PsycState *state)
+{
+    if (++state->gen == 0) { // unused slots have older generations, not this one
+	memset(state->vars, 0, state->size * sizeof(PsycStateVar));
+	state->gen = 1;
+    }
+    state->count = state->used = state->garbage = 0;
+    if (state->lines) { // no lines left
+	state->cache[2] = PSYC_PACKET_DELIMITER_CHAR;
+	state->cache[3] = '\n';
+	state->cachelen = 4;
+    }
+}
+
+const char *
+psyc_state_get_id (const PsycState *state, uint32_t id, size_t *len)
+{
+    PsycStateVar *v = var_find(state, id);
+
+    if (!v)
+	return NULL;
+    *len = v->length;
+    return state->values + v->offset;
+}
+
+const char *
+psyc_state_get (const PsycState *state, const char *name, size_t namelen,
+		size_t *len)
+{
+    uint32_t id = psyc_intern_lookup(name, namelen,
+				     psyc_intern_hash(name, namelen));
+    return id ? psyc_state_get_id(state, id, len) : NULL;
+}
+
+PsycStateRC
+psyc_state_apply_id (PsycState *state, char oper, uint32_t id,
+		     const char *value, size_t valuelen)
+{
+    PsycStateVar *v;
+    PsycString name;
+    PsycType type;
+    PsycUpdate u;
+    PsycUpdateRC r;
+    PsycStateRC ret;
+
+    switch (oper) {
+    case PSYC_OPERATOR_SET:
+    case PSYC_OPERATOR_QUERY:
+	return PSYC_STATE_UNCHANGED;
+
+    case PSYC_OPERATOR_ASSIGN:
+	v = var_find(state, id);
+	if (!valuelen) {
+	    if (!v)
+		return PSYC_STATE_UNCHANGED;
+	    var_delete(state, v);
+	    return PSYC_STATE_CHANGED;
+	}
+	if (v && v->length == valuelen
+	    && !memcmp(state->values + v->offset, value, valuelen))
+	    return PSYC_STATE_UNCHANGED;
+	return var_set(state, v, id, 0, value, valuelen);
+
+    case PSYC_OPERATOR_AUGMENT:
+    case PSYC_OPERATOR_DIMINISH:
+	name = psyc_intern_name(id);
+	type = psyc_var_type(PSYC_S2ARG(name));
+	if (type != PSYC_TYPE_LIST && type != PSYC_TYPE_DICT)
+	    return PSYC_STATE_ERROR_TYPE;
+	v = var_find(state, id);
+	if (!valuelen || (!v && oper == PSYC_OPERATOR_DIMINISH))
+	    return PSYC_STATE_UNCHANGED;
+	r = psyc_update_modify(&u, type, v ? state->values + v->offset : NULL,
+			       v ? v->length : 0, oper, value, valuelen);
+	break;
+
+    case PSYC_OPERATOR_UPDATE:
+	name = psyc_intern_name(id);
+	type = psyc_var_type(PSYC_S2ARG(name));
+	if (type != PSYC_TYPE_LIST && type != PSYC_TYPE_DICT)
+	    return PSYC_STATE_ERROR_TYPE;
+	v = var_find(state, id);
+	r = psyc_update_prepare(&u, v ? state->values + v->offset : NULL,
+				v ? v->length : 0, value, valuelen);
+	break;
+
+    default:
+	return PSYC_STATE_ERROR_OPERATOR;
+    }
+
+    switch (r) {
+    case PSYC_UPDATE_CHANGED:
+	ret = var_update(state, v, id, &u);
+	break;
+    case PSYC_UPDATE_UNCHANGED:
+	ret = PSYC_STATE_UNCHANGED;
+	break;
+    case PSYC_UPDATE_ERROR_MEMORY:
+	ret = PSYC_STATE_ERROR_MEMORY;
+	break;
+    case PSYC_UPDATE_ERROR_OPERATOR:
+	ret = PSYC_STATE_ERROR_OPERATOR;
+	break;
+    case PSYC_UPDATE_ERROR_VALUE:
+	ret = PSYC_STATE_ERROR_VALUE;
+	break;
+    default:
+	ret = PSYC_STATE_ERROR_UPDATE;
+    }
+    psyc_update_free(&u);
+    return ret;
+}
+
+PsycStateRC
+psyc_state_apply (PsycState *state, char oper, const char *name, size_t namelen,
+		  const char *value, size_t valuelen)
+{
+    uint32_t id;
+
+    if (oper == PSYC_OPERATOR_SET || oper == PSYC_OPERATOR_QUERY)
+	return PSYC_STATE_UNCHANGED;
+    if (!(id = psyc_intern(name, namelen)))
+	return PSYC_STATE_ERROR_NAME;
+    return psyc_state_apply_id(state, oper, id, value, valuelen);
+}
+
+PsycStateRC
+psyc_state_apply_packet (PsycState *state, PsycPacket *packet)
+{
+    PsycModifier *m;
+    PsycStateRC ret = PSYC_STATE_UNCHANGED, r;
+    size_t i;
+
+    if (packet->stateop == PSYC_STATE_RESET && state->count) {
+	psyc_state_reset(state);
+	ret = PSYC_STATE_CHANGED;
+    }
+
+    for (i = 0; i < packet->entity.lines; i++) {
+	m = &packet->entity.modifiers[i];
+	r = psyc_state_apply(state, m->oper, PSYC_S2ARG(m->name),
+			     PSYC_S2ARG(m->value));
+	if (r < 0)
+	    return r;
+	if (r == PSYC_STATE_CHANGED)
+	    ret = r;
+    }
+    return ret;
+}
+
+size_t
+psyc_state_length (const PsycState *state)
+{
+    PsycStateVar *v;
+    PsycModifier m;
+    size_t len = 2; // =\n
+
+    if (state->lines)
+	return state->cachelen - 2;
+    for (v = state->vars; v < state->vars + state->size; v++)
+	if (var_used(state, v)) {
+	    m = var_modifier(state, v);
+	    len += psyc_modifier_length(&m);
+	}
+    return len;
+}
+
+PsycRenderRC
+psyc_state_render (const PsycState *state, char *buffer, size_t buflen)
+{
+    PsycStateVar *v;
+    PsycModifier m;
+    size_t cur = 2;
+
+    if (buflen < psyc_state_length(state))
+	return PSYC_RENDER_ERROR;
+
+    if (state->lines) {
+	memcpy(buffer, state->cache, state->cachelen - 2);
+	return PSYC_RENDER_SUCCESS;
+    }
+    buffer[0] = PSYC_STATE_RESET;
+    buffer[1] = '\n';
+    for (v = state->vars; v < state->vars + state->size; v++)
+	if (var_used(state, v)) {
+	    m = var_modifier(state, v);
+	    cur += psyc_render_modifier(&m, buffer + cur);
+	}
+    return PSYC_RENDER_SUCCESS;
+}
+
+const char *
+psyc_state_content (PsycState *state, size_t *len)
+{
+    if (!state->lines && cache_build(state))
+	return NULL;
+    *len = state->cachelen - 2;
+    return state->cache;
+}
+
+PsycRenderRC
+psyc_state_resync (PsycState *state, PsycModifier *routing, size_t routinglen,
+		   char *header, size_t headerlen, struct iovec *iov)
+{
+    PsycPacket packet;
+    size_t i, len, n, cur = 0;
+
+    if (!psyc_state_content(state, &len))
+	return PSYC_RENDER_ERROR;
+
+    // the content is always given a length, values may contain a delimiter
+    psyc_packet_init_raw(&packet, routing, routinglen, state->cache, len,
+			 PSYC_PACKET_NEED_LENGTH);
+    if (packet.length - len - 2 > headerlen)
+	return PSYC_RENDER_ERROR;
+
+    for (i = 0; i < routinglen; i++) {
+	n = psyc_render_modifier(&routing[i], header + cur);
+	if (n <= 1)
+	    return PSYC_RENDER_ERROR_MODIFIER_NAME_MISSING;
+	cur += n;
+    }
+    cur += psyc_num_render(len, header + cur);
+    header[cur++] = '\n';
+
+    iov[0].iov_base = header;
+    iov[0].iov_len = cur;
+    iov[1].iov_base = state->cache;
+    iov[1].iov_len = state->cachelen;
+    return PSYC_RENDER_SUCCESS;
+}
@@ -0,0 +1,339 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+/**
+ * The trie has a node for each keyword segment of the patterns, the root
+ * stands for the leading underscore. Inheriting patterns match the nodes on
+ * the path of the method from the root, so these are collected while
+ * following it. A matching pattern only needs its segments to appear in the
+ * method in the same order, so the lookup keeps the set of nodes reached so
+ * far and tries to descend from each of them with every segment of the
+ * method. Each node is added to the set once per lookup, which is what the
+ * walk counter is for.
+ */
+
+#include "lib.h"
+#include <stdlib.h>
+#include <psyc/subscription.h>
+
+#define NODE_SEGMENT(n) ((char *)(n) + sizeof(PsycSubscriptionNode))
+
+/**
+ * Get the end of the keyword segment starting at s.
+ */
+static inline const char *
+segment_end (const char *s, const char *end)
+{
+    const char *p = memchr(s, '_', end - s);
+    return p ? p : end;
+}
+
+static inline int
+segment_cmp (const PsycSubscriptionNode *node, const char *seg, size_t len)
+{
+    if (node->segment.length != len)
+	return node->segment.length < len ? -1 : 1;
+    return memcmp(node->segment.data, seg, len);
+}
+
+/**
+ * Binary search for a child of node.
+ *
+ * @return Index of the child, or where it would be inserted
+ *         in the children array if not found.
+ */
+static size_t
+node_search (const PsycSubscriptionNode *node, const char *seg, size_t len,
+	     int *found)
+{
+    size_t lo = 0, hi = node->nchildren, mid;
+    int c;
+
+    while (lo < hi) {
+	mid = lo + (hi - lo) / 2;
+	c = segment_cmp(node->children[mid], seg, len);
+	if (c == 0) {
+	    *found = 1;
+	    return mid;
+	}
+	if (c < 0)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    *found = 0;
+    return lo;
+}
+
+static inline PsycSubscriptionNode *
+node_child (const PsycSubscriptionNode *node, const char *seg, size_t len)
+{
+    int found;
+    size_t i;
+
+    if (!node->nchildren)
+	return NULL;
+    i = node_search(node, seg, len, &found);
+    return found ? node->children[i] : NULL;
+}
+
+/**
+ * Grow an array to hold at least n elements of size bytes.
+ */
+static int
+array_reserve (void *array, size_t *alloc, size_t n, size_t size)
+{
+    size_t a = *alloc ? *alloc : 4;
+    void *p;
+
+    if (n <= *alloc)
+	return 0;
+    while (a < n)
+	a *= 2;
+    p = realloc(*(void **)array, a * size);
+    if (!p)
+	return -1;
+    *(void **)array = p;
+    *alloc = a;
+    return 0;
+}
+
+static PsycSubscriptionNode *
+node_add (PsycSubscriptions *subs, PsycSubscriptionNode *parent,
+	  const char *seg, size_t len)
+{
+    PsycSubscriptionNode *node;
+    int found;
+    size_t i = node_search(parent, seg, len, &found);
+
+    if (found)
+	return parent->children[i];
+
+    // the active set of a lookup can hold every node and the root
+    if (array_reserve(&subs->active, &subs->active_size, subs->nodes + 2,
+		      sizeof(*subs->active)) != 0
+	|| array_reserve(&parent->children, &parent->children_size,
+			 parent->nchildren + 1, sizeof(*parent->children)) != 0)
+	return NULL;
+
+    node = calloc(1, sizeof(PsycSubscriptionNode) + len);
+    if (!node)
+	return NULL;
+    memcpy(NODE_SEGMENT(node), seg, len);
+    node->segment = PSYC_STRING(NODE_SEGMENT(node), len);
+    node->parent = parent;
+    node->walk = subs->walk;
+
+    memmove(parent->children + i + 1, parent->children + i,
+	    (parent->nchildren - i) * sizeof(*parent->children));
+    parent->children[i] = node;
+    parent->nchildren++;
+    subs->nodes++;
+    return node;
+}
+
+/**
+ * Free the nodes without subscriptions and children from node upwards.
+ */
+static void
+node_prune (PsycSubscriptions *subs, PsycSubscriptionNode *node)
+{
+    PsycSubscriptionNode *parent;
+    int found;
+    size_t i;
+
+    while (node != &subs->root && !node->nchildren
+	   && !node->nids[PSYC_SUBSCRIPTION_INHERIT]
+	   && !node->nids[PSYC_SUBSCRIPTION_MATCH]) {
+	parent = node->parent;
+	i = node_search(parent, PSYC_S2ARG(node->segment), &found);
+	memmove(parent->children + i, parent->children + i + 1,
+		(parent->nchildren - i - 1) * sizeof(*parent->children));
+	parent->nchildren--;
+
+	free(node->children);
+	free(node->ids[PSYC_SUBSCRIPTION_INHERIT]);
+	free(node->ids[PSYC_SUBSCRIPTION_MATCH]);
+	free(node);
+	subs->nodes--;
+	node = parent;
+    }
+}
+
+static void
+node_free (PsycSubscriptionNode *node)
+{
+    size_t i;
+
+    for (i = 0; i < node->nchildren; i++) {
+	node_free(node->children[i]);
+	free(node->children[i]);
+    }
+    free(node->children);
+    free(node->ids[PSYC_SUBSCRIPTION_INHERIT]);
+    free(node->ids[PSYC_SUBSCRIPTION_MATCH]);
+}
+
+static void
+node_unmark (PsycSubscriptionNode *node)
+{
+    size_t i;
+
+    node->walk = 0;
+    for (i = 0; i < node->nchildren; i++)
+	node_unmark(node->children[i]);
+}
+
+/**
+ * Check that pattern is a long format keyword without empty segments.
+ */
+static inline int
+pattern_valid (const char *pattern, size_t len)
+{
+    size_t i;
+
+    if (len < 2 || pattern[0] != '_' || pattern[len - 1] == '_')
+	return 0;
+    for (i = 1; i < len; i++)
+	if (pattern[i] == '_' && pattern[i - 1] == '_')
+	    return 0;
+    return 1;
+}
+
+/**
+ * Find the node of the last segment of pattern.
+ */
+static PsycSubscriptionNode *
+pattern_node (PsycSubscriptions *subs, const char *pattern, size_t len)
+{
+    PsycSubscriptionNode *node = &subs->root;
+    const char *p = pattern + 1, *end = pattern + len, *e;
+
+    for (; node && p < end; p = e + 1) {
+	e = segment_end(p, end);
+	node = node_child(node, p, e - p);
+    }
+    return node;
+}
+
+void
+psyc_subscription_init (PsycSubscriptions *subs)
+{
+    memset(subs, 0, sizeof(*subs));
+}
+
+void
+psyc_subscription_free (PsycSubscriptions *subs)
+{
+    node_free(&subs->root);
+    free(subs->active);
+    psyc_subscription_init(subs);
+}
+
+PsycRC
+psyc_subscription_add (PsycSubscriptions *subs,
+		       const char *pattern, size_t patternlen,
+		       PsycSubscriptionMode mode, uintptr_t id)
+{
+    PsycSubscriptionNode *node = &subs->root;
+    const char *p = pattern + 1, *end = pattern + patternlen, *e;
+
+    if (!pattern_valid(pattern, patternlen))
+	return PSYC_ERROR;
+
+    for (; p < end; p = e + 1) {
+	e = segment_end(p, end);
+	if (!(node = node_add(subs, node, p, e - p)))
+	    return PSYC_ERROR;
+    }
+
+    if (array_reserve(&node->ids[mode], &node->ids_size[mode],
+		      node->nids[mode] + 1, sizeof(**node->ids)) != 0)
+	return PSYC_ERROR;
+    node->ids[mode][node->nids[mode]++] = id;
+    subs->count++;
+    return PSYC_OK;
+}
+
+PsycRC
+psyc_subscription_remove (PsycSubscriptions *subs,
+			  const char *pattern, size_t patternlen,
+			  PsycSubscriptionMode mode, uintptr_t id)
+{
+    PsycSubscriptionNode *node;
+    size_t i;
+
+    if (!pattern_valid(pattern, patternlen)
+	|| !(node = pattern_node(subs, pattern, patternlen)))
+	return PSYC_ERROR;
+
+    for (i = 0; i < node->nids[mode]; i++)
+	if (node->ids[mode][i] == id) {
+	    node->ids[mode][i] = node->ids[mode][--node->nids[mode]];
+	    subs->count--;
+	    node_prune(subs, node);
+	    return PSYC_OK;
+	}
+
+    return PSYC_ERROR;
+}
+
+size_t
+psyc_subscription_lookup (PsycSubscriptions *subs,
+			  const char *method, size_t methodlen,
+			  uintptr_t *ids, size_t size)
+{
+    PsycSubscriptionNode *node, *child, *prefix = &subs->root;
+    PsycSubscriptionNode **active = subs->active;
+    const char *p = method + 1, *end = method + methodlen, *e;
+    size_t nactive = 1, n, i, j, count = 0;
+
+    if (methodlen < 2 || method[0] != '_' || !subs->count)
+	return 0;
+
+    if (++subs->walk == 0) { // wrapped around, marks could be stale
+	node_unmark(&subs->root);
+	subs->walk = 1;
+    }
+    active[0] = &subs->root;
+
+    for (; p < end; p = e + 1) {
+	e = segment_end(p, end);
+
+	for (n = nactive, i = 0; i < n; i++) {
+	    node = active[i];
+	    if (!(child = node_child(node, p, e - p)) || child->walk == subs->walk)
+		continue;
+	    child->walk = subs->walk;
+	    active[nactive++] = child;
+
+	    for (j = 0; j < child->nids[PSYC_SUBSCRIPTION_MATCH]; j++, count++)
+		if (count < size)
+		    ids[count] = child->ids[PSYC_SUBSCRIPTION_MATCH][j];
+	}
+
+	if (prefix && (prefix = node_child(prefix, p, e - p)))
+	    for (j = 0; j < prefix->nids[PSYC_SUBSCRIPTION_INHERIT]; j++, count++)
+		if (count < size)
+		    ids[count] = prefix->ids[PSYC_SUBSCRIPTION_INHERIT][j];
+    }
+
+    return count;
+}
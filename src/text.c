@@ -19,7 +19,9 @@
 */
 
 #include "lib.h"
+#include <stdlib.h>
 #include <psyc/text.h>
+#include <psyc/intern.h>
 
 const PsycTemplates psyc_templates = { .s = {
 #include "templates.h"
@@ -124,3 +126,281 @@ psyc_text (PsycTextState *state, PsycTextCB get_value, void *get_value_cls)
 
     return PSYC_TEXT_COMPLETE;
 }
+
+/**
+ * Append a segment to a template being compiled.
+ */
+static inline PsycRC
+text_segment (PsycTextTemplate *tmpl, size_t size, const char *text, size_t len,
+	      const char *name, size_t namelen)
+{
+    PsycTextSegment *seg;
+
+    if (!tmpl->segments) { // only counting
+	tmpl->nsegments++;
+	tmpl->nvars += namelen > 0;
+	return PSYC_OK;
+    }
+    if (tmpl->nsegments >= size)
+	return PSYC_ERROR;
+
+    seg = &tmpl->segments[tmpl->nsegments++];
+    seg->text = PSYC_STRING((char *)text, len);
+    seg->name = PSYC_STRING((char *)name, namelen);
+    seg->id = 0;
+    if (namelen) {
+	seg->id = psyc_intern(name, namelen);
+	tmpl->nvars++;
+    }
+    return PSYC_OK;
+}
+
+PsycRC
+psyc_text_compile (PsycTextTemplate *tmpl, const char *text, size_t textlen,
+		   const char *ope, size_t opelen, const char *clo, size_t clolen,
+		   PsycTextSegment *segments, size_t size)
+{
+    const char *start, *end, *prev = text;
+    size_t cursor = 0;
+
+    if (!ope)
+	ope = "[", opelen = 1;
+    if (!clo)
+	clo = "]", clolen = 1;
+
+    *tmpl = (PsycTextTemplate) {segments, 0, 0};
+
+    // find the variables the same way as psyc_text()
+    while (cursor < textlen) {
+	start = memmem(text + cursor, textlen - cursor, ope, opelen);
+	if (!start)
+	    break;
+
+	cursor = (start - text) + opelen;
+	if (cursor >= textlen)
+	    break; // [ at the end
+
+	end = memmem(text + cursor, textlen - cursor, clo, clolen);
+	if (!end)
+	    break; // ] not found
+
+	cursor = (end - text) + clolen;
+	if (start + opelen == end) {
+	    cursor += clolen;
+	    continue; // [] is invalid, name can't be empty
+	}
+
+	if ((start > prev
+	     && text_segment(tmpl, size, prev, start - prev, NULL, 0) != PSYC_OK)
+	    || text_segment(tmpl, size, start, cursor - (start - text),
+			    start + opelen, end - start - opelen) != PSYC_OK)
+	    return PSYC_ERROR;
+	prev = text + cursor;
+    }
+
+    if (prev < text + textlen)
+	return text_segment(tmpl, size, prev, text + textlen - prev, NULL, 0);
+
+    return PSYC_OK;
+}
+
+/**
+ * Check if any variable from segment i on has a value.
+ */
+static PsycBool
+text_has_subst (const PsycTextTemplate *tmpl, size_t i,
+		PsycTextIdCB get_value, void *get_value_cls)
+{
+    const PsycTextSegment *seg;
+    PsycString value;
+
+    for (; i < tmpl->nsegments; i++) {
+	seg = &tmpl->segments[i];
+	if (seg->name.length
+	    && get_value(get_value_cls, seg->id, PSYC_S2ARG(seg->name), &value)
+	    >= 0)
+	    return PSYC_TRUE;
+    }
+    return PSYC_FALSE;
+}
+
+PsycTextRC
+psyc_text_render_compiled (PsycTextState *state, const PsycTextTemplate *tmpl,
+			   PsycTextIdCB get_value, void *get_value_cls)
+{
+    const PsycTextSegment *seg;
+    PsycString value;
+    uint8_t no_subst = (state->cursor == 0); // whether we can return NO_SUBST
+
+    for (; state->cursor < tmpl->nsegments; state->cursor++) {
+	seg = &tmpl->segments[state->cursor];
+	value = seg->text;
+
+	if (seg->name.length) {
+	    if (get_value(get_value_cls, seg->id, PSYC_S2ARG(seg->name), &value)
+		< 0)
+		value = seg->text; // value not found, no substitution
+	    else
+		no_subst = 0;
+	}
+
+	if (state->written + value.length > state->buffer.length) {
+	    // psyc_text() wouldn't write anything without a substitution
+	    if (no_subst && !text_has_subst(tmpl, state->cursor + 1,
+					    get_value, get_value_cls)) {
+		state->written = 0;
+		state->cursor = tmpl->nsegments;
+		return PSYC_TEXT_NO_SUBST;
+	    }
+	    return PSYC_TEXT_INCOMPLETE;
+	}
+
+	memcpy(state->buffer.data + state->written, value.data, value.length);
+	state->written += value.length;
+    }
+
+    if (no_subst) {
+	state->written = 0;
+	return PSYC_TEXT_NO_SUBST;
+    }
+
+    return PSYC_TEXT_COMPLETE;
+}
+
+const PsycTextTemplate *
+psyc_template_compiled (PsycMethod mc)
+{
+    static PsycTextTemplate templates[PSYC_METHODS_NUM];
+    static uint8_t compiled, lock;
+    PsycTextSegment *segments;
+    size_t i, used = 0;
+
+    if (mc < 0 || mc >= PSYC_METHODS_NUM)
+	return NULL;
+
+    if (!__atomic_load_n(&compiled, __ATOMIC_ACQUIRE)) {
+	while (__atomic_test_and_set(&lock, __ATOMIC_ACQUIRE))
+	    ;
+	if (!compiled) {
+	    // count the segments of all templates, then split them into these
+	    for (i = 0; i < PSYC_METHODS_NUM; i++) {
+		psyc_text_compile(&templates[i], PSYC_S2ARG(psyc_templates.a[i]),
+				  NULL, 0, NULL, 0, NULL, 0);
+		used += templates[i].nsegments;
+	    }
+	    segments = malloc((used ? used : 1) * sizeof(PsycTextSegment));
+	    for (i = 0; segments && i < PSYC_METHODS_NUM; i++) {
+		psyc_text_compile(&templates[i], PSYC_S2ARG(psyc_templates.a[i]),
+				  NULL, 0, NULL, 0, segments,
+				  templates[i].nsegments);
+		segments += templates[i].nsegments;
+	    }
+	    if (segments)
+		__atomic_store_n(&compiled, 1, __ATOMIC_RELEASE);
+	}
+	__atomic_clear(&lock, __ATOMIC_RELEASE);
+	if (!__atomic_load_n(&compiled, __ATOMIC_ACQUIRE))
+	    return NULL;
+    }
+
+    return templates[mc].nsegments ? &templates[mc] : NULL;
+}
+
+/**
+ * Add a modifier to the index, unless one with the same name is there.
+ */
+static inline PsycBool
+text_vars_add (PsycTextVars *vars, const PsycModifier *mod, size_t *count)
+{
+    uint32_t h = psyc_intern_hash(PSYC_S2ARG(mod->name));
+    size_t i = h % PSYC_TEXT_VARS_SLOTS;
+
+    // keep a quarter of the slots free for short probes
+    if (*count >= PSYC_TEXT_VARS_SLOTS * 3 / 4)
+	return PSYC_FALSE;
+
+    for (; vars->slots[i].mod; i = (i + 1) % PSYC_TEXT_VARS_SLOTS)
+	if (vars->slots[i].hash == h
+	    && vars->slots[i].mod->name.length == mod->name.length
+	    && memcmp(vars->slots[i].mod->name.data, mod->name.data,
+		      mod->name.length) == 0)
+	    return PSYC_TRUE;
+
+    vars->slots[i].hash = h;
+    vars->slots[i].mod = mod;
+    (*count)++;
+    return PSYC_TRUE;
+}
+
+void
+psyc_text_vars_init (PsycTextVars *vars, const PsycPacket *packet,
+		     PsycBool routing)
+{
+    const PsycHeader *headers[] = {&packet->entity, &packet->routing};
+    size_t count = 0, h, i;
+
+    memset(vars->slots, 0, sizeof(vars->slots));
+    vars->packet = packet;
+    vars->routing = routing;
+    vars->rest = 0;
+
+    for (h = 0; h < (routing ? 2 : 1); h++)
+	for (i = 0; i < headers[h]->lines; i++)
+	    if (!text_vars_add(vars, &headers[h]->modifiers[i], &count)) {
+		vars->rest = (h ? packet->entity.lines : 0) + i;
+		return;
+	    }
+}
+
+/**
+ * Search the modifiers that didn't fit in the index, in the same order.
+ */
+static const PsycModifier *
+text_vars_search (const PsycTextVars *vars, const char *name, size_t namelen)
+{
+    const PsycHeader *headers[] = {&vars->packet->entity, &vars->packet->routing};
+    size_t h = 0, i = vars->rest;
+
+    if (i >= headers[0]->lines) {
+	i -= headers[0]->lines;
+	h = 1;
+    }
+
+    for (; h < (vars->routing ? 2 : 1); h++, i = 0)
+	for (; i < headers[h]->lines; i++)
+	    if (headers[h]->modifiers[i].name.length == namelen
+		&& memcmp(headers[h]->modifiers[i].name.data, name, namelen) == 0)
+		return &headers[h]->modifiers[i];
+    return NULL;
+}
+
+PsycTextValueRC
+psyc_text_vars_get (void *cls, const char *name, size_t namelen,
+		    PsycString *value)
+{
+    const PsycTextVars *vars = cls;
+    const PsycModifier *mod;
+    uint32_t h = psyc_intern_hash(name, namelen);
+    size_t i = h % PSYC_TEXT_VARS_SLOTS;
+
+    for (; (mod = vars->slots[i].mod); i = (i + 1) % PSYC_TEXT_VARS_SLOTS)
+	if (vars->slots[i].hash == h && mod->name.length == namelen
+	    && memcmp(mod->name.data, name, namelen) == 0) {
+	    *value = mod->value;
+	    return PSYC_TEXT_VALUE_FOUND;
+	}
+
+    if (vars->rest && (mod = text_vars_search(vars, name, namelen))) {
+	*value = mod->value;
+	return PSYC_TEXT_VALUE_FOUND;
+    }
+
+    return PSYC_TEXT_VALUE_NOT_FOUND;
+}
+
+PsycTextValueRC
+psyc_text_vars_get_id (void *cls, uint32_t id, const char *name,
+		       size_t namelen, PsycString *value)
+{
+    return psyc_text_vars_get(cls, name, namelen, value);
+}
@@ -18,179 +18,161 @@
   the linking exception along with libpsyc in a COPYING file.
 */
 
-#include <ctype.h>
 #include "lib.h"
+#include "scan.h"
 #include "psyc/uniform.h"
 #include "psyc/parse.h"
 
+/* Byte classes of uniforms. */
+#define UNI_HOST 1	///< hostname character, as psyc_is_host_char()
+#define UNI_NAME 2	///< resource or channel character, as psyc_is_name_char()
+#define UNI_NUM  4	///< port digit
+
+static const uint8_t uniform_class[256] = {
+    ['!'] = UNI_NAME,
+    ['$' ... ','] = UNI_NAME,
+    ['-'] = UNI_HOST | UNI_NAME,
+    ['.'] = UNI_HOST | UNI_NAME,
+    ['/'] = UNI_NAME,
+    ['0' ... '9'] = UNI_HOST | UNI_NAME | UNI_NUM,
+    [':' ... ';'] = UNI_NAME,
+    ['='] = UNI_NAME,
+    ['?'] = UNI_NAME,
+    ['@'] = UNI_NAME,
+    ['A' ... 'Z'] = UNI_HOST | UNI_NAME,
+    ['_'] = UNI_NAME,
+    ['a' ... 'z'] = UNI_HOST | UNI_NAME,
+    ['~'] = UNI_NAME,
+};
+
+#define uniform_is(c, cls) (uniform_class[(uint8_t)(c)] & (cls))
+
 /**
  * Parse uniform.
  *
+ * The host, resource and channel are scanned as runs of their byte class,
+ * whole blocks at a time where SIMD is available.
+ *
  * @return PsycScheme on success, PsycParseUniformRC on error.
  */
 int
 psyc_uniform_parse (PsycUniform *uni, const char *buffer, size_t length)
 {
-    char c;
-    PsycString *p;
     char *data = (char*)buffer;
-    size_t pos = 0, part = PSYC_UNIFORM_SCHEME;
+    size_t pos = 0, start;
 
     uni->valid = 0;
     uni->full = PSYC_STRING(data, length);
 
-    while (pos < length) {
-	c = data[pos];
-	if (c == ':') {
-	    uni->scheme = PSYC_STRING(data, pos++);
-	    break;
-	} else if (!psyc_is_host_char(c))
-	    return PSYC_PARSE_UNIFORM_INVALID_SCHEME;
+    while (pos < length && uniform_is(data[pos], UNI_HOST))
 	pos++;
-    }
+    if (pos == length || data[pos] != ':')
+	return PSYC_PARSE_UNIFORM_INVALID_SCHEME;
+    uni->scheme = PSYC_STRING(data, pos++);
 
-    p = &uni->scheme;
-    if (p->length == 4 && (tolower(p->data[0]) == 'p' &&
-			   tolower(p->data[1]) == 's' &&
-			   tolower(p->data[2]) == 'y' &&
-			   tolower(p->data[3]) == 'c')) {
-	uni->type = PSYC_SCHEME_PSYC;
-	part = PSYC_UNIFORM_SLASHES;
-	uni->slashes = PSYC_STRING(data + pos, 0);
-
-	while (pos < length) {
-	    c = data[pos];
-	    switch (part) {
-	    case PSYC_UNIFORM_SLASHES:
-		if (c == '/')
-		    uni->slashes.length++;
-		else
-		    return PSYC_PARSE_UNIFORM_INVALID_SLASHES;
-
-		if (uni->slashes.length == 2) {
-		    part = PSYC_UNIFORM_HOST;
-		    uni->host = PSYC_STRING(data + pos + 1, 0);
-		}
-		break;
+    // letters are folded to lowercase, the other host characters can't match
+    if (uni->scheme.length != 4 || (data[0] | 0x20) != 'p'
+	|| (data[1] | 0x20) != 's' || (data[2] | 0x20) != 'y'
+	|| (data[3] | 0x20) != 'c')
+	return PSYC_PARSE_UNIFORM_INVALID_SCHEME;
+    uni->type = PSYC_SCHEME_PSYC;
 
-	    case PSYC_UNIFORM_HOST:
-		if (psyc_is_host_char(c)) {
-		    uni->host.length++;
-		    break;
-		}
+    uni->slashes = PSYC_STRING(data + pos, 0);
+    for (; uni->slashes.length < 2; uni->slashes.length++, pos++) {
+	if (pos == length)
+	    return PSYC_PARSE_UNIFORM_INVALID_HOST;
+	if (data[pos] != '/')
+	    return PSYC_PARSE_UNIFORM_INVALID_SLASHES;
+    }
 
-		if (uni->host.length == 0)
-		    return PSYC_PARSE_UNIFORM_INVALID_HOST;
+    start = pos;
+    pos += scan_host_run(data + pos, length - pos);
+    while (pos < length && uniform_is(data[pos], UNI_HOST))
+	pos++;
+    uni->host = PSYC_STRING(data + start, pos - start);
+    if (uni->host.length == 0)
+	return PSYC_PARSE_UNIFORM_INVALID_HOST;
 
-		if (c == ':') {
-		    part = PSYC_UNIFORM_PORT;
-		    p = &uni->port;
-		} else if (c == '/') {
-		    uni->slash = PSYC_STRING(data + pos, 1);
+    if (pos < length && data[pos] == ':') {
+	start = ++pos;
+	if (pos < length && data[pos] == '-')
+	    pos++;
+	while (pos < length && uniform_is(data[pos], UNI_NUM))
+	    pos++;
+	uni->port = PSYC_STRING(data + start, pos - start);
 
-		    part = PSYC_UNIFORM_RESOURCE;
-		    p = &uni->resource;
-		} else
-		    return PSYC_PARSE_UNIFORM_INVALID_HOST;
+	if (pos < length) {
+	    if (uni->port.length == 0 && data[pos] != PSYC_TRANSPORT_GNUNET)
+		return PSYC_PARSE_UNIFORM_INVALID_PORT;
 
-		*p = PSYC_STRING(data + pos + 1, 0);
+	    switch (data[pos]) {
+	    case '/':
 		break;
-
-	    case PSYC_UNIFORM_PORT:
-		if (psyc_is_numeric(c) || (uni->port.length == 0 && c == '-')) {
-		    uni->port.length++;
-		    break;
-		}
-
-		if (uni->port.length == 0 && c != PSYC_TRANSPORT_GNUNET)
-		    return PSYC_PARSE_UNIFORM_INVALID_PORT;
-
-		if (c == '/') {
-		    uni->slash = PSYC_STRING(data + pos, 1);
-
-		    part = PSYC_UNIFORM_RESOURCE;
-		    uni->resource = PSYC_STRING(data + pos + 1, 0);
-		    break;
-		} else {
-		    part = PSYC_UNIFORM_TRANSPORT;
-		    uni->transport = PSYC_STRING(data + pos, 0);
-		}
+	    case PSYC_TRANSPORT_GNUNET:
+		if (uni->port.length > 0)
+		    return PSYC_PARSE_UNIFORM_INVALID_TRANSPORT;
 		// fall thru
-
-	    case PSYC_UNIFORM_TRANSPORT:
-		switch (c) {
-		case PSYC_TRANSPORT_GNUNET:
-		    if (uni->port.length > 0)
-			return PSYC_PARSE_UNIFORM_INVALID_TRANSPORT;
-		case PSYC_TRANSPORT_TCP:
-		case PSYC_TRANSPORT_UDP:
-		case PSYC_TRANSPORT_TLS:
-		    if (uni->transport.length > 0)
-			return PSYC_PARSE_UNIFORM_INVALID_TRANSPORT;
-		    uni->transport.length++;
-		    break;
-		case '/':
-		    uni->slash = PSYC_STRING(data + pos, 1);
-
-		    part = PSYC_UNIFORM_RESOURCE;
-		    uni->resource = PSYC_STRING(data + pos + 1, 0);
-		    break;
-		default:
+	    case PSYC_TRANSPORT_TCP:
+	    case PSYC_TRANSPORT_UDP:
+	    case PSYC_TRANSPORT_TLS:
+		uni->transport = PSYC_STRING(data + pos++, 1);
+		if (pos < length && data[pos] != '/')
 		    return PSYC_PARSE_UNIFORM_INVALID_TRANSPORT;
-		}
 		break;
-
-	    case PSYC_UNIFORM_RESOURCE:
-		if (psyc_is_name_char(c)) {
-		    uni->resource.length++;
-		    break;
-		} else if (c == '#') {
-		    part = PSYC_UNIFORM_CHANNEL;
-		    uni->channel = PSYC_STRING(data + pos + 1, 0);
-		    break;
-		} else
-		    return PSYC_PARSE_UNIFORM_INVALID_RESOURCE;
-
-	    case PSYC_UNIFORM_CHANNEL:
-		if (psyc_is_name_char(c)) {
-		    uni->channel.length++;
-		    break;
-		} else
-		    return PSYC_PARSE_UNIFORM_INVALID_CHANNEL;
+	    default:
+		return PSYC_PARSE_UNIFORM_INVALID_TRANSPORT;
 	    }
-	    pos++;
 	}
+    } else if (pos < length && data[pos] != '/')
+	return PSYC_PARSE_UNIFORM_INVALID_HOST;
 
-	if (uni->host.length == 0)
-	    return PSYC_PARSE_UNIFORM_INVALID_HOST;
+    if (pos < length) {
+	uni->slash = PSYC_STRING(data + pos++, 1);
 
-	uni->host_port = PSYC_STRING(uni->host.data, uni->host.length
-				     + uni->port.length + uni->transport.length);
-	if (uni->port.length > 0 || uni->transport.length > 0)
-	    uni->host_port.length++;
+	start = pos;
+	pos += scan_name_run(data + pos, length - pos);
+	while (pos < length && uniform_is(data[pos], UNI_NAME))
+	    pos++;
+	uni->resource = PSYC_STRING(data + start, pos - start);
+
+	if (pos < length) {
+	    if (data[pos] != '#')
+		return PSYC_PARSE_UNIFORM_INVALID_RESOURCE;
+
+	    start = ++pos;
+	    pos += scan_name_run(data + pos, length - pos);
+	    while (pos < length && uniform_is(data[pos], UNI_NAME))
+		pos++;
+	    uni->channel = PSYC_STRING(data + start, pos - start);
+	    if (pos < length)
+		return PSYC_PARSE_UNIFORM_INVALID_CHANNEL;
+	}
+    }
 
-	uni->root = PSYC_STRING(data, uni->scheme.length + 1
-				+ uni->slashes.length + uni->host_port.length);
+    // PSYC uniforms have no user part
+    uni->user_host = uni->host;
 
-	uni->entity = PSYC_STRING(data, uni->root.length + uni->slash.length
-				  + uni->resource.length);
+    uni->host_port = PSYC_STRING(uni->host.data, uni->host.length
+				 + uni->port.length + uni->transport.length);
+    if (uni->port.length > 0 || uni->transport.length > 0)
+	uni->host_port.length++;
 
-	uni->body = PSYC_STRING(uni->host.data,
-				length - uni->scheme.length - 1 - uni->slashes.length);
+    uni->root = PSYC_STRING(data, uni->scheme.length + 1
+			    + uni->slashes.length + uni->host_port.length);
 
-	if (uni->slash.length) {
-	    uni->path.data = uni->slash.data;
-	    uni->path.length = length - uni->root.length;
-	}
+    uni->entity = PSYC_STRING(data, uni->root.length + uni->slash.length
+			      + uni->resource.length);
 
-	if (uni->resource.length)
-	    uni->nick = PSYC_STRING(uni->resource.data + 1, uni->resource.length - 1);
+    uni->body = PSYC_STRING(uni->host.data,
+			    length - uni->scheme.length - 1 - uni->slashes.length);
 
-    } else
-	return PSYC_PARSE_UNIFORM_INVALID_SCHEME;
+    if (uni->slash.length) {
+	uni->path.data = uni->slash.data;
+	uni->path.length = length - uni->root.length;
+    }
 
-    if (uni->host.length == 0)
-	return PSYC_PARSE_UNIFORM_INVALID_HOST;
+    if (uni->resource.length)
+	uni->nick = PSYC_STRING(uni->resource.data + 1, uni->resource.length - 1);
 
     uni->valid = 1;
     return uni->type;
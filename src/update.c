@@ -0,0 +1,1288 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+/**
+ * An update is prepared by scanning the rendered value up to the element at
+ * the end of the index path, without keeping the elements scanned. The
+ * elements of the list or dict updated stay where they are, only the
+ * element replaced, removed or appended becomes an edit.
+ *
+ * An element nested deeper is updated in a copy of the value of the element
+ * containing it, which then replaces that value, and so on up the path.
+ *
+ * Edits are spliced in place: bytes moving back are moved first, from the
+ * front, then those moving forward, from the back, so no byte is overwritten
+ * before it's moved. Then the inserted parts are rendered into the gaps.
+ */
+
+#include "lib.h"
+#include <stdlib.h>
+#include <psyc/parse.h>
+#include <psyc/render.h>
+#include <psyc/update.h>
+
+/** Longest index path of an update. */
+#define UPDATE_MAX_DEPTH 16
+
+/** Element of a list or entry of a dict in a rendered value. */
+typedef struct {
+    size_t start;		///< Offset of the raw element or entry.
+    size_t mid;			///< Offset after the key of a dict entry.
+    size_t end;			///< Offset after it.
+    PsycString key;		///< Key of a dict entry.
+    PsycString type;		///< Type of the element.
+    PsycString value;		///< Value of the element.
+    uint8_t taken;		///< Matched an element removed already.
+} Span;
+
+/** Spans of a value, the first ones in local. */
+typedef struct {
+    Span *spans;
+    size_t n;
+    size_t size;
+    Span local[16];
+} Spans;
+
+/** Scanner of the elements of a rendered list or dict. */
+typedef struct {
+    PsycType type;
+    size_t len;
+    uint8_t done;
+    union {
+	PsycParseListState list;
+	PsycParseDictState dict;
+    } p;
+} Scan;
+
+/** Step of an index path. */
+typedef struct {
+    PsycParseUpdateRC kind;	///< INDEX_LIST, INDEX_DICT or INDEX_STRUCT.
+    size_t index;		///< Index in a list.
+    PsycString key;		///< Key in a dict.
+} Step;
+
+/** Parsed update modifier. */
+typedef struct {
+    Step path[UPDATE_MAX_DEPTH];
+    size_t depth;
+    char oper;
+    PsycString type;
+    PsycString value;
+} Update;
+
+/** What an update does to the element at the end of its path. */
+typedef enum {
+    ACTION_NONE,
+    ACTION_SET,
+    ACTION_REMOVE,
+    ACTION_MODIFY,
+} Action;
+
+/** Memory of a nested value rendered again. */
+typedef struct Block {
+    struct Block *next;
+    char data[];
+} Block;
+
+/** Ways of changing one list or dict into another. */
+typedef enum {
+    PLAN_ASSIGN,		///< '=' the whole value.
+    PLAN_MODIFY,		///< '-' the elements removed, '+' those added.
+    PLAN_INDEX,			///< '@' each element changed.
+} Plan;
+
+/** Modifiers of a diff, their values rendered one after the other. */
+typedef struct {
+    PsycModifier *mods;
+    size_t n;			///< Number of modifiers.
+    size_t size;		///< Number of modifiers allocated.
+    char *buffer;		///< Buffer of the values, NULL to count only.
+    size_t buflen;
+    size_t used;		///< Bytes of the values.
+    size_t start;		///< Offset of the value of the next modifier.
+    PsycString name;		///< Name of the variable.
+} Diff;
+
+static void
+scan_init (Scan *s, PsycType type, const char *data, size_t len)
+{
+    s->type = type;
+    s->len = len;
+    s->done = !len;
+    if (type == PSYC_TYPE_LIST) {
+	psyc_parse_list_state_init(&s->p.list);
+	psyc_parse_list_buffer_set(&s->p.list, (char *)data, len);
+    } else {
+	psyc_parse_dict_state_init(&s->p.dict);
+	psyc_parse_dict_buffer_set(&s->p.dict, (char *)data, len);
+    }
+}
+
+/**
+ * Get the next element of a list.
+ *
+ * @return 1, 0 at the end, -1 if the list is invalid.
+ */
+static int
+scan_list (Scan *s, Span *span)
+{
+    PsycString type, elem;
+    size_t start;
+    int ret;
+
+    for (;;) {
+	start = s->p.list.cursor;
+	switch (ret = psyc_parse_list(&s->p.list, &type, &elem)) {
+	case PSYC_PARSE_LIST_TYPE:
+	    break;
+	case PSYC_PARSE_LIST_ELEM:
+	case PSYC_PARSE_LIST_ELEM_LAST:
+	    s->done = ret == PSYC_PARSE_LIST_ELEM_LAST;
+	    span->start = span->mid = start;
+	    span->end = s->done ? s->len : s->p.list.cursor;
+	    span->key = (PsycString){0, NULL};
+	    span->type = type;
+	    span->value = elem;
+	    span->taken = 0;
+	    return 1;
+	case PSYC_PARSE_LIST_END:
+	    s->done = 1;
+	    return 0;
+	default:
+	    return -1;
+	}
+    }
+}
+
+/**
+ * Get the next entry of a dict.
+ *
+ * @see scan_list()
+ */
+static int
+scan_dict (Scan *s, Span *span)
+{
+    PsycString type, elem;
+    size_t start;
+    uint8_t key = 0;
+    int ret;
+
+    for (;;) {
+	start = s->p.dict.cursor;
+	switch (ret = psyc_parse_dict(&s->p.dict, &type, &elem)) {
+	case PSYC_PARSE_DICT_TYPE:
+	    break;
+	case PSYC_PARSE_DICT_KEY:
+	    if (key)
+		return -1;
+	    key = 1;
+	    span->start = start;
+	    span->mid = s->p.dict.cursor + 1;
+	    span->key = elem;
+	    break;
+	case PSYC_PARSE_DICT_VALUE:
+	case PSYC_PARSE_DICT_VALUE_LAST:
+	    if (!key)
+		return -1;
+	    s->done = ret == PSYC_PARSE_DICT_VALUE_LAST;
+	    span->end = s->done ? s->len : s->p.dict.cursor;
+	    span->type = type;
+	    span->value = elem;
+	    span->taken = 0;
+	    return 1;
+	case PSYC_PARSE_DICT_END:
+	    s->done = 1;
+	    return key ? -1 : 0;
+	default:
+	    return -1;
+	}
+    }
+}
+
+static inline int
+scan_next (Scan *s, Span *span)
+{
+    if (s->done)
+	return 0;
+    return s->type == PSYC_TYPE_LIST ? scan_list(s, span) : scan_dict(s, span);
+}
+
+static inline void
+spans_init (Spans *s)
+{
+    s->spans = s->local;
+    s->n = 0;
+    s->size = PSYC_NUM_ELEM(s->local);
+}
+
+static inline void
+spans_free (Spans *s)
+{
+    if (s->spans != s->local)
+	free(s->spans);
+}
+
+/**
+ * Find all elements of a list or entries of a dict.
+ *
+ * @return 0, -1 if the value is invalid, -2 if out of memory.
+ */
+static int
+spans_scan (Spans *s, PsycType type, const char *data, size_t len)
+{
+    Span *spans;
+    Scan scan;
+    int ret;
+
+    scan_init(&scan, type, data, len);
+    for (;;) {
+	if (s->n == s->size) {
+	    if (s->spans == s->local) {
+		if ((spans = malloc(s->size * 2 * sizeof(Span))))
+		    memcpy(spans, s->local, sizeof(s->local));
+	    } else
+		spans = realloc(s->spans, s->size * 2 * sizeof(Span));
+	    if (!spans)
+		return -2;
+	    s->spans = spans;
+	    s->size *= 2;
+	}
+	if ((ret = scan_next(&scan, &s->spans[s->n])) <= 0)
+	    return ret;
+	s->n++;
+    }
+}
+
+static inline int
+str_eq (const PsycString *a, const PsycString *b)
+{
+    return a->length == b->length
+	&& (!a->length || !memcmp(a->data, b->data, a->length));
+}
+
+/**
+ * Check if two spans are the same list element or have the same dict key.
+ */
+static inline int
+span_eq (const Span *a, const Span *b, PsycType type)
+{
+    return type == PSYC_TYPE_DICT ? str_eq(&a->key, &b->key)
+	: str_eq(&a->value, &b->value) && str_eq(&a->type, &b->type);
+}
+
+/**
+ * Guess if a value is a list or a dict from the element type or the first
+ * byte after the type of the value.
+ */
+static PsycType
+value_type (const PsycString *type, const PsycString *value)
+{
+    PsycType t = type->length ? psyc_var_type(PSYC_S2ARG(*type)) : PSYC_TYPE_UNKNOWN;
+    size_t i = 0;
+
+    if (t == PSYC_TYPE_LIST || t == PSYC_TYPE_DICT)
+	return t;
+    while (i < value->length && psyc_is_kw_char(value->data[i]))
+	i++;
+    if (i < value->length && value->data[i] == '|')
+	return PSYC_TYPE_LIST;
+    if (i < value->length && value->data[i] == '{')
+	return PSYC_TYPE_DICT;
+    return PSYC_TYPE_UNKNOWN;
+}
+
+static inline ptrdiff_t
+edit_growth (const PsycUpdateEdit *e)
+{
+    return (ptrdiff_t)e->length - (ptrdiff_t)(e->end - e->start);
+}
+
+/**
+ * Add an edit after the others.
+ */
+static PsycUpdateEdit *
+edit_push (PsycUpdate *u, PsycUpdateEditKind kind, size_t start, size_t end)
+{
+    PsycUpdateEdit *edits = u->edits, *e;
+
+    if (u->n == u->size) {
+	if (edits == u->local) {
+	    if ((edits = malloc(u->size * 2 * sizeof(PsycUpdateEdit))))
+		memcpy(edits, u->local, sizeof(u->local));
+	} else
+	    edits = realloc(edits, u->size * 2 * sizeof(PsycUpdateEdit));
+	if (!edits)
+	    return NULL;
+	u->edits = edits;
+	u->size *= 2;
+    }
+    e = &edits[u->n++];
+    memset(e, 0, sizeof(PsycUpdateEdit));
+    e->kind = kind;
+    e->start = start;
+    e->end = end;
+    return e;
+}
+
+/**
+ * Set what an edit inserts and its length.
+ */
+static void
+edit_set (PsycUpdateEdit *e, const PsycString *key,
+	  const PsycString *type, const PsycString *value)
+{
+    PsycElem *elem = &e->elem;
+
+    elem->type = *type;
+    elem->value = *value;
+    switch (e->kind) {
+    case PSYC_UPDATE_EDIT_RAW:
+	e->length = value->length;
+	return;
+    case PSYC_UPDATE_EDIT_ELEM:
+	elem->flag = psyc_elem_length_check(&elem->value, '|');
+	elem->length = psyc_elem_length(elem);
+	e->length = 1 + elem->length;
+	return;
+    default:
+	elem->flag = psyc_elem_length_check(&elem->value, '{');
+	elem->length = psyc_elem_length(elem);
+	e->length = elem->length;
+	if (e->kind == PSYC_UPDATE_EDIT_ENTRY) {
+	    e->key = *key;
+	    e->length += 2 + key->length;
+	    if (psyc_elem_length_check(&e->key, '}') == PSYC_ELEM_NEED_LENGTH)
+		e->length += psyc_num_length(key->length) + 1;
+	}
+    }
+}
+
+static void
+edit_render (const PsycUpdateEdit *e, char *buffer)
+{
+    PsycElem elem = e->elem;
+    size_t cur = 0;
+
+    switch (e->kind) {
+    case PSYC_UPDATE_EDIT_RAW:
+	if (elem.value.length)
+	    memcpy(buffer, PSYC_S2ARG(elem.value));
+	return;
+    case PSYC_UPDATE_EDIT_ELEM:
+	buffer[cur++] = '|';
+	break;
+    case PSYC_UPDATE_EDIT_ENTRY:
+	buffer[cur++] = '{';
+	if (psyc_elem_length_check((PsycString *)&e->key, '}')
+	    == PSYC_ELEM_NEED_LENGTH) {
+	    cur += psyc_num_render(e->key.length, buffer + cur);
+	    buffer[cur++] = ' ';
+	}
+	memcpy(buffer + cur, PSYC_S2ARG(e->key));
+	cur += e->key.length;
+	buffer[cur++] = '}';
+	break;
+    case PSYC_UPDATE_EDIT_VALUE:
+	break;
+    }
+    psyc_render_elem(&elem, buffer + cur, elem.length);
+}
+
+static inline void
+update_init (PsycUpdate *u)
+{
+    u->edits = u->local;
+    u->n = 0;
+    u->size = PSYC_NUM_ELEM(u->local);
+    u->length = 0;
+    u->mem = NULL;
+}
+
+/**
+ * Set the length of the value after the update.
+ */
+static PsycUpdateRC
+update_done (PsycUpdate *u, size_t len)
+{
+    size_t i;
+
+    u->length = len;
+    for (i = 0; i < u->n; i++)
+	u->length += edit_growth(&u->edits[i]);
+    return u->n ? PSYC_UPDATE_CHANGED : PSYC_UPDATE_UNCHANGED;
+}
+
+
+/**
+ * Parse an update modifier.
+ */
+static PsycUpdateRC
+update_parse (Update *up, const char *buffer, size_t len)
+{
+    PsycParseUpdateState p;
+    PsycParseUpdateRC ret;
+    PsycString value;
+    Step *step;
+    char oper = 0;
+
+    psyc_parse_update_state_init(&p);
+    psyc_parse_update_buffer_set(&p, buffer, len);
+    up->depth = 0;
+    up->type = up->value = (PsycString){0, NULL};
+
+    for (;;) {
+	switch (ret = psyc_parse_update(&p, &oper, &value)) {
+	case PSYC_PARSE_UPDATE_INDEX_LIST:
+	case PSYC_PARSE_UPDATE_INDEX_DICT:
+	case PSYC_PARSE_UPDATE_INDEX_STRUCT:
+	    if (up->depth == UPDATE_MAX_DEPTH)
+		return PSYC_UPDATE_ERROR_PATH;
+	    step = &up->path[up->depth++];
+	    step->kind = ret;
+	    step->index = value.length;
+	    step->key = value;
+	    break;
+	case PSYC_PARSE_UPDATE_TYPE:
+	    up->type = value;
+	    break;
+	case PSYC_PARSE_UPDATE_TYPE_END: // type at the end of the buffer
+	    up->type = value;
+	    // fall thru
+	case PSYC_PARSE_UPDATE_VALUE: // the rest of the buffer without a length
+	    if (ret == PSYC_PARSE_UPDATE_VALUE)
+		up->value = value;
+	    // fall thru
+	case PSYC_PARSE_UPDATE_END:
+	    up->oper = oper;
+	    return up->depth && oper ? PSYC_UPDATE_UNCHANGED : PSYC_UPDATE_ERROR;
+	default:
+	    return PSYC_UPDATE_ERROR;
+	}
+    }
+}
+
+/**
+ * Decide what an update does to the element at the end of its path,
+ * t is NULL if it's missing.
+ *
+ * @return Action, or PSYC_UPDATE_ERROR_OPERATOR.
+ */
+static int
+update_action (const Update *up, const Span *t)
+{
+    switch (up->oper) {
+    case PSYC_OPERATOR_SET:
+    case PSYC_OPERATOR_QUERY:
+	return ACTION_NONE;
+    case PSYC_OPERATOR_ASSIGN:
+	if (t && str_eq(&t->type, &up->type) && str_eq(&t->value, &up->value))
+	    return ACTION_NONE;
+	return ACTION_SET;
+    case PSYC_OPERATOR_AUGMENT:
+	if (!t)
+	    return ACTION_SET;
+	return up->value.length ? ACTION_MODIFY : ACTION_NONE;
+    case PSYC_OPERATOR_DIMINISH:
+	if (!t)
+	    return ACTION_NONE;
+	return up->value.length ? ACTION_MODIFY : ACTION_REMOVE;
+    default:
+	return PSYC_UPDATE_ERROR_OPERATOR;
+    }
+}
+
+/**
+ * Add the edits adding or removing the elements of mod to a list or dict.
+ *
+ * @return 0 or a PsycUpdateRC error.
+ */
+static PsycUpdateRC
+update_modify (PsycUpdate *u, PsycType type, const char *value, size_t len,
+	       char oper, const char *mod, size_t modlen)
+{
+    PsycString empty = {0, NULL}, add;
+    PsycUpdateEdit *e;
+    Spans m;
+    Span cur;
+    Scan scan;
+    size_t i, n = 0, removed = 0, left;
+    int r;
+
+    spans_init(&m);
+    if ((r = spans_scan(&m, type, mod, modlen)))
+	goto end;
+
+    if (len && (oper == PSYC_OPERATOR_DIMINISH || type == PSYC_TYPE_DICT)) {
+	// a list element is removed once for each time it's given,
+	// dict entries are removed by key, to be replaced when augmenting;
+	// a list is scanned only until all elements given are found
+	scan_init(&scan, type, value, len);
+	left = type == PSYC_TYPE_LIST ? m.n : SIZE_MAX;
+	while (left && (r = scan_next(&scan, &cur)) > 0) {
+	    n++;
+	    for (i = 0; i < m.n; i++)
+		if (!m.spans[i].taken && span_eq(&m.spans[i], &cur, type)) {
+		    if (!(e = edit_push(u, PSYC_UPDATE_EDIT_RAW, cur.start, cur.end))) {
+			r = -2;
+			goto end;
+		    }
+		    edit_set(e, NULL, &empty, &empty);
+		    if (type == PSYC_TYPE_LIST) {
+			m.spans[i].taken = 1;
+			left--;
+		    }
+		    removed++;
+		    break;
+		}
+	}
+	if (r < 0)
+	    goto end;
+	r = 0;
+	if (removed == n && scan_next(&scan, &cur) == 0)
+	    n = 0; // nothing is left, not even the type
+    }
+
+    add = (PsycString){modlen, (char *)mod};
+    if (removed && !n) {
+	u->n = 0;
+	e = edit_push(u, PSYC_UPDATE_EDIT_RAW, 0, len);
+	if (oper == PSYC_OPERATOR_AUGMENT && m.n)
+	    edit_set(e, NULL, &empty, &add);
+	else
+	    edit_set(e, NULL, &empty, &empty);
+    } else if (oper == PSYC_OPERATOR_AUGMENT && m.n) {
+	// without a value to add to, the type of the addition is kept
+	if (len) {
+	    add.data += m.spans[0].start;
+	    add.length -= m.spans[0].start;
+	}
+	if (!(e = edit_push(u, PSYC_UPDATE_EDIT_RAW, len, len))) {
+	    r = -2;
+	    goto end;
+	}
+	edit_set(e, NULL, &empty, &add);
+    }
+
+end:
+    spans_free(&m);
+    if (r)
+	return r == -1 ? PSYC_UPDATE_ERROR_VALUE : PSYC_UPDATE_ERROR_MEMORY;
+    return PSYC_UPDATE_UNCHANGED;
+}
+
+static PsycUpdateRC
+update_at (PsycUpdate *u, const Update *up, const Step *step,
+	   const char *data, size_t len);
+
+/**
+ * Add the edit replacing the value of element t of a list or dict with the
+ * value updated by the rest of the path, or by the elements added or
+ * removed if it's the end of the path.
+ *
+ * @return 0 or a PsycUpdateRC error.
+ */
+static PsycUpdateRC
+update_nested (PsycUpdate *u, const Update *up, const Step *step,
+	       const Span *t, PsycType kind)
+{
+    PsycUpdate sub;
+    PsycUpdateEdit *e;
+    PsycString type, value;
+    PsycType vtype;
+    PsycUpdateRC ret;
+    Block *b;
+
+    update_init(&sub);
+    if (step)
+	ret = update_at(&sub, up, step, t->value.data, t->value.length);
+    else if ((vtype = value_type(&t->type, &t->value)) == PSYC_TYPE_UNKNOWN
+	     && (vtype = value_type(&up->type, &up->value)) == PSYC_TYPE_UNKNOWN)
+	ret = PSYC_UPDATE_ERROR_VALUE;
+    else
+	ret = update_modify(&sub, vtype, PSYC_S2ARG(t->value), up->oper,
+			    PSYC_S2ARG(up->value));
+    if (ret || update_done(&sub, t->value.length) == PSYC_UPDATE_UNCHANGED)
+	goto end;
+
+    // the type is copied too, the element is overwritten when spliced
+    b = malloc(sizeof(Block) + t->type.length
+	       + (sub.length > t->value.length ? sub.length : t->value.length));
+    if (!b || !(e = edit_push(u, kind == PSYC_TYPE_LIST ? PSYC_UPDATE_EDIT_ELEM
+			      : PSYC_UPDATE_EDIT_VALUE, t->mid, t->end))) {
+	free(b);
+	ret = PSYC_UPDATE_ERROR_MEMORY;
+	goto end;
+    }
+    b->next = u->mem;
+    u->mem = b;
+    type = (PsycString){t->type.length, b->data};
+    value = (PsycString){sub.length, b->data + type.length};
+    if (type.length)
+	memcpy(type.data, PSYC_S2ARG(t->type));
+    if (t->value.length)
+	memcpy(value.data, PSYC_S2ARG(t->value));
+    psyc_update_splice(&sub, value.data, t->value.length);
+    edit_set(e, NULL, &type, &value);
+
+end:
+    psyc_update_free(&sub);
+    return ret;
+}
+
+/**
+ * Add the edits of an update to a list or dict, from this step of its path.
+ *
+ * @return 0 or a PsycUpdateRC error.
+ */
+static PsycUpdateRC
+update_at (PsycUpdate *u, const Update *up, const Step *step,
+	   const char *data, size_t len)
+{
+    PsycType type = step->kind == PSYC_PARSE_UPDATE_INDEX_LIST
+	? PSYC_TYPE_LIST : PSYC_TYPE_DICT;
+    PsycString empty = {0, NULL};
+    PsycUpdateEdit *e;
+    Span span, *t = NULL;
+    Scan scan;
+    size_t i = 0;
+    int r;
+
+    if (step->kind == PSYC_PARSE_UPDATE_INDEX_STRUCT)
+	return PSYC_UPDATE_ERROR_PATH;
+
+    scan_init(&scan, type, data, len);
+    while ((r = scan_next(&scan, &span)) > 0)
+	if (type == PSYC_TYPE_LIST ? i++ == step->index
+	    : str_eq(&span.key, &step->key)) {
+	    t = &span;
+	    break;
+	}
+    if (r < 0)
+	return PSYC_UPDATE_ERROR_VALUE;
+
+    if (step < up->path + up->depth - 1) {
+	if (!t)
+	    return PSYC_UPDATE_ERROR_PATH;
+	return update_nested(u, up, step + 1, t, type);
+    }
+
+    if (!t && type == PSYC_TYPE_LIST && step->index > i)
+	return PSYC_UPDATE_ERROR_PATH;
+    switch (r = update_action(up, t)) {
+    case ACTION_SET:
+	if (t)
+	    e = edit_push(u, type == PSYC_TYPE_LIST ? PSYC_UPDATE_EDIT_ELEM
+			  : PSYC_UPDATE_EDIT_VALUE, t->mid, t->end);
+	else
+	    e = edit_push(u, type == PSYC_TYPE_LIST ? PSYC_UPDATE_EDIT_ELEM
+			  : PSYC_UPDATE_EDIT_ENTRY, len, len);
+	if (!e)
+	    return PSYC_UPDATE_ERROR_MEMORY;
+	edit_set(e, &step->key, &up->type, &up->value);
+	return PSYC_UPDATE_UNCHANGED;
+    case ACTION_REMOVE:
+	if (!(e = edit_push(u, PSYC_UPDATE_EDIT_RAW, t->start, t->end)))
+	    return PSYC_UPDATE_ERROR_MEMORY;
+	edit_set(e, NULL, &empty, &empty);
+	return PSYC_UPDATE_UNCHANGED;
+    case ACTION_MODIFY:
+	return update_nested(u, up, NULL, t, type);
+    default:
+	return r;
+    }
+}
+
+PsycUpdateRC
+psyc_update_prepare (PsycUpdate *u, const char *value, size_t len,
+		     const char *update, size_t updatelen)
+{
+    PsycUpdateRC ret;
+    Update up;
+
+    update_init(u);
+    if ((ret = update_parse(&up, update, updatelen))
+	|| (ret = update_at(u, &up, up.path, value, len)))
+	return ret;
+    return update_done(u, len);
+}
+
+PsycUpdateRC
+psyc_update_modify (PsycUpdate *u, PsycType type, const char *value, size_t len,
+		    char oper, const char *mod, size_t modlen)
+{
+    PsycUpdateRC ret;
+
+    update_init(u);
+    if (type != PSYC_TYPE_LIST && type != PSYC_TYPE_DICT)
+	return PSYC_UPDATE_ERROR_VALUE;
+    if (oper != PSYC_OPERATOR_AUGMENT && oper != PSYC_OPERATOR_DIMINISH)
+	return PSYC_UPDATE_ERROR_OPERATOR;
+    if ((ret = update_modify(u, type, value, len, oper, mod, modlen)))
+	return ret;
+    return update_done(u, len);
+}
+
+void
+psyc_update_splice (const PsycUpdate *u, char *value, size_t len)
+{
+    const PsycUpdateEdit *e, *end = u->edits + u->n;
+    ptrdiff_t shift = 0;
+    size_t from, to;
+
+    // the bytes after each edit move by the growth of the edits before them
+    for (e = u->edits; e < end; e++) {
+	shift += edit_growth(e);
+	from = e->end;
+	to = e + 1 < end ? e[1].start : len;
+	if (shift < 0)
+	    memmove(value + from + shift, value + from, to - from);
+    }
+    for (e = end; e-- > u->edits;) {
+	from = e->end;
+	to = e + 1 < end ? e[1].start : len;
+	if (shift > 0)
+	    memmove(value + from + shift, value + from, to - from);
+	shift -= edit_growth(e);
+    }
+    for (e = u->edits; e < end; e++) {
+	edit_render(e, value + e->start + shift);
+	shift += edit_growth(e);
+    }
+}
+
+void
+psyc_update_free (PsycUpdate *u)
+{
+    Block *b, *next;
+
+    if (u->edits != u->local)
+	free(u->edits);
+    for (b = u->mem; b; b = next) {
+	next = b->next;
+	free(b);
+    }
+    update_init(u);
+}
+
+PsycUpdateRC
+psyc_update_apply (char *value, size_t *len, size_t size,
+		   const char *update, size_t updatelen)
+{
+    PsycUpdate u;
+    PsycUpdateRC ret = psyc_update_prepare(&u, value, *len, update, updatelen);
+
+    if (ret == PSYC_UPDATE_CHANGED) {
+	if (u.length > size)
+	    ret = PSYC_UPDATE_ERROR_SIZE;
+	else {
+	    psyc_update_splice(&u, value, *len);
+	    *len = u.length;
+	}
+    }
+    psyc_update_free(&u);
+    return ret;
+}
+
+PsycUpdateRC
+psyc_update_list (PsycList *list, size_t size,
+		  const char *update, size_t updatelen)
+{
+    Update up;
+    Span span, *t = NULL;
+    size_t i;
+    int ret;
+
+    if ((ret = update_parse(&up, update, updatelen)))
+	return ret;
+    if (up.depth != 1 || up.path[0].kind != PSYC_PARSE_UPDATE_INDEX_LIST
+	|| (i = up.path[0].index) > list->num_elems)
+	return PSYC_UPDATE_ERROR_PATH;
+    if (i < list->num_elems) {
+	span.type = list->elems[i].type;
+	span.value = list->elems[i].value;
+	t = &span;
+    }
+
+    switch (ret = update_action(&up, t)) {
+    case ACTION_SET:
+	if (!t && list->num_elems++ == size) {
+	    list->num_elems--;
+	    return PSYC_UPDATE_ERROR_SIZE;
+	}
+	list->elems[i] = PSYC_ELEM(up.type.data, up.type.length,
+				   up.value.data, up.value.length,
+				   PSYC_ELEM_CHECK_LENGTH);
+	break;
+    case ACTION_REMOVE:
+	list->num_elems--;
+	memmove(list->elems + i, list->elems + i + 1,
+		(list->num_elems - i) * sizeof(PsycElem));
+	break;
+    case ACTION_MODIFY: // the value of the element would have to be rendered
+	return PSYC_UPDATE_ERROR_OPERATOR;
+    default:
+	return ret;
+    }
+    psyc_list_length_set(list);
+    return PSYC_UPDATE_CHANGED;
+}
+
+PsycUpdateRC
+psyc_update_dict (PsycDict *dict, size_t size,
+		  const char *update, size_t updatelen)
+{
+    Update up;
+    Span span, *t = NULL;
+    size_t i;
+    int ret;
+
+    if ((ret = update_parse(&up, update, updatelen)))
+	return ret;
+    if (up.depth != 1 || up.path[0].kind != PSYC_PARSE_UPDATE_INDEX_DICT)
+	return PSYC_UPDATE_ERROR_PATH;
+    for (i = 0; i < dict->num_elems; i++)
+	if (str_eq(&dict->elems[i].key.value, &up.path[0].key)) {
+	    span.type = dict->elems[i].value.type;
+	    span.value = dict->elems[i].value.value;
+	    t = &span;
+	    break;
+	}
+
+    switch (ret = update_action(&up, t)) {
+    case ACTION_SET:
+	if (!t) {
+	    if (dict->num_elems == size)
+		return PSYC_UPDATE_ERROR_SIZE;
+	    dict->num_elems++;
+	    dict->elems[i].key = PSYC_DICT_KEY(up.path[0].key.data,
+					       up.path[0].key.length,
+					       PSYC_ELEM_CHECK_LENGTH);
+	}
+	dict->elems[i].value = PSYC_ELEM(up.type.data, up.type.length,
+					 up.value.data, up.value.length,
+					 PSYC_ELEM_CHECK_LENGTH);
+	break;
+    case ACTION_REMOVE:
+	dict->num_elems--;
+	memmove(dict->elems + i, dict->elems + i + 1,
+		(dict->num_elems - i) * sizeof(PsycDictElem));
+	break;
+    case ACTION_MODIFY:
+	return PSYC_UPDATE_ERROR_OPERATOR;
+    default:
+	return ret;
+    }
+    psyc_dict_length_set(dict);
+    return PSYC_UPDATE_CHANGED;
+}
+
+static void
+diff_init (Diff *d, const char *name, size_t namelen,
+	   PsycModifier *mods, size_t size, char *buffer, size_t buflen)
+{
+    d->mods = mods;
+    d->n = 0;
+    d->size = size;
+    d->buffer = buffer;
+    d->buflen = buflen;
+    d->used = 0;
+    d->start = 0;
+    d->name = PSYC_STRING((char *)name, namelen);
+}
+
+static void
+diff_put (Diff *d, const char *data, size_t len)
+{
+    if (d->buffer && len && d->used + len <= d->buflen)
+	memcpy(d->buffer + d->used, data, len);
+    d->used += len;
+}
+
+static void
+diff_num (Diff *d, size_t n)
+{
+    char num[24];
+    diff_put(d, num, psyc_num_render(n, num));
+}
+
+/**
+ * Add a list element after its delimiter, or the value of a dict entry.
+ */
+static void
+diff_elem (Diff *d, const char *delim, PsycElem *elem)
+{
+    if (delim)
+	diff_put(d, delim, 1);
+    if (d->buffer && d->used + elem->length <= d->buflen)
+	psyc_render_elem(elem, d->buffer + d->used, elem->length);
+    d->used += elem->length;
+}
+
+/**
+ * Add a dict key, with its length if it needs one or contains a space.
+ */
+static void
+diff_key (Diff *d, PsycString *key)
+{
+    diff_put(d, "{", 1);
+    if (psyc_elem_length_check(key, '}') == PSYC_ELEM_NEED_LENGTH
+	|| (key->length && memchr(key->data, ' ', key->length))) {
+	diff_num(d, key->length);
+	diff_put(d, " ", 1);
+    }
+    diff_put(d, PSYC_S2ARG(*key));
+    diff_put(d, "}", 1);
+}
+
+/**
+ * End the value of a modifier.
+ */
+static void
+diff_mod (Diff *d, char oper)
+{
+    if (d->buffer && d->n < d->size && d->used <= d->buflen)
+	psyc_modifier_init(&d->mods[d->n], (PsycOperator)oper,
+			   (char *)d->name.data, d->name.length,
+			   d->buffer + d->start, d->used - d->start,
+			   PSYC_MODIFIER_CHECK_LENGTH);
+    d->n++;
+    d->start = d->used;
+}
+
+/**
+ * End an update modifier after its index path, setting the element
+ * or removing it if elem is NULL.
+ */
+static void
+diff_update (Diff *d, PsycElem *elem)
+{
+    if (!elem) {
+	diff_put(d, " -", 2);
+	diff_mod(d, PSYC_OPERATOR_UPDATE);
+	return;
+    }
+    diff_put(d, " =", 2);
+    diff_put(d, PSYC_S2ARG(elem->type));
+    if (elem->value.length) {
+	diff_put(d, " ", 1);
+	diff_put(d, PSYC_S2ARG(elem->value));
+    }
+    diff_mod(d, PSYC_OPERATOR_UPDATE);
+}
+
+/**
+ * Bytes of the modifiers rendered, without the length of long values.
+ */
+static inline size_t
+diff_cost (const Diff *d)
+{
+    return d->used + d->n * (d->name.length + 3);
+}
+
+static inline int
+elem_eq (const PsycElem *a, const PsycElem *b)
+{
+    return str_eq(&a->value, &b->value) && str_eq(&a->type, &b->type);
+}
+
+/**
+ * Find the elements of from kept by '-' when the others are removed, those
+ * that are the longest start of to, the rest of which is added by '+'.
+ *
+ * @return Number of elements kept, or -1 if '-' would remove other elements
+ *         than these.
+ */
+static ptrdiff_t
+diff_list_keep (PsycList *from, PsycList *to, uint8_t *keep)
+{
+    size_t i, j, k = 0;
+
+    for (i = 0; i < from->num_elems; i++)
+	if ((keep[i] = k < to->num_elems
+	     && elem_eq(&from->elems[i], &to->elems[k])))
+	    k++;
+
+    // '-' removes the first ones of the same elements, none may be kept
+    for (i = 0; i < from->num_elems; i++)
+	if (!keep[i])
+	    for (j = 0; j < i; j++)
+		if (keep[j] && elem_eq(&from->elems[j], &from->elems[i]))
+		    return -1;
+    return k;
+}
+
+/**
+ * Add the modifiers of a plan changing a list.
+ *
+ * @return 0, or -1 if the plan can't change from into to.
+ */
+static int
+diff_list (Diff *d, Plan plan, PsycList *from, PsycList *to,
+	   const uint8_t *keep, ptrdiff_t kept)
+{
+    size_t i, n = from->num_elems, m = to->num_elems;
+
+    switch (plan) {
+    case PLAN_ASSIGN:
+	diff_put(d, PSYC_S2ARG(to->type));
+	for (i = 0; i < m; i++)
+	    diff_elem(d, "|", &to->elems[i]);
+	diff_mod(d, PSYC_OPERATOR_ASSIGN);
+	return 0;
+
+    case PLAN_MODIFY:
+	if (kept < 0 || !(str_eq(&from->type, &to->type)
+			  || (!n && !from->type.length)))
+	    return -1;
+	// removing all elements removes the type as well
+	if (n && !kept && m == 0 && to->type.length)
+	    return -1;
+	if ((size_t)kept < n) {
+	    for (i = 0; i < n; i++)
+		if (!keep[i])
+		    diff_elem(d, "|", &from->elems[i]);
+	    diff_mod(d, PSYC_OPERATOR_DIMINISH);
+	}
+	if ((size_t)kept < m) {
+	    diff_put(d, PSYC_S2ARG(to->type));
+	    for (i = kept; i < m; i++)
+		diff_elem(d, "|", &to->elems[i]);
+	    diff_mod(d, PSYC_OPERATOR_AUGMENT);
+	}
+	return 0;
+
+    case PLAN_INDEX:
+	if (!str_eq(&from->type, &to->type))
+	    return -1;
+	for (i = 0; i < n && i < m; i++)
+	    if (!elem_eq(&from->elems[i], &to->elems[i])) {
+		diff_put(d, "#", 1);
+		diff_num(d, i);
+		diff_update(d, &to->elems[i]);
+	    }
+	for (i = n; i > m; i--) { // from the last one, the others stay in place
+	    diff_put(d, "#", 1);
+	    diff_num(d, i - 1);
+	    diff_update(d, NULL);
+	}
+	for (i = n; i < m; i++) {
+	    diff_put(d, "#", 1);
+	    diff_num(d, i);
+	    diff_update(d, &to->elems[i]);
+	}
+	return 0;
+    }
+    return -1;
+}
+
+PsycUpdateRC
+psyc_update_diff_list (PsycList *from, PsycList *to,
+		       const char *name, size_t namelen,
+		       PsycModifier *mods, size_t *nmods,
+		       char *buffer, size_t buflen)
+{
+    Diff d;
+    Plan plan, best = PLAN_ASSIGN;
+    uint8_t *keep = NULL;
+    ptrdiff_t kept = -1;
+    size_t i, cost;
+
+    psyc_list_length_set(from);
+    psyc_list_length_set(to);
+
+    if (str_eq(&from->type, &to->type) && from->num_elems == to->num_elems) {
+	for (i = 0; i < from->num_elems; i++)
+	    if (!elem_eq(&from->elems[i], &to->elems[i]))
+		break;
+	if (i == from->num_elems) {
+	    *nmods = 0;
+	    return PSYC_UPDATE_UNCHANGED;
+	}
+    }
+
+    if (from->num_elems) {
+	if (!(keep = malloc(from->num_elems)))
+	    return PSYC_UPDATE_ERROR_MEMORY;
+	kept = diff_list_keep(from, to, keep);
+    } else
+	kept = 0;
+
+    // count the bytes of each plan, then render the smallest one
+    diff_init(&d, name, namelen, NULL, 0, NULL, 0);
+    diff_list(&d, PLAN_ASSIGN, from, to, keep, kept);
+    cost = diff_cost(&d);
+    for (plan = PLAN_MODIFY; plan <= PLAN_INDEX; plan++) {
+	diff_init(&d, name, namelen, NULL, 0, NULL, 0);
+	if (diff_list(&d, plan, from, to, keep, kept) == 0
+	    && d.n <= *nmods && diff_cost(&d) < cost) {
+	    best = plan;
+	    cost = diff_cost(&d);
+	}
+    }
+
+    diff_init(&d, name, namelen, mods, *nmods, buffer, buflen);
+    diff_list(&d, best, from, to, keep, kept);
+    free(keep);
+    if (d.n > *nmods || d.used > buflen)
+	return PSYC_UPDATE_ERROR_SIZE;
+    *nmods = d.n;
+    return PSYC_UPDATE_CHANGED;
+}
+
+static int
+dict_entry_cmp (const void *a, const void *b)
+{
+    const PsycString *x = &(*(PsycDictElem *const *)a)->key.value;
+    const PsycString *y = &(*(PsycDictElem *const *)b)->key.value;
+    int c = memcmp(x->data, y->data, x->length < y->length ? x->length : y->length);
+
+    return c ? c : (x->length > y->length) - (x->length < y->length);
+}
+
+/**
+ * Add the modifiers of a plan changing a dict.
+ *
+ * @param match Index of the entry of to with the same key as each entry of
+ *              from, or to->num_elems if it's removed.
+ * @param added Whether each entry of to is added.
+ */
+static int
+diff_dict (Diff *d, Plan plan, PsycDict *from, PsycDict *to,
+	   const size_t *match, const uint8_t *added)
+{
+    size_t i, n = from->num_elems, m = to->num_elems, removed = 0, add = 0;
+
+    if (plan == PLAN_ASSIGN) {
+	diff_put(d, PSYC_S2ARG(to->type));
+	for (i = 0; i < m; i++) {
+	    diff_key(d, &to->elems[i].key.value);
+	    diff_elem(d, NULL, &to->elems[i].value);
+	}
+	diff_mod(d, PSYC_OPERATOR_ASSIGN);
+	return 0;
+    }
+
+    if (!(str_eq(&from->type, &to->type) || (!n && !from->type.length)))
+	return -1;
+    for (i = 0; i < n; i++)
+	removed += match[i] == m;
+    for (i = 0; i < m; i++)
+	add += added[i];
+    if (n && removed == n && !add && to->type.length)
+	return -1;
+
+    if (removed) {
+	for (i = 0; i < n; i++)
+	    if (match[i] == m)
+		diff_key(d, &from->elems[i].key.value);
+	diff_mod(d, PSYC_OPERATOR_DIMINISH);
+    }
+    for (i = 0; i < n; i++)
+	if (match[i] != m && !elem_eq(&from->elems[i].value,
+				      &to->elems[match[i]].value)) {
+	    diff_key(d, &from->elems[i].key.value);
+	    diff_update(d, &to->elems[match[i]].value);
+	}
+    if (add) {
+	diff_put(d, PSYC_S2ARG(to->type));
+	for (i = 0; i < m; i++)
+	    if (added[i]) {
+		diff_key(d, &to->elems[i].key.value);
+		diff_elem(d, NULL, &to->elems[i].value);
+	    }
+	diff_mod(d, PSYC_OPERATOR_AUGMENT);
+    }
+    return 0;
+}
+
+PsycUpdateRC
+psyc_update_diff_dict (PsycDict *from, PsycDict *to,
+		       const char *name, size_t namelen,
+		       PsycModifier *mods, size_t *nmods,
+		       char *buffer, size_t buflen)
+{
+    Diff d;
+    Plan best = PLAN_ASSIGN;
+    size_t n = from->num_elems, m = to->num_elems, i, j, cost;
+    PsycDictElem **f, **t;
+    size_t *match;
+    uint8_t *added;
+    void *mem;
+    int c;
+
+    psyc_dict_length_set(from);
+    psyc_dict_length_set(to);
+
+    mem = malloc((n + m) * sizeof(PsycDictElem *) + n * sizeof(size_t) + m + 1);
+    if (!mem)
+	return PSYC_UPDATE_ERROR_MEMORY;
+    f = mem;
+    t = f + n;
+    match = (size_t *)(t + m);
+    added = (uint8_t *)(match + n);
+
+    // match the entries by key in sorted order
+    for (i = 0; i < n; i++)
+	f[i] = &from->elems[i];
+    for (j = 0; j < m; j++)
+	t[j] = &to->elems[j];
+    qsort(f, n, sizeof(PsycDictElem *), dict_entry_cmp);
+    qsort(t, m, sizeof(PsycDictElem *), dict_entry_cmp);
+    for (i = 0; i < n; i++)
+	match[i] = m;
+    memset(added, 1, m);
+    for (i = j = 0; i < n && j < m; ) {
+	c = dict_entry_cmp(&f[i], &t[j]);
+	if (c == 0) {
+	    match[f[i] - from->elems] = t[j] - to->elems;
+	    added[t[j] - to->elems] = 0;
+	}
+	i += c <= 0;
+	j += c >= 0;
+    }
+
+    if (n == m && str_eq(&from->type, &to->type)) {
+	for (i = 0; i < n; i++)
+	    if (match[i] != i
+		|| !elem_eq(&from->elems[i].value, &to->elems[i].value))
+		break;
+	if (i == n) {
+	    free(mem);
+	    *nmods = 0;
+	    return PSYC_UPDATE_UNCHANGED;
+	}
+    }
+
+    diff_init(&d, name, namelen, NULL, 0, NULL, 0);
+    diff_dict(&d, PLAN_ASSIGN, from, to, match, added);
+    cost = diff_cost(&d);
+    diff_init(&d, name, namelen, NULL, 0, NULL, 0);
+    if (diff_dict(&d, PLAN_MODIFY, from, to, match, added) == 0
+	&& d.n <= *nmods && diff_cost(&d) < cost)
+	best = PLAN_MODIFY;
+
+    diff_init(&d, name, namelen, mods, *nmods, buffer, buflen);
+    diff_dict(&d, best, from, to, match, added);
+    free(mem);
+    if (d.n > *nmods || d.used > buflen)
+	return PSYC_UPDATE_ERROR_SIZE;
+    *nmods = d.n;
+    return PSYC_UPDATE_CHANGED;
+}
@@ -107,6 +107,9 @@ const size_t psyc_methods_num = PSYC_NUM_ELEM(psyc_methods);
 extern inline PsycRoutingVar
 psyc_var_routing (const char *name, size_t len);
 
+extern inline PsycRoutingVar
+psyc_var_routing_id (uint32_t id);
+
 extern inline PsycType
 psyc_var_type (const char *name, size_t len);
 
@@ -119,8 +122,8 @@ psyc_var_is_list (const char *name, size_t len);
 PsycMethod
 psyc_method (char *method, size_t methodlen, PsycMethod *family, unsigned int *flag)
 {
-    int mc = psyc_map_lookup_int(psyc_methods, psyc_methods_num,
-				  method, methodlen, PSYC_YES);
+    int mc = psyc_map_hash_lookup_int(&psyc_methods_hash,
+				      method, methodlen, PSYC_YES);
 
     switch (mc) {
     case PSYC_MC_DATA:
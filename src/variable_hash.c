@@ -0,0 +1,65 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+/* Perfect hashes of the maps in variable.c generated by genmap,
+ * run make maps after changing them. */
+
+#include "lib.h"
+#include <psyc/variable.h>
+
+static const uint8_t rvars_slots[] = {
+    5, 1, 7, 4, 8, 3, 9, 0, 6, 2,
+};
+
+static const uint16_t rvars_disp[] = {
+    3, 0, 5, 6, 0, 0, 6, 0, 21, 0,
+};
+
+const PsycMapHash psyc_rvars_hash = {
+    psyc_rvars, rvars_slots, rvars_disp, 10, 17, 0,
+};
+
+static const uint8_t var_types_slots[] = {
+    6, 1, 8, 13, 10, 3, 12, 0, 4, 5, 2, 11, 9, 7,
+};
+
+static const uint16_t var_types_disp[] = {
+    0, 0, 0, 2, 2, 0, 0, 0, 1, 24, 5, 0,
+    0, 7,
+};
+
+const PsycMapHash psyc_var_types_hash = {
+    psyc_var_types, var_types_slots, var_types_disp, 14, 9, 0,
+};
+
+static const uint8_t methods_slots[] = {
+    27, 8, 17, 21, 10, 14, 13, 1, 16, 2, 23, 4, 26, 18, 24, 15,
+    28, 19, 25, 12, 7, 5, 3, 0, 6, 29, 11, 22, 9, 20, 30,
+};
+
+static const uint16_t methods_disp[] = {
+    2, 96, 0, 0, 3, 0, 4, 0, 22, 0, 0, 3,
+    1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 10,
+    1, 19, 0, 2, 0, 0, 3,
+};
+
+const PsycMapHash psyc_methods_hash = {
+    psyc_methods, methods_slots, methods_disp, 31, 26, 0,
+};
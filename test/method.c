@@ -44,6 +44,18 @@ int main()
 	&& family != PSYC_MC_WARNING)
 	return 103;
 
+    // shorter siblings sorted before the prefix must not hide it
+    if (psyc_method(PSYC_C2ARG("_echo_abcde"), &family, &flag) != PSYC_MC_ECHO)
+	return 104;
+
+    if (psyc_method(PSYC_C2ARG("_notice_context_enter_foo"), &family, &flag)
+	!= PSYC_MC_NOTICE_CONTEXT_ENTER)
+	return 105;
+
+    if (psyc_method(PSYC_C2ARG("_notice_contextual"), &family, &flag)
+	!= PSYC_MC_NOTICE)
+	return 106;
+
     printf("psyc_method passed all tests.\n");
     return 0;
 }
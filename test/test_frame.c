@@ -0,0 +1,146 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+/**
+ * Concatenate the packets given as arguments and check that psyc_frame()
+ * finds the same packet boundaries as psyc_parse(), for the whole buffer and
+ * for every prefix of it.
+ *
+ * With -c <count> the time taken by both to find the packets is shown.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <psyc.h>
+#include <psyc/parse.h>
+
+#define BUFSIZE 262144
+#define MAXFRAMES 1024
+
+static char buffer[BUFSIZE];
+static size_t ends[MAXFRAMES];
+
+/**
+ * Find the end of each packet with psyc_parse().
+ *
+ * @return Number of complete packets.
+ */
+static size_t
+parse (size_t length, uint8_t flags)
+{
+    PsycParseState state;
+    PsycString name, value;
+    char oper;
+    size_t n = 0;
+    int ret;
+
+    psyc_parse_state_init(&state, flags);
+    psyc_parse_buffer_set(&state, buffer, length);
+
+    do {
+	ret = psyc_parse(&state, &oper, &name, &value);
+	if (ret == PSYC_PARSE_COMPLETE && n < MAXFRAMES)
+	    ends[n++] = psyc_parse_cursor(&state);
+    } while (ret > 0 && ret != PSYC_PARSE_INSUFFICIENT);
+
+    return n;
+}
+
+static long
+elapsed (struct timeval *start)
+{
+    struct timeval end;
+    gettimeofday(&end, NULL);
+    return (end.tv_sec - start->tv_sec) * 1000 + (end.tv_usec - start->tv_usec) / 1000;
+}
+
+int
+main (int argc, char **argv)
+{
+    PsycFrame frames[MAXFRAMES];
+    size_t length = 0, len, cursor, n, i, count = 0;
+    struct timeval start;
+    int c, fd, ret, errors = 0;
+    ssize_t r;
+
+    while ((c = getopt(argc, argv, "c:")) != -1)
+	if (c == 'c')
+	    count = atoi(optarg);
+
+    for (i = optind; i < argc; i++) {
+	fd = open(argv[i], O_RDONLY);
+	if (fd < 0) {
+	    perror(argv[i]);
+	    return -1;
+	}
+	r = read(fd, buffer + length, sizeof(buffer) - length);
+	close(fd);
+	if (r > 0)
+	    length += r;
+    }
+
+    n = parse(length, PSYC_PARSE_ALL);
+    if (n != parse(length, PSYC_PARSE_ROUTING_ONLY)) {
+	printf("psyc_parse() and PSYC_PARSE_ROUTING_ONLY disagree\n");
+	errors++;
+    }
+
+    // complete packets in every prefix of the buffer
+    for (len = 0; len <= length; len++) {
+	ret = psyc_frame(buffer, len, frames, MAXFRAMES, &cursor);
+	for (i = 0; i < ret && i < n && ends[i] <= len; i++)
+	    if (frames[i].start != (i ? ends[i - 1] : 0) || frames[i].end != ends[i])
+		break;
+	if (ret < 0 || i != ret || (i < n && ends[i] <= len)
+	    || cursor != (ret ? frames[ret - 1].end : 0)) {
+	    printf("length %ld: %d packets, cursor: %ld\n",
+		   (long)len, ret, (long)cursor);
+	    errors++;
+	}
+    }
+
+    // an invalid packet
+    if (psyc_frame("2\n_foo\n|\n", 9, frames, MAXFRAMES, &cursor) != -1
+	|| psyc_frame(":_foo\tbar\n\n_foo\n|\n5x\n", 21, frames, MAXFRAMES,
+		      &cursor) != 1 || cursor != 18) {
+	printf("invalid packet not detected\n");
+	errors++;
+    }
+
+    if (count) {
+	gettimeofday(&start, NULL);
+	for (i = 0; i < count; i++)
+	    parse(length, PSYC_PARSE_ROUTING_ONLY);
+	printf("psyc_parse: %ld ms\n", elapsed(&start));
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < count; i++)
+	    psyc_frame(buffer, length, frames, MAXFRAMES, &cursor);
+	printf("psyc_frame: %ld ms\n", elapsed(&start));
+    }
+
+    printf("test_frame: %s\n", errors ? "ERROR" : "SUCCESS");
+    return errors;
+}
@@ -0,0 +1,289 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+/**
+ * Check the intern table, interning keywords from several threads at once,
+ * and parse the packets given as arguments with PSYC_PARSE_INTERN, comparing
+ * psyc_parse_keyword_id() with the ID of each name and method,
+ * with psyc_parse() and with psyc_parse_iov() on small chunks.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <psyc.h>
+#include <psyc/parse.h>
+#include <psyc/intern.h>
+
+#define BUFSIZE 65536
+#define THREADS 4
+#define KEYWORDS 500
+
+static char buffer[BUFSIZE];
+static uint64_t nl[PSYC_PARSE_STRUCT_WORDS(BUFSIZE)];
+static uint64_t delim[PSYC_PARSE_STRUCT_WORDS(BUFSIZE)];
+static uint32_t ids[THREADS][KEYWORDS];
+
+static void *
+intern_thread (void *arg)
+{
+    uint32_t *id = arg;
+    char name[32];
+    int i, len;
+
+    for (i = 0; i < KEYWORDS; i++) {
+	len = sprintf(name, "_thread_%d", i);
+	id[i] = psyc_intern(name, len);
+    }
+    return NULL;
+}
+
+static int
+test_table ()
+{
+    pthread_t threads[THREADS];
+    PsycString name;
+    size_t i, t;
+    uint32_t id;
+
+    for (i = 0; i < psyc_rvars_num; i++)
+	if (psyc_var_routing_id(psyc_intern(PSYC_S2ARG(psyc_rvars[i].key)))
+	    != psyc_rvars[i].value)
+	    return 1;
+
+    id = psyc_intern(PSYC_C2ARG("_nick_place"));
+    if (!id || id != psyc_intern(PSYC_C2ARG("_nick_place"))
+	|| psyc_var_routing_id(id) != PSYC_RVAR_UNKNOWN
+	|| psyc_intern_lookup(PSYC_C2ARG("_nick_plac"),
+			      psyc_intern_hash(PSYC_C2ARG("_nick_plac"))) != 0)
+	return 2;
+
+    name = psyc_intern_name(id);
+    if (name.length != 11 || memcmp(name.data, "_nick_place", 11)
+	|| psyc_intern_name(0).length || psyc_intern_name(-1).length)
+	return 3;
+
+    for (t = 0; t < THREADS; t++)
+	pthread_create(&threads[t], NULL, intern_thread, ids[t]);
+    for (t = 0; t < THREADS; t++)
+	pthread_join(threads[t], NULL);
+
+    // every thread got the same IDs, without gaps
+    for (i = 0; i < KEYWORDS; i++)
+	for (t = 0; t < THREADS; t++)
+	    if (!ids[t][i] || ids[t][i] != ids[0][i])
+		return 4;
+    if (psyc_intern_count() != id + KEYWORDS)
+	return 5;
+
+    return 0;
+}
+
+/**
+ * Parse length bytes of buffer, feeding chunk bytes at a time
+ * (0 for everything at once), and check the ID of every keyword.
+ * With add, keywords are added to the table instead.
+ *
+ * @return Number of keywords with a wrong ID.
+ */
+static int
+parse (size_t length, size_t chunk, uint8_t indexed, uint8_t add)
+{
+    PsycParseState state;
+    PsycParseStructIndex idx = {nl, delim, PSYC_PARSE_STRUCT_WORDS(BUFSIZE)};
+    PsycString name, value;
+    char oper;
+    const char *start = buffer;
+    size_t end = chunk ? chunk : length;
+    int errors = 0, ret;
+    uint32_t id;
+
+    psyc_parse_state_init(&state, PSYC_PARSE_INTERN);
+    if (indexed)
+	psyc_parse_struct_index_set(&state, &idx);
+    psyc_parse_buffer_set(&state, start, (end < length ? end : length));
+
+    for (;;) {
+	name.length = 0;
+	ret = psyc_parse(&state, &oper, &name, &value);
+
+	switch (ret) {
+	case PSYC_PARSE_INSUFFICIENT:
+	    if (end >= length)
+		return errors;
+	    start += psyc_parse_cursor(&state);
+	    end += chunk;
+	    psyc_parse_buffer_set(&state, start,
+				  (end < length ? end : length)
+				  - (start - buffer));
+	    continue;
+
+	case PSYC_PARSE_ROUTING:
+	case PSYC_PARSE_ENTITY_START:
+	case PSYC_PARSE_ENTITY:
+	case PSYC_PARSE_BODY_START:
+	case PSYC_PARSE_BODY:
+	    if (!name.length)
+		break;
+	    if (add) { // after the parser looked it up
+		psyc_intern(PSYC_S2ARG(name));
+		break;
+	    }
+	    id = psyc_intern_lookup(PSYC_S2ARG(name),
+				    psyc_intern_hash(PSYC_S2ARG(name)));
+	    if (psyc_parse_keyword_id(&state) != id) {
+		printf("%.*s: id %u, expected %u\n", (int)name.length,
+		       name.data, psyc_parse_keyword_id(&state), id);
+		errors++;
+	    }
+	    break;
+
+	case PSYC_PARSE_COMPLETE:
+	    if (psyc_parse_remaining_length(&state) == 0 && end >= length)
+		return errors;
+	    break;
+
+	default:
+	    if (ret < 0)
+		return errors + 1;
+	}
+    }
+}
+
+/**
+ * Same as parse(), but with psyc_parse_iov() on a chain of chunk byte buffers,
+ * so names and methods are read across buffer boundaries.
+ */
+static int
+parse_iov (size_t length, size_t chunk, uint8_t add)
+{
+    static PsycString iov[BUFSIZE];
+    static char joined[BUFSIZE];
+    PsycParseIovState state;
+    PsycString name[2], value;
+    const PsycString *mid;
+    size_t iovcnt, parts, len, i;
+    char oper;
+    int errors = 0, ret;
+    uint32_t id;
+
+    for (iovcnt = 0; iovcnt * chunk < length; iovcnt++)
+	iov[iovcnt] = (PsycString) {length - iovcnt * chunk < chunk
+				    ? length - iovcnt * chunk : chunk,
+				    buffer + iovcnt * chunk};
+
+    psyc_parse_iov_state_init(&state, PSYC_PARSE_INTERN);
+    psyc_parse_iov_buffer_set(&state, iov, iovcnt);
+
+    for (;;) {
+	name[0] = (PsycString) {0, NULL};
+	ret = psyc_parse_iov(&state, &oper, name, &value);
+
+	switch (ret) {
+	case PSYC_PARSE_INSUFFICIENT:
+	    return errors;
+
+	case PSYC_PARSE_ROUTING_START:
+	case PSYC_PARSE_ROUTING:
+	case PSYC_PARSE_ENTITY_START:
+	case PSYC_PARSE_ENTITY:
+	case PSYC_PARSE_BODY_START:
+	case PSYC_PARSE_BODY:
+	    if (!name[0].length)
+		break;
+	    len = 0;
+	    memcpy(joined, name[0].data, name[0].length);
+	    len += name[0].length;
+	    parts = psyc_parse_iov_name_parts(&state, &mid);
+	    for (i = 0; i < parts; len += mid[i++].length)
+		memcpy(joined + len, mid[i].data, mid[i].length);
+	    memcpy(joined + len, name[1].data, name[1].length);
+	    len += name[1].length;
+
+	    if (add) {
+		psyc_intern(joined, len);
+		break;
+	    }
+	    id = psyc_intern_lookup(joined, len, psyc_intern_hash(joined, len));
+	    if (psyc_parse_keyword_id(&state.parser) != id) {
+		printf("%.*s: id %u, expected %u\n", (int)len, joined,
+		       psyc_parse_keyword_id(&state.parser), id);
+		errors++;
+	    }
+	    break;
+
+	default:
+	    if (ret < 0)
+		return errors + 1;
+	}
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+    size_t chunks[] = {0, 1, 7, 64};
+    size_t iov_chunks[] = {1, 2, 5, 13};
+    int i, c, fd, errors = 0, ret;
+    ssize_t length;
+
+    if ((ret = test_table())) {
+	printf("intern table: ERROR %d\n", ret);
+	errors++;
+    }
+
+    for (i = 1; i < argc; i++) {
+	fd = open(argv[i], O_RDONLY);
+	if (fd < 0) {
+	    perror(argv[i]);
+	    return -1;
+	}
+	length = read(fd, buffer, sizeof(buffer));
+	close(fd);
+	if (length <= 0)
+	    continue;
+
+	for (c = 0; c < sizeof(chunks) / sizeof(*chunks); c++) {
+	    // unknown keywords first, then all of them are added
+	    if (parse(length, chunks[c], 0, 0) || parse(length, chunks[c], 1, 0)
+		|| parse(length, chunks[c], 0, 1)
+		|| parse(length, chunks[c], 0, 0) || parse(length, chunks[c], 1, 0)) {
+		printf("%s: wrong keyword IDs, chunk: %ld\n", argv[i], (long)chunks[c]);
+		errors++;
+	    }
+	}
+
+	for (c = 0; c < sizeof(iov_chunks) / sizeof(*iov_chunks); c++) {
+	    if (parse_iov(length, iov_chunks[c], 0)
+		|| parse_iov(length, iov_chunks[c], 1)
+		|| parse_iov(length, iov_chunks[c], 0)) {
+		printf("%s: wrong keyword IDs, iov chunk: %ld\n", argv[i],
+		       (long)iov_chunks[c]);
+		errors++;
+	    }
+	}
+    }
+
+    printf("test_intern: %s\n", errors ? "ERROR" : "SUCCESS");
+    return errors;
+}
@@ -0,0 +1,313 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+/**
+ * Index a large rendered list: check random elements, slices and offsets
+ * against the elements it's rendered from, decode it in chunks with several
+ * threads, then time random access with the index and by parsing the list
+ * up to each element.
+ *
+ * Options: -n <elements> (default: 100000), -c <random accesses>
+ * (default: 100000), -t <threads> (default: 4).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include <lib.h>
+#include <psyc/list.h>
+#include <psyc/render.h>
+
+#define MAXTHREADS 64
+
+static size_t nelems = 100000, count = 100000, nthreads = 4;
+static PsycElem *elems;
+static PsycListIndex idx;
+
+static int
+elem_eq (const PsycElem *a, const PsycElem *b)
+{
+    return a->type.length == b->type.length
+	&& a->value.length == b->value.length
+	&& !memcmp(a->type.data, b->type.data, a->type.length)
+	&& !memcmp(a->value.data, b->value.data, a->value.length);
+}
+
+static long
+elapsed (struct timeval *start)
+{
+    struct timeval end;
+    gettimeofday(&end, NULL);
+    return (end.tv_sec - start->tv_sec) * 1000000 + (end.tv_usec - start->tv_usec);
+}
+
+static ptrdiff_t
+index_count (const char *list)
+{
+    PsycListIndex i;
+    ptrdiff_t n;
+
+    psyc_list_index_init(&i, list, strlen(list));
+    n = psyc_list_index_count(&i);
+    psyc_list_index_free(&i);
+    return n;
+}
+
+/**
+ * Index small lists, empty and invalid ones.
+ */
+static int
+test_small ()
+{
+    const char *list = "_list_test| a|=_nick:3 b|c|=_list|4 d|ef";
+    PsycElem elem;
+    PsycString s;
+    int errors = 0;
+
+    errors += index_count("") != 0;
+    errors += index_count("_list") != 0;
+    errors += index_count("| a") != 1;
+    errors += index_count("| a|| b") != 3;
+    errors += index_count("|=_nick:x a") != PSYC_LIST_INDEX_ERROR;
+
+    psyc_list_index_init(&idx, list, strlen(list));
+    if (psyc_list_index_get(&idx, 1, &elem) != PSYC_LIST_INDEX_SUCCESS
+	|| memcmp(elem.type.data, "_nick", 5) || memcmp(elem.value.data, "b|c", 3)
+	|| elem.flag != PSYC_ELEM_NEED_LENGTH)
+	errors++;
+    if (psyc_list_index_get(&idx, 3, &elem) != PSYC_LIST_INDEX_SUCCESS
+	|| elem.value.length != 4 || memcmp(elem.value.data, "d|ef", 4))
+	errors++;
+    if (psyc_list_index_get(&idx, 4, &elem) != PSYC_LIST_INDEX_ERROR_RANGE)
+	errors++;
+    if (idx.type.length != 10 || psyc_list_index_slice(&idx, 1, 3, &s)
+	|| s.length != 20 || memcmp(s.data, "|=_nick:3 b|c|=_list", 20))
+	errors++;
+    if (psyc_list_index_find(&idx, 0) != 0 || psyc_list_index_find(&idx, 12) != 0
+	|| psyc_list_index_find(&idx, 13) != 1
+	|| psyc_list_index_find(&idx, strlen(list)) != 4)
+	errors++;
+    psyc_list_index_free(&idx);
+
+    if (errors)
+	printf("test_small: %d errors\n", errors);
+    return errors;
+}
+
+/**
+ * Check random elements, slices and offsets of the large list.
+ */
+static int
+test_random (char *buf, size_t len)
+{
+    PsycElem elem;
+    PsycList sub;
+    PsycString s;
+    char out[4096];
+    size_t i, j, k, offset;
+    ptrdiff_t f;
+    int errors = 0;
+
+    // only the start is indexed to get an element near it
+    psyc_list_index_init(&idx, buf, len);
+    if (psyc_list_index_get(&idx, 5, &elem) != PSYC_LIST_INDEX_SUCCESS
+	|| !elem_eq(&elem, &elems[5]) || idx.n > 7)
+	errors++;
+
+    srand(42);
+    for (k = 0; k < count && errors < 10; k++) {
+	i = rand() % nelems;
+	if (psyc_list_index_get(&idx, i, &elem) != PSYC_LIST_INDEX_SUCCESS
+	    || !elem_eq(&elem, &elems[i])
+	    || psyc_render_elem(&elem, out, sizeof(out)) != PSYC_RENDER_SUCCESS
+	    || psyc_list_index_slice(&idx, i, i + 1, &s)
+	    || s.length != elem.length + 1 || memcmp(s.data + 1, out, elem.length)) {
+	    printf("element %d: %.*s\n", (int)i, PSYC_S2ARGP(elem.value));
+	    errors++;
+	}
+
+	j = i + rand() % 20;
+	if (j > nelems)
+	    j = nelems;
+	psyc_list_init(&sub, elems + i, j - i);
+	psyc_render_list(&sub, out, sizeof(out));
+	if (psyc_list_index_slice(&idx, i, j, &s) != PSYC_LIST_INDEX_SUCCESS
+	    || s.length != sub.length || memcmp(s.data, out, s.length)) {
+	    printf("slice %d-%d\n", (int)i, (int)j);
+	    errors++;
+	}
+
+	offset = rand() % len;
+	f = psyc_list_index_find(&idx, offset);
+	if (f < 0 || (size_t)f >= nelems
+	    || psyc_list_index_slice(&idx, f, f + 1, &s)
+	    || (f > 0 && (size_t)(s.data - buf) > offset)
+	    || (size_t)(s.data - buf) + s.length <= offset) {
+	    printf("offset %d: %d\n", (int)offset, (int)f);
+	    errors++;
+	}
+    }
+
+    if (psyc_list_index_count(&idx) != (ptrdiff_t)nelems
+	|| psyc_list_index_get(&idx, nelems, &elem) != PSYC_LIST_INDEX_ERROR_RANGE)
+	errors++;
+    return errors;
+}
+
+static void *
+decode_thread (void *arg)
+{
+    size_t t = (size_t)arg, i = nelems * t / nthreads, j = nelems * (t + 1) / nthreads;
+    PsycElem *out = malloc((j - i + 1) * sizeof(PsycElem));
+    size_t k, errors = 0;
+
+    if (psyc_list_index_decode(&idx, i, j, out) != PSYC_LIST_INDEX_SUCCESS)
+	errors++;
+    else
+	for (k = i; k < j; k++)
+	    errors += !elem_eq(&out[k - i], &elems[k]);
+    free(out);
+    return (void *)errors;
+}
+
+/**
+ * Decode chunks of the indexed list in parallel.
+ */
+static int
+test_threads ()
+{
+    pthread_t threads[MAXTHREADS];
+    struct timeval start;
+    size_t i, errors = 0;
+    void *ret;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < nthreads; i++)
+	pthread_create(&threads[i], NULL, decode_thread, (void *)i);
+    for (i = 0; i < nthreads; i++) {
+	pthread_join(threads[i], &ret);
+	errors += (size_t)ret;
+    }
+    printf("list_index: %lu elements decoded by %lu threads: %ld us\n",
+	   (unsigned long)nelems, (unsigned long)nthreads, elapsed(&start));
+    return errors;
+}
+
+/**
+ * Time random access to elements with the index and by parsing the list
+ * from the start, the latter for a hundredth of them.
+ */
+static int
+bench (char *buf, size_t len)
+{
+    PsycParseListState p;
+    PsycString type, value;
+    PsycListIndex i2;
+    PsycElem elem;
+    struct timeval start;
+    size_t i, k, n;
+    int errors = 0, r;
+
+    srand(42);
+    gettimeofday(&start, NULL);
+    psyc_list_index_init(&i2, buf, len);
+    for (k = 0; k < count; k++)
+	if (psyc_list_index_get(&i2, rand() % nelems, &elem))
+	    errors++;
+    psyc_list_index_free(&i2);
+    printf("list_index: %lu random elements with the index: %ld us\n",
+	   (unsigned long)count, elapsed(&start));
+
+    srand(42);
+    gettimeofday(&start, NULL);
+    for (k = 0; k < count / 100; k++) {
+	i = rand() % nelems;
+	psyc_parse_list_state_init(&p);
+	psyc_parse_list_buffer_set(&p, buf, len);
+	for (n = 0; n <= i; ) {
+	    r = psyc_parse_list(&p, &type, &value);
+	    if (r == PSYC_PARSE_LIST_ELEM || r == PSYC_PARSE_LIST_ELEM_LAST)
+		n++;
+	    else if (r != PSYC_PARSE_LIST_TYPE) {
+		errors++;
+		break;
+	    }
+	}
+    }
+    printf("list_index: %lu random elements parsed from the start: %ld us\n",
+	   (unsigned long)(count / 100), elapsed(&start));
+    return errors;
+}
+
+int
+main (int argc, char **argv)
+{
+    const char *bin = "a|b\nc|d";
+    PsycList list;
+    char *buf, *values;
+    size_t i, len;
+    int c, errors = 0;
+
+    while ((c = getopt(argc, argv, "n:c:t:")) != -1)
+	switch (c) {
+	case 'n': nelems = atoi(optarg); break;
+	case 'c': count = atoi(optarg); break;
+	case 't': nthreads = atoi(optarg); break;
+	}
+    if (!nelems || !nthreads || nthreads > MAXTHREADS)
+	return -1;
+
+    errors += test_small();
+
+    // members with and without a length, short values and binary ones
+    elems = malloc(nelems * sizeof(PsycElem));
+    values = malloc(nelems * 32);
+    for (i = 0; i < nelems; i++) {
+	if (i % 7 == 3)
+	    len = sprintf(values + i * 32, "%s%d", bin, (int)(i % 10));
+	else if (i % 5 == 1)
+	    len = sprintf(values + i * 32, "m%d", (int)(i % 1000));
+	else
+	    len = sprintf(values + i * 32, "psyc://example.net/~user%06d", (int)i);
+	elems[i] = i % 3 ? PSYC_ELEM_V(values + i * 32, len)
+	    : PSYC_ELEM("_uniform", 8, values + i * 32, len, PSYC_ELEM_CHECK_LENGTH);
+    }
+    psyc_list_init(&list, elems, nelems);
+    list.type = PSYC_C2STR("_list_members");
+    len = psyc_list_length_set(&list);
+    buf = malloc(len);
+    psyc_render_list(&list, buf, len);
+
+    errors += test_random(buf, len);
+    errors += test_threads();
+    psyc_list_index_free(&idx);
+    errors += bench(buf, len);
+
+    free(elems);
+    free(values);
+    free(buf);
+
+    printf("test_list_index: %s\n", errors ? "ERROR" : "SUCCESS");
+    return errors;
+}
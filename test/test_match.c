@@ -19,9 +19,74 @@
 */
 
 #include <stdio.h>
+#include <string.h>
 #include <lib.h>
+#include <psyc/variable.h>
+
+/**
+ * Find the longest key of a map that key is or inherits from.
+ */
+static intptr_t
+inherited (const PsycMapInt *map, size_t size, const char *key, size_t len)
+{
+    size_t i, best = 0;
+    intptr_t value = 0;
+
+    for (i = 0; i < size; i++)
+	if (map[i].key.length <= len && map[i].key.length > best
+	    && !memcmp(map[i].key.data, key, map[i].key.length)
+	    && (map[i].key.length == len || key[map[i].key.length] == '_')) {
+	    best = map[i].key.length;
+	    value = map[i].value;
+	}
+    return value;
+}
+
+/**
+ * Check that a perfect hash generated by genmap is the one of the map in
+ * variable.c: every key is found through it with the value the sorted map
+ * has, and a longer name inherits from the longest key it starts with.
+ */
+static int
+check_hash (const char *name, const PsycMapHash *hash,
+	    const PsycMapInt *map, size_t size)
+{
+    char key[PSYC_MAP_HASH_KEYLEN_MAX + 8];
+    size_t i, len;
+
+    if (hash->map != map || hash->size != size) {
+	printf("%s: hash of %lu keys for %lu, run make maps in src\n",
+	       name, (unsigned long)hash->size, (unsigned long)size);
+	return 1;
+    }
+    for (i = 0; i < size; i++) {
+	len = map[i].key.length;
+	memcpy(key, map[i].key.data, len);
+	if (psyc_map_hash_lookup_int(hash, key, len, PSYC_NO) != map[i].value
+	    || psyc_map_lookup_int(map, size, key, len, PSYC_NO) != map[i].value) {
+	    printf("%s: %s not found, run make maps in src\n", name, key);
+	    return 1;
+	}
+	memcpy(key + len, "_foo", 4);
+	if (psyc_map_hash_lookup_int(hash, key, len + 4, PSYC_YES)
+	    != inherited(map, size, key, len + 4)) {
+	    printf("%s: %.*s inherits differently\n", name, (int)len + 4, key);
+	    return 1;
+	}
+    }
+    return 0;
+}
 
 int main() {
+    if (check_hash("psyc_rvars", &psyc_rvars_hash, psyc_rvars, psyc_rvars_num)
+	|| check_hash("psyc_var_types", &psyc_var_types_hash,
+		      psyc_var_types, psyc_var_types_num)
+	|| check_hash("psyc_methods", &psyc_methods_hash,
+		      psyc_methods, psyc_methods_num))
+	return 20;
+
+    puts("psyc_map_hash_lookup_int passed all tests.");
+
     if (psyc_matches(PSYC_C2ARG("_failure_delivery"),
 		     PSYC_C2ARG("_failure_unsuccessful_delivery_death")))
 	return 1;
@@ -0,0 +1,172 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+/**
+ * Compare memmem() with a naive search on random strings over small
+ * alphabets, then search the files given as arguments for the packet
+ * delimiter, a template bracket and a long needle from their end, timing
+ * both.
+ *
+ * Options: -n <random searches> (default: 100000),
+ * -c <searches per file> (default: 10000).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <lib.h>
+
+#define BUFSIZE 65536
+
+static char buffer[BUFSIZE];
+static size_t tests = 100000, count = 10000;
+
+static void *
+naive_memmem (const void *l, size_t l_len, const void *s, size_t s_len)
+{
+    const char *cur, *last = (const char *)l + l_len - s_len;
+
+    if (l_len == 0 || s_len == 0 || l_len < s_len)
+	return NULL;
+    for (cur = l; cur <= last; cur++)
+	if (memcmp(cur, s, s_len) == 0)
+	    return (void *)cur;
+    return NULL;
+}
+
+static void
+fill (char *buf, size_t len, int alphabet)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+	buf[i] = 'a' + rand() % alphabet;
+}
+
+/**
+ * Search random haystacks for random and periodic needles of all lengths.
+ */
+static int
+test_random ()
+{
+    char hay[600], needle[100];
+    size_t i, j, hlen, nlen, period;
+    int errors = 0;
+
+    srand(42);
+    for (i = 0; i < tests; i++) {
+	hlen = rand() % sizeof(hay);
+	nlen = 1 + rand() % (i % 4 ? 40 : sizeof(needle));
+	fill(hay, hlen, 2 + i % 3);
+
+	if (i % 3 == 0 && hlen >= nlen) // take it from the haystack
+	    memcpy(needle, hay + rand() % (hlen - nlen + 1), nlen);
+	else if (i % 3 == 1) { // periodic, like aabaabaab
+	    period = 1 + rand() % 4;
+	    fill(needle, period, 2);
+	    for (j = period; j < nlen; j++)
+		needle[j] = needle[j - period];
+	    if (i % 2) { // in a haystack with the same period and a flaw
+		for (j = 0; j < hlen; j++)
+		    hay[j] = needle[j % period];
+		if (hlen)
+		    hay[rand() % hlen] = 'c';
+	    }
+	} else
+	    fill(needle, nlen, 2 + i % 3);
+
+	if (memmem(hay, hlen, needle, nlen) != naive_memmem(hay, hlen, needle, nlen)) {
+	    printf("%.*s in %.*s: %p, expected %p\n", (int)nlen, needle,
+		   (int)hlen, hay, memmem(hay, hlen, needle, nlen),
+		   naive_memmem(hay, hlen, needle, nlen));
+	    errors++;
+	}
+    }
+    return errors;
+}
+
+static long
+elapsed (struct timeval *start)
+{
+    struct timeval end;
+    gettimeofday(&end, NULL);
+    return (end.tv_sec - start->tv_sec) * 1000000 + (end.tv_usec - start->tv_usec);
+}
+
+/**
+ * Search a file for a needle with both and time them.
+ */
+static int
+bench (const char *file, size_t len, const char *needle, size_t nlen)
+{
+    void *(*fn[])(const void *, size_t, const void *, size_t) = {
+	memmem, naive_memmem};
+    const char *name[] = {"memmem", "naive"};
+    struct timeval start;
+    void *found[2];
+    size_t i, f;
+
+    for (f = 0; f < 2; f++) {
+	gettimeofday(&start, NULL);
+	for (i = 0; i < count; i++)
+	    found[f] = fn[f](buffer, len, needle, nlen);
+	printf("%s: %s, %lu bytes: %ld us\n", file, name[f], (unsigned long)nlen,
+	       elapsed(&start));
+    }
+    return found[0] != found[1];
+}
+
+int
+main (int argc, char **argv)
+{
+    int i, c, fd, errors = 0;
+    ssize_t len;
+
+    while ((c = getopt(argc, argv, "n:c:")) != -1)
+	switch (c) {
+	case 'n': tests = atoi(optarg); break;
+	case 'c': count = atoi(optarg); break;
+	}
+
+    errors += test_random();
+
+    for (i = optind; i < argc; i++) {
+	fd = open(argv[i], O_RDONLY);
+	if (fd < 0) {
+	    perror(argv[i]);
+	    return -1;
+	}
+	len = read(fd, buffer, sizeof(buffer));
+	close(fd);
+	if (len < 64)
+	    continue;
+
+	errors += bench(argv[i], len, PSYC_C2ARG("\n|\n"));
+	errors += bench(argv[i], len, PSYC_C2ARG("]"));
+	errors += bench(argv[i], len, buffer + len - 48, 48);
+    }
+
+    printf("test_memmem: %s\n", errors ? "ERROR" : "SUCCESS");
+    return errors;
+}
@@ -0,0 +1,259 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+/**
+ * Parse packets split into separately allocated chunks with psyc_parse_iov()
+ * and compare the result with psyc_parse() on the whole packet.
+ *
+ * The chain is passed to the parser a few chunks at a time,
+ * the way a receive ring is filled.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <psyc.h>
+#include <psyc/parse.h>
+
+#define BUFSIZE 65536
+#define MAXCHUNKS BUFSIZE
+
+static char buffer[BUFSIZE];
+static PsycString chunks[MAXCHUNKS];
+static size_t nchunks;
+
+/// Parsed packet as text: one line per modifier or body, split values joined.
+static char out[2][BUFSIZE * 2];
+static size_t outlen[2];
+
+static int
+append (int o, const char *s, size_t len)
+{
+    if (outlen[o] + len > sizeof(out[o]))
+	return -1;
+    memcpy(out[o] + outlen[o], s, len);
+    outlen[o] += len;
+    return 0;
+}
+
+/**
+ * Check that a string returned by the parser points into a chunk.
+ */
+static int
+in_chunk (const PsycString *s)
+{
+    size_t i;
+
+    if (!s->length)
+	return 1;
+    for (i = 0; i < nchunks; i++)
+	if (s->data >= chunks[i].data
+	    && s->data + s->length <= chunks[i].data + chunks[i].length)
+	    return 1;
+    return 0;
+}
+
+/**
+ * Append a parsed line, parts is the number of buffers returned by
+ * psyc_parse_iov_name_parts() between name[0] and name[1].
+ */
+static void
+event (int o, int ret, char oper, PsycString *name,
+       const PsycString *mid, size_t parts, PsycString *value)
+{
+    char line[32];
+    size_t i;
+
+    switch (ret) {
+    case PSYC_PARSE_ROUTING_START:
+    case PSYC_PARSE_ENTITY_START:
+    case PSYC_PARSE_BODY_START:
+	ret = ret == PSYC_PARSE_ROUTING_START ? PSYC_PARSE_ROUTING
+	    : ret == PSYC_PARSE_ENTITY_START ? PSYC_PARSE_ENTITY : PSYC_PARSE_BODY;
+	// fall thru
+    case PSYC_PARSE_ROUTING:
+    case PSYC_PARSE_ENTITY:
+    case PSYC_PARSE_BODY:
+    case PSYC_PARSE_STATE_RESYNC:
+    case PSYC_PARSE_STATE_RESET:
+    case PSYC_PARSE_COMPLETE:
+	snprintf(line, sizeof(line), "\n%d %c ", ret, oper ? oper : '.');
+	append(o, line, strlen(line));
+	append(o, name[0].data, name[0].length);
+	for (i = 0; i < parts; i++)
+	    append(o, mid[i].data, mid[i].length);
+	if (o)
+	    append(o, name[1].data, name[1].length);
+	append(o, "\t", 1);
+	// fall thru
+    case PSYC_PARSE_ROUTING_CONT:
+    case PSYC_PARSE_ENTITY_CONT:
+    case PSYC_PARSE_BODY_CONT:
+    case PSYC_PARSE_ROUTING_END:
+    case PSYC_PARSE_ENTITY_END:
+    case PSYC_PARSE_BODY_END:
+	if (ret != PSYC_PARSE_COMPLETE && ret != PSYC_PARSE_STATE_RESYNC
+	    && ret != PSYC_PARSE_STATE_RESET)
+	    append(o, value->data, value->length);
+	break;
+    default:
+	snprintf(line, sizeof(line), "\nerror %d", ret);
+	append(o, line, strlen(line));
+    }
+}
+
+/**
+ * Parse the whole buffer with psyc_parse().
+ */
+static void
+parse (size_t length, uint8_t flags)
+{
+    PsycParseState state;
+    PsycString name[2] = {{0, NULL}, {0, NULL}}, value;
+    char oper;
+    int ret;
+
+    outlen[0] = 0;
+    psyc_parse_state_init(&state, flags);
+    psyc_parse_buffer_set(&state, buffer, length);
+
+    do {
+	oper = 0;
+	name[0] = value = (PsycString) {0, NULL};
+	ret = psyc_parse(&state, &oper, name, &value);
+	if (ret != PSYC_PARSE_INSUFFICIENT)
+	    event(0, ret, oper, name, NULL, 0, &value);
+    } while (ret > 0 && ret != PSYC_PARSE_COMPLETE
+	     && ret != PSYC_PARSE_INSUFFICIENT);
+}
+
+/**
+ * Parse the chunks with psyc_parse_iov(), adding step chunks to the chain
+ * when it needs more data.
+ *
+ * @return -1 if a string points outside the chunks, 0 otherwise.
+ */
+static int
+parse_iov (uint8_t flags, size_t step)
+{
+    PsycParseIovState state;
+    PsycString iov[MAXCHUNKS], name[2], value;
+    const PsycString *mid;
+    size_t first = 0, last = step < nchunks ? step : nchunks, parts, i;
+    char oper;
+    int ret;
+
+    outlen[1] = 0;
+    psyc_parse_iov_state_init(&state, flags);
+    memcpy(iov, chunks, last * sizeof(PsycString));
+    psyc_parse_iov_buffer_set(&state, iov, last);
+
+    do {
+	oper = 0;
+	name[0] = name[1] = value = (PsycString) {0, NULL};
+	ret = psyc_parse_iov(&state, &oper, name, &value);
+
+	if (ret == PSYC_PARSE_INSUFFICIENT) {
+	    if (last >= nchunks)
+		break;
+	    // the new chain starts with the unparsed rest
+	    first += psyc_parse_iov_segment(&state);
+	    iov[0] = (PsycString) {psyc_parse_iov_remaining_length(&state),
+				   (char*)psyc_parse_iov_remaining_buffer(&state)};
+	    last = last + step < nchunks ? last + step : nchunks;
+	    for (i = first + 1; i < last; i++)
+		iov[i - first] = chunks[i];
+	    psyc_parse_iov_buffer_set(&state, iov, last - first);
+	    continue;
+	}
+
+	parts = psyc_parse_iov_name_parts(&state, &mid);
+	for (i = 0; i < parts; i++)
+	    if (!in_chunk(&mid[i]))
+		return -1;
+	if (!in_chunk(&name[0]) || !in_chunk(&name[1]) || !in_chunk(&value))
+	    return -1;
+	event(1, ret, oper, name, mid, parts, &value);
+    } while (ret > 0 && ret != PSYC_PARSE_COMPLETE);
+
+    return 0;
+}
+
+int
+main (int argc, char **argv)
+{
+    size_t sizes[] = {1, 2, 3, 8, 26, 27, 31, 40, 64, 100, 1000};
+    size_t steps[] = {1, 2, 1000};
+    uint8_t flags[] = {PSYC_PARSE_ALL, PSYC_PARSE_ROUTING_ONLY};
+    size_t s, t, f, i, off;
+    int fd, errors = 0;
+    ssize_t length;
+
+    for (i = 1; i < argc; i++) {
+	fd = open(argv[i], O_RDONLY);
+	if (fd < 0) {
+	    perror(argv[i]);
+	    return -1;
+	}
+	length = read(fd, buffer, sizeof(buffer));
+	close(fd);
+	if (length <= 0)
+	    continue;
+
+	for (s = 0; s < sizeof(sizes) / sizeof(*sizes); s++) {
+	    // split the packet into separately allocated chunks
+	    for (off = nchunks = 0; off < length; off += sizes[s], nchunks++) {
+		chunks[nchunks].length = length - off < sizes[s]
+		    ? length - off : sizes[s];
+		chunks[nchunks].data = malloc(chunks[nchunks].length);
+		memcpy(chunks[nchunks].data, buffer + off, chunks[nchunks].length);
+	    }
+
+	    for (f = 0; f < sizeof(flags) / sizeof(*flags); f++) {
+		parse(length, flags[f]);
+
+		for (t = 0; t < sizeof(steps) / sizeof(*steps); t++) {
+		    if (parse_iov(flags[f], steps[t]) < 0) {
+			printf("%s: string outside of the chunks, flags: %d, "
+			       "size: %ld, step: %ld\n", argv[i], flags[f],
+			       (long)sizes[s], (long)steps[t]);
+			errors++;
+		    } else if (outlen[0] != outlen[1]
+			       || memcmp(out[0], out[1], outlen[0])) {
+			printf("%s: mismatch, flags: %d, size: %ld, step: %ld\n"
+			       "%.*s\n---\n%.*s\n", argv[i], flags[f],
+			       (long)sizes[s], (long)steps[t],
+			       (int)outlen[0], out[0], (int)outlen[1], out[1]);
+			errors++;
+		    }
+		}
+	    }
+
+	    for (off = 0; off < nchunks; off++)
+		free(chunks[off].data);
+	}
+    }
+
+    printf("test_parse_iov: %s\n", errors ? "ERROR" : "SUCCESS");
+    return errors;
+}
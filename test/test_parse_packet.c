@@ -0,0 +1,129 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+/**
+ * Parse packets with psyc_parse_packet(), render them and compare the result
+ * with the input.
+ *
+ * The input is fed in chunks the way test_psyc does: the unparsed rest is
+ * moved to the start of the buffer and the parsed part is overwritten,
+ * so the packet must not point into it. A small arena makes it grow.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <psyc.h>
+#include <psyc/parse.h>
+#include <psyc/render.h>
+
+#define BUFSIZE 65536
+
+static char input[BUFSIZE], buffer[BUFSIZE], output[BUFSIZE];
+
+/**
+ * Parse the input feeding chunk bytes at a time (0 for everything at once)
+ * and render the packet to output.
+ *
+ * @return Length of the rendered packet, or -1 on error.
+ */
+static ssize_t
+parse (size_t length, size_t chunk, uint8_t flags)
+{
+    PsycParseState state;
+    PsycPacket packet;
+    PsycArena arena;
+    char mem[64];
+    size_t fed = chunk && chunk < length ? chunk : length, rest = 0;
+    ssize_t ret = -1;
+
+    psyc_arena_init(&arena, mem, sizeof(mem));
+    psyc_parse_state_init(&state, flags);
+    memcpy(buffer, input, fed);
+    psyc_parse_buffer_set(&state, buffer, fed);
+
+    for (;;) {
+	switch (psyc_parse_packet(&state, &arena, &packet)) {
+	case PSYC_PARSE_INSUFFICIENT:
+	    if (fed >= length)
+		goto done;
+	    // keep the rest only and overwrite what was parsed
+	    rest = psyc_parse_remaining_length(&state);
+	    memmove(buffer, psyc_parse_remaining_buffer(&state), rest);
+	    memset(buffer + rest, 'X', sizeof(buffer) - rest);
+	    chunk = chunk < length - fed ? chunk : length - fed;
+	    memcpy(buffer + rest, input + fed, chunk);
+	    fed += chunk;
+	    psyc_parse_buffer_set(&state, buffer, rest + chunk);
+	    continue;
+
+	case PSYC_PARSE_COMPLETE:
+	    if (psyc_render(&packet, output, sizeof(output))
+		== PSYC_RENDER_SUCCESS)
+		ret = packet.length;
+	    goto done;
+
+	default:
+	    goto done;
+	}
+    }
+
+done:
+    psyc_arena_free(&arena);
+    return ret;
+}
+
+int
+main (int argc, char **argv)
+{
+    size_t chunks[] = {0, 1, 2, 7, 64};
+    uint8_t flags[] = {PSYC_PARSE_ALL, PSYC_PARSE_ROUTING_ONLY};
+    size_t c, f;
+    int i, fd, errors = 0;
+    ssize_t length, len;
+
+    for (i = 1; i < argc; i++) {
+	fd = open(argv[i], O_RDONLY);
+	if (fd < 0) {
+	    perror(argv[i]);
+	    return -1;
+	}
+	length = read(fd, input, sizeof(input));
+	close(fd);
+	if (length <= 0)
+	    continue;
+
+	for (f = 0; f < sizeof(flags) / sizeof(*flags); f++)
+	    for (c = 0; c < sizeof(chunks) / sizeof(*chunks); c++) {
+		len = parse(length, chunks[c], flags[f]);
+		if (len != length || memcmp(input, output, length)) {
+		    printf("%s: mismatch, flags: %d, chunk: %ld\n%.*s\n",
+			   argv[i], flags[f], (long)chunks[c],
+			   (int)(len > 0 ? len : 0), output);
+		    errors++;
+		}
+	    }
+    }
+
+    printf("test_parse_packet: %s\n", errors ? "ERROR" : "SUCCESS");
+    return errors;
+}
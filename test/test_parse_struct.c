@@ -0,0 +1,149 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+/**
+ * Compare the output of the parser with and without the structural index
+ * for whole and chunked input.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <psyc.h>
+#include <psyc/parse.h>
+
+#define BUFSIZE 65536
+#define MAXTOKENS 4096
+
+typedef struct {
+    int ret;
+    char oper;
+    size_t name, value; // hashes of the name & value
+} Token;
+
+static char buffer[BUFSIZE];
+static uint64_t nl[PSYC_PARSE_STRUCT_WORDS(BUFSIZE)];
+static uint64_t delim[PSYC_PARSE_STRUCT_WORDS(BUFSIZE)];
+
+static size_t
+hash (PsycString *s)
+{
+    size_t i, h = 5381;
+    for (i = 0; i < s->length; i++)
+	h = h * 33 + (uint8_t)s->data[i];
+    return h;
+}
+
+/**
+ * Parse length bytes of buffer, feeding chunk bytes at a time
+ * (0 for everything at once).
+ *
+ * @return Number of tokens.
+ */
+static int
+parse (size_t length, size_t chunk, uint8_t flags, uint8_t indexed,
+       Token *tokens)
+{
+    PsycParseState state;
+    PsycParseStructIndex idx = {nl, delim, PSYC_PARSE_STRUCT_WORDS(BUFSIZE)};
+    PsycString name, value;
+    char oper;
+    const char *start = buffer;
+    size_t end = chunk ? chunk : length;
+    int n = 0, ret;
+
+    psyc_parse_state_init(&state, flags);
+    if (indexed)
+	psyc_parse_struct_index_set(&state, &idx);
+    psyc_parse_buffer_set(&state, start, (end < length ? end : length));
+
+    while (n < MAXTOKENS) {
+	oper = 0;
+	name.length = value.length = 0;
+	name.data = value.data = NULL;
+	ret = psyc_parse(&state, &oper, &name, &value);
+
+	if (ret == PSYC_PARSE_INSUFFICIENT) {
+	    if (end >= length)
+		break;
+	    // grow the window starting at the first unparsed byte
+	    start += psyc_parse_cursor(&state);
+	    end += chunk;
+	    psyc_parse_buffer_set(&state, start,
+				  (end < length ? end : length)
+				  - (start - buffer));
+	    continue;
+	}
+
+	memset(&tokens[n], 0, sizeof(Token));
+	tokens[n].ret = ret;
+	tokens[n].oper = oper;
+	tokens[n].name = hash(&name);
+	tokens[n].value = hash(&value);
+	n++;
+
+	if (ret < 0)
+	    break;
+	if (ret == PSYC_PARSE_COMPLETE && psyc_parse_remaining_length(&state) == 0
+	    && end >= length)
+	    break;
+    }
+
+    return n;
+}
+
+int
+main (int argc, char **argv)
+{
+    static Token plain[MAXTOKENS], indexed[MAXTOKENS];
+    size_t chunks[] = {0, 1, 7, 64, 1000};
+    uint8_t flags[] = {PSYC_PARSE_ALL, PSYC_PARSE_ROUTING_ONLY};
+    int i, c, f, n, m, fd, errors = 0;
+    ssize_t length;
+
+    for (i = 1; i < argc; i++) {
+	fd = open(argv[i], O_RDONLY);
+	if (fd < 0) {
+	    perror(argv[i]);
+	    return -1;
+	}
+	length = read(fd, buffer, sizeof(buffer));
+	close(fd);
+	if (length <= 0)
+	    continue;
+
+	for (f = 0; f < sizeof(flags) / sizeof(*flags); f++)
+	    for (c = 0; c < sizeof(chunks) / sizeof(*chunks); c++) {
+		n = parse(length, chunks[c], flags[f], 0, plain);
+		m = parse(length, chunks[c], flags[f], 1, indexed);
+
+		if (n != m || memcmp(plain, indexed, n * sizeof(Token))) {
+		    printf("%s: mismatch, flags: %d, chunk: %ld, tokens: %d/%d\n",
+			   argv[i], flags[f], (long)chunks[c], n, m);
+		    errors++;
+		}
+	    }
+    }
+
+    printf("test_parse_struct: %s\n", errors ? "ERROR" : "SUCCESS");
+    return errors;
+}
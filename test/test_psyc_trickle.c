@@ -0,0 +1,251 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+/**
+ * Parser benchmark for slow clients: the packet is fed to the parser
+ * <chunk> bytes at a time, as if it was trickling in from the network.
+ *
+ * The unparsed rest of the buffer is not copied, the parser gets a growing
+ * window of the input file, so the time measured is spent in the parser only.
+ *
+ * With -v the names and values returned are checked against parsing the
+ * whole packet at once instead, split values are joined for that.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <psyc.h>
+#include <psyc/parse.h>
+
+// cmd line args
+char *filename;
+uint8_t routing_only, stats, verify;
+size_t count = 1, chunk = 1;
+
+// what the parser returned, with -v
+char *trace;
+size_t tracelen, tracesize;
+
+void
+check_range (char c, const char *s, int min, int max)
+{
+    int n = atoi(s);
+    if (n < min) {
+	printf("-%c: error, should be >= %d\n", c, min);
+	exit(-1);
+    }
+}
+
+void
+trace_append (const char *data, size_t len)
+{
+    if (tracelen + len > tracesize) {
+	tracesize = (tracelen + len) * 2;
+	trace = realloc(trace, tracesize);
+	if (!trace) {
+	    perror("realloc");
+	    exit(1);
+	}
+    }
+    memcpy(trace + tracelen, data, len);
+    tracelen += len;
+}
+
+/**
+ * Append what psyc_parse() returned to the trace, the parts of a value split
+ * by the end of the buffer are joined as if it was returned in one go. The
+ * operator is only set for modifiers and the method only with the entity.
+ */
+void
+trace_parse (int ret, char oper, PsycString *name, PsycString *value)
+{
+    char line[64];
+    int len, start = 0;
+
+    switch (ret) {
+    case PSYC_PARSE_INSUFFICIENT:
+	return;
+    case PSYC_PARSE_ENTITY_START:
+    case PSYC_PARSE_BODY_START:
+	ret += PSYC_PARSE_ENTITY - PSYC_PARSE_ENTITY_START;
+	start = 1;
+	// fall through
+    case PSYC_PARSE_ROUTING:
+    case PSYC_PARSE_ENTITY:
+    case PSYC_PARSE_BODY:
+	len = snprintf(line, sizeof(line), "%d %c ", ret,
+		       ret == PSYC_PARSE_BODY ? ' ' : oper);
+	trace_append(line, len);
+	if (ret != PSYC_PARSE_BODY || !routing_only)
+	    trace_append(name->data, name->length);
+	trace_append("\t", 1);
+	trace_append(value->data, value->length);
+	if (!start)
+	    trace_append("\n", 1);
+	return;
+    case PSYC_PARSE_ENTITY_CONT:
+    case PSYC_PARSE_BODY_CONT:
+	trace_append(value->data, value->length);
+	return;
+    case PSYC_PARSE_ENTITY_END:
+    case PSYC_PARSE_BODY_END:
+	trace_append(value->data, value->length);
+	trace_append("\n", 1);
+	return;
+    default:
+	len = snprintf(line, sizeof(line), "%d\n", ret);
+	trace_append(line, len);
+    }
+}
+
+/**
+ * Parse the packet in buf feeding it chunk bytes at a time.
+ *
+ * @return Number of psyc_parse() calls.
+ */
+size_t
+test_trickle (char *buf, size_t size, size_t chunk)
+{
+    PsycParseState state;
+    PsycString name, value;
+    char oper;
+    const char *start = buf;
+    size_t end = chunk < size ? chunk : size, calls = 0;
+    int ret;
+
+    psyc_parse_state_init(&state, routing_only
+			  ? PSYC_PARSE_ROUTING_ONLY : PSYC_PARSE_ALL);
+    psyc_parse_buffer_set(&state, start, end);
+
+    for (;;) {
+	ret = psyc_parse(&state, &oper, &name, &value);
+	calls++;
+	if (verify)
+	    trace_parse(ret, oper, &name, &value);
+
+	if (ret == PSYC_PARSE_INSUFFICIENT) {
+	    if (end >= size)
+		break;
+	    start += psyc_parse_cursor(&state);
+	    end = end + chunk < size ? end + chunk : size;
+	    psyc_parse_buffer_set(&state, start, end - (start - buf));
+	} else if (ret == PSYC_PARSE_COMPLETE || ret < 0)
+	    break;
+    }
+
+    if (ret != PSYC_PARSE_COMPLETE && !verify) {
+	printf("error while parsing: %d\n", ret);
+	exit(1);
+    }
+    return calls;
+}
+
+int
+main (int argc, char **argv)
+{
+    struct timeval start, end;
+    struct stat st;
+    size_t i, calls = 0;
+    char *buf;
+    int c, fd;
+
+    while ((c = getopt (argc, argv, "f:b:c:rsvh")) != -1) {
+	switch (c) {
+	case 'f': filename = optarg; break;
+	case 'b': chunk = atoi(optarg); check_range(c, optarg, 1, 0); break;
+	case 'c': count = atoi(optarg); check_range(c, optarg, 1, 0); break;
+	case 'r': routing_only = 1; break;
+	case 's': stats = 1; break;
+	case 'v': verify = 1; break;
+	case 'h':
+	    printf("test_psyc_trickle -f <filename> [-b <chunk_size>] [-c <count>] [-rsv]\n"
+		   "  -f <filename>\tInput file name, containing one packet\n"
+		   "  -b <chunk_size>\tNumber of bytes to add to the buffer at a time, default is 1\n"
+		   "  -c <count>\t\tParse the packet <count> times\n"
+		   "  -r\t\t\tParse routing header only\n"
+		   "  -s\t\t\tShow statistics at the end\n"
+		   "  -v\t\t\tCompare the result with parsing the packet at once\n"
+		   "  -h\t\t\tShow this help\n");
+	    exit(0);
+	case '?': exit(-1);
+	default:  abort();
+	}
+    }
+
+    if (!filename) {
+	printf("-f is required\n");
+	exit(-1);
+    }
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+	perror("open");
+	exit(1);
+    }
+    fstat(fd, &st);
+    buf = malloc(st.st_size);
+    if (!buf || read(fd, buf, st.st_size) != st.st_size) {
+	perror("read");
+	exit(1);
+    }
+    close(fd);
+
+    if (verify) {
+	char *whole;
+	size_t len;
+
+	test_trickle(buf, st.st_size, st.st_size);
+	whole = trace, len = tracelen;
+	trace = NULL, tracelen = tracesize = 0;
+	test_trickle(buf, st.st_size, chunk);
+	if (len != tracelen || memcmp(whole, trace, len)) {
+	    printf("%s: chunk %ld differs\n%.*s\n--\n%.*s\n", filename,
+		   (long)chunk, (int)len, whole, (int)tracelen, trace);
+	    exit(1);
+	}
+	free(whole);
+	free(trace);
+	free(buf);
+	return 0;
+    }
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < count; i++)
+	calls += test_trickle(buf, st.st_size, chunk);
+    gettimeofday(&end, NULL);
+
+    if (stats)
+	printf("%ld bytes, %ld calls, %ld ms\n", (long)st.st_size, (long)calls,
+	       (end.tv_sec * 1000000 + end.tv_usec
+		- start.tv_sec * 1000000 - start.tv_usec) / 1000);
+    else
+	printf("%ld\n", (end.tv_sec * 1000000 + end.tv_usec
+			 - start.tv_sec * 1000000 - start.tv_usec) / 1000);
+
+    free(buf);
+    return 0;
+}
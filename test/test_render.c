@@ -116,6 +116,303 @@ test_list (const char *rendered, uint8_t verbose)
     return strncmp(rendered, buffer, packet.length);
 }
 
+/* render packets from a prototype & compare them with psyc_render() */
+int
+test_proto (uint8_t verbose)
+{
+    PsycModifier routing[4];
+    psyc_modifier_init(&routing[0], PSYC_OPERATOR_SET,
+		       PSYC_C2ARG("_source"),
+		       PSYC_C2ARG(myUNI), PSYC_MODIFIER_ROUTING);
+    psyc_modifier_init(&routing[1], PSYC_OPERATOR_SET,
+		       PSYC_C2ARG("_target"),
+		       NULL, 0, PSYC_MODIFIER_ROUTING);
+    psyc_modifier_init(&routing[2], PSYC_OPERATOR_SET,
+		       PSYC_C2ARG("_counter"),
+		       NULL, 0, PSYC_MODIFIER_ROUTING);
+    psyc_modifier_init(&routing[3], PSYC_OPERATOR_SET,
+		       PSYC_C2ARG("_tag"),
+		       PSYC_C2ARG("1234"), PSYC_MODIFIER_ROUTING);
+
+    PsycModifier entity[1];
+    psyc_modifier_init(&entity[0], PSYC_OPERATOR_SET,
+		       PSYC_C2ARG("_nick"),
+		       PSYC_C2ARG("ludwig"), PSYC_MODIFIER_CHECK_LENGTH);
+
+    PsycPacket packet;
+    psyc_packet_init(&packet, routing, PSYC_NUM_ELEM(routing),
+		     entity, PSYC_NUM_ELEM(entity),
+		     PSYC_C2ARG("_message_public"),
+		     PSYC_C2ARG("hello\n|\nworld"),
+		     PSYC_STATE_NOOP,
+		     PSYC_PACKET_CHECK_LENGTH);
+
+    PsycRenderProto proto;
+    size_t vars[] = {1, 2};
+    char pbuf[512], buffer[512], expected[512];
+    if (psyc_render_proto_init(&proto, &packet, vars, PSYC_NUM_ELEM(vars),
+			       pbuf, sizeof(pbuf)) != PSYC_RENDER_SUCCESS)
+	return 1;
+
+    PsycString values[][2] = {
+	{ PSYC_C2STRI("psyc://example.net/~alice"), PSYC_C2STRI("1") },
+	{ PSYC_C2STRI("psyc://example.net/@bob"), PSYC_C2STRI("123456789") },
+	{ PSYC_C2STRI("psyc://example.net/~carol"), {0, NULL} },
+    };
+    size_t i, len;
+
+    for (i = 0; i < PSYC_NUM_ELEM(values); i++) {
+	routing[1].value = values[i][0];
+	routing[2].value = values[i][1];
+	psyc_packet_length_set(&packet);
+	psyc_render(&packet, expected, sizeof(expected));
+
+	if (psyc_render_proto(&proto, values[i], buffer, sizeof(buffer), &len)
+	    != PSYC_RENDER_SUCCESS || len != packet.length
+	    || memcmp(buffer, expected, len)) {
+	    if (verbose)
+		printf("%.*s\n", (int)len, buffer);
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+/* render a packet for several recipients & compare them with psyc_render() */
+int
+test_multicast (uint8_t verbose)
+{
+    PsycModifier routing[3][2];
+    PsycHeader headers[3];
+    size_t i;
+    const char *targets[] = {
+	"psyc://example.net/~alice",
+	"psyc://example.net/~bob",
+	"psyc://example.net/~carol",
+    };
+
+    for (i = 0; i < 3; i++) {
+	psyc_modifier_init(&routing[i][0], PSYC_OPERATOR_SET,
+			   PSYC_C2ARG("_source"),
+			   PSYC_C2ARG(myUNI), PSYC_MODIFIER_ROUTING);
+	psyc_modifier_init(&routing[i][1], PSYC_OPERATOR_SET,
+			   PSYC_C2ARG("_target"),
+			   (char*)targets[i], strlen(targets[i]),
+			   PSYC_MODIFIER_ROUTING);
+	headers[i] = (PsycHeader) {2, routing[i]};
+    }
+
+    PsycModifier entity[1];
+    psyc_modifier_init(&entity[0], PSYC_OPERATOR_ASSIGN,
+		       PSYC_C2ARG("_description_presence"),
+		       PSYC_C2ARG("I'm omnipresent right now"),
+		       PSYC_MODIFIER_CHECK_LENGTH);
+
+    PsycPacket packet;
+    psyc_packet_init(&packet, NULL, 0, entity, PSYC_NUM_ELEM(entity),
+		     PSYC_C2ARG("_notice_presence"), NULL, 0,
+		     PSYC_STATE_NOOP, PSYC_PACKET_CHECK_LENGTH);
+
+    PsycString content;
+    char cbuf[256], buffer[1024], expected[1024], scratch[256];
+    struct iovec iov[6];
+    size_t lengths[3], iovcnt = PSYC_NUM_ELEM(iov), len = 0, cur = 0;
+
+    if (psyc_render_content(&packet, cbuf, sizeof(cbuf), &content)
+	!= PSYC_RENDER_SUCCESS)
+	return 1;
+
+    for (i = 0; i < 3; i++) {
+	packet.routing = headers[i];
+	psyc_packet_length_set(&packet);
+	psyc_render(&packet, expected + len, sizeof(expected) - len);
+	len += packet.length;
+    }
+
+    if (psyc_render_multicast(&content, headers, 3, buffer, sizeof(buffer),
+			      lengths) != PSYC_RENDER_SUCCESS
+	|| lengths[0] + lengths[1] + lengths[2] != len
+	|| memcmp(buffer, expected, len)) {
+	if (verbose)
+	    printf("%.*s\n", (int)len, buffer);
+	return 1;
+    }
+
+    if (psyc_render_multicast_iov(&content, headers, 3, iov, &iovcnt,
+				  scratch, sizeof(scratch))
+	!= PSYC_RENDER_SUCCESS || iovcnt != 6)
+	return 1;
+    for (i = 0; i < iovcnt; i++) {
+	if (i % 2 && iov[i].iov_base != content.data)
+	    return 1;
+	memcpy(buffer + cur, iov[i].iov_base, iov[i].iov_len);
+	cur += iov[i].iov_len;
+    }
+    if (cur != len || memcmp(buffer, expected, len))
+	return 1;
+
+    return 0;
+}
+
+/* check psyc_num_length() & psyc_num_render() around each power of 10 & 2 */
+int
+test_num (uint8_t verbose)
+{
+    char buf[32], expected[32];
+    uint64_t n, nums[3 * 64];
+    size_t i, len, count = 0;
+
+    for (i = 0, n = 1; i < 20; i++, n *= 10) {
+	nums[count++] = n - 1;
+	nums[count++] = n;
+	nums[count++] = n + 1;
+    }
+    for (i = 0; i < 64; i++)
+	nums[count++] = ((uint64_t)1 << i) - 1;
+
+    for (i = 0; i < count; i++) {
+	if ((size_t)nums[i] != nums[i])
+	    continue; // larger than size_t
+	len = snprintf(expected, sizeof(expected), "%llu",
+		       (unsigned long long)nums[i]);
+	if (psyc_num_length(nums[i]) != len
+	    || psyc_num_render(nums[i], buf) != len
+	    || memcmp(buf, expected, len)) {
+	    if (verbose)
+		printf("%s: %ld [%.*s]\n", expected,
+		       (long)psyc_num_length(nums[i]), (int)len, buf);
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+/* packets with every part psyc_render() knows, n from 0 to 2 */
+static void
+test_packet (PsycPacket *packet, int n)
+{
+    static PsycModifier routing[2], entity[3];
+    static char value[PSYC_RENDER_IOV_COPY_MAX * 3];
+
+    memset(value, 'v', sizeof(value));
+    value[PSYC_RENDER_IOV_COPY_MAX] = '\n';
+    psyc_modifier_init(&routing[0], PSYC_OPERATOR_SET,
+		       PSYC_C2ARG("_source"),
+		       PSYC_C2ARG(myUNI), PSYC_MODIFIER_ROUTING);
+    psyc_modifier_init(&routing[1], PSYC_OPERATOR_SET,
+		       PSYC_C2ARG("_target"),
+		       PSYC_C2ARG("psyc://example.net/~alice"),
+		       PSYC_MODIFIER_ROUTING);
+    psyc_modifier_init(&entity[0], PSYC_OPERATOR_ASSIGN,
+		       PSYC_C2ARG("_nick"),
+		       PSYC_C2ARG("ludwig"), PSYC_MODIFIER_CHECK_LENGTH);
+    psyc_modifier_init(&entity[1], PSYC_OPERATOR_AUGMENT,
+		       PSYC_C2ARG("_data_binary"),
+		       value, sizeof(value), PSYC_MODIFIER_CHECK_LENGTH);
+    psyc_modifier_init(&entity[2], PSYC_OPERATOR_SET,
+		       PSYC_C2ARG("_description"),
+		       PSYC_C2ARG("a|b\nc"), PSYC_MODIFIER_CHECK_LENGTH);
+
+    switch (n) {
+    case 0:
+	psyc_packet_init(packet, routing, PSYC_NUM_ELEM(routing),
+			 entity, PSYC_NUM_ELEM(entity),
+			 PSYC_C2ARG("_message_public"),
+			 value, sizeof(value),
+			 PSYC_STATE_NOOP, PSYC_PACKET_CHECK_LENGTH);
+	break;
+    case 1:
+	psyc_packet_init(packet, NULL, 0, entity, 1,
+			 PSYC_C2ARG("_request_state"), NULL, 0,
+			 PSYC_STATE_RESYNC, PSYC_PACKET_CHECK_LENGTH);
+	break;
+    default:
+	psyc_packet_init_raw(packet, routing, PSYC_NUM_ELEM(routing),
+			     value, sizeof(value), PSYC_PACKET_CHECK_LENGTH);
+    }
+}
+
+/* render the test packets to an iovec & compare them with psyc_render() */
+int
+test_iov (uint8_t verbose)
+{
+    PsycPacket packet;
+    struct iovec iov[32];
+    char scratch[1024], buffer[1024], expected[1024];
+    size_t iovcnt, i, len;
+    int n, referenced;
+
+    for (n = 0; n < 3; n++) {
+	test_packet(&packet, n);
+	psyc_render(&packet, expected, sizeof(expected));
+
+	iovcnt = PSYC_NUM_ELEM(iov);
+	if (psyc_render_iov(&packet, iov, &iovcnt, scratch, sizeof(scratch))
+	    != PSYC_RENDER_SUCCESS)
+	    return 1;
+	for (i = len = referenced = 0; i < iovcnt; i++) {
+	    if (iov[i].iov_len > PSYC_RENDER_IOV_COPY_MAX)
+		referenced++;
+	    memcpy(buffer + len, iov[i].iov_base, iov[i].iov_len);
+	    len += iov[i].iov_len;
+	}
+	if (len != packet.length || memcmp(buffer, expected, len)
+	    || (n != 1 && !referenced)) {
+	    if (verbose)
+		printf("%.*s\n", (int)len, buffer);
+	    return 1;
+	}
+
+	// too little scratch space, or too few entries for a referenced value
+	iovcnt = PSYC_NUM_ELEM(iov);
+	if (psyc_render_iov(&packet, iov, &iovcnt, scratch, 8)
+	    != PSYC_RENDER_ERROR)
+	    return 1;
+	iovcnt = 1;
+	if (referenced && psyc_render_iov(&packet, iov, &iovcnt, scratch,
+					  sizeof(scratch)) != PSYC_RENDER_ERROR)
+	    return 1;
+    }
+    return 0;
+}
+
+/* render the test packets a few bytes at a time & compare them with psyc_render() */
+int
+test_stream (uint8_t verbose)
+{
+    PsycPacket packet;
+    PsycRenderState state;
+    size_t sizes[] = {1, 7, 128}, i, len;
+    char buf[128], buffer[1024], expected[1024];
+    int n, ret;
+
+    for (n = 0; n < 3; n++) {
+	test_packet(&packet, n);
+	psyc_render(&packet, expected, sizeof(expected));
+
+	for (i = 0; i < PSYC_NUM_ELEM(sizes); i++) {
+	    len = 0;
+	    psyc_render_state_init(&state, &packet, buf, sizes[i]);
+	    do {
+		ret = psyc_render_stream(&state);
+		if (ret < 0 || len + psyc_render_bytes_written(&state)
+		    > sizeof(buffer))
+		    return 1;
+		memcpy(buffer + len, buf, psyc_render_bytes_written(&state));
+		len += psyc_render_bytes_written(&state);
+		psyc_render_buffer_set(&state, buf, sizes[i]);
+	    } while (ret == PSYC_RENDER_INCOMPLETE);
+
+	    if (len != packet.length || memcmp(buffer, expected, len)) {
+		if (verbose)
+		    printf("%.*s\n", (int)len, buffer);
+		return 1;
+	    }
+	}
+    }
+    return 0;
+}
+
 int
 main (int argc, char **argv)
 {
@@ -142,6 +439,21 @@ list test\n\
 |\n", verbose))
 	return 2;
 
+    if (test_num(verbose))
+	return 3;
+
+    if (test_proto(verbose))
+	return 4;
+
+    if (test_multicast(verbose))
+	return 5;
+
+    if (test_iov(verbose))
+	return 6;
+
+    if (test_stream(verbose))
+	return 7;
+
     puts("psyc_render passed all tests.");
 
     return 0;
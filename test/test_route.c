@@ -0,0 +1,313 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+/**
+ * Check the routing table: the most specific route of a uniform is found,
+ * lookups from several threads give the right handlers while routes are
+ * added and removed, and replaced memory is freed while lookups never stop.
+ *
+ * Options: -n <routes added and removed> (default: 20000, ten times as many
+ * for freeing), -t <threads> (default: 4).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <psyc.h>
+#include <psyc/route.h>
+
+#define MAXTHREADS 64
+/// Retired pointers that may pile up while a lookup thread is preempted.
+#define RETIRED_MAX 200000
+
+static PsycRoutes routes;
+static size_t count = 20000, nthreads = 4;
+static uint8_t done;
+
+static PsycUniform
+parse (const char *str)
+{
+    PsycUniform uni;
+
+    memset(&uni, 0, sizeof(uni));
+    psyc_uniform_parse(&uni, str, strlen(str));
+    return uni;
+}
+
+static int
+add (const char *str, PsycRouteLevel level, uintptr_t handler)
+{
+    PsycUniform uni = parse(str);
+    return psyc_route_add(&routes, &uni, level, (void *)handler);
+}
+
+static int
+removed (const char *str, PsycRouteLevel level)
+{
+    PsycUniform uni = parse(str);
+    return psyc_route_remove(&routes, &uni, level);
+}
+
+static int
+lookup (const char *str, uintptr_t handler, PsycRouteLevel level)
+{
+    PsycUniform uni = parse(str);
+    PsycRouteLevel l;
+    uintptr_t h = (uintptr_t)psyc_route_lookup(&routes, &uni, &l);
+
+    if (h != handler || l != level) {
+	printf("%s: %lu %d, expected %lu %d\n",
+	       str, (unsigned long)h, l, (unsigned long)handler, level);
+	return 1;
+    }
+    return 0;
+}
+
+static int
+test_levels ()
+{
+    int errors = 0;
+
+    if (add("psyc://example.net", PSYC_ROUTE_HOST, 1) != PSYC_OK
+	|| add("psyc://example.net:4404d", PSYC_ROUTE_ROOT, 2) != PSYC_OK
+	|| add("psyc://example.net:4404d/@place", PSYC_ROUTE_ENTITY, 3) != PSYC_OK
+	|| add("psyc://example.net:4404d/@place#chan", PSYC_ROUTE_CHANNEL, 4)
+	   != PSYC_OK
+	|| add("psyc://example.net:4404d/~place", PSYC_ROUTE_ENTITY, 5) != PSYC_OK
+	|| add("psyc://example.net/#chan", PSYC_ROUTE_CHANNEL, 6) != PSYC_OK
+	// no such part
+	|| add("psyc://example.net", PSYC_ROUTE_ENTITY, 7) != PSYC_ERROR
+	|| add("psyc://example.net/~x", PSYC_ROUTE_CHANNEL, 7) != PSYC_ERROR
+	|| add("psyc://example.net/~x", PSYC_ROUTE_ENTITY, 0) != PSYC_ERROR
+	|| add("psyc://:x", PSYC_ROUTE_HOST, 7) != PSYC_ERROR)
+	errors++;
+
+    errors += lookup("psyc://example.net:4404d/@place#chan", 4, PSYC_ROUTE_CHANNEL);
+    errors += lookup("psyc://example.net:4404d/@place#other", 3, PSYC_ROUTE_ENTITY);
+    errors += lookup("psyc://example.net:4404d/@place", 3, PSYC_ROUTE_ENTITY);
+    errors += lookup("psyc://example.net:4404d/~place", 5, PSYC_ROUTE_ENTITY);
+    errors += lookup("psyc://example.net:4404d/$place", 2, PSYC_ROUTE_ROOT);
+    errors += lookup("psyc://example.net:4404d/@plac", 2, PSYC_ROUTE_ROOT);
+    errors += lookup("psyc://example.net:4404d/", 2, PSYC_ROUTE_ROOT);
+    errors += lookup("psyc://example.net:4404d", 2, PSYC_ROUTE_ROOT);
+    errors += lookup("PSYC://Example.NET:4404d/@place", 3, PSYC_ROUTE_ENTITY);
+    errors += lookup("psyc://example.net:4404/@place", 1, PSYC_ROUTE_HOST);
+    errors += lookup("psyc://example.net/@place", 1, PSYC_ROUTE_HOST);
+    errors += lookup("psyc://example.net/#chan", 6, PSYC_ROUTE_CHANNEL);
+    errors += lookup("psyc://example.net", 1, PSYC_ROUTE_HOST);
+    errors += lookup("psyc://example.org:4404d/@place", 0, PSYC_ROUTE_NONE);
+    errors += lookup("psyc://example.net.org", 0, PSYC_ROUTE_NONE);
+    if (routes.count != 6)
+	errors++;
+
+    // replace
+    if (add("psyc://example.net:4404d/@place", PSYC_ROUTE_ENTITY, 8) != PSYC_OK
+	|| routes.count != 6)
+	errors++;
+    errors += lookup("psyc://example.net:4404d/@place", 8, PSYC_ROUTE_ENTITY);
+
+    if (removed("psyc://example.net:4404d/@place", PSYC_ROUTE_ENTITY) != PSYC_OK
+	|| removed("psyc://example.net:4404d/@place", PSYC_ROUTE_ENTITY) != PSYC_ERROR
+	|| removed("psyc://example.net/@place", PSYC_ROUTE_ENTITY) != PSYC_ERROR)
+	errors++;
+    errors += lookup("psyc://example.net:4404d/@place#chan", 4, PSYC_ROUTE_CHANNEL);
+    errors += lookup("psyc://example.net:4404d/@place", 2, PSYC_ROUTE_ROOT);
+
+    if (removed("psyc://EXAMPLE.net", PSYC_ROUTE_HOST) != PSYC_OK)
+	errors++;
+    errors += lookup("psyc://example.net/@place", 0, PSYC_ROUTE_NONE);
+
+    // all nodes are freed with the last route
+    if (removed("psyc://example.net:4404d", PSYC_ROUTE_ROOT) != PSYC_OK
+	|| removed("psyc://example.net:4404d/@place#chan", PSYC_ROUTE_CHANNEL)
+	   != PSYC_OK
+	|| removed("psyc://example.net:4404d/~place", PSYC_ROUTE_ENTITY) != PSYC_OK
+	|| removed("psyc://example.net/#chan", PSYC_ROUTE_CHANNEL) != PSYC_OK
+	|| routes.count != 0 || routes.nodes != 0 || routes.root.children)
+	errors++;
+
+    return errors;
+}
+
+static void
+churn_uniform (char *buf, size_t i)
+{
+    switch (i % 3) {
+    case 0:
+	sprintf(buf, "psyc://host%d.example.net/~user%d", (int)(i % 50), (int)i);
+	break;
+    case 1:
+	sprintf(buf, "psyc://host%d.example.net:4404/@place%d#c%d",
+		(int)(i % 50), (int)i, (int)i);
+	break;
+    default:
+	sprintf(buf, "psyc://host%d.example.net:%d", (int)i, (int)(i % 10));
+    }
+}
+
+static PsycRouteLevel
+churn_level (size_t i)
+{
+    return i % 3 == 0 ? PSYC_ROUTE_ENTITY
+	: i % 3 == 1 ? PSYC_ROUTE_CHANNEL : PSYC_ROUTE_ROOT;
+}
+
+/**
+ * Look up routes that stay while others come and go.
+ */
+static void *
+lookup_thread (void *arg)
+{
+    size_t errors = 0, n = 0;
+    char buf[128];
+
+    while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE) || n < 1000) {
+	sprintf(buf, "psyc://host%d.example.net/~stay%d", (int)(n % 50), (int)n);
+	errors += lookup(buf, 1000 + n % 50, PSYC_ROUTE_HOST);
+	sprintf(buf, "psyc://host%d.example.net:4404/@place-1", (int)(n % 50));
+	errors += lookup(buf, 2000 + n % 50, PSYC_ROUTE_ROOT);
+	n++;
+    }
+    return (void *)errors;
+}
+
+static int
+test_threads ()
+{
+    pthread_t threads[MAXTHREADS];
+    char buf[128];
+    size_t i, errors = 0;
+    void *ret;
+
+    for (i = 0; i < 50; i++) {
+	sprintf(buf, "psyc://host%d.example.net", (int)i);
+	if (add(buf, PSYC_ROUTE_HOST, 1000 + i) != PSYC_OK)
+	    errors++;
+	sprintf(buf, "psyc://host%d.example.net:4404", (int)i);
+	if (add(buf, PSYC_ROUTE_ROOT, 2000 + i) != PSYC_OK)
+	    errors++;
+    }
+
+    for (i = 0; i < nthreads; i++)
+	pthread_create(&threads[i], NULL, lookup_thread, NULL);
+
+    for (i = 0; i < count; i++) {
+	churn_uniform(buf, i);
+	if (add(buf, churn_level(i), 10000 + i) != PSYC_OK)
+	    errors++;
+	if (i >= 100) { // keep the last hundred
+	    churn_uniform(buf, i - 100);
+	    if (removed(buf, churn_level(i - 100)) != PSYC_OK)
+		errors++;
+	}
+    }
+    __atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+
+    for (i = 0; i < nthreads; i++) {
+	pthread_join(threads[i], &ret);
+	errors += (size_t)ret;
+    }
+
+    for (i = count > 100 ? count - 100 : 0; i < count; i++) {
+	churn_uniform(buf, i);
+	errors += lookup(buf, 10000 + i, churn_level(i));
+    }
+    if (routes.count != 100 + (count < 100 ? count : 100))
+	errors++;
+
+    return errors;
+}
+
+/**
+ * Look up routes without a break until the updates are done.
+ */
+static void *
+reclaim_thread (void *arg)
+{
+    PsycUniform uni = parse("psyc://host1.example.net:4404/@place#chan");
+
+    while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE))
+	psyc_route_lookup(&routes, &uni, NULL);
+    return NULL;
+}
+
+/**
+ * Add and remove routes while lookups never stop: the retired memory has to
+ * be freed meanwhile, not only when no lookups happen to be running.
+ */
+static int
+test_reclaim ()
+{
+    pthread_t threads[MAXTHREADS];
+    char buf[128];
+    size_t i, max = 0;
+    uint32_t epoch = routes.epoch;
+    int errors = 0;
+
+    __atomic_store_n(&done, 0, __ATOMIC_RELEASE);
+    for (i = 0; i < nthreads; i++)
+	pthread_create(&threads[i], NULL, reclaim_thread, NULL);
+
+    for (i = 0; i < 10 * count; i++) {
+	sprintf(buf, "psyc://host1.example.net:4404/@place#c%d", (int)(i % 10));
+	if (add(buf, PSYC_ROUTE_CHANNEL, 1) != PSYC_OK
+	    || removed(buf, PSYC_ROUTE_CHANNEL) != PSYC_OK)
+	    errors++;
+	if (routes.nretired > max)
+	    max = routes.nretired;
+    }
+    __atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+
+    for (i = 0; i < nthreads; i++)
+	pthread_join(threads[i], NULL);
+
+    printf("test_route: %lu updates, %lu epochs, at most %lu retired\n",
+	   (unsigned long)count * 20, (unsigned long)(routes.epoch - epoch),
+	   (unsigned long)max);
+    if (routes.epoch == epoch || max > RETIRED_MAX)
+	errors++;
+    return errors;
+}
+
+int
+main (int argc, char **argv)
+{
+    int c, errors = 0;
+
+    while ((c = getopt(argc, argv, "n:t:")) != -1)
+	switch (c) {
+	case 'n': count = atoi(optarg); break;
+	case 't': nthreads = atoi(optarg); break;
+	}
+    if (nthreads > MAXTHREADS)
+	return -1;
+
+    psyc_routes_init(&routes);
+    errors += test_levels();
+    errors += test_threads();
+    errors += test_reclaim();
+    psyc_routes_free(&routes);
+
+    printf("test_route: %s\n", errors ? "ERROR" : "SUCCESS");
+    return errors;
+}
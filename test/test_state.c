@@ -0,0 +1,464 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+/**
+ * Check the operators applied to the entity state and the resync content
+ * rendered from it, also when it's cached while the state changes, then fill the states of many contexts and time updates
+ * to them.
+ *
+ * Options: -n <contexts> (default: 1000), -v <variables per context>
+ * (default: 20), -u <updates> (default: 1000000).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#include <lib.h>
+#include <psyc/state.h>
+
+static size_t ncontexts = 1000, nvars = 20, nupdates = 1000000;
+
+static int
+check (PsycState *state, const char *name, const char *expected)
+{
+    size_t len = 0;
+    const char *value = psyc_state_get(state, name, strlen(name), &len);
+
+    if ((!value && expected)
+	|| (value && (!expected || len != strlen(expected)
+		      || memcmp(value, expected, len)))) {
+	printf("%s: %.*s, expected %s\n", name, value ? (int)len : 6,
+	       value ? value : "(null)", expected ? expected : "(null)");
+	return 1;
+    }
+    return 0;
+}
+
+static int
+apply (PsycState *state, char oper, const char *name, const char *value,
+       PsycStateRC expected)
+{
+    PsycStateRC ret = psyc_state_apply(state, oper, name, strlen(name),
+				       value, strlen(value));
+    if (ret != expected) {
+	printf("%c%s %s: %d, expected %d\n", oper, name, value, ret, expected);
+	return 1;
+    }
+    return 0;
+}
+
+static int
+test_operators ()
+{
+    PsycState state;
+    int errors = 0;
+
+    psyc_state_init(&state);
+
+    errors += apply(&state, ':', "_nick", "foo", PSYC_STATE_UNCHANGED);
+    errors += check(&state, "_nick", NULL);
+    errors += apply(&state, '=', "_nick", "foo", PSYC_STATE_CHANGED);
+    errors += apply(&state, '=', "_nick", "foo", PSYC_STATE_UNCHANGED);
+    errors += apply(&state, '?', "_nick", "", PSYC_STATE_UNCHANGED);
+    errors += check(&state, "_nick", "foo");
+    errors += apply(&state, '=', "_nick", "fo", PSYC_STATE_CHANGED);
+    errors += check(&state, "_nick", "fo");
+    errors += apply(&state, '=', "_nick", "foobar", PSYC_STATE_CHANGED);
+    errors += check(&state, "_nick", "foobar");
+
+    errors += apply(&state, '+', "_list_members", "| a| b", PSYC_STATE_CHANGED);
+    errors += apply(&state, '+', "_list_members", "| c|3 d|e", PSYC_STATE_CHANGED);
+    errors += check(&state, "_list_members", "| a| b| c|3 d|e");
+    errors += apply(&state, '-', "_list_members", "| b|3 d|e| x", PSYC_STATE_CHANGED);
+    errors += check(&state, "_list_members", "| a| c");
+    errors += apply(&state, '-', "_list_members", "| x", PSYC_STATE_UNCHANGED);
+    errors += apply(&state, '+', "_list_members", "| a", PSYC_STATE_CHANGED);
+    errors += apply(&state, '-', "_list_members", "| a", PSYC_STATE_CHANGED);
+    errors += check(&state, "_list_members", "| c| a");
+    errors += apply(&state, '-', "_list_members", "| c| a", PSYC_STATE_CHANGED);
+    errors += check(&state, "_list_members", NULL);
+    errors += apply(&state, '+', "_list_typed", "_uniform| a", PSYC_STATE_CHANGED);
+    errors += apply(&state, '+', "_list_typed", "_uniform| b|=_nick c",
+		    PSYC_STATE_CHANGED);
+    errors += check(&state, "_list_typed", "_uniform| a| b|=_nick c");
+    errors += apply(&state, '-', "_list_typed", "| c", PSYC_STATE_UNCHANGED);
+    errors += apply(&state, '-', "_list_typed", "|=_nick c", PSYC_STATE_CHANGED);
+    errors += check(&state, "_list_typed", "_uniform| a| b");
+
+    errors += apply(&state, '+', "_dict_x", "{a} 1{b} 2", PSYC_STATE_CHANGED);
+    errors += apply(&state, '+', "_dict_x", "{b} 3{c} 4", PSYC_STATE_CHANGED);
+    errors += check(&state, "_dict_x", "{a} 1{b} 3{c} 4");
+    errors += apply(&state, '-', "_dict_x", "{a}{c}{d}", PSYC_STATE_CHANGED);
+    errors += check(&state, "_dict_x", "{b} 3");
+
+    errors += apply(&state, '+', "_nick", "| a", PSYC_STATE_ERROR_TYPE);
+    errors += apply(&state, '-', "_struct_x", "| a", PSYC_STATE_ERROR_TYPE);
+    errors += apply(&state, '+', "_list_members", "|a", PSYC_STATE_ERROR_VALUE);
+    errors += apply(&state, '+', "_dict_x", "{a", PSYC_STATE_ERROR_VALUE);
+    errors += apply(&state, '!', "_nick", "x", PSYC_STATE_ERROR_OPERATOR);
+    errors += apply(&state, '@', "_list_typed", "#1 = c", PSYC_STATE_CHANGED);
+    errors += apply(&state, '@', "_list_typed", "#3 = c", PSYC_STATE_ERROR_UPDATE);
+    errors += apply(&state, '@', "_list_typed", "0 =| x", PSYC_STATE_ERROR_UPDATE);
+    errors += apply(&state, '@', "_nick", "#0 = x", PSYC_STATE_ERROR_TYPE);
+    errors += check(&state, "_list_typed", "_uniform| a| c");
+    errors += check(&state, "_dict_x", "{b} 3");
+
+    errors += apply(&state, '=', "_nick", "", PSYC_STATE_CHANGED);
+    errors += apply(&state, '=', "_nick", "", PSYC_STATE_UNCHANGED);
+    errors += check(&state, "_nick", NULL);
+    if (state.count != 2)
+	errors++;
+
+    psyc_state_reset(&state);
+    errors += check(&state, "_dict_x", NULL);
+    errors += check(&state, "_list_typed", NULL);
+    errors += apply(&state, '=', "_nick", "bar", PSYC_STATE_CHANGED);
+    errors += check(&state, "_nick", "bar");
+    if (state.count != 1)
+	errors++;
+
+    psyc_state_free(&state);
+    return errors;
+}
+
+/**
+ * Send the rendered state in a resync packet and apply it to another state.
+ */
+static int
+test_resync ()
+{
+    PsycState state, copy;
+    PsycPacket packet, parsed;
+    PsycModifier routing[1];
+    PsycParseState parser;
+    PsycArena arena;
+    char content[4096], buf[8192], mem[16384], name[16], value[64];
+    const char *v;
+    size_t i, len;
+    int errors = 0, ret;
+
+    psyc_state_init(&state);
+    psyc_state_init(&copy);
+    for (i = 0; i < 100; i++) {
+	sprintf(name, "_var%d", (int)i);
+	sprintf(value, i % 10 ? "value %d" : "multi\nline %d", (int)i);
+	errors += apply(&state, '=', name, value, PSYC_STATE_CHANGED);
+	errors += apply(&copy, '=', name, "stale", PSYC_STATE_CHANGED);
+    }
+    for (i = 0; i < 100; i += 3) {
+	sprintf(name, "_var%d", (int)i);
+	errors += apply(&state, '=', name, "", PSYC_STATE_CHANGED);
+    }
+    errors += apply(&state, '+', "_list_members", "| a| b", PSYC_STATE_CHANGED);
+
+    if (psyc_state_render(&state, content, psyc_state_length(&state) - 1)
+	!= PSYC_RENDER_ERROR
+	|| psyc_state_render(&state, content, sizeof(content)) != PSYC_RENDER_SUCCESS)
+	errors++;
+
+    routing[0] = PSYC_MODIFIER(PSYC_OPERATOR_SET, PSYC_C2STR("_context"),
+			       PSYC_C2STR("psyc://example.net/@place"),
+			       PSYC_MODIFIER_ROUTING);
+    psyc_packet_init_raw(&packet, routing, 1, content, psyc_state_length(&state),
+			 PSYC_PACKET_CHECK_LENGTH);
+    if (psyc_render(&packet, buf, sizeof(buf)) != PSYC_RENDER_SUCCESS)
+	return errors + 1;
+
+    psyc_arena_init(&arena, mem, sizeof(mem));
+    psyc_parse_state_init(&parser, PSYC_PARSE_ALL);
+    psyc_parse_buffer_set(&parser, buf, packet.length);
+    if ((ret = psyc_parse_packet(&parser, &arena, &parsed)) != PSYC_PARSE_COMPLETE) {
+	printf("resync: parse %d\n%.*s", ret, (int)packet.length, buf);
+	return errors + 1;
+    }
+    if (psyc_state_apply_packet(&copy, &parsed) != PSYC_STATE_CHANGED)
+	errors++;
+
+    if (copy.count != state.count)
+	errors++;
+    for (i = 0; i < 100; i++) {
+	sprintf(name, "_var%d", (int)i);
+	sprintf(value, i % 10 ? "value %d" : "multi\nline %d", (int)i);
+	errors += check(&copy, name, i % 3 ? value : NULL);
+    }
+    errors += check(&copy, "_list_members", "| a| b");
+    v = psyc_state_get(&copy, PSYC_C2ARG("_var1"), &len);
+    if (!v || v == psyc_state_get(&state, PSYC_C2ARG("_var1"), &len))
+	errors++;
+
+    psyc_state_free(&state);
+    psyc_state_free(&copy);
+    return errors;
+}
+
+/**
+ * Check that a state and the one a resync answer recreates are the same.
+ */
+static int
+resync_check (PsycState *state)
+{
+    PsycState copy;
+    PsycPacket parsed;
+    PsycModifier routing[1];
+    PsycParseState parser;
+    PsycArena arena;
+    PsycStateVar *v;
+    struct iovec iov[2];
+    static char buf[65536], mem[65536];
+    char header[128];
+    const char *value;
+    size_t len;
+    int errors = 0;
+
+    routing[0] = PSYC_MODIFIER(PSYC_OPERATOR_SET, PSYC_C2STR("_context"),
+			       PSYC_C2STR("psyc://example.net/@place"),
+			       PSYC_MODIFIER_ROUTING);
+    if (psyc_state_resync(state, routing, 1, header, 10, iov) != PSYC_RENDER_ERROR
+	|| psyc_state_resync(state, routing, 1, header, sizeof(header), iov)
+	   != PSYC_RENDER_SUCCESS
+	|| iov[0].iov_len + iov[1].iov_len > sizeof(buf))
+	return 1;
+    memcpy(buf, iov[0].iov_base, iov[0].iov_len);
+    memcpy(buf + iov[0].iov_len, iov[1].iov_base, iov[1].iov_len);
+
+    psyc_state_init(&copy);
+    psyc_arena_init(&arena, mem, sizeof(mem));
+    psyc_parse_state_init(&parser, PSYC_PARSE_ALL);
+    psyc_parse_buffer_set(&parser, buf, iov[0].iov_len + iov[1].iov_len);
+    if (psyc_parse_packet(&parser, &arena, &parsed) != PSYC_PARSE_COMPLETE
+	|| psyc_state_apply_packet(&copy, &parsed) < 0
+	|| copy.count != state->count)
+	errors++;
+
+    for (v = state->vars; !errors && v < state->vars + state->size; v++)
+	if (v->gen == state->gen) {
+	    value = psyc_state_get_id(&copy, v->id, &len);
+	    if (!value || len != v->length
+		|| memcmp(value, state->values + v->offset, len))
+		errors++;
+	}
+    if (errors)
+	printf("resync: %u %u\n%.*s", state->count, copy.count, (int)(iov[0].iov_len + iov[1].iov_len), buf);
+
+    psyc_state_free(&copy);
+    return errors;
+}
+
+/**
+ * Change a state at random, asking for the cached resync answer in between.
+ */
+static int
+test_cache ()
+{
+    const char *names[] = {"_nick", "_topic", "_list_members", "_dict_x"};
+    char name[32], value[64];
+    PsycState state;
+    size_t i, len, cached = 0;
+    int errors = 0, n;
+
+    psyc_state_init(&state);
+    srand(23);
+    for (i = 0; i < 20000 && !errors; i++) {
+	n = rand() % 8;
+	if (n < 4)
+	    sprintf(name, "%s", names[n]);
+	else
+	    sprintf(name, "_var%d", rand() % 50);
+
+	switch (rand() % 4) {
+	case 0:
+	    if (n == 3)
+		len = sprintf(value, "{k%d} %d", rand() % 8, rand());
+	    else if (n == 2)
+		len = sprintf(value, "| m%d", rand() % 8);
+	    else
+		len = sprintf(value, rand() % 2 ? "v%d" : "line\n%d%d", rand(), rand());
+	    psyc_state_apply(&state, '=', name, strlen(name), value, len);
+	    break;
+	case 1:
+	    psyc_state_apply(&state, '=', name, strlen(name), "", 0);
+	    break;
+	case 2:
+	case 3:
+	    if (n == 2)
+		len = sprintf(value, "| m%d", rand() % 8);
+	    else if (n == 3)
+		len = sprintf(value, "{k%d} %d", rand() % 8, rand());
+	    else
+		break;
+	    psyc_state_apply(&state, rand() % 2 ? '+' : '-', name, strlen(name),
+			     value, len);
+	}
+
+	if (rand() % 500 == 0)
+	    psyc_state_reset(&state);
+	if (rand() % 5 == 0) {
+	    errors += resync_check(&state);
+	    cached++;
+	}
+	if (state.lines && psyc_state_length(&state) != state.cachelen - 2)
+	    errors++;
+    }
+    psyc_state_free(&state);
+    return errors;
+}
+
+static long
+elapsed (struct timeval *start)
+{
+    struct timeval end;
+    gettimeofday(&end, NULL);
+    return (end.tv_sec - start->tv_sec) * 1000000 + (end.tv_usec - start->tv_usec);
+}
+
+/**
+ * Fill the states of many contexts, then assign variables and add and
+ * remove list members at random.
+ */
+static int
+bench ()
+{
+    PsycState *states = malloc(ncontexts * sizeof(PsycState)), *s = NULL;
+    uint32_t *ids = malloc(nvars * sizeof(uint32_t)), members;
+    char name[32], value[32], member[64];
+    static char buf[65536];
+    struct timeval start;
+    size_t i, j, rlen, mem = 0;
+    long t;
+    int errors = 0, len = 0, c;
+
+    if (!states || !ids)
+	return 1;
+    for (j = 0; j < nvars; j++) {
+	sprintf(name, "_bench%d", (int)j);
+	ids[j] = psyc_intern(name, strlen(name));
+    }
+    members = psyc_intern(PSYC_C2ARG("_list_members"));
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < ncontexts; i++) {
+	psyc_state_init(&states[i]);
+	len = sprintf(member, "| psyc://example.net/~a%d| psyc://example.net/~b%d",
+		      (int)i, (int)i);
+	if (psyc_state_apply_id(&states[i], '+', members, member, len)
+	    != PSYC_STATE_CHANGED)
+	    errors++;
+	for (j = 0; j < nvars; j++) {
+	    len = sprintf(value, "value %d", (int)(i + j));
+	    if (psyc_state_apply_id(&states[i], '=', ids[j], value, len)
+		!= PSYC_STATE_CHANGED)
+		errors++;
+	}
+    }
+    t = elapsed(&start);
+
+    for (i = 0; i < ncontexts; i++)
+	mem += sizeof(PsycState) + states[i].size * sizeof(PsycStateVar)
+	    + states[i].alloc;
+    printf("state: %lu contexts, %lu vars: %ld us, %lu bytes per context\n",
+	   (unsigned long)ncontexts, (unsigned long)nvars, t,
+	   (unsigned long)(mem / (ncontexts ? ncontexts : 1)));
+
+    srand(42);
+    gettimeofday(&start, NULL);
+    for (i = 0; i < nupdates; i++) {
+	// every other update adds a member to a context, the next removes it
+	if (i % 4 != 3)
+	    s = &states[rand() % ncontexts];
+	switch (i % 4) {
+	case 0:
+	case 1:
+	    len = sprintf(value, "update %d", (int)i);
+	    errors += psyc_state_apply_id(s, '=', ids[rand() % nvars], value, len) < 0;
+	    break;
+	case 2:
+	    len = sprintf(member, "| psyc://example.net/~u%d", (int)i);
+	    errors += psyc_state_apply_id(s, '+', members, member, len)
+		!= PSYC_STATE_CHANGED;
+	    break;
+	case 3:
+	    errors += psyc_state_apply_id(s, '-', members, member, len)
+		!= PSYC_STATE_CHANGED;
+	    break;
+	}
+    }
+    t = elapsed(&start);
+
+    mem = 0;
+    for (i = 0; i < ncontexts; i++)
+	mem += sizeof(PsycState) + states[i].size * sizeof(PsycStateVar)
+	    + states[i].alloc;
+    printf("state: %lu updates: %ld us, %.0f updates/s, %lu bytes per context\n",
+	   (unsigned long)nupdates, t, t ? nupdates * 1e6 / t : 0.0,
+	   (unsigned long)(mem / (ncontexts ? ncontexts : 1)));
+
+    // answer a resync after each update to one of the first hundred
+    // contexts, rendering the whole state or patching the cached content
+    for (c = 0; c < 2; c++) {
+	srand(42);
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nupdates / 10; i++) {
+	    s = &states[rand() % (ncontexts < 100 ? ncontexts : 100)];
+	    len = sprintf(value, "resync %d", (int)i);
+	    errors += psyc_state_apply_id(s, '=', ids[rand() % nvars], value, len) < 0;
+	    if (c)
+		errors += !psyc_state_content(s, &rlen);
+	    else
+		errors += psyc_state_render(s, buf, sizeof(buf)) != PSYC_RENDER_SUCCESS;
+	}
+	t = elapsed(&start);
+	printf("state: %lu resyncs %s: %ld us\n", (unsigned long)(nupdates / 10),
+	       c ? "cached" : "rendered", t);
+    }
+
+    for (i = 0; i < ncontexts; i++)
+	psyc_state_free(&states[i]);
+
+    free(states);
+    free(ids);
+    return errors;
+}
+
+int
+main (int argc, char **argv)
+{
+    int c, errors = 0;
+
+    while ((c = getopt(argc, argv, "n:v:u:")) != -1)
+	switch (c) {
+	case 'n': ncontexts = atoi(optarg); break;
+	case 'v': nvars = atoi(optarg); break;
+	case 'u': nupdates = atoi(optarg); break;
+	}
+    if (!ncontexts)
+	return -1;
+
+    errors += test_operators();
+    errors += test_resync();
+    errors += test_cache();
+    errors += bench();
+
+    printf("test_state: %s\n", errors ? "ERROR" : "SUCCESS");
+    return errors;
+}
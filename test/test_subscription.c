@@ -0,0 +1,248 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+/**
+ * Check psyc_subscription_lookup() against calling psyc_inherits() and
+ * psyc_matches() for each subscription, with random patterns and methods
+ * made of a few keyword segments, while adding and removing subscriptions.
+ *
+ * With -c <count> the time taken by both for count lookups is shown,
+ * -n <patterns> sets the number of subscriptions (default: 1000),
+ * e.g. -n 100000 -c 1000.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <psyc.h>
+#include <psyc/subscription.h>
+
+#define KEYLEN 64
+#define METHODS 1000
+
+typedef struct {
+    char name[KEYLEN];
+    size_t length;
+    PsycSubscriptionMode mode;
+    int active;
+} Pattern;
+
+static const char *segments[] = {
+    "notice", "request", "status", "echo", "failure", "message", "context",
+    "enter", "leave", "alias", "add", "remove", "friendship", "peer",
+    "connect", "hello", "public", "private", "delivery", "link",
+};
+
+static Pattern *patterns;
+static size_t npatterns = 1000;
+static char methods[METHODS][KEYLEN];
+static size_t methodlens[METHODS];
+
+/**
+ * Make a keyword of 1 to max random segments.
+ */
+static size_t
+keyword (char *buf, size_t max)
+{
+    size_t n = 1 + rand() % max, len = 0, i;
+    const char *s;
+
+    for (i = 0; i < n; i++) {
+	s = segments[rand() % PSYC_NUM_ELEM(segments)];
+	buf[len++] = '_';
+	memcpy(buf + len, s, strlen(s));
+	len += strlen(s);
+    }
+    return len;
+}
+
+static int
+cmp_id (const void *a, const void *b)
+{
+    uintptr_t x = *(uintptr_t *)a, y = *(uintptr_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Find the subscriptions matching a method the slow way.
+ */
+static size_t
+lookup (const char *method, size_t len, uintptr_t *ids, size_t size)
+{
+    size_t i, count = 0;
+    int ret;
+
+    for (i = 0; i < npatterns; i++) {
+	if (!patterns[i].active)
+	    continue;
+	if (patterns[i].mode == PSYC_SUBSCRIPTION_INHERIT)
+	    ret = psyc_inherits(patterns[i].name, patterns[i].length,
+				(char *)method, len);
+	else
+	    ret = psyc_matches(patterns[i].name, patterns[i].length,
+			       (char *)method, len);
+	if (ret == 0 && count++ < size)
+	    ids[count - 1] = i;
+    }
+    return count;
+}
+
+static long
+elapsed (struct timeval *start)
+{
+    struct timeval end;
+    gettimeofday(&end, NULL);
+    return (end.tv_sec - start->tv_sec) * 1000 + (end.tv_usec - start->tv_usec) / 1000;
+}
+
+static int
+check (PsycSubscriptions *subs, size_t size)
+{
+    uintptr_t *ids = malloc(size * sizeof(*ids)), *exp = malloc(size * sizeof(*exp));
+    size_t i, n, m;
+    int errors = 0;
+
+    for (i = 0; i < METHODS; i++) {
+	n = psyc_subscription_lookup(subs, methods[i], methodlens[i], ids, size);
+	m = lookup(methods[i], methodlens[i], exp, size);
+	if (n > size || m > size) {
+	    printf("%.*s: too many matches\n", (int)methodlens[i], methods[i]);
+	    errors++;
+	    continue;
+	}
+	qsort(ids, n, sizeof(*ids), cmp_id);
+	if (n != m || memcmp(ids, exp, n * sizeof(*ids))) {
+	    printf("%.*s: %ld matches, expected %ld\n", (int)methodlens[i],
+		   methods[i], (long)n, (long)m);
+	    errors++;
+	}
+    }
+
+    free(ids);
+    free(exp);
+    return errors;
+}
+
+int
+main (int argc, char **argv)
+{
+    PsycSubscriptions subs;
+    struct timeval start;
+    uintptr_t ids[256];
+    size_t i, count = 0;
+    int c, errors = 0;
+
+    while ((c = getopt(argc, argv, "c:n:")) != -1)
+	switch (c) {
+	case 'c': count = atoi(optarg); break;
+	case 'n': npatterns = atoi(optarg); break;
+	}
+
+    srand(42);
+    patterns = calloc(npatterns, sizeof(*patterns));
+    psyc_subscription_init(&subs);
+
+    for (i = 0; i < npatterns; i++) {
+	patterns[i].length = keyword(patterns[i].name, 3);
+	patterns[i].mode = rand() % 2;
+	patterns[i].active = 1;
+	if (psyc_subscription_add(&subs, patterns[i].name, patterns[i].length,
+				  patterns[i].mode, i) != PSYC_OK) {
+	    printf("psyc_subscription_add failed\n");
+	    return 1;
+	}
+    }
+    for (i = 0; i < METHODS; i++)
+	methodlens[i] = keyword(methods[i], 5);
+
+    if (psyc_subscription_add(&subs, PSYC_C2ARG("_notice_"), 0, 0) != PSYC_ERROR
+	|| psyc_subscription_add(&subs, PSYC_C2ARG("_a__b"), 0, 0) != PSYC_ERROR
+	|| psyc_subscription_add(&subs, PSYC_C2ARG("notice"), 0, 0) != PSYC_ERROR
+	|| psyc_subscription_remove(&subs, PSYC_C2ARG("_foo"), 0, 0) != PSYC_ERROR) {
+	printf("invalid pattern accepted\n");
+	errors++;
+    }
+
+    if (npatterns <= 10000) {
+	errors += check(&subs, npatterns);
+
+	// remove every third subscription and add some back
+	for (i = 0; i < npatterns; i += 3) {
+	    if (psyc_subscription_remove(&subs, patterns[i].name,
+					 patterns[i].length, patterns[i].mode,
+					 i) != PSYC_OK) {
+		printf("psyc_subscription_remove failed\n");
+		errors++;
+	    }
+	    patterns[i].active = 0;
+	}
+	errors += check(&subs, npatterns);
+
+	for (i = 0; i < npatterns; i += 6) {
+	    psyc_subscription_add(&subs, patterns[i].name, patterns[i].length,
+				  patterns[i].mode, i);
+	    patterns[i].active = 1;
+	}
+	errors += check(&subs, npatterns);
+
+	// removing everything frees all nodes
+	for (i = 0; i < npatterns; i++)
+	    if (patterns[i].active)
+		psyc_subscription_remove(&subs, patterns[i].name,
+					 patterns[i].length, patterns[i].mode, i);
+	if (subs.count || subs.nodes || subs.root.nchildren) {
+	    printf("subscriptions left after removing all\n");
+	    errors++;
+	}
+	for (i = 0; i < npatterns; i++)
+	    if (patterns[i].active)
+		psyc_subscription_add(&subs, patterns[i].name,
+				      patterns[i].length, patterns[i].mode, i);
+    }
+
+    if (count) {
+	size_t n = 0;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < count; i++)
+	    n += lookup(methods[i % METHODS], methodlens[i % METHODS],
+			ids, PSYC_NUM_ELEM(ids));
+	printf("psyc_inherits/psyc_matches: %ld ms, %ld matches\n",
+	       elapsed(&start), (long)n);
+
+	n = 0;
+	gettimeofday(&start, NULL);
+	for (i = 0; i < count; i++)
+	    n += psyc_subscription_lookup(&subs, methods[i % METHODS],
+					  methodlens[i % METHODS],
+					  ids, PSYC_NUM_ELEM(ids));
+	printf("psyc_subscription_lookup: %ld ms, %ld matches\n",
+	       elapsed(&start), (long)n);
+    }
+
+    psyc_subscription_free(&subs);
+    free(patterns);
+
+    printf("test_subscription: %s\n", errors ? "ERROR" : "SUCCESS");
+    return errors;
+}
@@ -21,6 +21,7 @@
 #include <stdio.h>
 
 #include <lib.h>
+#include <psyc.h>
 #include <psyc/text.h>
 
 #define BUFSIZE 512
@@ -90,6 +91,139 @@ testText (char *template, size_t tmplen, char *buffer, size_t buflen,
     return -2; // shouldn't be reached
 }
 
+PsycTextValueRC
+getValueId (void *cls, uint32_t id, const char *name, size_t len,
+	    PsycString *value)
+{
+    if (id != psyc_intern_lookup(name, len, psyc_intern_hash(name, len)))
+	return PSYC_TEXT_VALUE_NOT_FOUND;
+    return ((PsycTextCB)cls)(NULL, name, len, value);
+}
+
+PsycTextValueRC
+getValueSome (void *cls, const char *name, size_t len, PsycString *value)
+{
+    if (len < 2 || name[1] < 'm')
+	return PSYC_TEXT_VALUE_NOT_FOUND;
+    *value = PSYC_STRING((char *)name, len);
+    return PSYC_TEXT_VALUE_FOUND;
+}
+
+/**
+ * Render a template with psyc_text() and compiled, with an output buffer
+ * of buflen bytes for the first call, and compare the results.
+ */
+int
+testCompiled (char *template, size_t tmplen, char *ope, size_t opelen,
+	      char *clo, size_t clolen, size_t buflen, PsycTextCB getValue)
+{
+    PsycTextState state;
+    PsycTextTemplate tmpl, counted;
+    PsycTextSegment segments[32];
+    char buffer[BUFSIZE], compiled[BUFSIZE];
+    size_t length = 0, clength = 0;
+    PsycTextRC ret, cret;
+
+    if (psyc_text_compile(&counted, template, tmplen, ope, opelen, clo, clolen,
+			  NULL, 0) != PSYC_OK
+	|| counted.nsegments > PSYC_NUM_ELEM(segments)
+	|| psyc_text_compile(&tmpl, template, tmplen, ope, opelen, clo, clolen,
+			     segments, counted.nsegments) != PSYC_OK
+	|| tmpl.nvars != counted.nvars)
+	return -1;
+
+    psyc_text_state_init_custom(&state, template, tmplen, buffer, buflen,
+				ope ? ope : "[", ope ? opelen : 1,
+				clo ? clo : "]", clo ? clolen : 1);
+    while ((ret = psyc_text(&state, getValue, NULL)) == PSYC_TEXT_INCOMPLETE) {
+	length += psyc_text_bytes_written(&state);
+	psyc_text_buffer_set(&state, buffer + length, BUFSIZE - length);
+    }
+    length += psyc_text_bytes_written(&state);
+
+    psyc_text_state_init(&state, NULL, 0, compiled, buflen);
+    while ((cret = psyc_text_render_compiled(&state, &tmpl, getValueId,
+					     getValue)) == PSYC_TEXT_INCOMPLETE) {
+	clength += psyc_text_bytes_written(&state);
+	psyc_text_buffer_set(&state, compiled + clength, BUFSIZE - clength);
+    }
+    clength += psyc_text_bytes_written(&state);
+
+    if (ret != cret || length != clength || memcmp(buffer, compiled, length)) {
+	printf("%.*s: %d %.*s, compiled: %d %.*s\n", (int)tmplen, template,
+	       ret, (int)length, buffer, cret, (int)clength, compiled);
+	return -1;
+    }
+    return 0;
+}
+
+/**
+ * Look up the variables of a packet with an index and linearly,
+ * with few modifiers and with more than fit in the index.
+ */
+int
+testVars ()
+{
+    static char names[100][16], values[100][16];
+    PsycModifier routing[2], entity[100];
+    PsycPacket packet;
+    PsycTextVars vars;
+    PsycTextState state;
+    PsycString value;
+    char buffer[BUFSIZE], name[16];
+    size_t n, i, r, len;
+    const PsycModifier *m;
+    PsycTextValueRC ret;
+
+    routing[0] = PSYC_MODIFIER(':', PSYC_C2STR("_context"),
+			       PSYC_C2STR("psyc://example.net/@place"),
+			       PSYC_MODIFIER_ROUTING);
+    routing[1] = PSYC_MODIFIER(':', PSYC_C2STR("_nick_0"),
+			       PSYC_C2STR("routing"), PSYC_MODIFIER_ROUTING);
+    for (i = 0; i < PSYC_NUM_ELEM(entity); i++) {
+	// every tenth one has the name of the previous one
+	sprintf(names[i], "_nick_%d", (int)(i % 10 == 9 ? i - 1 : i));
+	sprintf(values[i], "value %d", (int)i);
+	entity[i] = PSYC_MODIFIER(':', PSYC_STRING(names[i], strlen(names[i])),
+				  PSYC_STRING(values[i], strlen(values[i])),
+				  PSYC_MODIFIER_CHECK_LENGTH);
+    }
+
+    for (n = 0; n <= PSYC_NUM_ELEM(entity); n += 20)
+	for (r = 0; r < 2; r++) {
+	    psyc_packet_init(&packet, routing, 2, entity, n, PSYC_C2ARG("_notice"),
+			     NULL, 0, 0, PSYC_PACKET_CHECK_LENGTH);
+	    psyc_text_vars_init(&vars, &packet, r);
+
+	    for (i = 0; i < 110; i++) {
+		len = sprintf(name, i < 100 ? "_nick_%d" : "_context", (int)i);
+		ret = psyc_text_vars_get(&vars, name, len, &value);
+
+		for (m = entity; m < entity + n; m++)
+		    if (m->name.length == len && !memcmp(m->name.data, name, len))
+			break;
+		if (m == entity + n && r)
+		    for (m = routing; m < routing + 2; m++)
+			if (m->name.length == len
+			    && !memcmp(m->name.data, name, len))
+			    break;
+		if ((m == entity + n || m == routing + 2)
+		    ? ret != PSYC_TEXT_VALUE_NOT_FOUND
+		    : ret != PSYC_TEXT_VALUE_FOUND || value.data != m->value.data)
+		    return 1;
+	    }
+	}
+
+    psyc_text_state_init(&state, PSYC_C2ARG("[_nick_1] in [_context]"),
+			 buffer, BUFSIZE);
+    if (psyc_text(&state, psyc_text_vars_get, &vars) != PSYC_TEXT_COMPLETE
+	|| psyc_text_bytes_written(&state) != 36
+	|| memcmp(buffer, "value 1 in psyc://example.net/@place", 36))
+	return 2;
+
+    return 0;
+}
+
 int
 main (int argc, char **argv)
 {
@@ -119,6 +253,43 @@ main (int argc, char **argv)
 	    return 10 + i;
     }
 
+    char *templates[] = {
+	"Hello [_foo] & [_bar]!", "[_foo]", "[_foo][_bar]", "no vars", "",
+	"[_foo", "[", "x[]y[_bar]", "[][_foo]", "[[_foo]]", "[_foo]]",
+    };
+    PsycTextCB callbacks[] = {getValueFooBar, getValueEmpty, getValueNotFound,
+			      getValueSome};
+    int j, k;
+
+    for (i = 0; i < PSYC_NUM_ELEM(templates); i++)
+	for (j = 0; j < PSYC_NUM_ELEM(callbacks); j++)
+	    for (k = 0; k < 24; k += 3)
+		if (testCompiled(templates[i], strlen(templates[i]), NULL, 0,
+				 NULL, 0, k, callbacks[j]))
+		    return 40 + i;
+
+    str = "Hello ${_foo} & ${_bar} ${}${_foo}$}";
+    for (j = 0; j < PSYC_NUM_ELEM(callbacks); j++)
+	if (testCompiled(str, strlen(str), PSYC_C2ARG("${"), PSYC_C2ARG("}"),
+			 BUFSIZE, callbacks[j]))
+	    return 60;
+
+    for (i = 0; i < PSYC_METHODS_NUM; i++) {
+	size_t tlen;
+	const char *t = psyc_template(i, &tlen);
+	const PsycTextTemplate *tmpl = psyc_template_compiled(i);
+
+	if (!t != !tmpl)
+	    return 70;
+	for (j = 0; t && j < PSYC_NUM_ELEM(callbacks); j++)
+	    if (testCompiled((char *)t, tlen, NULL, 0, NULL, 0, BUFSIZE,
+			     callbacks[j]))
+		return 71;
+    }
+
+    if (testVars())
+	return 80;
+
     size_t tlen = 0;
     const char *t = psyc_template(PSYC_MC_NOTICE_CONTEXT_ENTER, &tlen);
     printf("_notice_context_enter = %s, %ld\n", t, tlen);
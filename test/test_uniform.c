@@ -0,0 +1,173 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+/**
+ * Parse uniforms picked from a set of distinct ones, the first ones much more
+ * often than the rest as the sources of packets are, from several threads,
+ * check that each gives the same result as parsing it alone and show the time
+ * taken.
+ *
+ * Options: -n <distinct uniforms> (default: 2000), -c <uniforms to parse>
+ * (default: 100000), -t <threads> (default: 4). The time is measured in a
+ * single thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include <psyc.h>
+#include <psyc/uniform.h>
+
+#define MAXTHREADS 64
+
+static char (*uniforms)[64];
+static PsycUniform *parsed;
+static int *rets;
+static size_t *picks;
+static size_t distinct = 2000, count = 100000, nthreads = 4;
+
+/**
+ * Pick uniforms with a power law distribution: the most frequent
+ * tenth of them makes up about half of the picks.
+ */
+static void
+pick ()
+{
+    size_t i;
+
+    for (i = 0; i < count; i++)
+	picks[i] = distinct * pow((double)rand() / ((double)RAND_MAX + 1), 3.3);
+}
+
+static int
+same (const PsycUniform *a, const PsycUniform *b)
+{
+    const PsycString *p, *q;
+
+    if (a->valid != b->valid || (a->valid && a->type != b->type))
+	return 0;
+    for (p = &a->scheme, q = &b->scheme; p <= &a->nick; p++, q++)
+	if (p->length != q->length || p->data != q->data)
+	    return 0;
+    return 1;
+}
+
+static void *
+parse_thread (void *arg)
+{
+    size_t t = (size_t)arg, i, errors = 0;
+    PsycUniform uni;
+    const char *u;
+    int ret;
+
+    for (i = t; i < count; i += nthreads) {
+	u = uniforms[picks[i]];
+	memset(&uni, 0, sizeof(uni));
+	ret = psyc_uniform_parse(&uni, u, strlen(u));
+	if (ret != rets[picks[i]] || !same(&uni, &parsed[picks[i]])) {
+	    printf("%s: %d, alone: %d\n", u, ret, rets[picks[i]]);
+	    errors++;
+	}
+    }
+    return (void *)errors;
+}
+
+static long
+elapsed (struct timeval *start)
+{
+    struct timeval end;
+    gettimeofday(&end, NULL);
+    return (end.tv_sec - start->tv_sec) * 1000000 + (end.tv_usec - start->tv_usec);
+}
+
+int
+main (int argc, char **argv)
+{
+    pthread_t threads[MAXTHREADS];
+    struct timeval start;
+    PsycUniform uni;
+    void *ret;
+    size_t i;
+    int c, errors = 0;
+
+    while ((c = getopt(argc, argv, "n:c:t:")) != -1)
+	switch (c) {
+	case 'n': distinct = atoi(optarg); break;
+	case 'c': count = atoi(optarg); break;
+	case 't': nthreads = atoi(optarg); break;
+	}
+    if (!distinct || !nthreads || nthreads > MAXTHREADS)
+	return -1;
+
+    uniforms = malloc(distinct * sizeof(*uniforms));
+    parsed = calloc(distinct, sizeof(*parsed));
+    rets = malloc(distinct * sizeof(*rets));
+    picks = malloc(count * sizeof(*picks));
+    for (i = 0; i < distinct; i++)
+	switch (i % 8) {
+	case 0:
+	    sprintf(uniforms[i], "psyc://host%d.example.net/@place%d",
+		    (int)i, (int)i);
+	    break;
+	case 1:
+	    sprintf(uniforms[i], "psyc://host%d:4404d", (int)i);
+	    break;
+	case 2:
+	    sprintf(uniforms[i], "psyc://host%d:x/~invalid", (int)i);
+	    break;
+	default:
+	    sprintf(uniforms[i], "psyc://host%d.example.net:%dd/~user%d#chan",
+		    (int)(i % 97), 4400 + (int)(i % 10), (int)i);
+	}
+
+    for (i = 0; i < distinct; i++)
+	rets[i] = psyc_uniform_parse(&parsed[i], uniforms[i], strlen(uniforms[i]));
+
+    srand(42);
+    pick();
+
+    for (i = 0; i < nthreads; i++)
+	pthread_create(&threads[i], NULL, parse_thread, (void *)i);
+    for (i = 0; i < nthreads; i++) {
+	pthread_join(threads[i], &ret);
+	errors += (size_t)ret;
+    }
+
+    // time a single thread
+    gettimeofday(&start, NULL);
+    for (i = 0; i < count; i++) {
+	memset(&uni, 0, sizeof(uni));
+	psyc_uniform_parse(&uni, uniforms[picks[i]], strlen(uniforms[picks[i]]));
+    }
+    printf("psyc_uniform_parse: %ld us\n", elapsed(&start));
+
+    free(uniforms);
+    free(parsed);
+    free(rets);
+    free(picks);
+
+    printf("test_uniform: %s\n", errors ? "ERROR" : "SUCCESS");
+    return errors;
+}
@@ -0,0 +1,584 @@
+/*
+  This file is part of libpsyc.
+  Copyright (C) 2011,2012 Carlo v. Loesch, Gabor X Toth, Mathias L. Baumann,
+  and other contributing authors.
+
+  libpsyc is free software: you can redistribute it and/or modify it under the
+  terms of the GNU Affero General Public License as published by the Free
+  Software Foundation, either version 3 of the License, or (at your option) any
+  later version. As a special exception, libpsyc is distributed with additional
+  permissions to link libpsyc libraries with non-AGPL works.
+
+  libpsyc is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for more
+  details.
+
+  You should have received a copy of the GNU Affero General Public License and
+  the linking exception along with libpsyc in a COPYING file.
+*/
+
+/**
+ * Apply update modifiers to rendered lists and dicts and check the result,
+ * compare random updates of a list with the same changes made to a PsycList
+ * rendered again, apply the diffs of random lists and dicts, then time joins
+ * and leaves of a large _list_members both ways.
+ *
+ * Options: -t <random updates> (default: 100000), -n <members> (default:
+ * 10000), -u <joins and leaves> (default: 1000).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <lib.h>
+#include <psyc/parse.h>
+#include <psyc/render.h>
+#include <psyc/update.h>
+
+static size_t tests = 100000, nmembers = 10000, nupdates = 1000;
+
+static int
+apply (const char *value, const char *update, const char *expected,
+       PsycUpdateRC rc)
+{
+    char buf[256];
+    size_t len = strlen(value);
+    PsycUpdateRC ret;
+
+    memcpy(buf, value, len);
+    ret = psyc_update_apply(buf, &len, sizeof(buf), update, strlen(update));
+    if (ret != rc || (expected && (len != strlen(expected)
+				   || memcmp(buf, expected, len)))) {
+	printf("%s @ %s: %d %.*s, expected %d %s\n", value, update, ret,
+	       (int)len, buf, rc, expected ? expected : "");
+	return 1;
+    }
+    return 0;
+}
+
+static int
+test_updates ()
+{
+    int errors = 0;
+
+    errors += apply("| a| b", "#1 = c", "| a| c", PSYC_UPDATE_CHANGED);
+    errors += apply("| a| b", "#2 =_nick c", "| a| b|=_nick c", PSYC_UPDATE_CHANGED);
+    errors += apply("| a| b", "#0 =:3 a|b", "|3 a|b| b", PSYC_UPDATE_CHANGED);
+    errors += apply("| a| b", "#0 -", "| b", PSYC_UPDATE_CHANGED);
+    errors += apply("| a| b", "#1 -", "| a", PSYC_UPDATE_CHANGED);
+    errors += apply("| a| b", "#1 = b", "| a| b", PSYC_UPDATE_UNCHANGED);
+    errors += apply("| a| b", "#2 -", "| a| b", PSYC_UPDATE_UNCHANGED);
+    errors += apply("| a| b", "#1 ? x", "| a| b", PSYC_UPDATE_UNCHANGED);
+    errors += apply("_uniform| a", "#0 = b", "_uniform| b", PSYC_UPDATE_CHANGED);
+    errors += apply("", "#0 = a", "| a", PSYC_UPDATE_CHANGED);
+    errors += apply("", "{a} = 1", "{a} 1", PSYC_UPDATE_CHANGED);
+
+    errors += apply("{a} 1{b} 2", "{b} = 3", "{a} 1{b} 3", PSYC_UPDATE_CHANGED);
+    errors += apply("{a} 1{b} 2", "{c} =_x", "{a} 1{b} 2{c}=_x", PSYC_UPDATE_CHANGED);
+    errors += apply("{a} 1{b} 2", "{a} -", "{b} 2", PSYC_UPDATE_CHANGED);
+    errors += apply("{a} 1{b} 2", "{3 foo} = x", "{a} 1{b} 2{foo} x",
+		    PSYC_UPDATE_CHANGED);
+
+    // nested values are rendered again with their new length
+    errors += apply("{a}=_list | x| y{b} 2", "{a} + | z",
+		    "{a}=_list | x| y| z{b} 2", PSYC_UPDATE_CHANGED);
+    errors += apply("{a}=_list | x| y{b} 2", "{a} + | long member",
+		    "{a}=_list:19 | x| y| long member{b} 2", PSYC_UPDATE_CHANGED);
+    errors += apply("{a}=_list | x| y{b} 2", "{a}#1 = q",
+		    "{a}=_list | x| q{b} 2", PSYC_UPDATE_CHANGED);
+    errors += apply("{a}=_list | x| y{b} 2", "{a}#0 -",
+		    "{a}=_list | y{b} 2", PSYC_UPDATE_CHANGED);
+    errors += apply("{a}=_list | x| y{b} 2", "{a} - | y| x",
+		    "{a}=_list{b} 2", PSYC_UPDATE_CHANGED);
+    errors += apply("{a}=_list | x| y{b} 2", "{a} - | w",
+		    "{a}=_list | x| y{b} 2", PSYC_UPDATE_UNCHANGED);
+    errors += apply("{a}=_list | x| y{b} 2", "{c} + | w",
+		    "{a}=_list | x| y{b} 2{c} | w", PSYC_UPDATE_CHANGED);
+    errors += apply("| a|7 {k} | v", "#1{k}#0 = w", "| a|7 {k} | w",
+		    PSYC_UPDATE_CHANGED);
+    errors += apply("| a|7 {k} | v", "#1{k} + | ww", "| a|11 {k} | v| ww",
+		    PSYC_UPDATE_CHANGED);
+
+    errors += apply("| a| b", "#3 = c", NULL, PSYC_UPDATE_ERROR_PATH);
+    errors += apply("| a b| c", "#0#0 = c", NULL, PSYC_UPDATE_ERROR_VALUE);
+    errors += apply("| a| b", "#5#0 = c", NULL, PSYC_UPDATE_ERROR_PATH);
+    errors += apply("| a| b", "._x = c", NULL, PSYC_UPDATE_ERROR_PATH);
+    errors += apply("{a} 1", "#0 = c", NULL, PSYC_UPDATE_ERROR_VALUE);
+    errors += apply("| a| b", "#0 + c", NULL, PSYC_UPDATE_ERROR_VALUE);
+    errors += apply("| a| b", "#0", NULL, PSYC_UPDATE_ERROR);
+    errors += apply("| a| b", "#0 ! c", NULL, PSYC_UPDATE_ERROR_OPERATOR);
+    errors += apply("| a| b", "#0 = a very long value, longer than the buffer "
+		    "a very long value, longer than the buffer a very long value, "
+		    "longer than the buffer a very long value, longer than the "
+		    "buffer a very long value, longer than the buffer a very long "
+		    "value, longer than the buffer", "| a| b", PSYC_UPDATE_ERROR_SIZE);
+    return errors;
+}
+
+/**
+ * Update parsed lists and dicts.
+ */
+static int
+test_parsed ()
+{
+    PsycElem elems[3] = {PSYC_ELEM_V("a", 1), PSYC_ELEM_V("b", 1)};
+    PsycDictElem entries[2] = {
+	PSYC_DICT_ELEM(PSYC_DICT_KEY("k", 1, PSYC_ELEM_NO_LENGTH),
+		       PSYC_ELEM_V("1", 1))};
+    PsycList list;
+    PsycDict dict;
+    char buf[64];
+    int errors = 0;
+
+    psyc_list_init(&list, elems, 2);
+    errors += psyc_update_list(&list, 3, PSYC_C2ARG("#1 = z")) != PSYC_UPDATE_CHANGED;
+    errors += psyc_update_list(&list, 3, PSYC_C2ARG("#2 =_nick w")) != PSYC_UPDATE_CHANGED;
+    errors += psyc_update_list(&list, 3, PSYC_C2ARG("#3 = v")) != PSYC_UPDATE_ERROR_SIZE;
+    errors += psyc_update_list(&list, 3, PSYC_C2ARG("#0 -")) != PSYC_UPDATE_CHANGED;
+    errors += psyc_update_list(&list, 3, PSYC_C2ARG("#0 + | x")) != PSYC_UPDATE_ERROR_OPERATOR;
+    errors += psyc_update_list(&list, 3, PSYC_C2ARG("{a} = x")) != PSYC_UPDATE_ERROR_PATH;
+    if (psyc_render_list(&list, buf, sizeof(buf)) != PSYC_RENDER_SUCCESS
+	|| list.length != 12 || memcmp(buf, "| z|=_nick w", 12))
+	errors++;
+
+    psyc_dict_init(&dict, entries, 1);
+    errors += psyc_update_dict(&dict, 2, PSYC_C2ARG("{k} = 2")) != PSYC_UPDATE_CHANGED;
+    errors += psyc_update_dict(&dict, 2, PSYC_C2ARG("{j} = 3")) != PSYC_UPDATE_CHANGED;
+    errors += psyc_update_dict(&dict, 2, PSYC_C2ARG("{i} = 4")) != PSYC_UPDATE_ERROR_SIZE;
+    errors += psyc_update_dict(&dict, 2, PSYC_C2ARG("{k} -")) != PSYC_UPDATE_CHANGED;
+    if (dict.num_elems != 1 || dict.elems[0].key.value.data[0] != 'j'
+	|| dict.elems[0].value.value.data[0] != '3')
+	errors++;
+
+    if (errors)
+	printf("parsed: %d errors\n", errors);
+    return errors;
+}
+
+/**
+ * Apply random updates to a rendered list and make the same changes to a
+ * PsycList, then compare the rendered list with it.
+ */
+static int
+test_random ()
+{
+    const char *values[] = {"a", "bc", "x|y", "", "a value longer than nine"};
+    const char *types[] = {"", "_nick", "_list"};
+    PsycElem elems[64], mod;
+    PsycList list, modlist;
+    PsycUpdate u;
+    char buf[4096], expected[4096], update[128];
+    size_t len = 0, i, k, t, v, n;
+    PsycUpdateRC ret;
+    int errors = 0;
+
+    srand(42);
+    psyc_list_init(&list, elems, 0);
+    for (n = 0; n < tests && errors < 10; n++) {
+	i = list.num_elems ? rand() % (list.num_elems + 1) : 0;
+	t = rand() % PSYC_NUM_ELEM(types);
+	v = rand() % PSYC_NUM_ELEM(values);
+	switch (rand() % 4) {
+	case 0: // assign
+	    if (i == PSYC_NUM_ELEM(elems))
+		continue;
+	    sprintf(update, "#%d =%s:%d %s", (int)i, types[t],
+		    (int)strlen(values[v]), values[v]);
+	    ret = psyc_update_apply(buf, &len, sizeof(buf), update, strlen(update));
+	    if (i == list.num_elems)
+		list.num_elems++;
+	    elems[i] = PSYC_ELEM((char *)types[t], strlen(types[t]),
+				 (char *)values[v], strlen(values[v]),
+				 PSYC_ELEM_CHECK_LENGTH);
+	    break;
+	case 1: // remove by index
+	    sprintf(update, "#%d -", (int)i);
+	    ret = psyc_update_apply(buf, &len, sizeof(buf), update, strlen(update));
+	    if (i < list.num_elems)
+		memmove(elems + i, elems + i + 1, (--list.num_elems - i) * sizeof(PsycElem));
+	    break;
+	default: // add or remove an element by value
+	    if (list.num_elems == PSYC_NUM_ELEM(elems))
+		continue;
+	    mod = PSYC_ELEM((char *)types[t], strlen(types[t]),
+			    (char *)values[v], strlen(values[v]),
+			    PSYC_ELEM_CHECK_LENGTH);
+	    psyc_list_init(&modlist, &mod, 1);
+	    psyc_render_list(&modlist, update, sizeof(update));
+	    ret = psyc_update_modify(&u, PSYC_TYPE_LIST, buf, len,
+				     n % 2 ? '+' : '-', update, modlist.length);
+	    if (ret == PSYC_UPDATE_CHANGED) {
+		psyc_update_splice(&u, buf, len);
+		len = u.length;
+	    }
+	    psyc_update_free(&u);
+	    if (n % 2)
+		elems[list.num_elems++] = mod;
+	    else
+		for (k = 0; k < list.num_elems; k++)
+		    if (elems[k].type.length == mod.type.length
+			&& elems[k].value.length == mod.value.length
+			&& !memcmp(elems[k].type.data, mod.type.data, mod.type.length)
+			&& !memcmp(elems[k].value.data, mod.value.data, mod.value.length)) {
+			memmove(elems + k, elems + k + 1,
+				(--list.num_elems - k) * sizeof(PsycElem));
+			break;
+		    }
+	}
+
+	psyc_list_length_set(&list);
+	psyc_render_list(&list, expected, sizeof(expected));
+	if (ret < 0 || len != list.length || memcmp(buf, expected, len)) {
+	    printf("%s: %d\n%.*s\nexpected\n%.*s\n", update, ret,
+		   (int)len, buf, (int)list.length, expected);
+	    errors++;
+	}
+    }
+    return errors;
+}
+
+/**
+ * Apply the modifiers of a diff to a rendered list or dict.
+ */
+static int
+apply_mods (char *buf, size_t *len, size_t size, PsycType type,
+	    PsycModifier *mods, size_t nmods)
+{
+    PsycUpdate u;
+    PsycUpdateRC ret;
+    size_t i;
+
+    for (i = 0; i < nmods; i++) {
+	switch (mods[i].oper) {
+	case PSYC_OPERATOR_ASSIGN:
+	    memcpy(buf, PSYC_S2ARG(mods[i].value));
+	    *len = mods[i].value.length;
+	    continue;
+	case PSYC_OPERATOR_UPDATE:
+	    ret = psyc_update_apply(buf, len, size, PSYC_S2ARG(mods[i].value));
+	    break;
+	default:
+	    ret = psyc_update_modify(&u, type, buf, *len, mods[i].oper,
+				     PSYC_S2ARG(mods[i].value));
+	    if (ret == PSYC_UPDATE_CHANGED) {
+		psyc_update_splice(&u, buf, *len);
+		*len = u.length;
+	    }
+	    psyc_update_free(&u);
+	}
+	if (ret < 0) {
+	    printf("%c%.*s: %d\n", mods[i].oper, PSYC_S2ARGP(mods[i].value), ret);
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+/**
+ * Check that a rendered dict has the entries of a PsycDict.
+ */
+static int
+dict_check (char *buf, size_t len, PsycDict *dict)
+{
+    PsycParseDictState p;
+    PsycString type, elem, key = {0, NULL};
+    PsycElem *v;
+    size_t i = 0;
+    int r;
+
+    psyc_parse_dict_state_init(&p);
+    psyc_parse_dict_buffer_set(&p, buf, len);
+    while ((r = psyc_parse_dict(&p, &type, &elem)) > 0) {
+	if (r == PSYC_PARSE_DICT_TYPE) {
+	    if (type.length != dict->type.length
+		|| memcmp(type.data, dict->type.data, type.length))
+		return 1;
+	} else if (r == PSYC_PARSE_DICT_KEY)
+	    key = elem;
+	else if (r == PSYC_PARSE_DICT_VALUE || r == PSYC_PARSE_DICT_VALUE_LAST) {
+	    if (i == dict->num_elems)
+		return 1;
+	    v = &dict->elems[i].value;
+	    if (key.length != dict->elems[i].key.value.length
+		|| memcmp(key.data, dict->elems[i].key.value.data, key.length)
+		|| type.length != v->type.length
+		|| memcmp(type.data, v->type.data, type.length)
+		|| elem.length != v->value.length
+		|| memcmp(elem.data, v->value.data, elem.length))
+		return 1;
+	    i++;
+	    if (r == PSYC_PARSE_DICT_VALUE_LAST)
+		break;
+	} else if (r == PSYC_PARSE_DICT_END)
+	    break;
+    }
+    return r < 0 || i != dict->num_elems;
+}
+
+/**
+ * Change random lists and dicts into others with the modifiers of a diff
+ * applied by the update parser, and check that the diff of a large
+ * _list_members after a leave and a join is one '-' and one '+'.
+ */
+static int
+test_diff ()
+{
+    const char *values[] = {"a", "bc", "x|y", "", "a value longer than nine"};
+    const char *types[] = {"", "_nick", "_list"};
+    const char *keys[] = {"a", "bc", "k y", "}x", "a key longer than nine",
+			  "d", "e", "f"};
+    PsycElem from[16], to[32];
+    PsycDictElem dfrom[8], dto[8];
+    PsycList lfrom, lto;
+    PsycDict dictfrom, dictto, dictnone;
+    PsycModifier mods[40];
+    PsycElem *members;
+    char *names;
+    char buf[4096], expected[4096], out[4096];
+    size_t len, nmods, n, i, j, k;
+    uint8_t used[8];
+    PsycUpdateRC ret;
+    int errors = 0;
+
+    srand(42);
+    for (n = 0; n < tests / 10 && errors < 10; n++) {
+	// a list, and another one with some of its elements removed,
+	// replaced or added, or a random one
+	k = rand() % 10;
+	for (i = 0; i < k; i++) {
+	    j = rand() % 3; // few values, so they repeat
+	    from[i] = PSYC_ELEM((char *)types[j % 2], strlen(types[j % 2]),
+				(char *)values[j], strlen(values[j]),
+				PSYC_ELEM_CHECK_LENGTH);
+	}
+	psyc_list_init(&lfrom, from, k);
+	for (i = j = 0; i < k; i++)
+	    switch (rand() % (n % 2 ? 8 : 2)) {
+	    case 0:
+		break;
+	    case 1:
+		to[j++] = PSYC_ELEM((char *)types[i % 3], strlen(types[i % 3]),
+				    (char *)values[i % 5], strlen(values[i % 5]),
+				    PSYC_ELEM_CHECK_LENGTH);
+		break;
+	    default:
+		to[j++] = from[i];
+	    }
+	for (i = rand() % 4; i > 0; i--)
+	    to[j++] = PSYC_ELEM(NULL, 0, (char *)values[i], strlen(values[i]),
+				PSYC_ELEM_CHECK_LENGTH);
+	psyc_list_init(&lto, to, j);
+	if (n % 5 == 0)
+	    lfrom.type = lto.type = PSYC_C2STR("_list_test");
+	psyc_list_length_set(&lfrom);
+
+	psyc_render_list(&lfrom, buf, sizeof(buf));
+	len = lfrom.length;
+	nmods = PSYC_NUM_ELEM(mods);
+	ret = psyc_update_diff_list(&lfrom, &lto, PSYC_C2ARG("_list_test"),
+				    mods, &nmods, out, sizeof(out));
+	psyc_render_list(&lto, expected, sizeof(expected));
+	if (ret < 0 || apply_mods(buf, &len, sizeof(buf), PSYC_TYPE_LIST, mods, nmods)
+	    || len != lto.length || memcmp(buf, expected, len)) {
+	    printf("diff list: %d\n%.*s\nexpected\n%.*s\n", ret,
+		   (int)len, buf, (int)lto.length, expected);
+	    errors++;
+	}
+
+	// a dict, and another one with some entries removed, changed or added
+	memset(used, 0, sizeof(used));
+	k = rand() % 6;
+	for (i = 0; i < k; i++) {
+	    used[i] = 1;
+	    j = rand() % 5;
+	    dfrom[i] = PSYC_DICT_ELEM(PSYC_DICT_KEY((char *)keys[i], strlen(keys[i]),
+						   PSYC_ELEM_CHECK_LENGTH),
+				      PSYC_ELEM((char *)types[j % 3], strlen(types[j % 3]),
+						(char *)values[j], strlen(values[j]),
+						PSYC_ELEM_CHECK_LENGTH));
+	}
+	psyc_dict_init(&dictfrom, dfrom, k);
+	for (i = j = 0; i < k; i++)
+	    switch (rand() % 4) {
+	    case 0:
+		break;
+	    case 1:
+		dto[j] = dfrom[i];
+		dto[j++].value = PSYC_ELEM(NULL, 0, (char *)values[n % 5],
+					   strlen(values[n % 5]),
+					   PSYC_ELEM_CHECK_LENGTH);
+		break;
+	    default:
+		dto[j++] = dfrom[i];
+	    }
+	for (i = rand() % 3; i > 0; i--) {
+	    k = rand() % PSYC_NUM_ELEM(keys);
+	    if (used[k])
+		continue;
+	    used[k] = 1;
+	    dto[j++] = PSYC_DICT_ELEM(PSYC_DICT_KEY((char *)keys[k], strlen(keys[k]),
+						    PSYC_ELEM_CHECK_LENGTH),
+				      PSYC_ELEM(NULL, 0, (char *)values[i],
+						strlen(values[i]),
+						PSYC_ELEM_CHECK_LENGTH));
+	}
+	psyc_dict_init(&dictto, dto, j);
+	if (n % 3 == 0)
+	    dictfrom.type = dictto.type = PSYC_C2STR("_dict_test");
+
+	// diff from an empty dict to from, then from from to to
+	len = 0;
+	psyc_dict_init(&dictnone, NULL, 0);
+	for (i = 0; i < 2; i++) {
+	    nmods = PSYC_NUM_ELEM(mods);
+	    ret = i ? psyc_update_diff_dict(&dictfrom, &dictto,
+					    PSYC_C2ARG("_dict_test"),
+					    mods, &nmods, out, sizeof(out))
+		: psyc_update_diff_dict(&dictnone, &dictfrom,
+					PSYC_C2ARG("_dict_test"),
+					mods, &nmods, out, sizeof(out));
+	    if (ret < 0 || apply_mods(buf, &len, sizeof(buf), PSYC_TYPE_DICT, mods, nmods)
+		|| dict_check(buf, len, i ? &dictto : &dictfrom)) {
+		printf("diff dict %d: %d\n%.*s\n", (int)i, ret, (int)len, buf);
+		errors++;
+		break;
+	    }
+	}
+    }
+
+    // a member leaves and another one joins
+    psyc_list_init(&lfrom, from, 0);
+    psyc_list_init(&lto, to, 0);
+    members = malloc(2 * nmembers * sizeof(PsycElem));
+    names = malloc(nmembers * 32);
+    for (i = 0; i < nmembers; i++) {
+	len = sprintf(names + i * 32, "psyc://example.net/~user%06d", (int)i);
+	members[i] = PSYC_ELEM(NULL, 0, names + i * 32, len, PSYC_ELEM_CHECK_LENGTH);
+    }
+    memcpy(members + nmembers, members + 1, (nmembers - 1) * sizeof(PsycElem));
+    members[2 * nmembers - 1] = PSYC_ELEM(NULL, 0, "psyc://example.net/~new", 23,
+					  PSYC_ELEM_CHECK_LENGTH);
+    psyc_list_init(&lfrom, members, nmembers);
+    psyc_list_init(&lto, members + nmembers, nmembers);
+    nmods = PSYC_NUM_ELEM(mods);
+    ret = psyc_update_diff_list(&lfrom, &lto, PSYC_C2ARG("_list_members"),
+				mods, &nmods, out, sizeof(out));
+    if (ret != PSYC_UPDATE_CHANGED || nmods != 2
+	|| mods[0].oper != '-' || mods[1].oper != '+') {
+	printf("diff members: %d %d\n", ret, (int)nmods);
+	errors++;
+    }
+    free(members);
+    free(names);
+    return errors;
+}
+
+static long
+elapsed (struct timeval *start)
+{
+    struct timeval end;
+    gettimeofday(&end, NULL);
+    return (end.tv_sec - start->tv_sec) * 1000000 + (end.tv_usec - start->tv_usec);
+}
+
+/**
+ * Have members join and leave a _list_members with nmembers, updating it in
+ * place, then have them leave by parsing it into a PsycList and rendering
+ * that again.
+ */
+static int
+bench ()
+{
+    PsycParseListState p;
+    PsycString type, elem;
+    PsycElem *elems = malloc((nmembers + 1) * sizeof(PsycElem));
+    PsycList list;
+    PsycUpdate u;
+    size_t size = (nmembers + 1) * 48, len = 0, i, k;
+    char *buf = malloc(size), *out = malloc(size), member[48], mod[64], oper;
+    struct timeval start;
+    int errors = 0, r;
+
+    for (i = 0; i < nmembers; i++)
+	len += sprintf(buf + len, "| psyc://example.net/~user%06d", (int)i);
+
+    // a random member leaves and joins again, moving to the end of the list
+    srand(42);
+    gettimeofday(&start, NULL);
+    for (i = 0; i < nupdates; i++) {
+	sprintf(mod, "| psyc://example.net/~user%06d", rand() % (int)nmembers);
+	for (oper = '-'; oper; oper = oper == '-' ? '+' : 0) {
+	    if (psyc_update_modify(&u, PSYC_TYPE_LIST, buf, len, oper,
+				   mod, strlen(mod)) != PSYC_UPDATE_CHANGED)
+		errors++;
+	    psyc_update_splice(&u, buf, len);
+	    len = u.length;
+	    psyc_update_free(&u);
+	}
+    }
+    printf("update: %lu leaves and joins of %lu members in place: %ld us\n",
+	   (unsigned long)nupdates, (unsigned long)nmembers, elapsed(&start));
+
+    srand(42);
+    gettimeofday(&start, NULL);
+    for (i = 0; i < nupdates; i++) {
+	psyc_parse_list_state_init(&p);
+	psyc_parse_list_buffer_set(&p, buf, len);
+	list.num_elems = 0;
+	while ((r = psyc_parse_list(&p, &type, &elem)) == PSYC_PARSE_LIST_ELEM
+	       || r == PSYC_PARSE_LIST_ELEM_LAST) {
+	    if (list.num_elems == nmembers + 1)
+		break;
+	    elems[list.num_elems++] = PSYC_ELEM(type.data, type.length, elem.data, elem.length,
+						PSYC_ELEM_CHECK_LENGTH);
+	    if (r == PSYC_PARSE_LIST_ELEM_LAST)
+		break;
+	}
+	sprintf(member, "psyc://example.net/~user%06d", rand() % (int)nmembers);
+	for (k = 0; k < list.num_elems; k++)
+	    if (elems[k].value.length == strlen(member)
+		&& !memcmp(elems[k].value.data, member, elems[k].value.length)) {
+		memmove(elems + k, elems + k + 1,
+			(--list.num_elems - k) * sizeof(PsycElem));
+		break;
+	    }
+	list.elems = elems;
+	list.type = (PsycString){0, NULL};
+	psyc_list_length_set(&list);
+	if (psyc_render_list(&list, out, size) != PSYC_RENDER_SUCCESS)
+	    errors++;
+    }
+    printf("update: %lu leaves of %lu members rendered again: %ld us\n",
+	   (unsigned long)nupdates, (unsigned long)nmembers, elapsed(&start));
+
+    free(elems);
+    free(buf);
+    free(out);
+    return errors;
+}
+
+int
+main (int argc, char **argv)
+{
+    int c, errors = 0;
+
+    while ((c = getopt(argc, argv, "t:n:u:")) != -1)
+	switch (c) {
+	case 't': tests = atoi(optarg); break;
+	case 'n': nmembers = atoi(optarg); break;
+	case 'u': nupdates = atoi(optarg); break;
+	}
+
+    errors += test_updates();
+    errors += test_parsed();
+    errors += test_random();
+    errors += test_diff();
+    errors += bench();
+
+    printf("test_update_apply: %s\n", errors ? "ERROR" : "SUCCESS");
+    return errors;
+}
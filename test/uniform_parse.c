@@ -58,6 +58,42 @@ testUniform (char *str, int ret)
     }
 }
 
+void
+testPart (const char *name, PsycString part, const char *expected)
+{
+    if (part.length != strlen(expected)
+	|| memcmp(part.data, expected, part.length) != 0) {
+	fprintf(stderr, "ERROR: %s is [%.*s] instead of [%s]\n",
+		name, (int)PSYC_S2ARG2(part), expected);
+	exit(1);
+    }
+}
+
+void
+testParts (char *str)
+{
+    PsycUniform uni;
+    memset(&uni, 0, sizeof(PsycUniform));
+    printf("%s\n", str);
+    if (psyc_uniform_parse(&uni, str, strlen(str)) != PSYC_SCHEME_PSYC) {
+	fprintf(stderr, "ERROR: psyc_uniform_parse failed\n");
+	exit(1);
+    }
+
+    testPart("host", uni.host, "foo.example.net");
+    testPart("user_host", uni.user_host, "foo.example.net");
+    testPart("host_port", uni.host_port, "foo.example.net:4404d");
+    testPart("root", uni.root, "psyc://foo.example.net:4404d");
+    testPart("entity", uni.entity,
+	     "psyc://foo.example.net:4404d/~somebody_with_a_long_nick");
+    testPart("body", uni.body,
+	     "foo.example.net:4404d/~somebody_with_a_long_nick#chan");
+    testPart("path", uni.path, "/~somebody_with_a_long_nick#chan");
+    testPart("resource", uni.resource, "~somebody_with_a_long_nick");
+    testPart("nick", uni.nick, "somebody_with_a_long_nick");
+    testPart("channel", uni.channel, "chan");
+}
+
 int
 main ()
 {
@@ -71,6 +107,9 @@ main ()
     testUniform("psyc://foo/", PSYC_SCHEME_PSYC);
     testUniform("psyc://foo", PSYC_SCHEME_PSYC);
     testUniform("psyc://1234567890abcdef:g/~foo", PSYC_SCHEME_PSYC);
+    testUniform("psyc://a-very-long-host-name.example.net/@a_long_place_name",
+		PSYC_SCHEME_PSYC);
+    testParts("psyc://foo.example.net:4404d/~somebody_with_a_long_nick#chan");
 
     testUniform("xmpp:user@host", PSYC_PARSE_UNIFORM_INVALID_SCHEME);
     testUniform("psyc:host", PSYC_PARSE_UNIFORM_INVALID_SLASHES);
@@ -80,6 +119,12 @@ main ()
     testUniform("psyc://host:d/~foo", PSYC_PARSE_UNIFORM_INVALID_PORT);
     testUniform("psyc://1234567890abcdef:1g/~foo",
 		PSYC_PARSE_UNIFORM_INVALID_TRANSPORT);
+    testUniform("psyc://a-very-long-host_name.example.net/",
+		PSYC_PARSE_UNIFORM_INVALID_HOST);
+    testUniform("psyc://foo/~a_long_nick_with a_space",
+		PSYC_PARSE_UNIFORM_INVALID_RESOURCE);
+    testUniform("psyc://foo/@place#a_long_channel_name#",
+		PSYC_PARSE_UNIFORM_INVALID_CHANNEL);
 
     printf("SUCCESS: psyc_uniform_parse passed all tests.\n");
     return 0;
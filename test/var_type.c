@@ -34,6 +34,9 @@ int main() {
     unless (psyc_var_type(PSYC_C2ARG("_list"))) return 51;
     unless (psyc_var_type(PSYC_C2ARG("_list_foo"))) return 52;
     unless (psyc_var_type(PSYC_C2ARG("_color_red"))) return 53;
+    if (psyc_var_type(PSYC_C2ARG("_date_a")) != PSYC_TYPE_DATE) return 54;
+    if (psyc_var_type(PSYC_C2ARG("_uniform_of_a_rather_long_name_beyond_any_key"))
+	!= PSYC_TYPE_UNIFORM) return 55;
 
     if (psyc_var_type(PSYC_C2ARG("_last"))) return 104;
     if (psyc_var_type(PSYC_C2ARG("_lost_foo"))) return 105;